@@ -2,6 +2,7 @@
 #include "defines.h"
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 
 namespace Utils {
   bitstream::bitstream() {
@@ -212,4 +213,253 @@ namespace Utils {
     }
     data.erase(0, pos);
   }
+
+  /// Loads 8 bytes as a big endian integer.
+  static inline uint64_t loadBE64(const unsigned char * p){
+    uint64_t w;
+    memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+  }
+
+  /// Loads 8 bytes as a little endian integer.
+  static inline uint64_t loadLE64(const unsigned char * p){
+    uint64_t w;
+    memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+  }
+
+  ///Creates a reader over len bytes of data, which must stay valid while reading.
+  ///\param unescape Whether to skip emulation prevention bytes, for reading H.264 NAL unit payloads.
+  bitReader::bitReader(const char * data, size_t len, bool unescape) {
+    pos = (const unsigned char *)data;
+    end = pos + len;
+    this->unescape = unescape;
+    zeroes = 0;
+    cache = 0;
+    cached = 0;
+  }
+
+  ///Fills the cache up to at least 57 bits, or as far as the data goes.
+  void bitReader::refill() {
+    if (cached > 56) {
+      return;
+    }
+    if (!unescape && end - pos >= 8) {
+      unsigned int bytes = (64 - cached) >> 3;
+      cache |= loadBE64(pos) >> cached;
+      pos += bytes;
+      cached += bytes * 8;
+      if (cached < 64) {
+        //clear the part of the next byte that was loaded as well
+        cache &= ~(0xFFFFFFFFFFFFFFFFull >> cached);
+      }
+      return;
+    }
+    while (cached <= 56 && pos < end) {
+      unsigned char byte = *(pos++);
+      if (unescape) {
+        if (zeroes >= 2 && byte == 3) {
+          zeroes = 0;
+          continue;
+        }
+        zeroes = byte ? 0 : zeroes + 1;
+      }
+      cache |= (uint64_t)byte << (56 - cached);
+      cached += 8;
+    }
+  }
+
+  ///Returns the amount of bits left. When skipping emulation prevention bytes,
+  ///this includes the bits of the ones that were not reached yet.
+  long long unsigned int bitReader::size() {
+    return cached + (end - pos) * 8;
+  }
+
+  ///Returns the next count bits, at most 56, without consuming them.
+  long long unsigned int bitReader::peek(size_t count) {
+    if (!count) {
+      return 0;
+    }
+    if (cached < count) {
+      refill();
+    }
+    if (count > cached) {
+      DEBUG_MSG(DLVL_ERROR, "Not enough bits left in stream. Left: %d requested: %d", (int)cached, (int)count);
+      return 0;
+    }
+    return cache >> (64 - count);
+  }
+
+  ///Consumes and returns the next count bits, at most 64.
+  long long unsigned int bitReader::get(size_t count) {
+    if (count > 32) {
+      long long unsigned int upper = get(count - 32);
+      return (upper << 32) | get(32);
+    }
+    if (!count) {
+      return 0;
+    }
+    if (cached < count) {
+      refill();
+      if (cached < count) {
+        DEBUG_MSG(DLVL_ERROR, "Not enough bits left in stream. Left: %d requested: %d", (int)cached, (int)count);
+        cache = 0;
+        cached = 0;
+        return 0;
+      }
+    }
+    long long unsigned int retVal = cache >> (64 - count);
+    cache <<= count;
+    cached -= count;
+    return retVal;
+  }
+
+  void bitReader::skip(size_t count) {
+    while (count > cached) {
+      count -= cached;
+      cache = 0;
+      cached = 0;
+      if (!unescape) {
+        //whole bytes can be skipped without loading them
+        size_t bytes = std::min((size_t)(end - pos), count / 8);
+        pos += bytes;
+        count -= bytes * 8;
+      }
+      refill();
+      if (!cached) {
+        return;
+      }
+    }
+    if (count == 64) {
+      cache = 0;
+    } else {
+      cache <<= count;
+    }
+    cached -= count;
+  }
+
+  ///Reads an unsigned Exp-Golomb code, counting its leading zero bits in one go where possible.
+  long long unsigned int bitReader::getUExpGolomb() {
+    if (cached < 32) {
+      refill();
+    }
+    if (cache) {
+      unsigned int zeros = __builtin_clzll(cache);
+      if (zeros * 2 + 1 <= cached) {
+        return get(zeros * 2 + 1) - 1;
+      }
+    }
+    //very long code, or not enough data left
+    unsigned int zeros = 0;
+    while (size() && !get(1) && zeros < 64) {
+      zeros++;
+    }
+    if (zeros >= 64) {
+      return 0;
+    }
+    return (((long long unsigned int)1 << zeros) | get(zeros)) - 1;
+  }
+
+  long long int bitReader::getExpGolomb() {
+    long long unsigned int temp = getUExpGolomb() + 1;
+    return (temp >> 1) * (1 - ((temp & 1) << 1)); //Is actually return (temp / 2) * (1 - (temp & 1) * 2);
+  }
+
+  ///Creates a reader over len bytes of data, which must stay valid while reading.
+  bitReaderLSBF::bitReaderLSBF(const char * data, size_t len) {
+    pos = (const unsigned char *)data;
+    end = pos + len;
+    cache = 0;
+    cached = 0;
+  }
+
+  ///Fills the cache up to at least 57 bits, or as far as the data goes.
+  void bitReaderLSBF::refill() {
+    if (cached > 56) {
+      return;
+    }
+    if (end - pos >= 8) {
+      unsigned int bytes = (64 - cached) >> 3;
+      cache |= loadLE64(pos) << cached;
+      pos += bytes;
+      cached += bytes * 8;
+      if (cached < 64) {
+        //clear the part of the next byte that was loaded as well
+        cache &= ((uint64_t)1 << cached) - 1;
+      }
+      return;
+    }
+    while (cached <= 56 && pos < end) {
+      cache |= (uint64_t)*(pos++) << cached;
+      cached += 8;
+    }
+  }
+
+  long long unsigned int bitReaderLSBF::size() {
+    return cached + (end - pos) * 8;
+  }
+
+  ///Returns the next count bits, at most 56, without consuming them.
+  long long unsigned int bitReaderLSBF::peek(size_t count) {
+    if (!count) {
+      return 0;
+    }
+    if (cached < count) {
+      refill();
+    }
+    if (count > cached) {
+      return 0;
+    }
+    return cache & (0xFFFFFFFFFFFFFFFFull >> (64 - count));
+  }
+
+  ///Consumes and returns the next count bits, at most 64.
+  long long unsigned int bitReaderLSBF::get(size_t count) {
+    if (count > 32) {
+      long long unsigned int lower = get(32);
+      return lower | (get(count - 32) << 32);
+    }
+    if (!count) {
+      return 0;
+    }
+    if (cached < count) {
+      refill();
+      if (cached < count) {
+        cache = 0;
+        cached = 0;
+        return 0;
+      }
+    }
+    long long unsigned int retVal = cache & (0xFFFFFFFFFFFFFFFFull >> (64 - count));
+    cache >>= count;
+    cached -= count;
+    return retVal;
+  }
+
+  void bitReaderLSBF::skip(size_t count) {
+    while (count > cached) {
+      count -= cached;
+      cache = 0;
+      cached = 0;
+      size_t bytes = std::min((size_t)(end - pos), count / 8);
+      pos += bytes;
+      count -= bytes * 8;
+      refill();
+      if (!cached) {
+        return;
+      }
+    }
+    if (count == 64) {
+      cache = 0;
+    } else {
+      cache >>= count;
+    }
+    cached -= count;
+  }
 }
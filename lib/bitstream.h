@@ -1,4 +1,5 @@
 #include<string>
+#include <stdint.h>
 
 namespace Utils {
   class bitstream {
@@ -9,7 +10,7 @@ namespace Utils {
         return *this;
       };
       bitstream & operator<< (char input) {
-        append(std::string(input, 1));
+        append(std::string(1, input));
         return *this;
       };
       void append(char * input, size_t bytes);
@@ -55,6 +56,42 @@ namespace Utils {
       unsigned int readBufferOffset;
       void fixData();
   };
-}
 
+  /// Reads bits most significant bit first from a buffer it does not own, 64 bits at a time.
+  /// Can skip H.264 emulation prevention bytes (the 03 in 00 00 03) while reading, so NAL unit
+  /// payloads can be parsed without first copying them into an RBSP.
+  class bitReader {
+    public:
+      bitReader(const char * data, size_t len, bool unescape = false);
+      long long unsigned int size();
+      void skip(size_t count);
+      long long unsigned int get(size_t count);
+      long long unsigned int peek(size_t count);
+      long long int getExpGolomb();
+      long long unsigned int getUExpGolomb();
+    private:
+      void refill();
+      const unsigned char * pos;///< Next byte to load into the cache.
+      const unsigned char * end;
+      bool unescape;
+      unsigned int zeroes;///< Consecutive zero bytes loaded, for removing emulation prevention bytes.
+      uint64_t cache;///< Loaded bits, starting at the most significant bit. Bits past cached are zero.
+      unsigned int cached;
+  };
 
+  /// Reads bits least significant bit first from a buffer it does not own, 64 bits at a time.
+  class bitReaderLSBF {
+    public:
+      bitReaderLSBF(const char * data, size_t len);
+      long long unsigned int size();
+      void skip(size_t count);
+      long long unsigned int get(size_t count);
+      long long unsigned int peek(size_t count);
+    private:
+      void refill();
+      const unsigned char * pos;///< Next byte to load into the cache.
+      const unsigned char * end;
+      uint64_t cache;///< Loaded bits, starting at the least significant bit. Bits past cached are zero.
+      unsigned int cached;
+  };
+}
@@ -0,0 +1,235 @@
+/// \file checksum.cpp
+/// Implementations of the CRC functions in checksum.h.
+
+#include "checksum.h"
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define CRC_HAVE_CLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace checksum {
+  /// The polynomial of all CRCs in this file.
+  static const uint32_t poly = 0x04C11DB7U;
+
+  /// tables[k][b] is the CRC of byte b followed by k zero bytes. tables[0] is the usual byte-at-a-time table.
+  static uint32_t tables[8][256];
+  /// The reflected byte-at-a-time table, used by crc32LE only.
+  static uint32_t tableLE[256];
+  /// Folding constants for the CLMUL implementation: x^n mod poly for n = 128, 192, 512 and 576.
+  static uint64_t fold128[2];
+  static uint64_t fold512[2];
+
+  typedef uint32_t (*crcFunc)(uint32_t crc, const char * data, size_t len);
+  static uint32_t crcFirstCall(uint32_t crc, const char * data, size_t len);
+  /// The implementation crc32c and crc32 call into.
+  static crcFunc kernel = crcFirstCall;
+  static crcImplementation kernelImpl = CRC_BYTEWISE;
+
+  /// Returns x^n mod poly.
+  static uint32_t xPowMod(unsigned int n){
+    uint32_t r = 1;
+    while (n--){
+      r = (r & 0x80000000U) ? ((r << 1) ^ poly) : (r << 1);
+    }
+    return r;
+  }
+
+  static uint32_t crcBytewise(uint32_t crc, const char * data, size_t len){
+    const unsigned char * d = (const unsigned char *)data;
+    while (len--){
+      crc = tables[0][*d++ ^ (crc >> 24)] ^ (crc << 8);
+    }
+    return crc;
+  }
+
+  static uint32_t crcSlice8(uint32_t crc, const char * data, size_t len){
+    const unsigned char * d = (const unsigned char *)data;
+    while (len >= 8){
+      uint32_t w = crc ^ (((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3]);
+      crc = tables[7][w >> 24] ^ tables[6][(w >> 16) & 0xFF] ^ tables[5][(w >> 8) & 0xFF] ^ tables[4][w & 0xFF] ^
+            tables[3][d[4]] ^ tables[2][d[5]] ^ tables[1][d[6]] ^ tables[0][d[7]];
+      d += 8;
+      len -= 8;
+    }
+    while (len--){
+      crc = tables[0][*d++ ^ (crc >> 24)] ^ (crc << 8);
+    }
+    return crc;
+  }
+
+#ifdef CRC_HAVE_CLMUL
+  /// Returns true if the CPU supports the instructions crcClmul needs.
+  static bool haveClmul(){
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)){
+      return false;
+    }
+    //bit 1 is PCLMULQDQ, bit 9 is SSSE3
+    return (c & (1 << 1)) && (c & (1 << 9));
+  }
+
+  /// Multiplies both halves of a by the matching halves of k, folding a forward by the distance k was made for.
+  __attribute__((target("pclmul,ssse3")))
+  static inline __m128i fold(__m128i a, __m128i k){
+    return _mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11), _mm_clmulepi64_si128(a, k, 0x00));
+  }
+
+  /// Folds 16-byte blocks with carry-less multiplication, four at a time, and finishes with slicing-by-8.
+  /// Blocks are byte-reversed on load, so bit n of a register is the coefficient of x^n.
+  __attribute__((target("pclmul,ssse3")))
+  static uint32_t crcClmul(uint32_t crc, const char * data, size_t len){
+    if (len < 128){
+      return crcSlice8(crc, data, len);
+    }
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k128 = _mm_set_epi64x(fold128[1], fold128[0]);
+    const __m128i k512 = _mm_set_epi64x(fold512[1], fold512[0]);
+    const __m128i * p = (const __m128i *)data;
+    __m128i a0 = _mm_shuffle_epi8(_mm_loadu_si128(p), reverse);
+    __m128i a1 = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), reverse);
+    __m128i a2 = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), reverse);
+    __m128i a3 = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), reverse);
+    //the initial value is added to the first four bytes
+    a0 = _mm_xor_si128(a0, _mm_set_epi32(crc, 0, 0, 0));
+    p += 4;
+    len -= 64;
+    while (len >= 64){
+      a0 = _mm_xor_si128(fold(a0, k512), _mm_shuffle_epi8(_mm_loadu_si128(p), reverse));
+      a1 = _mm_xor_si128(fold(a1, k512), _mm_shuffle_epi8(_mm_loadu_si128(p + 1), reverse));
+      a2 = _mm_xor_si128(fold(a2, k512), _mm_shuffle_epi8(_mm_loadu_si128(p + 2), reverse));
+      a3 = _mm_xor_si128(fold(a3, k512), _mm_shuffle_epi8(_mm_loadu_si128(p + 3), reverse));
+      p += 4;
+      len -= 64;
+    }
+    a0 = _mm_xor_si128(fold(a0, k128), a1);
+    a0 = _mm_xor_si128(fold(a0, k128), a2);
+    a0 = _mm_xor_si128(fold(a0, k128), a3);
+    while (len >= 16){
+      a0 = _mm_xor_si128(fold(a0, k128), _mm_shuffle_epi8(_mm_loadu_si128(p), reverse));
+      ++p;
+      len -= 16;
+    }
+    //what is left is congruent to the data so far, so its CRC is the CRC of the data so far
+    char rest[16];
+    _mm_storeu_si128((__m128i *)rest, _mm_shuffle_epi8(a0, reverse));
+    crc = crcSlice8(0, rest, 16);
+    return crcSlice8(crc, (const char *)p, len);
+  }
+#endif
+
+  /// Fills the tables and folding constants. Safe to call more than once.
+  static void fillTables(){
+    static bool filled = false;
+    if (filled){
+      return;
+    }
+    for (unsigned int i = 0; i < 256; ++i){
+      uint32_t c = i << 24;
+      uint32_t r = i;
+      for (unsigned int j = 0; j < 8; ++j){
+        c = (c & 0x80000000U) ? ((c << 1) ^ poly) : (c << 1);
+        r = (r & 1) ? ((r >> 1) ^ 0xEDB88320U) : (r >> 1);
+      }
+      tables[0][i] = c;
+      tableLE[i] = r;
+    }
+    for (unsigned int k = 1; k < 8; ++k){
+      for (unsigned int i = 0; i < 256; ++i){
+        tables[k][i] = (tables[k - 1][i] << 8) ^ tables[0][tables[k - 1][i] >> 24];
+      }
+    }
+    fold128[0] = xPowMod(128);
+    fold128[1] = xPowMod(192);
+    fold512[0] = xPowMod(512);
+    fold512[1] = xPowMod(576);
+    filled = true;
+  }
+
+  /// Fills the tables and picks the fastest implementation.
+  static void init(){
+    fillTables();
+    if (!setImplementation(CRC_CLMUL)){
+      setImplementation(CRC_SLICE8);
+    }
+  }
+
+  static uint32_t crcFirstCall(uint32_t crc, const char * data, size_t len){
+    init();
+    return kernel(crc, data, len);
+  }
+
+  /// Runs init when the library is loaded, so the kernel never changes while threads are running.
+  static struct crcInit {
+    crcInit(){
+      if (kernel == crcFirstCall){
+        init();
+      }
+    }
+  } crcInitializer;
+
+  /// Makes crc32c and crc32 use impl.
+  /// \returns False if impl is not supported by this CPU, in which case nothing changes.
+  bool setImplementation(crcImplementation impl){
+    fillTables();
+    switch (impl){
+      case CRC_BYTEWISE:
+        kernel = crcBytewise;
+        break;
+      case CRC_SLICE8:
+        kernel = crcSlice8;
+        break;
+      case CRC_CLMUL:
+#ifdef CRC_HAVE_CLMUL
+        if (!haveClmul()){
+          return false;
+        }
+        kernel = crcClmul;
+        break;
+#else
+        return false;
+#endif
+      default:
+        return false;
+    }
+    kernelImpl = impl;
+    return true;
+  }
+
+  /// Returns the implementation crc32c and crc32 currently use.
+  crcImplementation getImplementation(){
+    if (kernel == crcFirstCall){
+      init();
+    }
+    return kernelImpl;
+  }
+
+  const char * implementationName(crcImplementation impl){
+    switch (impl){
+      case CRC_BYTEWISE: return "bytewise";
+      case CRC_SLICE8: return "slice8";
+      case CRC_CLMUL: return "clmul";
+    }
+    return "unknown";
+  }
+
+  unsigned int crc32c(unsigned int crc, const char * data, size_t len){
+    return kernel(crc, data, len);
+  }
+
+  unsigned int crc32LE(unsigned int crc, const char * data, size_t len){
+    fillTables();
+    const unsigned char * d = (const unsigned char *)data;
+    while (len--){
+      crc = tableLE[*d++ ^ (crc >> 24)] ^ (crc << 8);
+    }
+    return crc;
+  }
+
+  unsigned int crc32(unsigned int crc, const char * data, size_t len){
+    return __builtin_bswap32(kernel(__builtin_bswap32(crc), data, len));
+  }
+}
@@ -32,8 +32,28 @@
 #include <stdlib.h>
 #include <fstream>
 #include <dirent.h> //for getMyExec
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+/// Maximum amount of connections the servers accept per wakeup.
+#define ACCEPT_BATCH 64
+/// Milliseconds the servers wait for connections before checking whether they should still be running.
+#define ACCEPT_WAIT 1000
+
+/// Maximum amount of workers poolServer forks in one go, so accepting is never held up for long.
+#define POOL_SPAWN_BURST 16
+/// The pool may grow to this many times its configured size while connections come in faster than it refills.
+#define POOL_MAX_GROWTH 8
+/// After this many milliseconds without running dry, the pool shrinks back towards its configured size.
+#define POOL_SHRINK_DELAY 30000
 
 bool Util::Config::is_active = false;
+unsigned int Util::Config::poolIdle = 0;
+unsigned int Util::Config::poolSpawned = 0;
 unsigned int Util::Config::printDebugLevel = DEBUG;//
 std::string Util::Config::libver = PACKAGE_VERSION;
 
@@ -338,19 +358,19 @@ static void callThreadCallback(void * cDataArg) {
 }
 
 int Util::Config::threadServer(Socket::Server & server_socket, int (*callback)(Socket::Connection &)) {
+  std::deque<Socket::Connection> conns;
   while (is_active && server_socket.connected()) {
-    Socket::Connection S = server_socket.accept();
-    if (S.connected()) { //check if the new connection is valid
+    server_socket.acceptMany(conns, ACCEPT_BATCH, ACCEPT_WAIT);
+    while (conns.size()) {
       callbackData * cData = new callbackData;
-      cData->sock = new Socket::Connection(S);
+      cData->sock = new Socket::Connection(conns.front());
       cData->cb = callback;
+      conns.pop_front();
       //spawn a new thread for this connection
       tthread::thread T(callThreadCallback, (void *)cData);
       //detach it, no need to keep track of it anymore
       T.detach();
-      DEBUG_MSG(DLVL_HIGH, "Spawned new thread for socket %i", S.getSocket());
-    } else {
-      Util::sleep(10); //sleep 10ms
+      DEBUG_MSG(DLVL_HIGH, "Spawned new thread for socket %i", cData->sock->getSocket());
     }
   }
   server_socket.close();
@@ -358,56 +378,327 @@ int Util::Config::threadServer(Socket::Server & server_socket, int (*callback)(S
 }
 
 int Util::Config::forkServer(Socket::Server & server_socket, int (*callback)(Socket::Connection &)) {
+  std::deque<Socket::Connection> conns;
   while (is_active && server_socket.connected()) {
-    Socket::Connection S = server_socket.accept();
-    if (S.connected()) { //check if the new connection is valid
+    server_socket.acceptMany(conns, ACCEPT_BATCH, ACCEPT_WAIT);
+    while (conns.size()) {
+      Socket::Connection S = conns.front();
+      conns.pop_front();
       pid_t myid = fork();
       if (myid == 0) { //if new child, start MAINHANDLER
         server_socket.drop();
+        for (std::deque<Socket::Connection>::iterator it = conns.begin(); it != conns.end(); ++it) {
+          it->drop();
+        }
         return callback(S);
       } else { //otherwise, do nothing or output debugging text
         DEBUG_MSG(DLVL_HIGH, "Forked new process %i for socket %i", (int)myid, S.getSocket());
         S.drop();
       }
-    } else {
-      Util::sleep(10); //sleep 10ms
     }
   }
   server_socket.close();
   return 0;
 }
 
-int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)) {
+/// Sent to a pooled worker along with the file descriptor of its connection.
+struct poolHandover {
+  unsigned int idle; ///< Idle workers left in the pool.
+  unsigned int spawned; ///< Workers spawned by the pool so far.
+  char host[64]; ///< Address of the peer, as found by accept.
+};
+
+/// An idle pooled worker, waiting on its end of a socketpair.
+struct poolWorker {
+  pid_t pid;
+  int sock;
+};
+
+/// Passes file descriptor fd and info over Unix socket sock.
+/// \returns True on success, false if the worker on the other end is gone.
+static bool poolSend(int sock, int fd, poolHandover & info) {
+  struct iovec iov;
+  iov.iov_base = &info;
+  iov.iov_len = sizeof(info);
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  ssize_t ret;
+  do {
+    ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+  return ret == (ssize_t)sizeof(info);
+}
+
+/// Waits on Unix socket sock for a file descriptor sent by poolSend.
+/// \returns The received file descriptor, or -1 if the pool closed the socket or the process is shutting down.
+static int poolReceive(int sock, poolHandover & info) {
+  struct iovec iov;
+  iov.iov_base = &info;
+  iov.iov_len = sizeof(info);
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t ret;
+  do {
+    ret = recvmsg(sock, &msg, 0);
+  } while (ret < 0 && errno == EINTR && Util::Config::is_active);
+  if (ret != (ssize_t)sizeof(info)) {
+    return -1;
+  }
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  info.host[sizeof(info.host) - 1] = 0;
+  return fd;
+}
+
+/// Serves server_socket with a pool of pre-forked workers, one connection per worker.
+/// Up to poolSize workers are kept idle, each waiting on a socketpair for the parent to pass it an accepted connection.
+/// When connections arrive faster than the pool refills, the parent forks for the connection itself, like forkServer,
+/// and the pool grows up to POOL_MAX_GROWTH times its size. It shrinks back after POOL_SHRINK_DELAY ms without running dry.
+/// Workers learn the idle count and the total amount of spawned workers on hand-over, for the statistics.
+int Util::Config::poolServer(Socket::Server & server_socket, int (*callback)(Socket::Connection &), unsigned int poolSize) {
+  std::deque<poolWorker> idle;
+  unsigned int target = poolSize;
+  unsigned int spawned = 0;
+  long long lastDry = Util::getMS();
+  std::deque<Socket::Connection> conns;
+  DEBUG_MSG(DLVL_DEVEL, "Serving with a pool of %u workers", poolSize);
+  while (is_active && server_socket.connected()) {
+    //top up the pool, a burst at a time
+    for (unsigned int burst = 0; idle.size() < target && burst < POOL_SPAWN_BURST; ++burst) {
+      int socks[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) != 0) {
+        DEBUG_MSG(DLVL_FAIL, "Could not create socket pair for pooled worker: %s", strerror(errno));
+        break;
+      }
+      pid_t myid = fork();
+      if (myid == 0) { //new worker: wait for a connection, then start MAINHANDLER
+        close(socks[0]);
+        for (std::deque<poolWorker>::iterator it = idle.begin(); it != idle.end(); ++it) {
+          close(it->sock);
+        }
+        server_socket.drop();
+        poolHandover info;
+        int fd = poolReceive(socks[1], info);
+        close(socks[1]);
+        if (fd < 0) {
+          return 0;
+        }
+        poolIdle = info.idle;
+        poolSpawned = info.spawned;
+        Socket::Connection S(fd);
+        S.setHost(info.host);
+        return callback(S);
+      }
+      close(socks[1]);
+      if (myid < 0) {
+        DEBUG_MSG(DLVL_FAIL, "Could not fork pooled worker: %s", strerror(errno));
+        close(socks[0]);
+        break;
+      }
+      poolWorker W;
+      W.pid = myid;
+      W.sock = socks[0];
+      idle.push_back(W);
+      ++spawned;
+    }
+    //wait briefly while the pool is still filling up, so it fills quickly
+    if (!server_socket.acceptMany(conns, ACCEPT_BATCH, idle.size() < target ? 10 : ACCEPT_WAIT)) {
+      if (target > poolSize && Util::getMS() - lastDry > POOL_SHRINK_DELAY) {
+        target = std::max(poolSize, target / 2);
+        lastDry = Util::getMS();
+        while (idle.size() > target) {
+          close(idle.back().sock);
+          idle.pop_back();
+        }
+        DEBUG_MSG(DLVL_HIGH, "Worker pool shrunk to %u", target);
+      }
+      continue;
+    }
+    while (conns.size()) {
+      Socket::Connection S = conns.front();
+      conns.pop_front();
+      bool handed = false;
+      while (!handed && idle.size()) {
+        poolWorker W = idle.front();
+        idle.pop_front();
+        poolHandover info;
+        info.idle = idle.size();
+        info.spawned = spawned;
+        snprintf(info.host, sizeof(info.host), "%s", S.getHost().c_str());
+        handed = poolSend(W.sock, S.getSocket(), info);
+        close(W.sock);
+        if (handed) {
+          DEBUG_MSG(DLVL_HIGH, "Handed socket %i to pooled process %i", S.getSocket(), (int)W.pid);
+        }
+      }
+      if (!handed) {
+        //the pool ran dry: serve this one like forkServer does, and keep more workers around
+        lastDry = Util::getMS();
+        if (target < poolSize * POOL_MAX_GROWTH) {
+          target = std::min(target * 2, poolSize * POOL_MAX_GROWTH);
+          DEBUG_MSG(DLVL_MEDIUM, "Worker pool ran dry, growing it to %u", target);
+        }
+        pid_t myid = fork();
+        if (myid == 0) {
+          server_socket.drop();
+          for (std::deque<Socket::Connection>::iterator it = conns.begin(); it != conns.end(); ++it) {
+            it->drop();
+          }
+          poolSpawned = spawned;
+          return callback(S);
+        }
+        DEBUG_MSG(DLVL_HIGH, "Forked new process %i for socket %i", (int)myid, S.getSocket());
+      }
+      S.drop();
+    }
+  }
+  //closing their sockets makes the idle workers exit
+  for (std::deque<poolWorker>::iterator it = idle.begin(); it != idle.end(); ++it) {
+    close(it->sock);
+  }
+  server_socket.close();
+  return 0;
+}
+
+/// Opens the listening sockets for serveThreadedSocket and serveForkedSocket.
+/// TCP listeners get as many sockets as the acceptors option asks for, all on the same port with SO_REUSEPORT,
+/// so the kernel spreads incoming connections over their queues. The backlog and defer_accept options apply to all of them.
+/// \returns False if not all sockets could be opened.
+bool Util::Config::openServerSockets(std::deque<Socket::Server> & sockets) {
   Socket::Server server_socket;
   if (vals.isMember("socket")) {
     server_socket = Socket::Server(Util::getTmpFolder() + getString("socket"));
   }
   if (vals.isMember("listen_port") && vals.isMember("listen_interface")) {
-    server_socket = Socket::Server(getInteger("listen_port"), getString("listen_interface"), false);
+    Socket::listenOptions opts;
+    if (vals.isMember("backlog") && getInteger("backlog") > 0) {
+      opts.backlog = getInteger("backlog");
+    }
+    if (vals.isMember("defer_accept")) {
+      opts.deferAccept = getInteger("defer_accept");
+    }
+    long long acceptors = 1;
+    if (vals.isMember("acceptors") && getInteger("acceptors") > 1) {
+      acceptors = getInteger("acceptors");
+      opts.reusePort = true;
+    }
+    server_socket = Socket::Server(getInteger("listen_port"), getString("listen_interface"), false, opts);
+    for (long long i = 1; i < acceptors && server_socket.connected(); ++i) {
+      Socket::Server extra(getInteger("listen_port"), getString("listen_interface"), false, opts);
+      if (!extra.connected()) {
+        break;
+      }
+      sockets.push_back(extra);
+    }
+  }
+  sockets.push_front(server_socket);
+  if (!server_socket.connected() || (vals.isMember("acceptors") && getInteger("acceptors") > (long long)sockets.size())) {
+    for (std::deque<Socket::Server>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
+      it->close();
+    }
+    return false;
   }
-  if (!server_socket.connected()) {
+  return true;
+}
+
+/// Runs threadServer for a listening socket of an extra acceptor thread.
+struct acceptorData {
+  Util::Config * conf;
+  Socket::Server sock;
+  int (*cb)(Socket::Connection &);
+};
+
+static void callAcceptorThread(void * aDataArg) {
+  acceptorData * aData = (acceptorData *)aDataArg;
+  aData->conf->threadServer(aData->sock, aData->cb);
+  delete aData;
+}
+
+int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)) {
+  std::deque<Socket::Server> sockets;
+  if (!openServerSockets(sockets)) {
     DEBUG_MSG(DLVL_DEVEL, "Failure to open socket");
     return 1;
   }
   DEBUG_MSG(DLVL_DEVEL, "Activating threaded server: %s", getString("cmd").c_str());
   activate();
-  return threadServer(server_socket, callback);
+  //every extra acceptor thread serves its own socket
+  while (sockets.size() > 1) {
+    acceptorData * aData = new acceptorData;
+    aData->conf = this;
+    aData->sock = sockets.back();
+    aData->cb = callback;
+    sockets.pop_back();
+    tthread::thread T(callAcceptorThread, (void *)aData);
+    T.detach();
+  }
+  return threadServer(sockets.front(), callback);
 }
 
 int Util::Config::serveForkedSocket(int (*callback)(Socket::Connection & S)) {
-  Socket::Server server_socket;
-  if (vals.isMember("socket")) {
-    server_socket = Socket::Server(Util::getTmpFolder() + getString("socket"));
-  }
-  if (vals.isMember("listen_port") && vals.isMember("listen_interface")) {
-    server_socket = Socket::Server(getInteger("listen_port"), getString("listen_interface"), false);
-  }
-  if (!server_socket.connected()) {
+  std::deque<Socket::Server> sockets;
+  if (!openServerSockets(sockets)) {
     DEBUG_MSG(DLVL_DEVEL, "Failure to open socket");
     return 1;
   }
   DEBUG_MSG(DLVL_DEVEL, "Activating forked server: %s", getString("cmd").c_str());
   activate();
+  //every extra acceptor process serves its own socket, with its own pool if there is one
+  std::deque<pid_t> acceptors;
+  while (sockets.size() > 1) {
+    pid_t myid = fork();
+    if (myid == 0) {
+#ifdef __linux__
+      //do not outlive the main acceptor
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+      Socket::Server mine = sockets.back();
+      sockets.pop_back();
+      for (std::deque<Socket::Server>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
+        it->drop();
+      }
+      return serveForkedAcceptor(mine, callback);
+    }
+    if (myid < 0) {
+      DEBUG_MSG(DLVL_FAIL, "Could not fork acceptor process: %s", strerror(errno));
+    } else {
+      acceptors.push_back(myid);
+    }
+    sockets.back().drop();
+    sockets.pop_back();
+  }
+  int ret = serveForkedAcceptor(sockets.front(), callback);
+  for (std::deque<pid_t>::iterator it = acceptors.begin(); it != acceptors.end(); ++it) {
+    kill(*it, SIGTERM);
+  }
+  return ret;
+}
+
+/// Serves a single listening socket of serveForkedSocket, with a pool of workers if the pool option is set.
+int Util::Config::serveForkedAcceptor(Socket::Server & server_socket, int (*callback)(Socket::Connection & S)) {
+  if (vals.isMember("pool") && getInteger("pool") > 0) {
+    return poolServer(server_socket, callback, getInteger("pool"));
+  }
   return forkServer(server_socket, callback);
 }
 
@@ -501,6 +792,58 @@ void Util::Config::addConnectorOptions(int port, JSON::Value & capabilities) {
   capabilities["optional"]["interface"]["option"] = "--interface";
   capabilities["optional"]["interface"]["type"] = "str";
 
+  option.null();
+  option["long"] = "pool";
+  option["short"] = "W";
+  option["arg"] = "integer";
+  option["help"] = "Amount of pre-forked workers to keep waiting for connections, or 0 to fork per connection.";
+  option["value"].append(0ll);
+  addOption("pool", option);
+  capabilities["optional"]["pool"]["name"] = "Worker pool";
+  capabilities["optional"]["pool"]["help"] = "Amount of pre-forked workers to keep waiting for connections - default if unprovided is to fork per connection";
+  capabilities["optional"]["pool"]["option"] = "--pool";
+  capabilities["optional"]["pool"]["type"] = "uint";
+  capabilities["optional"]["pool"]["default"] = 0ll;
+
+  option.null();
+  option["long"] = "acceptors";
+  option["short"] = "N";
+  option["arg"] = "integer";
+  option["help"] = "Amount of processes accepting connections, each with its own SO_REUSEPORT socket.";
+  option["value"].append(1ll);
+  addOption("acceptors", option);
+  capabilities["optional"]["acceptors"]["name"] = "Acceptors";
+  capabilities["optional"]["acceptors"]["help"] = "Amount of processes accepting connections on the port - default if unprovided is 1";
+  capabilities["optional"]["acceptors"]["option"] = "--acceptors";
+  capabilities["optional"]["acceptors"]["type"] = "uint";
+  capabilities["optional"]["acceptors"]["default"] = 1ll;
+
+  option.null();
+  option["long"] = "backlog";
+  option["short"] = "B";
+  option["arg"] = "integer";
+  option["help"] = "Maximum amount of connections waiting to be accepted, per acceptor.";
+  option["value"].append(100ll);
+  addOption("backlog", option);
+  capabilities["optional"]["backlog"]["name"] = "Listen backlog";
+  capabilities["optional"]["backlog"]["help"] = "Maximum amount of connections waiting to be accepted, per acceptor - default if unprovided is 100";
+  capabilities["optional"]["backlog"]["option"] = "--backlog";
+  capabilities["optional"]["backlog"]["type"] = "uint";
+  capabilities["optional"]["backlog"]["default"] = 100ll;
+
+  option.null();
+  option["long"] = "defer_accept";
+  option["short"] = "E";
+  option["arg"] = "integer";
+  option["help"] = "Seconds to hold back new connections until they have sent data (TCP_DEFER_ACCEPT), or 0 to disable.";
+  option["value"].append(0ll);
+  addOption("defer_accept", option);
+  capabilities["optional"]["defer_accept"]["name"] = "Defer accept";
+  capabilities["optional"]["defer_accept"]["help"] = "Seconds to hold back new connections until they have sent data - default if unprovided is to not hold them back";
+  capabilities["optional"]["defer_accept"]["option"] = "--defer_accept";
+  capabilities["optional"]["defer_accept"]["type"] = "uint";
+  capabilities["optional"]["defer_accept"]["default"] = 0ll;
+
   addBasicConnectorOptions(capabilities);
 } //addConnectorOptions
 
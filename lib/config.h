@@ -19,11 +19,15 @@ namespace Util {
       JSON::Value vals; ///< Holds all current config values
       int long_count;
       static void signal_handler(int signum);
+      bool openServerSockets(std::deque<Socket::Server> & sockets);
+      int serveForkedAcceptor(Socket::Server & server_socket, int (*callback)(Socket::Connection & S));
     public:
       //variables
       static std::string libver; ///< Version number of the library as a string.
       static bool is_active; ///< Set to true by activate(), set to false by the signal handler.
       static unsigned int printDebugLevel;
+      static unsigned int poolIdle; ///< Idle pooled workers when this process was handed its connection, zero if not pooled.
+      static unsigned int poolSpawned; ///< Workers the pool had spawned when this process was handed its connection.
       //functions
       Config();
       Config(std::string cmd, std::string version);
@@ -37,6 +41,7 @@ namespace Util {
       void activate();
       int threadServer(Socket::Server & server_socket, int (*callback)(Socket::Connection & S));
       int forkServer(Socket::Server & server_socket, int (*callback)(Socket::Connection & S));
+      int poolServer(Socket::Server & server_socket, int (*callback)(Socket::Connection & S), unsigned int poolSize);
       int serveThreadedSocket(int (*callback)(Socket::Connection & S));
       int serveForkedSocket(int (*callback)(Socket::Connection & S));
       int servePlainSocket(int (*callback)(Socket::Connection & S));
@@ -66,6 +66,17 @@ static const char * DBG_LVL_LIST[] = {"NONE", "FAIL", "ERROR", "WARN", "INFO", "
 /// The size used for server configuration pages.
 #define DEFAULT_CONF_PAGE_SIZE 4 * 1024 * 1024
 
+/// The size of the page holding the versions of the configuration snapshot, see Util::configSnapshot.
+/// Each of the four versions can use a little under a quarter, for the packed configuration and its member index.
+#define DEFAULT_CONF_SNAPSHOT_SIZE 5 * DEFAULT_CONF_PAGE_SIZE
+
+/// The size of the page holding the stream to input resolution table, see Util::buildInputTable.
+#define DEFAULT_INPUTS_PAGE_SIZE 2 * 1024 * 1024
+
+/// The amount and size of the slots of the page that caches generated info_, json_ and embed_ responses.
+#define INFO_CACHE_SLOTS 64
+#define INFO_CACHE_SLOT_SIZE 64 * 1024
+
 /// The position from where on stream data pages are switched over to the next page.
 #define FLIP_DATA_PAGE_SIZE 8 * 1024 * 1024
 
@@ -74,6 +85,9 @@ static const char * DBG_LVL_LIST[] = {"NONE", "FAIL", "ERROR", "WARN", "INFO", "
 #define SHM_TRACK_INDEX "MstTRID%s@%lu" //%s stream name, %lu track ID
 #define SHM_TRACK_DATA "MstDATA%s@%lu_%lu" //%s stream name, %lu track ID, %lu page #
 #define SHM_STATISTICS "MstSTAT"
+#define SHM_INPUTS "MstINPT"
+#define SHM_CONF_SNAPSHOT "MstCONF"
+#define SHM_INFO_CACHE "MstINFO"
 #define SHM_USERS "MstUSER%s" //%s stream name
 #define SEM_LIVE "MstLIVE%s" //%s stream name
 #define NAME_BUFFER_SIZE 200    //char buffer size for snprintf'ing shm filenames
@@ -5,6 +5,8 @@
 #include "defines.h"
 #include <stdlib.h>
 #include <string.h> //for memcmp
+#include <algorithm>
+#include <sys/mman.h>
 #include <arpa/inet.h> //for htonl/ntohl
 char DTSC::Magic_Header[] = "DTSC";
 char DTSC::Magic_Packet[] = "DTPD";
@@ -539,14 +541,22 @@ DTSC::File::File() {
   F = 0;
   buffer = malloc(4);
   endPos = 0;
+  mapped = 0;
+  mapSize = 0;
+  readPos = 0;
+  indexed = false;
+  indexPos = 0;
 }
 
 DTSC::File::File(const File & rhs) {
   buffer = malloc(4);
+  mapped = 0;
+  mapSize = 0;
   *this = rhs;
 }
 
 DTSC::File & DTSC::File::operator =(const File & rhs) {
+  unmapFile();
   created = rhs.created;
   if (rhs.F) {
     F = fdopen(dup(fileno(rhs.F)), (created ? "w+b" : "r+b"));
@@ -555,15 +565,25 @@ DTSC::File & DTSC::File::operator =(const File & rhs) {
   }
   endPos = rhs.endPos;
   if (rhs.myPack) {
-    myPack = rhs.myPack;
+    //the packet may point into the mapping of rhs, which does not outlive it
+    myPack.null();
+    myPack.reInit(rhs.myPack.getData(), rhs.myPack.getDataLen());
   }
   metaStorage = rhs.metaStorage;
-  metadata = metaStorage;
+  metadata = rhs.metadata;
   currtime = rhs.currtime;
   lastreadpos = rhs.lastreadpos;
   headerSize = rhs.headerSize;
   trackMapping = rhs.trackMapping;
+  currentPositions = rhs.currentPositions;
+  selectedTracks = rhs.selectedTracks;
   memcpy(buffer, rhs.buffer, 4);
+  if (rhs.mapped && F && mapFile()) {
+    readPos = rhs.readPos;
+    packetIndex = rhs.packetIndex;
+    indexed = rhs.indexed;
+    indexPos = rhs.indexPos;
+  }
   return *this;
 }
 
@@ -575,6 +595,11 @@ DTSC::File::operator bool() const {
 /// If create is true and file does not exist, attempt to create.
 DTSC::File::File(std::string filename, bool create) {
   buffer = malloc(8);
+  mapped = 0;
+  mapSize = 0;
+  readPos = 0;
+  indexed = false;
+  indexPos = 0;
   if (create) {
     F = fopen(filename.c_str(), "w+b");
     if (!F) {
@@ -638,11 +663,111 @@ DTSC::File::File(std::string filename, bool create) {
     fseek(F, 0, SEEK_SET);
     File Fhead(filename + ".dtsh");
     if (Fhead) {
-      metaStorage = Fhead.metaStorage;
-      metadata = metaStorage;
+      metadata = Fhead.getMeta();
     }
   }
   currframe = 0;
+  if (!create) {
+    mapFile();
+  }
+}
+
+/// Maps the whole file read-only into memory, so packets can be read without system calls.
+/// Reading continues at the current position of F.
+/// \returns True if the file was mapped, false if reading continues through F.
+bool DTSC::File::mapFile() {
+  unmapFile();
+  if (!F || created || endPos <= 0) {
+    return false;
+  }
+  void * map = mmap(0, endPos, PROT_READ, MAP_SHARED, fileno(F), 0);
+  if (map == MAP_FAILED) {
+    DEBUG_MSG(DLVL_WARN, "Could not map DTSC file, reading it through stdio instead: %s", strerror(errno));
+    return false;
+  }
+  mapped = (char *)map;
+  mapSize = endPos;
+  readPos = ftell(F);
+  return true;
+}
+
+/// Drops the mapping, if any, and continues reading through F at the same position.
+/// The current packet is copied if it pointed into the mapping.
+void DTSC::File::unmapFile() {
+  if (!mapped) {
+    return;
+  }
+  if (myPack && myPack.getData() >= mapped && myPack.getData() < mapped + mapSize) {
+    std::string tmp(myPack.getData(), myPack.getDataLen());
+    myPack.null();
+    myPack.reInit(tmp.data(), tmp.size());
+  }
+  munmap(mapped, mapSize);
+  mapped = 0;
+  mapSize = 0;
+  if (F) {
+    fseek(F, readPos, SEEK_SET);
+  }
+  packetIndex.clear();
+  indexed = false;
+  indexPos = 0;
+}
+
+/// Walks the packet headers in the mapping once, and stores the positions of all packets in playback order.
+/// Files containing DTSCv1 packets, which have no time and track in their header, are not indexed:
+/// the mapping is dropped and these files are read through F instead.
+/// \returns True if the index could be built.
+bool DTSC::File::buildIndex() {
+  if (!mapped) {
+    return false;
+  }
+  if (indexed) {
+    return true;
+  }
+  packetIndex.clear();
+  //the header knows how many packets to expect
+  unsigned int parts = 0;
+  for (std::map<unsigned int, Track>::iterator it = metadata.tracks.begin(); it != metadata.tracks.end(); it++) {
+    parts += it->second.parts.size();
+  }
+  packetIndex.reserve(parts);
+  unsigned long long pos = 0;
+  while (pos + 8 <= mapSize) {
+    uint32_t * head = (uint32_t *)(mapped + pos);
+    unsigned long long packSize = ntohl(head[1]);
+    if (pos + 8 + packSize > mapSize) {
+      DEBUG_MSG(DLVL_WARN, "Truncated packet @ %llu, ignoring the rest of the file", pos);
+      break;
+    }
+    if (!memcmp(mapped + pos, DTSC::Magic_Packet2, 4)) {
+      if (packSize < 12) {
+        DEBUG_MSG(DLVL_WARN, "Packet too small @ %llu, ignoring the rest of the file", pos);
+        break;
+      }
+      seekPos tmpPos;
+      tmpPos.bytePos = pos;
+      tmpPos.trackID = ntohl(head[2]);
+      tmpPos.seekTime = ((long long unsigned int)ntohl(head[3]) << 32) + ntohl(head[4]);
+      if (tmpPos.seekTime > 0xffffffffffffff00ll) {
+        tmpPos.seekTime = 0;
+      }
+      packetIndex.push_back(tmpPos);
+    } else if (memcmp(mapped + pos, DTSC::Magic_Header, 4)) {
+      if (!memcmp(mapped + pos, DTSC::Magic_Packet, 4)) {
+        DEBUG_MSG(DLVL_DEVEL, "DTSCv1 packet @ %llu, reading file through stdio", pos);
+      } else {
+        DEBUG_MSG(DLVL_ERROR, "Invalid packet header @ %llu, reading file through stdio", pos);
+      }
+      unmapFile();
+      return false;
+    }
+    pos += 8 + packSize;
+  }
+  //packets are written in order per track, a stable sort keeps them that way
+  std::stable_sort(packetIndex.begin(), packetIndex.end());
+  indexed = true;
+  indexPos = 0;
+  return true;
 }
 
 
@@ -659,6 +784,7 @@ bool DTSC::File::writeHeader(std::string & header, bool force) {
     DEBUG_MSG(DLVL_ERROR, "Could not overwrite header - not equal size");
     return false;
   }
+  unmapFile();
   headerSize = header.size();
   int pSize = htonl(header.size());
   fseek(F, 4, SEEK_SET);
@@ -675,6 +801,7 @@ bool DTSC::File::writeHeader(std::string & header, bool force) {
 /// Adds the given string as a new header to the end of the file.
 /// \returns The positon the header was written at, or 0 on failure.
 long long int DTSC::File::addHeader(std::string & header) {
+  unmapFile();
   fseek(F, 0, SEEK_END);
   long long int writePos = ftell(F);
   int hSize = htonl(header.size());
@@ -748,10 +875,16 @@ long int DTSC::File::getBytePosEOF() {
 }
 
 long int DTSC::File::getBytePos() {
+  if (mapped) {
+    return readPos;
+  }
   return ftell(F);
 }
 
 bool DTSC::File::reachedEOF() {
+  if (mapped) {
+    return readPos >= mapSize;
+  }
   return feof(F);
 }
 
@@ -759,6 +892,21 @@ bool DTSC::File::reachedEOF() {
 /// If the packet could not be read for any reason, the reason is printed.
 /// Reading the packet means the file position is increased to the next packet.
 void DTSC::File::seekNext() {
+  if (indexed) {
+    while (indexPos < packetIndex.size() && !selectedTracks.count(packetIndex[indexPos].trackID)) {
+      indexPos++;
+    }
+    if (indexPos >= packetIndex.size()) {
+      DEBUG_MSG(DLVL_DEVEL, "End of file reached while seeking");
+      myPack.null();
+      return;
+    }
+    lastreadpos = packetIndex[indexPos].bytePos;
+    readPos = lastreadpos + 8 + ntohl(((uint32_t *)(mapped + lastreadpos))[1]);
+    myPack.reInit(mapped + lastreadpos, readPos - lastreadpos, true);
+    indexPos++;
+    return;
+  }
   if (!currentPositions.size()) {
     DEBUG_MSG(DLVL_WARN, "No seek positions set - returning empty packet.");
     myPack.null();
@@ -871,6 +1019,38 @@ void DTSC::File::seekNext() {
 }
 
 void DTSC::File::parseNext(){
+  if (mapped) {
+    lastreadpos = readPos;
+    if (readPos + 8 > mapSize) {
+      DEBUG_MSG(DLVL_DEVEL, "End of file reached @ %d", (int)lastreadpos);
+      readPos = mapSize;
+      myPack.null();
+      return;
+    }
+    const char * head = mapped + readPos;
+    unsigned long long packSize = ntohl(((uint32_t *)head)[1]) + 8;
+    if (memcmp(head, DTSC::Magic_Header, 4) && memcmp(head, DTSC::Magic_Packet, 4) && memcmp(head, DTSC::Magic_Packet2, 4)) {
+      DEBUG_MSG(DLVL_ERROR, "Invalid packet header @ %#x - %.4s != %.4s @ %d", (unsigned int)lastreadpos, head, DTSC::Magic_Packet2, (int)lastreadpos);
+      myPack.null();
+      return;
+    }
+    if (readPos + packSize > mapSize) {
+      DEBUG_MSG(DLVL_ERROR, "Could not read packet @ %d", (int)lastreadpos);
+      readPos = mapSize;
+      myPack.null();
+      return;
+    }
+    readPos += packSize;
+    if (lastreadpos != 0 && !memcmp(head, DTSC::Magic_Header, 4)) {
+      readHeader(lastreadpos);
+      std::string tmp = metaStorage.toNetPacked();
+      myPack.reInit(tmp.data(), tmp.size());
+      DEBUG_MSG(DLVL_DEVEL, "Read another header");
+      return;
+    }
+    myPack.reInit(head, packSize, true);
+    return;
+  }
   lastreadpos = ftell(F);
   if (fread(buffer, 4, 1, F) != 1) {
     if (feof(F)) {
@@ -952,6 +1132,10 @@ DTSC::Packet & DTSC::File::getPacket() {
 }
 
 bool DTSC::File::seek_time(unsigned int ms, unsigned int trackNo, bool forceSeek) {
+  if (buildIndex()) {
+    //the index plays all selected tracks from a single position
+    return seek_time(ms);
+  }
   seekPos tmpPos;
   tmpPos.trackID = trackNo;
   if (!forceSeek && myPack && ms > myPack.getTime() && trackNo >= myPack.getTrackId()) {
@@ -1027,6 +1211,13 @@ bool DTSC::File::seek_time(unsigned int ms, unsigned int trackNo, bool forceSeek
 /// Attempts to seek to the given time in ms within the file.
 /// Returns true if successful, false otherwise.
 bool DTSC::File::seek_time(unsigned int ms) {
+  if (buildIndex()) {
+    seekPos tmpPos;
+    tmpPos.seekTime = ms;
+    tmpPos.trackID = 0;
+    indexPos = std::lower_bound(packetIndex.begin(), packetIndex.end(), tmpPos) - packetIndex.begin();
+    return true;
+  }
   currentPositions.clear();
   if (selectedTracks.size()) {
     for (std::set<unsigned long>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++) {
@@ -1037,6 +1228,13 @@ bool DTSC::File::seek_time(unsigned int ms) {
 }
 
 bool DTSC::File::seek_bpos(int bpos) {
+  if (mapped) {
+    if (bpos < 0 || (unsigned long long)bpos > mapSize) {
+      return false;
+    }
+    readPos = bpos;
+    return true;
+  }
   if (fseek(F, bpos, SEEK_SET) == 0) {
     return true;
   }
@@ -1044,6 +1242,7 @@ bool DTSC::File::seek_bpos(int bpos) {
 }
 
 void DTSC::File::rewritePacket(std::string & newPacket, int bytePos) {
+  unmapFile();
   fseek(F, bytePos, SEEK_SET);
   fwrite(newPacket.c_str(), newPacket.size(), 1, F);
   fseek(F, 0, SEEK_END);
@@ -1053,6 +1252,7 @@ void DTSC::File::rewritePacket(std::string & newPacket, int bytePos) {
 }
 
 void DTSC::File::writePacket(std::string & newPacket) {
+  unmapFile();
   fseek(F, 0, SEEK_END);
   fwrite(newPacket.c_str(), newPacket.size(), 1, F); //write contents
   fseek(F, 0, SEEK_END);
@@ -1085,6 +1285,7 @@ void DTSC::File::selectTracks(std::set<unsigned long> & tracks) {
 
 /// Close the file if open
 DTSC::File::~File() {
+  unmapFile();
   if (F) {
     fclose(F);
     F = 0;
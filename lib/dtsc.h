@@ -64,12 +64,32 @@ namespace DTSC {
     DTSC_V2
   };
 
+  /// A hash index over the members of the larger objects inside a packed DTSC value, built by buildScanIndex.
+  /// The table is a 4 byte slot count followed by slots of three native 32 bit words:
+  /// the offset of the object, the offset of the member name (zero for an empty slot) and the hash of both.
+  /// Every indexed object also has a slot with SCAN_INDEX_SENTINEL as name offset, so a miss is a definite absence.
+  class scanIndex {
+    public:
+      scanIndex();
+      scanIndex(const char * data, size_t dataLen, const char * table, size_t tableLen);
+      char * find(const char * obj, const char * name, unsigned int nameLen, bool & indexed) const;
+    private:
+      const char * data;
+      size_t dataLen;
+      const uint32_t * slots;
+      uint32_t mask;
+  };
+
+  void buildScanIndex(const char * data, size_t len, std::string & table);
+
   /// This class allows scanning through raw binary format DTSC data.
   /// It can be used as an iterator or as a direct accessor.
+  /// When given a scanIndex, members of indexed objects are looked up without walking the object.
   class Scan {
     public:
       Scan();
       Scan(char * pointer, size_t len);
+      Scan(char * pointer, size_t len, const scanIndex * idx);
       operator bool() const;
       std::string toPrettyString(unsigned int indent = 0);
       bool hasMember(std::string indice);
@@ -90,6 +110,7 @@ namespace DTSC {
     private:
       char * p;
       size_t len;
+      const scanIndex * index;
   };
 
   /// DTSC::Packets can currently be three types:
@@ -251,6 +272,42 @@ namespace DTSC {
       char data[11];
   };
 
+  ///\brief Track types, resolved from Track::type once when the metadata is parsed.
+  enum trackType {
+    TRACK_UNKNOWN = 0,
+    TRACK_VIDEO,
+    TRACK_AUDIO,
+    TRACK_META
+  };
+
+  ///\brief Codecs, resolved from Track::codec once when the metadata is parsed.
+  enum trackCodec {
+    CODEC_UNKNOWN = 0,
+    CODEC_H264,
+    CODEC_HEVC,
+    CODEC_H263,
+    CODEC_VP6,
+    CODEC_VP6ALPHA,
+    CODEC_SCREENVIDEO1,
+    CODEC_SCREENVIDEO2,
+    CODEC_JPEG,
+    CODEC_THEORA,
+    CODEC_AAC,
+    CODEC_MP3,
+    CODEC_AC3,
+    CODEC_ADPCM,
+    CODEC_PCM,
+    CODEC_NELLYMOSER,
+    CODEC_G711A,
+    CODEC_G711MU,
+    CODEC_SPEEX,
+    CODEC_VORBIS,
+    CODEC_OPUS
+  };
+
+  trackType typeFromString(const std::string & type);
+  trackCodec codecFromString(const std::string & codec);
+
   ///\brief Class for storage of track data
   class Track {
     public:
@@ -262,6 +319,7 @@ namespace DTSC {
         return (parts.size() && keySizes.size() && (keySizes.size() == keys.size()));
       }
       void update(long long packTime, long long packOffset, long long packDataSize, long long packBytePos, bool isKeyframe, long long packSendSize, unsigned long segment_size = 5000);
+      void resolveIds();
       int getSendLen();
       void send(Socket::Connection & conn);
       void writeTo(char *& p);
@@ -286,6 +344,9 @@ namespace DTSC {
       std::string init;
       std::string codec;
       std::string type;
+      trackCodec codecId;///< Resolved from codec when parsed or updated, use this instead of comparing strings per packet.
+      trackType typeId;///< Resolved from type when parsed or updated, use this instead of comparing strings per packet.
+      bool idsResolved;///< Whether codecId and typeId were resolved, also when they resolved to unknown.
       //audio only
       int rate;
       int size;
@@ -328,6 +389,8 @@ namespace DTSC {
   };
 
   /// A simple wrapper class that will open a file and allow easy reading/writing of DTSC data from/to it.
+  /// Files opened for reading are memory-mapped. The first seek builds an index of all packets in playback order,
+  /// after which seekNext and parseNext return packets that point directly into the mapping, without any system calls.
   class File {
     public:
       File();
@@ -357,6 +420,9 @@ namespace DTSC {
     private:
       long int endPos;
       void readHeader(int pos);
+      bool mapFile();
+      void unmapFile();
+      bool buildIndex();
       DTSC::Packet myPack;
       JSON::Value metaStorage;
       Meta metadata;
@@ -370,6 +436,12 @@ namespace DTSC {
       bool created;
       std::set<seekPos> currentPositions;
       std::set<unsigned long> selectedTracks;
+      char * mapped;///< Read-only mapping of the whole file, or null when reading through F.
+      unsigned long long mapSize;///< Size of the mapping in bytes.
+      unsigned long long readPos;///< Position in the mapping of the next packet parseNext returns.
+      std::vector<seekPos> packetIndex;///< All packets in the mapping, sorted by time and track. Only valid if indexed is set.
+      bool indexed;
+      unsigned int indexPos;///< Position in packetIndex of the next packet seekNext returns.
   };
   //FileWriter
 
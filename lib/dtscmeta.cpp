@@ -6,6 +6,8 @@
 #include <iomanip>
 
 #define AUDIO_KEY_INTERVAL 5000 ///< This define controls the keyframe interval for non-video tracks, such as audio and metadata tracks.
+#define SCAN_INDEX_MIN_MEMBERS 8 ///< Objects with fewer members than this are not worth indexing, walking them is as fast.
+#define SCAN_INDEX_SENTINEL 0xFFFFFFFFu ///< Name offset of the slot that marks an object as indexed.
 
 namespace DTSC {
   /// Default constructor for packets - sets a null pointer and invalid packet.
@@ -134,6 +136,11 @@ namespace DTSC {
     if (master && noCopy) {
       null();
     }
+    //a referenced buffer is not ours to resize, copies start from a fresh one
+    if (!master && !noCopy) {
+      data = NULL;
+      bufferLen = 0;
+    }
     //set control flag to !noCopy
     master = !noCopy;
     //either copy the data, or only the pointer, depending on flag
@@ -202,7 +209,7 @@ namespace DTSC {
       memcpy(data+offset+13, (char *)&tmpLong, 4);
       offset += 17;
     }
-    if (packBytePos){
+    if (packBytePos >= 0){
       memcpy(data+offset, "\000\004bpos\001", 7);
       tmpLong = htonl((int)(packBytePos >> 32));
       memcpy(data+offset+7, (char *)&tmpLong, 4);
@@ -268,6 +275,150 @@ namespace DTSC {
     return 0;//out of packet! 1 == error
   }
 
+  /// Hashes a member name together with the offset of the object it belongs to (FNV-1a).
+  static uint32_t scanIndexHash(uint32_t obj, const char * name, unsigned int nameLen) {
+    uint32_t h = 2166136261u ^ (obj * 2654435761u);
+    for (unsigned int i = 0; i < nameLen; ++i) {
+      h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h ^ (h >> 15);
+  }
+
+  /// Collects index entries for the value at p and everything below it, as triples of object offset, name offset and hash.
+  /// Returns a pointer past the value, or 0 if it is malformed.
+  static char * collectScanIndex(char * data, char * p, char * max, std::vector<uint32_t> & entries) {
+    if (p + 1 >= max) {
+      return 0;
+    }
+    if (p[0] == DTSC_ARR) {
+      char * i = p + 1;
+      while (i[0] + i[1] != 0 && i < max) {
+        i = collectScanIndex(data, i, max, entries);
+        if (!i) {
+          return 0;
+        }
+      }
+      return i + 3;
+    }
+    if (p[0] != DTSC_OBJ && p[0] != DTSC_CON) {
+      return skipDTSC(p, max);
+    }
+    uint32_t obj = p - data;
+    std::vector<uint32_t> members;
+    char * i = p + 1;
+    while (i[0] + i[1] != 0 && i < max) {
+      if (i + 2 >= max) {
+        return 0;
+      }
+      unsigned int strlen = Bit::btohs(i);
+      members.push_back(i - data);
+      members.push_back(scanIndexHash(obj, i + 2, strlen));
+      i = collectScanIndex(data, i + 2 + strlen, max, entries);
+      if (!i) {
+        return 0;
+      }
+    }
+    if (members.size() / 2 >= SCAN_INDEX_MIN_MEMBERS) {
+      entries.push_back(obj);
+      entries.push_back(SCAN_INDEX_SENTINEL);
+      entries.push_back(scanIndexHash(obj, 0, 0));
+      //members are inserted in order, so a duplicate name resolves to the first one, like a walk would
+      for (size_t m = 0; m < members.size(); m += 2) {
+        entries.push_back(obj);
+        entries.push_back(members[m]);
+        entries.push_back(members[m + 1]);
+      }
+    }
+    return i + 3;
+  }
+
+  /// Builds a scanIndex table over the packed DTSC value in data, for use with the scanIndex constructor.
+  /// Sets table to an empty string if nothing is worth indexing or the value is malformed.
+  void buildScanIndex(const char * data, size_t len, std::string & table) {
+    table.clear();
+    std::vector<uint32_t> entries;
+    char * d = (char *)data;
+    if (!len || !collectScanIndex(d, d, d + len, entries) || entries.empty()) {
+      return;
+    }
+    //keep the load at or under one half, so probes stay short and there is always an empty slot
+    uint32_t slotCount = 16;
+    while (slotCount < entries.size() / 3 * 2) {
+      slotCount <<= 1;
+    }
+    std::vector<uint32_t> slots(slotCount * 3 + 1, 0);
+    slots[0] = slotCount;
+    for (size_t e = 0; e < entries.size(); e += 3) {
+      uint32_t s = entries[e + 2] & (slotCount - 1);
+      while (slots[1 + s * 3 + 1]) {
+        s = (s + 1) & (slotCount - 1);
+      }
+      slots[1 + s * 3] = entries[e];
+      slots[1 + s * 3 + 1] = entries[e + 1];
+      slots[1 + s * 3 + 2] = entries[e + 2];
+    }
+    table.assign((const char *)&slots[0], slots.size() * sizeof(uint32_t));
+  }
+
+  /// Creates an empty index, which knows no objects.
+  scanIndex::scanIndex() {
+    data = 0;
+    dataLen = 0;
+    slots = 0;
+    mask = 0;
+  }
+
+  /// Creates an index over the packed DTSC value in data, using a table made by buildScanIndex for that value.
+  /// The table must be 4-byte aligned; both buffers are used in place and must outlive this object.
+  scanIndex::scanIndex(const char * _data, size_t _dataLen, const char * table, size_t tableLen) {
+    data = _data;
+    dataLen = _dataLen;
+    slots = 0;
+    mask = 0;
+    if (tableLen < 4) {
+      return;
+    }
+    uint32_t slotCount = *(const uint32_t *)table;
+    if (!slotCount || (slotCount & (slotCount - 1)) || tableLen < 4 + (size_t)slotCount * 12) {
+      return;
+    }
+    slots = (const uint32_t *)(table + 4);
+    mask = slotCount - 1;
+  }
+
+  /// Looks up member name of the object at obj.
+  /// Sets indexed to true if the object is indexed, in which case the return value is definite:
+  /// a pointer to the 2 byte name length of the member, or 0 if it does not exist.
+  /// If indexed is false, the caller has to walk the object itself.
+  char * scanIndex::find(const char * obj, const char * name, unsigned int nameLen, bool & indexed) const {
+    indexed = false;
+    if (!slots || obj < data || obj >= data + dataLen) {
+      return 0;
+    }
+    uint32_t off = obj - data;
+    uint32_t h = scanIndexHash(off, name, nameLen);
+    for (uint32_t s = h & mask; slots[s * 3 + 1]; s = (s + 1) & mask) {
+      const uint32_t * slot = slots + s * 3;
+      if (slot[2] != h || slot[0] != off || slot[1] == SCAN_INDEX_SENTINEL || slot[1] + 2 + nameLen > dataLen) {
+        continue;
+      }
+      const char * key = data + slot[1];
+      if (Bit::btohs((char *)key) == nameLen && !memcmp(key + 2, name, nameLen)) {
+        indexed = true;
+        return (char *)key;
+      }
+    }
+    h = scanIndexHash(off, 0, 0);
+    for (uint32_t s = h & mask; slots[s * 3 + 1]; s = (s + 1) & mask) {
+      const uint32_t * slot = slots + s * 3;
+      if (slot[0] == off && slot[1] == SCAN_INDEX_SENTINEL) {
+        indexed = true;
+        return 0;
+      }
+    }
+    return 0;
+  }
+
   ///\brief Retrieves a single parameter as a string
   ///\param identifier The name of the parameter
   ///\param result A location on which the string will be returned
@@ -394,6 +545,7 @@ namespace DTSC {
   Scan::Scan() {
     p = 0;
     len = 0;
+    index = 0;
   }
 
 
@@ -401,6 +553,15 @@ namespace DTSC {
   Scan::Scan(char * pointer, size_t length) {
     p = pointer;
     len = length;
+    index = 0;
+  }
+
+  /// Create a DTSC::Scan object from memory pointer, using idx for member lookups.
+  /// The index must have been built over the value that contains pointer, and must outlive this object and its children.
+  Scan::Scan(char * pointer, size_t length, const scanIndex * idx) {
+    p = pointer;
+    len = length;
+    index = idx;
   }
 
   /// Returns whether the DTSC::Scan object contains valid data.
@@ -420,6 +581,17 @@ namespace DTSC {
     if (getType() != DTSC_OBJ && getType() != DTSC_CON) {
       return Scan();
     }
+    if (index) {
+      bool indexed = false;
+      char * i = index->find(p, indice, ind_len, indexed);
+      if (indexed) {
+        if (!i) {
+          return Scan();
+        }
+        i += 2;
+        return Scan(i + ind_len, len - (i - p), index);
+      }
+    }
     char * i = p + 1;
     //object, scan contents
     while (i[0] + i[1] != 0 && i < p + len) { //while not encountering 0x0000 (we assume 0x0000EE)
@@ -429,7 +601,7 @@ namespace DTSC {
       unsigned int strlen = Bit::btohs(i);
       i += 2;
       if (ind_len == strlen && strncmp(indice, i, strlen) == 0) {
-        return Scan(i + strlen, len - (i - p));
+        return Scan(i + strlen, len - (i - p), index);
       } else {
         i = skipDTSC(i + strlen, p + len);
         if (!i) {
@@ -506,7 +678,7 @@ namespace DTSC {
       while (i[0] + i[1] != 0 && i < p + len) { //while not encountering 0x0000 (we assume 0x0000EE)
         //search through contents...
         if (arr_indice == num) {
-          return Scan(i, len - (i - p));
+          return Scan(i, len - (i - p), index);
         } else {
           arr_indice++;
           i = skipDTSC(i, p + len);
@@ -527,7 +699,7 @@ namespace DTSC {
         unsigned int strlen = Bit::btohs(i);
         i += 2;
         if (arr_indice == num) {
-          return Scan(i + strlen, len - (i - p));
+          return Scan(i + strlen, len - (i - p), index);
         } else {
           arr_indice++;
           i = skipDTSC(i + strlen, p + len);
@@ -949,9 +1121,58 @@ namespace DTSC {
     str << std::string(indent, ' ') << "Fragment " << getNumber() << ": Dur(" << getDuration() << "), Len(" << (int)getLength() << "), Size(" << getSize() << ")" << std::endl;
   }
 
+  ///\brief Returns the trackType belonging to a track type string.
+  trackType typeFromString(const std::string & type) {
+    if (type == "video") {
+      return TRACK_VIDEO;
+    }
+    if (type == "audio") {
+      return TRACK_AUDIO;
+    }
+    if (type == "meta") {
+      return TRACK_META;
+    }
+    return TRACK_UNKNOWN;
+  }
+
+  ///\brief Returns the trackCodec belonging to a codec string.
+  trackCodec codecFromString(const std::string & codec) {
+    static std::map<std::string, trackCodec> codecs;
+    if (!codecs.size()) {
+      codecs["H264"] = CODEC_H264;
+      codecs["HEVC"] = CODEC_HEVC;
+      codecs["H263"] = CODEC_H263;
+      codecs["VP6"] = CODEC_VP6;
+      codecs["VP6Alpha"] = CODEC_VP6ALPHA;
+      codecs["ScreenVideo1"] = CODEC_SCREENVIDEO1;
+      codecs["ScreenVideo2"] = CODEC_SCREENVIDEO2;
+      codecs["JPEG"] = CODEC_JPEG;
+      codecs["theora"] = CODEC_THEORA;
+      codecs["AAC"] = CODEC_AAC;
+      codecs["MP3"] = CODEC_MP3;
+      codecs["AC3"] = CODEC_AC3;
+      codecs["ADPCM"] = CODEC_ADPCM;
+      codecs["PCM"] = CODEC_PCM;
+      codecs["Nellymoser"] = CODEC_NELLYMOSER;
+      codecs["G711a"] = CODEC_G711A;
+      codecs["G711mu"] = CODEC_G711MU;
+      codecs["Speex"] = CODEC_SPEEX;
+      codecs["vorbis"] = CODEC_VORBIS;
+      codecs["opus"] = CODEC_OPUS;
+    }
+    std::map<std::string, trackCodec>::iterator it = codecs.find(codec);
+    if (it == codecs.end()) {
+      return CODEC_UNKNOWN;
+    }
+    return it->second;
+  }
+
   ///\brief Constructs an empty track
   Track::Track() {
     trackID = 0;
+    codecId = CODEC_UNKNOWN;
+    typeId = TRACK_UNKNOWN;
+    idsResolved = false;
     firstms = 0;
     lastms = 0;
     bps = 0;
@@ -985,6 +1206,7 @@ namespace DTSC {
     missedFrags = trackRef["missed_frags"].asInt();
     codec = trackRef["codec"].asStringRef();
     type = trackRef["type"].asStringRef();
+    resolveIds();
     init = trackRef["init"].asStringRef();
     if (type == "audio") {
       rate = trackRef["rate"].asInt();
@@ -1031,6 +1253,7 @@ namespace DTSC {
     missedFrags = trackRef.getMember("missed_frags").asInt();
     codec = trackRef.getMember("codec").asString();
     type = trackRef.getMember("type").asString();
+    resolveIds();
     init = trackRef.getMember("init").asString();
     if (type == "audio") {
       rate = trackRef.getMember("rate").asInt();
@@ -1052,9 +1275,21 @@ namespace DTSC {
     }
   }
 
+  ///\brief Resolves codecId and typeId from the codec and type strings.
+  ///Call this again after changing codec or type of a track that was already parsed or updated.
+  void Track::resolveIds() {
+    codecId = codecFromString(codec);
+    typeId = typeFromString(type);
+    idsResolved = true;
+  }
+
   ///\brief Updates a track and its metadata given new packet properties.
   ///Will also insert keyframes on non-video tracks, and creates fragments
   void Track::update(long long packTime, long long packOffset, long long packDataSize, long long packBytePos, bool isKeyframe, long long packSendSize, unsigned long segment_size) {
+    //parsers fill in tracks by setting the strings directly, so resolve them on the first packet
+    if (!idsResolved) {
+      resolveIds();
+    }
     if ((unsigned long long)packTime < lastms) {
       DEBUG_MSG(DLVL_WARN, "Received packets for track %u in wrong order (%lld < %llu) - ignoring!", trackID, packTime, lastms);
       return;
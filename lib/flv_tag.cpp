@@ -371,18 +371,18 @@ bool FLV::Tag::DTSCLoader(DTSC::Stream & S) {
 bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
   std::string meta_str;
   len = 0;
-  if (track.type == "video") {
+  if (track.typeId == DTSC::TRACK_VIDEO) {
     char * tmpData = 0;
     unsigned int tmpLen = 0;
     packData.getString("data", tmpData, tmpLen);
     len = tmpLen + 16;
-    if (track.codec == "H264") {
+    if (track.codecId == DTSC::CODEC_H264) {
       len += 4;
     }
     if (!checkBufferSize()) {
       return false;
     }
-    if (track.codec == "H264") {
+    if (track.codecId == DTSC::CODEC_H264) {
       memcpy(data + 16, tmpData, len - 20);
       data[12] = 1;
       offset(packData.getInt("offset"));
@@ -390,25 +390,25 @@ bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
       memcpy(data + 12, tmpData, len - 16);
     }
     data[11] = 0;
-    if (track.codec == "H264") {
+    if (track.codecId == DTSC::CODEC_H264) {
       data[11] |= 7;
     }
-    if (track.codec == "ScreenVideo2") {
+    if (track.codecId == DTSC::CODEC_SCREENVIDEO2) {
       data[11] |= 6;
     }
-    if (track.codec == "VP6Alpha") {
+    if (track.codecId == DTSC::CODEC_VP6ALPHA) {
       data[11] |= 5;
     }
-    if (track.codec == "VP6") {
+    if (track.codecId == DTSC::CODEC_VP6) {
       data[11] |= 4;
     }
-    if (track.codec == "ScreenVideo1") {
+    if (track.codecId == DTSC::CODEC_SCREENVIDEO1) {
       data[11] |= 3;
     }
-    if (track.codec == "H263") {
+    if (track.codecId == DTSC::CODEC_H263) {
       data[11] |= 2;
     }
-    if (track.codec == "JPEG") {
+    if (track.codecId == DTSC::CODEC_JPEG) {
       data[11] |= 1;
     }
     if (packData.getFlag("keyframe")) {
@@ -420,18 +420,18 @@ bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
       data[11] |= 0x30;
     }
   }
-  if (track.type == "audio") {
+  if (track.typeId == DTSC::TRACK_AUDIO) {
     char * tmpData = 0;
     unsigned int tmpLen = 0;
     packData.getString("data", tmpData, tmpLen);
     len = tmpLen + 16;
-    if (track.codec == "AAC") {
+    if (track.codecId == DTSC::CODEC_AAC) {
       len ++;
     }
     if (!checkBufferSize()) {
       return false;
     }
-    if (track.codec == "AAC") {
+    if (track.codecId == DTSC::CODEC_AAC) {
       memcpy(data + 13, tmpData, len - 17);
       data[12] = 1; //raw AAC data, not sequence header
     } else {
@@ -439,23 +439,23 @@ bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
     }
     unsigned int datarate = track.rate;
     data[11] = 0;
-    if (track.codec == "AAC") {
+    if (track.codecId == DTSC::CODEC_AAC) {
       data[11] |= 0xA0;
     }
-    if (track.codec == "MP3") {
+    if (track.codecId == DTSC::CODEC_MP3) {
       if (datarate == 8000){
         data[11] |= 0xE0;
       }else{
         data[11] |= 0x20;
       }
     }
-    if (track.codec == "ADPCM") {
+    if (track.codecId == DTSC::CODEC_ADPCM) {
       data[11] |= 0x10;
     }
-    if (track.codec == "PCM") {
+    if (track.codecId == DTSC::CODEC_PCM) {
       data[11] |= 0x30;
     }
-    if (track.codec == "Nellymoser") {
+    if (track.codecId == DTSC::CODEC_NELLYMOSER) {
       if (datarate == 8000){
         data[11] |= 0x50;
       }else if(datarate == 16000){
@@ -464,13 +464,13 @@ bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
         data[11] |= 0x60;
       }
     }
-    if (track.codec == "G711a") {
+    if (track.codecId == DTSC::CODEC_G711A) {
       data[11] |= 0x70;
     }
-    if (track.codec == "G711mu") {
+    if (track.codecId == DTSC::CODEC_G711MU) {
       data[11] |= 0x80;
     }
-    if (track.codec == "Speex") {
+    if (track.codecId == DTSC::CODEC_SPEEX) {
       data[11] |= 0xB0;
     }
     if (datarate >= 44100) {
@@ -491,13 +491,13 @@ bool FLV::Tag::DTSCLoader(DTSC::Packet & packData, DTSC::Track & track) {
     return false;
   }
   setLen();
-  if (track.type == "video") {
+  if (track.typeId == DTSC::TRACK_VIDEO) {
     data[0] = 0x09;
   }
-  if (track.type == "audio") {
+  if (track.typeId == DTSC::TRACK_AUDIO) {
     data[0] = 0x08;
   }
-  if (track.type == "meta") {
+  if (track.typeId == DTSC::TRACK_META) {
     data[0] = 0x12;
   }
   data[1] = ((len - 15) >> 16) & 0xFF;
@@ -529,6 +529,7 @@ bool FLV::Tag::DTSCVideoInit(DTSC::Track & video) {
   len = 0;
   if (video.codec == "?") {
     video.codec = "H264";
+    video.resolveIds();
   }
   if (video.codec == "H264") {
     len = video.init.size() + 20;
@@ -560,6 +561,7 @@ bool FLV::Tag::DTSCAudioInit(DTSC::Track & audio) {
   //Unknown? Assume AAC.
   if (audio.codec == "?") {
     audio.codec = "AAC";
+    audio.resolveIds();
   }
   if (audio.codec == "AAC") {
     len = audio.init.size() + 17;
@@ -705,10 +707,12 @@ bool FLV::Tag::DTSCMetaInit(DTSC::Stream & S, DTSC::Track & videoRef, DTSC::Trac
   //Unknown? Assume AAC.
   if (audioRef.codec == "?") {
     audioRef.codec = "AAC";
+    audioRef.resolveIds();
   }
   //Unknown? Assume H264.
   if (videoRef.codec == "?") {
     videoRef.codec = "H264";
+    videoRef.resolveIds();
   }
 
   AMF::Object amfdata("root", AMF::AMF0_DDV_CONTAINER);
@@ -1086,6 +1090,7 @@ JSON::Value FLV::Tag::toJSON(DTSC::Meta & metadata, AMF::Object & amf_storage, u
     metadata.tracks[reTrack].type = "audio";
     if (metadata.tracks[reTrack].codec == "") {
       metadata.tracks[reTrack].codec = getAudioCodec();
+      metadata.tracks[reTrack].resolveIds();
     }
     if (!metadata.tracks[reTrack].rate) {
       switch (audiodata & 0x0C) {
@@ -1161,10 +1166,11 @@ JSON::Value FLV::Tag::toJSON(DTSC::Meta & metadata, AMF::Object & amf_storage, u
   }
   if (data[0] == 0x09) {
     char videodata = data[11];
+    metadata.tracks[reTrack].type = "video";
     if (metadata.tracks[reTrack].codec == "") {
       metadata.tracks[reTrack].codec = getVideoCodec();
+      metadata.tracks[reTrack].resolveIds();
     }
-    metadata.tracks[reTrack].type = "video";
     metadata.tracks[reTrack].trackID = reTrack;
     if (!metadata.tracks[reTrack].width || !metadata.tracks[reTrack].height){
       if (amf_storage.getContentP("width")) {
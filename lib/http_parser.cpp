@@ -3,6 +3,8 @@
 
 #include "http_parser.h"
 #include "timing.h"
+#include <strings.h>
+#include <algorithm>
 
 /// This constructor creates an empty HTTP::Parser, ready for use for either reading or writing.
 /// All this constructor does is call HTTP::Parser::Clean().
@@ -15,6 +17,7 @@ HTTP::Parser::Parser() {
 void HTTP::Parser::Clean() {
   CleanPreserveHeaders();
   headers.clear();
+  headerData.clear();
 }
 
 /// Completely re-initializes the HTTP::Parser, leaving it ready for either reading or writing usage.
@@ -41,23 +44,37 @@ void HTTP::Parser::setCORSHeaders(){
 }
 
 
+/// Appends all headers that have both a name and a value to the builder, followed by the empty line that ends them.
+/// \param skipEmptyLength If true, a "Content-Length: 0" header is left out.
+void HTTP::Parser::appendHeaders(bool skipEmptyLength) {
+  for (std::vector<headerEntry>::iterator it = headers.begin(); it != headers.end(); it++) {
+    if (!it->nameLen || !it->valueLen) {
+      continue;
+    }
+    if (skipEmptyLength && it->valueLen == 1 && headerData[it->value] == '0' && it->nameLen == 14 && !strncasecmp(headerData.data() + it->name, "Content-Length", 14)) {
+      continue;
+    }
+    builder.append(headerData, it->name, it->nameLen);
+    builder.append(": ", 2);
+    builder.append(headerData, it->value, it->valueLen);
+    builder.append("\r\n", 2);
+  }
+  builder.append("\r\n", 2);
+}
+
 /// Returns a string containing a valid HTTP 1.0 or 1.1 request, ready for sending.
 /// The request is build from internal variables set before this call is made.
 /// To be precise, method, url, protocol, headers and body are used.
 /// \return A string containing a valid HTTP 1.0 or 1.1 request, ready for sending.
 std::string & HTTP::Parser::BuildRequest() {
   /// \todo Include GET/POST variable parsing?
-  std::map<std::string, std::string>::iterator it;
   if (protocol.size() < 5 || protocol[4] != '/') {
     protocol = "HTTP/1.0";
   }
-  builder = method + " " + url + " " + protocol + "\r\n";
-  for (it = headers.begin(); it != headers.end(); it++) {
-    if ((*it).first != "" && (*it).second != "") {
-      builder += (*it).first + ": " + (*it).second + "\r\n";
-    }
-  }
-  builder += "\r\n" + body;
+  builder.clear();
+  builder.append(method).append(" ", 1).append(url).append(" ", 1).append(protocol).append("\r\n", 2);
+  appendHeaders(false);
+  builder.append(body);
   return builder;
 }
 
@@ -66,20 +83,18 @@ std::string & HTTP::Parser::BuildRequest() {
 /// To be precise, method, url, protocol, headers and body are used.
 void HTTP::Parser::SendRequest(Socket::Connection & conn) {
   /// \todo Include GET/POST variable parsing?
-  std::map<std::string, std::string>::iterator it;
   if (protocol.size() < 5 || protocol[4] != '/') {
     protocol = "HTTP/1.0";
   }
-  builder = method + " " + url + " " + protocol + "\r\n";
-  conn.SendNow(builder);
-  for (it = headers.begin(); it != headers.end(); it++) {
-    if ((*it).first != "" && (*it).second != "") {
-      builder = (*it).first + ": " + (*it).second + "\r\n";
-      conn.SendNow(builder);
-    }
-  }
-  conn.SendNow("\r\n", 2);
-  conn.SendNow(body);
+  builder.clear();
+  builder.append(method).append(" ", 1).append(url).append(" ", 1).append(protocol).append("\r\n", 2);
+  appendHeaders(false);
+  struct iovec parts[2];
+  parts[0].iov_base = (void *)builder.data();
+  parts[0].iov_len = builder.size();
+  parts[1].iov_base = (void *)body.data();
+  parts[1].iov_len = body.size();
+  conn.SendNow(parts, 2);
 }
 
 /// Returns a string containing a valid HTTP 1.0 or 1.1 response, ready for sending.
@@ -90,20 +105,13 @@ void HTTP::Parser::SendRequest(Socket::Connection & conn) {
 /// \return A string containing a valid HTTP 1.0 or 1.1 response, ready for sending.
 std::string & HTTP::Parser::BuildResponse(std::string code, std::string message) {
   /// \todo Include GET/POST variable parsing?
-  std::map<std::string, std::string>::iterator it;
   if (protocol.size() < 5 || protocol[4] != '/') {
     protocol = "HTTP/1.0";
   }
-  builder = protocol + " " + code + " " + message + "\r\n";
-  for (it = headers.begin(); it != headers.end(); it++) {
-    if ((*it).first != "" && (*it).second != "") {
-      if ((*it).first != "Content-Length" || (*it).second != "0") {
-        builder += (*it).first + ": " + (*it).second + "\r\n";
-      }
-    }
-  }
-  builder += "\r\n";
-  builder += body;
+  builder.clear();
+  builder.append(protocol).append(" ", 1).append(code).append(" ", 1).append(message).append("\r\n", 2);
+  appendHeaders(true);
+  builder.append(body);
   return builder;
 }
 
@@ -119,28 +127,25 @@ std::string & HTTP::Parser::BuildResponse() {
 /// Creates and sends a valid HTTP 1.0 or 1.1 response.
 /// The response is partly build from internal variables set before this call is made.
 /// To be precise, protocol, headers and body are used.
-/// This call will attempt to buffer as little as possible and block until the whole request is sent.
+/// The headers and body are sent together, without copying the body.
+/// This call will block until the whole response is sent.
 /// \param code The HTTP response code. Usually you want 200.
 /// \param message The HTTP response message. Usually you want "OK".
 /// \param conn The Socket::Connection to send the response over.
 void HTTP::Parser::SendResponse(std::string code, std::string message, Socket::Connection & conn) {
   /// \todo Include GET/POST variable parsing?
-  std::map<std::string, std::string>::iterator it;
   if (protocol.size() < 5 || protocol[4] != '/') {
     protocol = "HTTP/1.0";
   }
-  builder = protocol + " " + code + " " + message + "\r\n";
-  conn.SendNow(builder);
-  for (it = headers.begin(); it != headers.end(); it++) {
-    if ((*it).first != "" && (*it).second != "") {
-      if ((*it).first != "Content-Length" || (*it).second != "0") {
-        builder = (*it).first + ": " + (*it).second + "\r\n";
-        conn.SendNow(builder);
-      }
-    }
-  }
-  conn.SendNow("\r\n", 2);
-  conn.SendNow(body);
+  builder.clear();
+  builder.append(protocol).append(" ", 1).append(code).append(" ", 1).append(message).append("\r\n", 2);
+  appendHeaders(true);
+  struct iovec parts[2];
+  parts[0].iov_base = (void *)builder.data();
+  parts[0].iov_len = builder.size();
+  parts[1].iov_base = (void *)body.data();
+  parts[1].iov_len = body.size();
+  conn.SendNow(parts, 2);
 }
 
 /// Creates and sends a valid HTTP 1.0 or 1.1 response, based on the given request.
@@ -302,27 +307,87 @@ std::string HTTP::Parser::getUrl() {
 }
 
 /// Returns header i, if set.
-std::string HTTP::Parser::GetHeader(std::string i) {
-  return headers[i];
+/// Header names are matched case-insensitively.
+std::string HTTP::Parser::GetHeader(const std::string & i) {
+  int h = findHeader(i.data(), i.size());
+  if (h < 0) {
+    return "";
+  }
+  return headerData.substr(headers[h].value, headers[h].valueLen);
+}
+
+/// Returns true if header i is set to a non-empty value.
+bool HTTP::Parser::hasHeader(const std::string & i) {
+  int h = findHeader(i.data(), i.size());
+  return h >= 0 && headers[h].valueLen;
 }
+
 /// Returns POST variable i, if set.
 std::string HTTP::Parser::GetVar(std::string i) {
   return vars[i];
 }
 
+/// Returns the index of the header called name in headers, or -1 if there is no such header.
+/// Header names are matched case-insensitively.
+int HTTP::Parser::findHeader(const char * name, size_t nameLen) {
+  for (unsigned int i = 0; i < headers.size(); ++i) {
+    if (headers[i].nameLen == nameLen && !strncasecmp(headerData.data() + headers[i].name, name, nameLen)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/// Sets header name to value, trimming whitespace from both.
+/// An existing header with the same name is overwritten, in place if the new value fits.
+/// Neither name nor value may point into headerData.
+void HTTP::Parser::setHeader(const char * name, size_t nameLen, const char * value, size_t valueLen) {
+  while (nameLen && (*name == ' ' || *name == '\t')) {
+    ++name;
+    --nameLen;
+  }
+  while (nameLen && (name[nameLen - 1] == ' ' || name[nameLen - 1] == '\t')) {
+    --nameLen;
+  }
+  while (valueLen && (*value == ' ' || *value == '\t')) {
+    ++value;
+    --valueLen;
+  }
+  while (valueLen && (value[valueLen - 1] == ' ' || value[valueLen - 1] == '\t')) {
+    --valueLen;
+  }
+  int h = findHeader(name, nameLen);
+  if (h < 0) {
+    headerEntry entry;
+    entry.name = headerData.size();
+    entry.nameLen = nameLen;
+    headerData.append(name, nameLen);
+    entry.value = headerData.size();
+    entry.valueLen = valueLen;
+    headerData.append(value, valueLen);
+    headers.push_back(entry);
+    return;
+  }
+  headerEntry & entry = headers[h];
+  if (valueLen > entry.valueLen) {
+    entry.value = headerData.size();
+    headerData.append(value, valueLen);
+  } else {
+    headerData.replace(entry.value, valueLen, value, valueLen);
+  }
+  entry.valueLen = valueLen;
+}
+
 /// Sets header i to string value v.
-void HTTP::Parser::SetHeader(std::string i, std::string v) {
-  Trim(i);
-  Trim(v);
-  headers[i] = v;
+void HTTP::Parser::SetHeader(const std::string & i, const std::string & v) {
+  setHeader(i.data(), i.size(), v.data(), v.size());
 }
 
 /// Sets header i to integer value v.
-void HTTP::Parser::SetHeader(std::string i, long long v) {
-  Trim(i);
+void HTTP::Parser::SetHeader(const std::string & i, long long v) {
   char val[23]; //ints are never bigger than 22 chars as decimal
-  sprintf(val, "%lld", v);
-  headers[i] = val;
+  int len = sprintf(val, "%lld", v);
+  setHeader(i.data(), i.size(), val, len);
 }
 
 /// Sets POST variable i to string value v.
@@ -381,82 +446,62 @@ bool HTTP::Parser::Read(std::string & strbuf) {
 /// \param HTTPbuffer The data buffer to read from.
 /// \return True on success, false otherwise.
 bool HTTP::Parser::parse(std::string & HTTPbuffer) {
-  size_t f;
-  std::string tmpA, tmpB, tmpC;
-  /// \todo Make this not resize HTTPbuffer in parts, but read all at once and then remove the entire request, like doxygen claims it does?
-  while (!HTTPbuffer.empty()) {
+  size_t pos = 0;
+  bool ret = parse(HTTPbuffer, pos);
+  //remove everything that was interpreted in one go
+  if (pos >= HTTPbuffer.size()) {
+    HTTPbuffer.clear();
+  } else if (pos) {
+    HTTPbuffer.erase(0, pos);
+  }
+  return ret;
+}
+
+/// Parses as much of HTTPbuffer as possible, starting at pos, without changing the buffer.
+/// Lines are scanned in place, only the parts that are kept are copied.
+/// \param HTTPbuffer The data buffer to read from.
+/// \param pos The position to start at, set to the position of the first byte that was not interpreted.
+/// \return True on success, false otherwise.
+bool HTTP::Parser::parse(const std::string & HTTPbuffer, size_t & pos) {
+  while (pos < HTTPbuffer.size()) {
     if (!seenHeaders) {
-      f = HTTPbuffer.find('\n');
-      if (f == std::string::npos) return false;
-      tmpA = HTTPbuffer.substr(0, f);
-      if (f + 1 == HTTPbuffer.size()) {
-        HTTPbuffer.clear();
-      } else {
-        HTTPbuffer.erase(0, f + 1);
-      }
-      while (tmpA.find('\r') != std::string::npos) {
-        tmpA.erase(tmpA.find('\r'));
+      const char * line = HTTPbuffer.data() + pos;
+      const char * lineEnd = (const char *)memchr(line, '\n', HTTPbuffer.size() - pos);
+      if (!lineEnd) {
+        return false;
       }
+      pos += lineEnd - line + 1;
+      //ignore everything from the first \r onwards
+      const char * cr = (const char *)memchr(line, '\r', lineEnd - line);
+      size_t lineLen = (cr ? cr : lineEnd) - line;
       if (!seenReq) {
-        seenReq = true;
-        f = tmpA.find(' ');
-        if (f != std::string::npos) {
-          if (tmpA.substr(0, 4) == "HTTP") {
-            protocol = tmpA.substr(0, f);
-            tmpA.erase(0, f + 1);
-            f = tmpA.find(' ');
-            if (f != std::string::npos) {
-              url = tmpA.substr(0, f);
-              tmpA.erase(0, f + 1);
-              method = tmpA;
-              if (url.find('?') != std::string::npos) {
-                parseVars(url.substr(url.find('?') + 1)); //parse GET variables
-                url.erase(url.find('?'));
-              }
-              url = urlunescape(url);
-            } else {
-              seenReq = false;
-            }
-          } else {
-            method = tmpA.substr(0, f);
-            tmpA.erase(0, f + 1);
-            f = tmpA.find(' ');
-            if (f != std::string::npos) {
-              url = tmpA.substr(0, f);
-              tmpA.erase(0, f + 1);
-              protocol = tmpA;
-              if (url.find('?') != std::string::npos) {
-                parseVars(url.substr(url.find('?') + 1)); //parse GET variables
-                url.erase(url.find('?'));
-              }
-              url = urlunescape(url);
-            } else {
-              seenReq = false;
-            }
-          }
-        } else {
-          seenReq = false;
-        }
+        parseRequestLine(line, lineLen);
       } else {
-        if (tmpA.size() == 0) {
+        if (lineLen == 0) {
           seenHeaders = true;
           body.clear();
-          if (GetHeader("Content-Length") != "") {
-            length = atoi(GetHeader("Content-Length").c_str());
+          int h = findHeader("Content-Length", 14);
+          if (h >= 0) {
+            length = 0;
+            const char * val = headerData.data() + headers[h].value;
+            for (unsigned int i = 0; i < headers[h].valueLen && val[i] >= '0' && val[i] <= '9'; ++i) {
+              length = length * 10 + (val[i] - '0');
+            }
             if (body.capacity() < length) {
               body.reserve(length);
             }
           }
-          if (GetHeader("Transfer-Encoding") == "chunked") {
+          h = findHeader("Transfer-Encoding", 17);
+          if (h >= 0 && headers[h].valueLen == 7 && !strncasecmp(headerData.data() + headers[h].value, "chunked", 7)) {
             getChunks = true;
             doingChunk = 0;
           }
         } else {
-          f = tmpA.find(':');
-          if (f == std::string::npos) continue;
-          tmpB = tmpA.substr(0, f);
-          tmpC = tmpA.substr(f + 1);
-          SetHeader(tmpB, tmpC);
+          const char * colon = (const char *)memchr(line, ':', lineLen);
+          if (!colon) {
+            continue;
+          }
+          setHeader(line, colon - line, colon + 1, lineLen - (colon - line) - 1);
         }
       }
     }
@@ -465,10 +510,10 @@ bool HTTP::Parser::parse(std::string & HTTPbuffer) {
         if (headerOnly) {
           return true;
         }
-        unsigned int toappend = length - body.length();
+        unsigned int toappend = std::min((size_t)(length - body.length()), HTTPbuffer.size() - pos);
         if (toappend > 0) {
-          body.append(HTTPbuffer, 0, toappend);
-          HTTPbuffer.erase(0, toappend);
+          body.append(HTTPbuffer, pos, toappend);
+          pos += toappend;
         }
         if (length == body.length()) {
           parseVars(body); //parse POST variables
@@ -482,24 +527,25 @@ bool HTTP::Parser::parse(std::string & HTTPbuffer) {
             return true;
           }
           if (doingChunk) {
-            unsigned int toappend = HTTPbuffer.size();
+            unsigned int toappend = HTTPbuffer.size() - pos;
             if (toappend > doingChunk) {
               toappend = doingChunk;
             }
-            body.append(HTTPbuffer, 0, toappend);
-            HTTPbuffer.erase(0, toappend);
+            body.append(HTTPbuffer, pos, toappend);
+            pos += toappend;
             doingChunk -= toappend;
           } else {
-            f = HTTPbuffer.find('\n');
-            if (f == std::string::npos) return false;
-            tmpA = HTTPbuffer.substr(0, f);
-            while (tmpA.find('\r') != std::string::npos) {
-              tmpA.erase(tmpA.find('\r'));
+            const char * line = HTTPbuffer.data() + pos;
+            const char * lineEnd = (const char *)memchr(line, '\n', HTTPbuffer.size() - pos);
+            if (!lineEnd) {
+              return false;
             }
+            const char * cr = (const char *)memchr(line, '\r', lineEnd - line);
+            size_t lineLen = (cr ? cr : lineEnd) - line;
             unsigned int chunkLen = 0;
-            if (!tmpA.empty()) {
-              for (unsigned int i = 0; i < tmpA.size(); ++i) {
-                chunkLen = (chunkLen << 4) | unhex(tmpA[i]);
+            if (lineLen) {
+              for (unsigned int i = 0; i < lineLen; ++i) {
+                chunkLen = (chunkLen << 4) | unhex(line[i]);
               }
               if (chunkLen == 0) {
                 getChunks = false;
@@ -507,11 +553,7 @@ bool HTTP::Parser::parse(std::string & HTTPbuffer) {
               }
               doingChunk = chunkLen;
             }
-            if (f + 1 == HTTPbuffer.size()) {
-              HTTPbuffer.clear();
-            } else {
-              HTTPbuffer.erase(0, f + 1);
-            }
+            pos += lineEnd - line + 1;
           }
           return false;
         } else {
@@ -523,6 +565,39 @@ bool HTTP::Parser::parse(std::string & HTTPbuffer) {
   return false; //empty input
 } //HTTPReader::parse
 
+/// Parses the first line of a request or response: either "METHOD URL PROTOCOL" or "PROTOCOL CODE MESSAGE".
+/// Responses store the code in url and the message in method.
+/// GET variables are parsed and removed from the URL, which is then unescaped.
+/// Lines that do not have at least two spaces are ignored.
+void HTTP::Parser::parseRequestLine(const char * line, size_t len) {
+  const char * end = line + len;
+  const char * sp1 = (const char *)memchr(line, ' ', len);
+  if (!sp1) {
+    return;
+  }
+  const char * sp2 = (const char *)memchr(sp1 + 1, ' ', end - sp1 - 1);
+  if (!sp2) {
+    return;
+  }
+  seenReq = true;
+  url.assign(sp1 + 1, sp2 - sp1 - 1);
+  if (len >= 4 && !memcmp(line, "HTTP", 4)) {
+    protocol.assign(line, sp1 - line);
+    method.assign(sp2 + 1, end - sp2 - 1);
+  } else {
+    method.assign(line, sp1 - line);
+    protocol.assign(sp2 + 1, end - sp2 - 1);
+  }
+  size_t q = url.find('?');
+  if (q != std::string::npos) {
+    parseVars(url.substr(q + 1)); //parse GET variables
+    url.erase(q);
+  }
+  if (url.find_first_of("%+") != std::string::npos) {
+    url = urlunescape(url);
+  }
+}
+
 /// Parses GET or POST-style variable data.
 /// Saves to internal variable structure using HTTP::Parser::SetVar.
 void HTTP::Parser::parseVars(std::string data) {
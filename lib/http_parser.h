@@ -4,6 +4,7 @@
 #pragma once
 #include <map>
 #include <string>
+#include <vector>
 #include <stdlib.h>
 #include <stdio.h>
 #include "socket.h"
@@ -16,11 +17,12 @@ namespace HTTP {
       Parser();
       bool Read(Socket::Connection & conn);
       bool Read(std::string & strbuf);
-      std::string GetHeader(std::string i);
+      std::string GetHeader(const std::string & i);
+      bool hasHeader(const std::string & i);
       std::string GetVar(std::string i);
       std::string getUrl();
-      void SetHeader(std::string i, std::string v);
-      void SetHeader(std::string i, long long v);
+      void SetHeader(const std::string & i, const std::string & v);
+      void SetHeader(const std::string & i, long long v);
       void setCORSHeaders();
       void SetVar(std::string i, std::string v);
       void SetBody(std::string s);
@@ -53,10 +55,23 @@ namespace HTTP {
       bool sendingChunks;
       unsigned int doingChunk;
       bool parse(std::string & HTTPbuffer);
+      bool parse(const std::string & HTTPbuffer, size_t & pos);
+      void parseRequestLine(const char * line, size_t len);
       void parseVars(std::string data);
+      /// A single header, stored as offsets into headerData.
+      struct headerEntry {
+        unsigned int name;
+        unsigned int nameLen;
+        unsigned int value;
+        unsigned int valueLen;
+      };
+      int findHeader(const char * name, size_t nameLen);
+      void setHeader(const char * name, size_t nameLen, const char * value, size_t valueLen);
+      void appendHeaders(bool skipEmptyLength);
       std::string builder;
       std::string read_buffer;
-      std::map<std::string, std::string> headers;
+      std::string headerData;///< Names and values of all headers, back to back.
+      std::vector<headerEntry> headers;///< All headers, in the order they were set.
       std::map<std::string, std::string> vars;
       void Trim(std::string & s);
       static int unhex(char c);
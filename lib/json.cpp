@@ -8,6 +8,9 @@
 #include <stdint.h> //for uint64_t
 #include <string.h> //for memcpy
 #include <arpa/inet.h> //for htonl
+#include <stdio.h> //for snprintf
+#include <iterator>
+#include <algorithm>
 
 static inline char c2hex(char c) {
   if (c >= '0' && c <= '9') return c - '0';
@@ -26,12 +29,13 @@ static inline char hex2c(char c) {
   return '0';
 }
 
-static std::string read_string(int separator, std::istream & fromstream) {
-  std::string out;
+/// Reads a string up to the (unescaped) separator, starting right after the opening separator.
+/// p is left right after the closing separator.
+static void read_string(char separator, const char *& p, const char * end, std::string & out) {
+  out.clear();
   bool escaped = false;
-  while (fromstream.good()) {
-    char c;
-    fromstream.get(c);
+  while (p < end) {
+    char c = *(p++);
     if (c == '\\') {
       escaped = true;
       continue;
@@ -54,14 +58,14 @@ static std::string read_string(int separator, std::istream & fromstream) {
           out += '\t';
           break;
         case 'u': {
-            char d1, d2, d3, d4;
-            fromstream.get(d1);
-            fromstream.get(d2);
-            fromstream.get(d3);
-            fromstream.get(d4);
-            out.append(1, (c2hex(d4) + (c2hex(d3) << 4)));
+            if (end - p < 4) {
+              p = end;
+              return;
+            }
+            out.append(1, (c2hex(p[3]) + (c2hex(p[2]) << 4)));
             //We ignore the upper two characters.
-            // + (c2hex(d2) << 8) + (c2hex(d1) << 16)
+            // + (c2hex(p[1]) << 8) + (c2hex(p[0]) << 16)
+            p += 4;
             break;
           }
         default:
@@ -71,116 +75,170 @@ static std::string read_string(int separator, std::istream & fromstream) {
       escaped = false;
     } else {
       if (c == separator) {
-        return out;
-      } else {
-        out.append(1, c);
+        return;
       }
+      //copy everything up to the next separator or escape at once
+      const char * stop = p;
+      while (stop < end && *stop != separator && *stop != '\\') {
+        ++stop;
+      }
+      out.append(p - 1, stop - p + 1);
+      p = stop;
     }
   }
-  return out;
 }
 
-static std::string string_escape(const std::string val) {
-  std::string out = "\"";
+/// Appends val to out as a quoted and escaped JSON string.
+static void string_escape(const std::string & val, std::string & out) {
+  out += '"';
+  const char * data = val.data();
+  unsigned int plain = 0;//start of the current run of characters that need no escaping
   for (unsigned int i = 0; i < val.size(); ++i) {
-    switch (val.data()[i]) {
+    const char * esc = 0;
+    switch (data[i]) {
       case '"':
-        out += "\\\"";
+        esc = "\\\"";
         break;
       case '\\':
-        out += "\\\\";
+        esc = "\\\\";
         break;
       case '\n':
-        out += "\\n";
+        esc = "\\n";
         break;
       case '\b':
-        out += "\\b";
+        esc = "\\b";
         break;
       case '\f':
-        out += "\\f";
+        esc = "\\f";
         break;
       case '\r':
-        out += "\\r";
+        esc = "\\r";
         break;
       case '\t':
-        out += "\\t";
+        esc = "\\t";
         break;
       default:
-        if (val.data()[i] < 32 || val.data()[i] > 126) {
+        if (data[i] < 32 || data[i] > 126) {
+          out.append(data + plain, i - plain);
+          plain = i + 1;
           out += "\\u00";
-          out += hex2c((val.data()[i] >> 4) & 0xf);
-          out += hex2c(val.data()[i] & 0xf);
-        } else {
-          out += val.data()[i];
+          out += hex2c((data[i] >> 4) & 0xf);
+          out += hex2c(data[i] & 0xf);
         }
-        break;
+        continue;
     }
+    out.append(data + plain, i - plain);
+    plain = i + 1;
+    out += esc;
   }
-  out += "\"";
+  out.append(data + plain, val.size() - plain);
+  out += '"';
+}
+
+static std::string string_escape(const std::string & val) {
+  std::string out;
+  string_escape(val, out);
   return out;
 }
 
-/// Skips an std::istream forward until any of the following characters is seen: ,]}
-static void skipToEnd(std::istream & fromstream) {
-  while (fromstream.good()) {
-    char peek = fromstream.peek();
-    if (peek == ',') {
-      return;
-    }
-    if (peek == ']') {
-      return;
-    }
-    if (peek == '}') {
-      return;
-    }
-    peek = fromstream.get();
+/// Shared empty array, returned for values that have no array elements allocated.
+static std::deque<JSON::Value> & emptyArray() {
+  static std::deque<JSON::Value> empty;
+  return empty;
+}
+
+/// Shared empty object, returned for values that have no object members allocated.
+static std::map<std::string, JSON::Value> & emptyObject() {
+  static std::map<std::string, JSON::Value> empty;
+  return empty;
+}
+
+/// Skips p forward until any of the following characters is seen: ,]}
+static void skipToEnd(const char *& p, const char * end) {
+  while (p < end && *p != ',' && *p != ']' && *p != '}') {
+    ++p;
   }
 }
 
 /// Sets this JSON::Value to null;
 JSON::Value::Value() {
+  arrVal = 0;
+  objVal = 0;
   null();
 }
 
-/// Sets this JSON::Value to read from this position in the std::istream
+/// Sets this JSON::Value to a deep copy of rhs.
+JSON::Value::Value(const Value & rhs) {
+  myType = rhs.myType;
+  intVal = rhs.intVal;
+  strVal = rhs.strVal;
+  arrVal = (rhs.arrVal && rhs.arrVal->size()) ? new std::deque<Value>(*rhs.arrVal) : 0;
+  objVal = (rhs.objVal && rhs.objVal->size()) ? new std::map<std::string, Value>(*rhs.objVal) : 0;
+}
+
+JSON::Value::~Value() {
+  delete arrVal;
+  delete objVal;
+}
+
+/// Sets this JSON::Value to read from this position in the std::istream.
+/// The stream is read until its end, then rewound to just after the value, if it supports seeking.
 JSON::Value::Value(std::istream & fromstream) {
+  arrVal = 0;
+  objVal = 0;
+  std::streampos start = fromstream.tellg();
+  std::string data((std::istreambuf_iterator<char>(fromstream)), std::istreambuf_iterator<char>());
+  const char * p = data.data();
+  parse(p, p + data.size());
+  if (start != std::streampos(-1)) {
+    fromstream.clear();
+    fromstream.seekg(start + (std::streamoff)(p - data.data()));
+  }
+}
+
+/// Sets this JSON::Value to the value that starts at p, leaving p right after it.
+/// Objects and arrays are filled in place, without copying their members.
+/// Anything that does not make sense as JSON is skipped.
+void JSON::Value::parse(const char *& p, const char * end) {
   null();
   bool reading_object = false;
   bool reading_array = false;
   bool negative = false;
   bool stop = false;
-  while (!stop && fromstream.good()) {
-    int c = fromstream.peek();
-    switch (c) {
+  std::string tmpstr;
+  while (!stop && p < end) {
+    switch (*p) {
       case '{':
         reading_object = true;
-        c = fromstream.get();
+        ++p;
         myType = OBJECT;
         break;
       case '[': {
           reading_array = true;
-          c = fromstream.get();
+          ++p;
           myType = ARRAY;
-          Value tmp = JSON::Value(fromstream);
-          if (tmp.myType != EMPTY) {
-            append(tmp);
+          arr().push_back(Value());
+          arr().back().parse(p, end);
+          if (arr().back().myType == EMPTY) {
+            arr().pop_back();
           }
           break;
         }
       case '\'':
-      case '"':
-        c = fromstream.get();
-        if (!reading_object) {
-          myType = STRING;
-          strVal = read_string(c, fromstream);
-          stop = true;
-        } else {
-          std::string tmpstr = read_string(c, fromstream);
-          (*this)[tmpstr] = JSON::Value(fromstream);
+      case '"': {
+          char c = *(p++);
+          if (!reading_object) {
+            myType = STRING;
+            read_string(c, p, end, strVal);
+            stop = true;
+          } else {
+            read_string(c, p, end, tmpstr);
+            obj()[tmpstr].parse(p, end);
+          }
+          break;
         }
-        break;
       case '-':
-        c = fromstream.get();
+        ++p;
         negative = true;
         break;
       case '0':
@@ -193,55 +251,55 @@ JSON::Value::Value(std::istream & fromstream) {
       case '7':
       case '8':
       case '9':
-        c = fromstream.get();
         myType = INTEGER;
         intVal *= 10;
-        intVal += c - '0';
+        intVal += *(p++) - '0';
         break;
       case ',':
         if (!reading_object && !reading_array) {
           stop = true;
           break;
         }
-        c = fromstream.get();
+        ++p;
         if (reading_array) {
-          append(JSON::Value(fromstream));
+          arr().push_back(Value());
+          arr().back().parse(p, end);
         }
         break;
       case '}':
         if (reading_object) {
-          c = fromstream.get();
+          ++p;
         }
         stop = true;
         break;
       case ']':
         if (reading_array) {
-          c = fromstream.get();
+          ++p;
         }
         stop = true;
         break;
       case 't':
       case 'T':
-        skipToEnd(fromstream);
+        skipToEnd(p, end);
         myType = BOOL;
         intVal = 1;
         stop = true;
         break;
       case 'f':
       case 'F':
-        skipToEnd(fromstream);
+        skipToEnd(p, end);
         myType = BOOL;
         intVal = 0;
         stop = true;
         break;
       case 'n':
       case 'N':
-        skipToEnd(fromstream);
+        skipToEnd(p, end);
         myType = EMPTY;
         stop = true;
         break;
       default:
-        c = fromstream.get(); //ignore this character
+        ++p; //ignore this character
         continue;
         break;
     }
@@ -253,6 +311,8 @@ JSON::Value::Value(std::istream & fromstream) {
 
 /// Sets this JSON::Value to the given string.
 JSON::Value::Value(const std::string & val) {
+  arrVal = 0;
+  objVal = 0;
   myType = STRING;
   strVal = val;
   intVal = 0;
@@ -260,6 +320,8 @@ JSON::Value::Value(const std::string & val) {
 
 /// Sets this JSON::Value to the given string.
 JSON::Value::Value(const char * val) {
+  arrVal = 0;
+  objVal = 0;
   myType = STRING;
   strVal = val;
   intVal = 0;
@@ -267,6 +329,8 @@ JSON::Value::Value(const char * val) {
 
 /// Sets this JSON::Value to the given integer.
 JSON::Value::Value(long long int val) {
+  arrVal = 0;
+  objVal = 0;
   myType = INTEGER;
   intVal = val;
 }
@@ -284,22 +348,23 @@ bool JSON::Value::operator==(const JSON::Value & rhs) const {
     return true;
   }
   if (myType == OBJECT) {
-    if (objVal.size() != rhs.objVal.size()) return false;
-    for (std::map<std::string, Value>::const_iterator it = objVal.begin(); it != objVal.end(); ++it) {
-      if (!rhs.isMember(it->first)) {
+    if (obj().size() != rhs.obj().size()) return false;
+    for (std::map<std::string, Value>::const_iterator it = obj().begin(); it != obj().end(); ++it) {
+      std::map<std::string, Value>::const_iterator other = rhs.obj().find(it->first);
+      if (other == rhs.obj().end()) {
         return false;
       }
-      if (it->second != rhs.objVal.find(it->first)->second) {
+      if (it->second != other->second) {
         return false;
       }
     }
     return true;
   }
   if (myType == ARRAY) {
-    if (arrVal.size() != rhs.arrVal.size()) return false;
+    if (arr().size() != rhs.arr().size()) return false;
     int i = 0;
-    for (std::deque<Value>::const_iterator it = arrVal.begin(); it != arrVal.end(); ++it) {
-      if (*it != rhs.arrVal[i]) {
+    for (std::deque<Value>::const_iterator it = arr().begin(); it != arr().end(); ++it) {
+      if (*it != rhs.arr()[i]) {
         return false;
       }
       i++;
@@ -314,6 +379,16 @@ bool JSON::Value::operator!=(const JSON::Value & rhs) const {
   return !((*this) == rhs);
 }
 
+/// Sets this JSON::Value to a deep copy of rhs.
+/// rhs may be part of this value.
+JSON::Value & JSON::Value::operator=(const Value & rhs) {
+  if (this != &rhs) {
+    Value tmp(rhs);
+    swap(tmp);
+  }
+  return *this;
+}
+
 /// Sets this JSON::Value to the given boolean.
 JSON::Value & JSON::Value::operator=(const bool & rhs) {
   null();
@@ -332,7 +407,10 @@ JSON::Value & JSON::Value::operator=(const std::string & rhs) {
 
 /// Sets this JSON::Value to the given string.
 JSON::Value & JSON::Value::operator=(const char * rhs) {
-  return ((*this) = (std::string)rhs);
+  null();
+  myType = STRING;
+  strVal = rhs;
+  return *this;
 }
 
 /// Sets this JSON::Value to the given integer.
@@ -440,12 +518,12 @@ const char * JSON::Value::c_str() const {
 
 /// Retrieves or sets the JSON::Value at this position in the object.
 /// Converts destructively to object if not already an object.
-JSON::Value & JSON::Value::operator[](const std::string i) {
+JSON::Value & JSON::Value::operator[](const std::string & i) {
   if (myType != OBJECT) {
     null();
     myType = OBJECT;
   }
-  return objVal[i];
+  return obj()[i];
 }
 
 /// Retrieves or sets the JSON::Value at this position in the object.
@@ -455,7 +533,7 @@ JSON::Value & JSON::Value::operator[](const char * i) {
     null();
     myType = OBJECT;
   }
-  return objVal[i];
+  return obj()[i];
 }
 
 /// Retrieves or sets the JSON::Value at this position in the array.
@@ -465,83 +543,74 @@ JSON::Value & JSON::Value::operator[](unsigned int i) {
     null();
     myType = ARRAY;
   }
-  while (i >= arrVal.size()) {
-    append(JSON::Value());
+  if (i >= arr().size()) {
+    arr().resize(i + 1);
   }
-  return arrVal[i];
+  return arr()[i];
 }
 
 /// Retrieves the JSON::Value at this position in the object.
 /// Fails horribly if that values does not exist.
-const JSON::Value & JSON::Value::operator[](const std::string i) const {
-  return objVal.find(i)->second;
+const JSON::Value & JSON::Value::operator[](const std::string & i) const {
+  return obj().find(i)->second;
 }
 
 /// Retrieves the JSON::Value at this position in the object.
 /// Fails horribly if that values does not exist.
 const JSON::Value & JSON::Value::operator[](const char * i) const {
-  return objVal.find(i)->second;
+  return obj().find(i)->second;
 }
 
 /// Retrieves the JSON::Value at this position in the array.
 /// Fails horribly if that values does not exist.
 const JSON::Value & JSON::Value::operator[](unsigned int i) const {
-  return arrVal[i];
+  return arr()[i];
 }
 
 /// Packs to a std::string for transfer over the network.
 /// If the object is a container type, this function will call itself recursively and contain all contents.
-/// As a side effect, this function clear the internal buffer of any object-types.
 std::string JSON::Value::toPacked() const {
   std::string r;
+  r.reserve(packedSize());
+  pack(r);
+  return r;
+}
+//toPacked
+
+/// Appends the packed form of this value to out, as returned by toPacked.
+void JSON::Value::pack(std::string & out) const {
   if (isInt() || isNull() || isBool()) {
-    r += 0x01;
     uint64_t numval = intVal;
-    r += *(((char *) &numval) + 7);
-    r += *(((char *) &numval) + 6);
-    r += *(((char *) &numval) + 5);
-    r += *(((char *) &numval) + 4);
-    r += *(((char *) &numval) + 3);
-    r += *(((char *) &numval) + 2);
-    r += *(((char *) &numval) + 1);
-    r += *(((char *) &numval));
+    char tmp[9] = {0x01, (char)(numval >> 56), (char)(numval >> 48), (char)(numval >> 40), (char)(numval >> 32),
+                   (char)(numval >> 24), (char)(numval >> 16), (char)(numval >> 8), (char)numval};
+    out.append(tmp, 9);
   }
   if (isString()) {
-    r += 0x02;
-    r += strVal.size() / (256 * 256 * 256);
-    r += strVal.size() / (256 * 256);
-    r += strVal.size() / 256;
-    r += strVal.size() % 256;
-    r += strVal;
+    unsigned int len = strVal.size();
+    char tmp[5] = {0x02, (char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+    out.append(tmp, 5);
+    out += strVal;
   }
   if (isObject()) {
-    r += 0xE0;
-    if (objVal.size() > 0) {
-      for (JSON::ObjConstIter it = objVal.begin(); it != objVal.end(); it++) {
-        if (it->first.size() > 0) {
-          r += it->first.size() / 256;
-          r += it->first.size() % 256;
-          r += it->first;
-          r += it->second.toPacked();
-        }
+    out += (char)0xE0;
+    for (JSON::ObjConstIter it = ObjBegin(); it != ObjEnd(); it++) {
+      if (it->first.size() > 0) {
+        out += (char)(it->first.size() / 256);
+        out += (char)(it->first.size() % 256);
+        out += it->first;
+        it->second.pack(out);
       }
     }
-    r += (char)0x0;
-    r += (char)0x0;
-    r += (char)0xEE;
+    out.append("\000\000\356", 3);
   }
   if (isArray()) {
-    r += 0x0A;
-    for (JSON::ArrConstIter it = arrVal.begin(); it != arrVal.end(); it++) {
-      r += it->toPacked();
+    out += (char)0x0A;
+    for (JSON::ArrConstIter it = ArrBegin(); it != ArrEnd(); it++) {
+      it->pack(out);
     }
-    r += (char)0x0;
-    r += (char)0x0;
-    r += (char)0xEE;
+    out.append("\000\000\356", 3);
   }
-  return r;
 }
-//toPacked
 
 /// Packs and transfers over the network.
 /// If the object is a container type, this function will call itself recursively for all contents.
@@ -563,11 +632,11 @@ void JSON::Value::sendTo(Socket::Connection & socket) const {
   }
   if (isObject()) {
     if (isMember("trackid") && isMember("time")) {
-      unsigned int trackid = objVal.find("trackid")->second.asInt();
-      long long time = objVal.find("time")->second.asInt();
+      unsigned int trackid = obj().find("trackid")->second.asInt();
+      long long time = obj().find("time")->second.asInt();
       unsigned int size = 16;
-      if (objVal.size() > 0) {
-        for (JSON::ObjConstIter it = objVal.begin(); it != objVal.end(); it++) {
+      if (obj().size() > 0) {
+        for (JSON::ObjConstIter it = obj().begin(); it != obj().end(); it++) {
           if (it->first.size() > 0 && it->first != "trackid" && it->first != "time" && it->first != "datatype") {
             size += 2 + it->first.size() + it->second.packedSize();
           }
@@ -583,8 +652,8 @@ void JSON::Value::sendTo(Socket::Connection & socket) const {
       tmpHalf = htonl((int)(time & 0xFFFFFFFF));
       socket.SendNow((char *)&tmpHalf, 4);
       socket.SendNow("\340", 1);
-      if (objVal.size() > 0) {
-        for (JSON::ObjConstIter it = objVal.begin(); it != objVal.end(); it++) {
+      if (obj().size() > 0) {
+        for (JSON::ObjConstIter it = obj().begin(); it != obj().end(); it++) {
           if (it->first.size() > 0 && it->first != "trackid" && it->first != "time" && it->first != "datatype") {
             char sizebuffer[2] = {0, 0};
             sizebuffer[0] = (it->first.size() >> 8) & 0xFF;
@@ -604,8 +673,8 @@ void JSON::Value::sendTo(Socket::Connection & socket) const {
       socket.SendNow((char *)&size, 4);
     }
     socket.SendNow("\340", 1);
-    if (objVal.size() > 0) {
-      for (JSON::ObjConstIter it = objVal.begin(); it != objVal.end(); it++) {
+    if (obj().size() > 0) {
+      for (JSON::ObjConstIter it = obj().begin(); it != obj().end(); it++) {
         if (it->first.size() > 0) {
           char sizebuffer[2] = {0, 0};
           sizebuffer[0] = (it->first.size() >> 8) & 0xFF;
@@ -621,7 +690,7 @@ void JSON::Value::sendTo(Socket::Connection & socket) const {
   }
   if (isArray()) {
     socket.SendNow("\012", 1);
-    for (JSON::ArrConstIter it = arrVal.begin(); it != arrVal.end(); it++) {
+    for (JSON::ArrConstIter it = arr().begin(); it != arr().end(); it++) {
       it->sendTo(socket);
     }
     socket.SendNow("\000\000\356", 3);
@@ -639,8 +708,8 @@ unsigned int JSON::Value::packedSize() const {
   }
   if (isObject()) {
     unsigned int ret = 4;
-    if (objVal.size() > 0) {
-      for (JSON::ObjConstIter it = objVal.begin(); it != objVal.end(); it++) {
+    if (obj().size() > 0) {
+      for (JSON::ObjConstIter it = obj().begin(); it != obj().end(); it++) {
         if (it->first.size() > 0) {
           ret += 2 + it->first.size() + it->second.packedSize();
         }
@@ -650,7 +719,7 @@ unsigned int JSON::Value::packedSize() const {
   }
   if (isArray()) {
     unsigned int ret = 4;
-    for (JSON::ArrConstIter it = arrVal.begin(); it != arrVal.end(); it++) {
+    for (JSON::ArrConstIter it = arr().begin(); it != arr().end(); it++) {
       ret += it->packedSize();
     }
     return ret;
@@ -669,20 +738,20 @@ void JSON::Value::netPrepare() {
   std::string packed = toPacked();
   //insert proper header for this type of data
   int packID = -1;
-  long long unsigned int time = objVal["time"].asInt();
+  long long unsigned int time = obj()["time"].asInt();
   std::string dataType;
   if (isMember("datatype") || isMember("trackid")) {
-    dataType = objVal["datatype"].asString();
+    dataType = obj()["datatype"].asString();
     if (isMember("trackid")) {
-      packID = objVal["trackid"].asInt();
+      packID = obj()["trackid"].asInt();
     } else {
-      if (objVal["datatype"].asString() == "video") {
+      if (obj()["datatype"].asString() == "video") {
         packID = 1;
       }
-      if (objVal["datatype"].asString() == "audio") {
+      if (obj()["datatype"].asString() == "audio") {
         packID = 2;
       }
-      if (objVal["datatype"].asString() == "meta") {
+      if (obj()["datatype"].asString() == "meta") {
         packID = 3;
       }
       //endmark and the likes...
@@ -696,9 +765,9 @@ void JSON::Value::netPrepare() {
     }
     removeMember("trackid");
     packed = toPacked();
-    objVal["time"] = (long long int)time;
-    objVal["datatype"] = dataType;
-    objVal["trackid"] = packID;
+    obj()["time"] = (long long int)time;
+    obj()["datatype"] = dataType;
+    obj()["trackid"] = packID;
     strVal.resize(packed.size() + 20);
     memcpy((void *)strVal.c_str(), "DTP2", 4);
   } else {
@@ -749,53 +818,51 @@ std::string & JSON::Value::toNetPacked() {
 /// Converts this JSON::Value to valid JSON notation and returns it.
 /// Makes absolutely no attempts to pretty-print anything. :-)
 std::string JSON::Value::toString() const {
+  std::string out;
+  stringify(out);
+  return out;
+}
+
+/// Appends this JSON::Value to out in valid JSON notation, as returned by toString.
+void JSON::Value::stringify(std::string & out) const {
   switch (myType) {
     case INTEGER: {
-        std::stringstream st;
-        st << intVal;
-        return st.str();
+        char buf[24];
+        out.append(buf, snprintf(buf, 24, "%lld", intVal));
         break;
       }
     case STRING: {
-        return string_escape(strVal);
+        string_escape(strVal, out);
         break;
       }
     case ARRAY: {
-        std::string tmp = "[";
-        if (arrVal.size() > 0) {
-          for (ArrConstIter it = ArrBegin(); it != ArrEnd(); it++) {
-            tmp += it->toString();
-            if (it + 1 != ArrEnd()) {
-              tmp += ",";
-            }
+        out += '[';
+        for (ArrConstIter it = ArrBegin(); it != ArrEnd(); it++) {
+          if (it != ArrBegin()) {
+            out += ',';
           }
+          it->stringify(out);
         }
-        tmp += "]";
-        return tmp;
+        out += ']';
         break;
       }
     case OBJECT: {
-        std::string tmp2 = "{";
-        if (objVal.size() > 0) {
-          ObjConstIter it3 = ObjEnd();
-          --it3;
-          for (ObjConstIter it2 = ObjBegin(); it2 != ObjEnd(); it2++) {
-            tmp2 += string_escape(it2->first) + ":";
-            tmp2 += it2->second.toString();
-            if (it2 != it3) {
-              tmp2 += ",";
-            }
+        out += '{';
+        for (ObjConstIter it2 = ObjBegin(); it2 != ObjEnd(); it2++) {
+          if (it2 != ObjBegin()) {
+            out += ',';
           }
+          string_escape(it2->first, out);
+          out += ':';
+          it2->second.stringify(out);
         }
-        tmp2 += "}";
-        return tmp2;
+        out += '}';
         break;
       }
     case EMPTY:
     default:
-      return "null";
+      out += "null";
   }
-  return "null"; //should never get here...
 }
 
 /// Converts this JSON::Value to valid JSON notation and returns it.
@@ -818,7 +885,7 @@ std::string JSON::Value::toPrettyString(int indentation) const {
         break;
       }
     case ARRAY: {
-        if (arrVal.size() > 0) {
+        if (arr().size() > 0) {
           std::string tmp = "[\n" + std::string(indentation + 2, ' ');
           for (ArrConstIter it = ArrBegin(); it != ArrEnd(); it++) {
             tmp += it->toPrettyString(indentation + 2);
@@ -834,7 +901,7 @@ std::string JSON::Value::toPrettyString(int indentation) const {
         break;
       }
     case OBJECT: {
-        if (objVal.size() > 0) {
+        if (obj().size() > 0) {
           bool shortMode = false;
           if (size() <= 3 && isMember("len")) {
             shortMode = true;
@@ -870,7 +937,7 @@ void JSON::Value::append(const JSON::Value & rhs) {
     null();
     myType = ARRAY;
   }
-  arrVal.push_back(rhs);
+  arr().push_back(rhs);
 }
 
 /// Prepends the given value to the beginning of this JSON::Value array.
@@ -880,7 +947,7 @@ void JSON::Value::prepend(const JSON::Value & rhs) {
     null();
     myType = ARRAY;
   }
-  arrVal.push_front(rhs);
+  arr().push_front(rhs);
 }
 
 /// For array and object JSON::Value objects, reduces them
@@ -891,14 +958,14 @@ void JSON::Value::prepend(const JSON::Value & rhs) {
 /// given size.
 void JSON::Value::shrink(unsigned int size) {
   if (myType == ARRAY) {
-    while (arrVal.size() > size) {
-      arrVal.pop_front();
+    while (arr().size() > size) {
+      arr().pop_front();
     }
     return;
   }
   if (myType == OBJECT) {
-    while (objVal.size() > size) {
-      objVal.erase(objVal.begin());
+    while (obj().size() > size) {
+      obj().erase(obj().begin());
     }
     return;
   }
@@ -907,13 +974,15 @@ void JSON::Value::shrink(unsigned int size) {
 /// For object JSON::Value objects, removes the member with
 /// the given name, if it exists. Has no effect otherwise.
 void JSON::Value::removeMember(const std::string & name) {
-  objVal.erase(name);
+  if (objVal) {
+    objVal->erase(name);
+  }
 }
 
 /// For object JSON::Value objects, returns true if the
 /// given name is a member. Returns false otherwise.
 bool JSON::Value::isMember(const std::string & name) const {
-  return objVal.count(name) > 0;
+  return obj().count(name) > 0;
 }
 
 /// Returns true if this object is an integer.
@@ -948,72 +1017,133 @@ bool JSON::Value::isNull() const {
 
 /// Returns an iterator to the begin of the object map, if any.
 JSON::ObjIter JSON::Value::ObjBegin() {
-  return objVal.begin();
+  if (!objVal) {
+    return emptyObject().begin();
+  }
+  return objVal->begin();
 }
 
 /// Returns an iterator to the end of the object map, if any.
 JSON::ObjIter JSON::Value::ObjEnd() {
-  return objVal.end();
+  if (!objVal) {
+    return emptyObject().end();
+  }
+  return objVal->end();
 }
 
 /// Returns an iterator to the begin of the array, if any.
 JSON::ArrIter JSON::Value::ArrBegin() {
-  return arrVal.begin();
+  if (!arrVal) {
+    return emptyArray().begin();
+  }
+  return arrVal->begin();
 }
 
 /// Returns an iterator to the end of the array, if any.
 JSON::ArrIter JSON::Value::ArrEnd() {
-  return arrVal.end();
+  if (!arrVal) {
+    return emptyArray().end();
+  }
+  return arrVal->end();
 }
 
 /// Returns an iterator to the begin of the object map, if any.
 JSON::ObjConstIter JSON::Value::ObjBegin() const {
-  return objVal.begin();
+  return obj().begin();
 }
 
 /// Returns an iterator to the end of the object map, if any.
 JSON::ObjConstIter JSON::Value::ObjEnd() const {
-  return objVal.end();
+  return obj().end();
 }
 
 /// Returns an iterator to the begin of the array, if any.
 JSON::ArrConstIter JSON::Value::ArrBegin() const {
-  return arrVal.begin();
+  return arr().begin();
 }
 
 /// Returns an iterator to the end of the array, if any.
 JSON::ArrConstIter JSON::Value::ArrEnd() const {
-  return arrVal.end();
+  return arr().end();
 }
 
 /// Returns the total of the objects and array size combined.
 unsigned int JSON::Value::size() const {
-  return objVal.size() + arrVal.size();
+  return (objVal ? objVal->size() : 0) + (arrVal ? arrVal->size() : 0);
 }
 
 /// Completely clears the contents of this value,
 /// changing its type to NULL in the process.
+/// Containers that were allocated before are kept, so values that are reused do not reallocate them.
 void JSON::Value::null() {
-  objVal.clear();
-  arrVal.clear();
+  if (objVal) {
+    objVal->clear();
+  }
+  if (arrVal) {
+    arrVal->clear();
+  }
   strVal.clear();
   intVal = 0;
   myType = EMPTY;
 }
 
+/// Swaps the contents of this JSON::Value with rhs, without copying anything.
+void JSON::Value::swap(Value & rhs) {
+  std::swap(myType, rhs.myType);
+  std::swap(intVal, rhs.intVal);
+  strVal.swap(rhs.strVal);
+  std::swap(arrVal, rhs.arrVal);
+  std::swap(objVal, rhs.objVal);
+}
+
+/// Returns the array elements, allocating them if needed.
+std::deque<JSON::Value> & JSON::Value::arr() {
+  if (!arrVal) {
+    arrVal = new std::deque<Value>();
+  }
+  return *arrVal;
+}
+
+/// Returns the object members, allocating them if needed.
+std::map<std::string, JSON::Value> & JSON::Value::obj() {
+  if (!objVal) {
+    objVal = new std::map<std::string, Value>();
+  }
+  return *objVal;
+}
+
+/// Returns the array elements, or an empty array if there are none.
+const std::deque<JSON::Value> & JSON::Value::arr() const {
+  if (!arrVal) {
+    return emptyArray();
+  }
+  return *arrVal;
+}
+
+/// Returns the object members, or an empty object if there are none.
+const std::map<std::string, JSON::Value> & JSON::Value::obj() const {
+  if (!objVal) {
+    return emptyObject();
+  }
+  return *objVal;
+}
+
 /// Converts a std::string to a JSON::Value.
-JSON::Value JSON::fromString(std::string json) {
-  std::istringstream is(json);
-  return JSON::Value(is);
+/// Parses straight from the string data, without going through a stream.
+JSON::Value JSON::fromString(const std::string & json) {
+  JSON::Value ret;
+  const char * p = json.data();
+  ret.parse(p, p + json.size());
+  return ret;
 }
 
 /// Converts a file to a JSON::Value.
 JSON::Value JSON::fromFile(std::string filename) {
   std::ifstream File;
   File.open(filename.c_str());
-  JSON::Value ret(File);
+  std::string data((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
   File.close();
-  return ret;
+  return fromString(data);
 }
 
 /// Parses a single DTMI type - used recursively by the JSON::fromDTMI functions.
@@ -1064,26 +1194,26 @@ void JSON::fromDTMI(const unsigned char * data, unsigned int len, unsigned int &
           return;
         }
         unsigned int tmpi = data[i + 1] * 256 * 256 * 256 + data[i + 2] * 256 * 256 + data[i + 3] * 256 + data[i + 4]; //set tmpi to UTF-8-long length
-        std::string tmpstr = std::string((const char *)data + i + 5, (size_t)tmpi); //set the string data
         if (i + 4 + tmpi >= len) {
           return;
         }
+        ret.myType = STRING;
+        ret.strVal.assign((const char *)data + i + 5, (size_t)tmpi); //set the string data
         i += tmpi + 5; //skip length+size+1 forwards
-        ret = tmpstr;
         return;
         break;
       }
     case 0xFF: //also object
     case 0xE0: { //object
+        std::string tmpstr;
         ++i;
         while (data[i] + data[i + 1] != 0 && i < len) { //while not encountering 0x0000 (we assume 0x0000EE)
           if (i + 2 >= len) {
             return;
           }
           unsigned int tmpi = data[i] * 256 + data[i + 1]; //set tmpi to the UTF-8 length
-          std::string tmpstr = std::string((const char *)data + i + 2, (size_t)tmpi); //set the string data
+          tmpstr.assign((const char *)data + i + 2, (size_t)tmpi); //set the string data
           i += tmpi + 2; //skip length+size forwards
-          ret[tmpstr].null();
           fromDTMI(data, len, i, ret[tmpstr]); //add content, recursively parsed, updating i, setting indice to tmpstr
         }
         i += 3; //skip 0x0000EE
@@ -1093,8 +1223,9 @@ void JSON::fromDTMI(const unsigned char * data, unsigned int len, unsigned int &
     case 0x0A: { //array
         ++i;
         while (data[i] + data[i + 1] != 0 && i < len) { //while not encountering 0x0000 (we assume 0x0000EE)
-          ret.append(JSON::Value());
-          fromDTMI(data, len, i, *--ret.ArrEnd()); //add content, recursively parsed, updating i
+          ret.myType = ARRAY;
+          ret.arr().push_back(JSON::Value());
+          fromDTMI(data, len, i, ret.arr().back()); //add content, recursively parsed, updating i
         }
         i += 3; //skip 0x0000EE
         return;
@@ -30,18 +30,30 @@ namespace JSON {
   typedef std::deque<Value>::const_iterator ArrConstIter;
 
   /// A JSON::Value is either a string or an integer, but may also be an object, array or null.
+  /// Only the container that matches the type is allocated, and only once the first element is added.
   class Value {
     private:
       ValueType myType;
       long long int intVal;
-      std::string strVal;
-      std::deque<Value> arrVal;
-      std::map<std::string, Value> objVal;
+      std::string strVal;///< String value, or the packed form of an object after toNetPacked.
+      std::deque<Value> * arrVal;///< Array elements, null until the first element is added.
+      std::map<std::string, Value> * objVal;///< Object members, null until the first member is added.
+      std::deque<Value> & arr();
+      std::map<std::string, Value> & obj();
+      const std::deque<Value> & arr() const;
+      const std::map<std::string, Value> & obj() const;
+      void parse(const char *& p, const char * end);
+      void stringify(std::string & out) const;
+      void pack(std::string & out) const;
     public:
       //friends
       friend class DTSC::Stream; //for access to strVal
+      friend void fromDTMI(const unsigned char * data, unsigned int len, unsigned int & i, Value & ret);
+      friend Value fromString(const std::string & json);
       //constructors
       Value();
+      Value(const Value & rhs);
+      ~Value();
       Value(std::istream & fromstream);
       Value(const std::string & val);
       Value(const char * val);
@@ -51,6 +63,7 @@ namespace JSON {
       bool operator==(const Value & rhs) const;
       bool operator!=(const Value & rhs) const;
       //assignment operators
+      Value & operator=(const Value & rhs);
       Value & operator=(const std::string & rhs);
       Value & operator=(const char * rhs);
       Value & operator=(const long long int & rhs);
@@ -67,10 +80,10 @@ namespace JSON {
       const std::string & asStringRef() const;
       const char * c_str() const;
       //array operator for maps and arrays
-      Value & operator[](const std::string i);
+      Value & operator[](const std::string & i);
       Value & operator[](const char * i);
       Value & operator[](unsigned int i);
-      const Value & operator[](const std::string i) const;
+      const Value & operator[](const std::string & i) const;
       const Value & operator[](const char * i) const;
       const Value & operator[](unsigned int i) const;
       //handy functions and others
@@ -102,13 +115,14 @@ namespace JSON {
       ArrConstIter ArrEnd() const;
       unsigned int size() const;
       void null();
+      void swap(Value & rhs);
   };
 
   Value fromDTMI2(std::string & data);
   Value fromDTMI2(const unsigned char * data, unsigned int len, unsigned int & i);
   Value fromDTMI(std::string & data);
   Value fromDTMI(const unsigned char * data, unsigned int len, unsigned int & i);
-  Value fromString(std::string json);
+  Value fromString(const std::string & json);
   Value fromFile(std::string filename);
   void fromDTMI2(std::string & data, Value & ret);
   void fromDTMI2(const unsigned char * data, unsigned int len, unsigned int & i, Value & ret);
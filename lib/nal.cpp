@@ -4,8 +4,144 @@
 #include <iostream>
 #include <iomanip>
 #include <math.h>//for log
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && (defined(__clang__) || (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define NAL_HAVE_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace h264 {
 
+  typedef const char * (*startCodeScanner)(const char * data, size_t len);
+
+  /// Byte-by-byte start code scan, skipping three bytes at a time where possible.
+  /// Also finishes the last bytes of the vectorized scans.
+  static const char * findStartCodeScalar(const char * data, size_t len){
+    const unsigned char * p = (const unsigned char *)data;
+    size_t i = 2;
+    while (i < len){
+      if (p[i] > 1){
+        //no start code can end at i, i+1 or i+2
+        i += 3;
+      }else if (p[i] == 1 && !p[i - 1] && !p[i - 2]){
+        return data + i - 2;
+      }else{
+        ++i;
+      }
+    }
+    return data + len;
+  }
+
+#ifdef NAL_HAVE_SIMD
+  /// Checks 16 possible start code positions at once.
+  static const char * findStartCodeSSE2(const char * data, size_t len){
+    const char * p = data;
+    const char * end = data + len;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    while (end - p >= 18){
+      __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+      __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero);
+      __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one);
+      int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+      if (mask){
+        return p + __builtin_ctz(mask);
+      }
+      p += 16;
+    }
+    return findStartCodeScalar(p, end - p);
+  }
+
+  /// Checks 32 possible start code positions at once.
+  __attribute__((target("avx2")))
+  static const char * findStartCodeAVX2(const char * data, size_t len){
+    const char * p = data;
+    const char * end = data + len;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    while (end - p >= 34){
+      __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), zero);
+      __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), zero);
+      __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), one);
+      unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c));
+      if (mask){
+        return p + __builtin_ctz(mask);
+      }
+      p += 32;
+    }
+    return findStartCodeScalar(p, end - p);
+  }
+#endif
+
+  /// Returns the fastest start code scanner the CPU supports.
+  static startCodeScanner pickScanner(){
+#ifdef NAL_HAVE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+      return findStartCodeAVX2;
+    }
+    return findStartCodeSSE2;
+#else
+    return findStartCodeScalar;
+#endif
+  }
+
+  /// Finds the first Annex B start code (00 00 01) in data.
+  /// A four byte start code is found as the three byte start code that ends it.
+  /// \returns A pointer to the first zero byte of the start code, or data + len if there is none.
+  const char * findStartCode(const char * data, size_t len){
+    static startCodeScanner scanner = pickScanner();
+    return scanner(data, len);
+  }
+
+  /// Converts NAL units with four byte length prefixes (as stored in DTSC) to Annex B with four byte start codes.
+  /// The result is exactly as long as the input, so dest needs room for len bytes. dest may not overlap data.
+  /// \returns The amount of bytes converted. This is less than len if the data ends in a truncated NAL unit.
+  size_t avccToAnnexB(const char * data, size_t len, char * dest){
+    size_t i = 0;
+    while (i + 4 < len){
+      const unsigned char * p = (const unsigned char *)data + i;
+      size_t nalLen = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      if (nalLen > len - i - 4){
+        break;
+      }
+      memcpy(dest + i, "\000\000\000\001", 4);
+      memcpy(dest + i + 4, data + i + 4, nalLen);
+      i += 4 + nalLen;
+    }
+    return i;
+  }
+
+  /// Converts Annex B data to NAL units with four byte length prefixes.
+  /// Bytes before the first start code and trailing zero bytes of NAL units are dropped.
+  /// dest needs room for len + len / 3 bytes, and may not overlap data.
+  /// \returns The amount of bytes written to dest.
+  size_t annexBToAVCC(const char * data, size_t len, char * dest){
+    const char * end = data + len;
+    const char * nal = findStartCode(data, len);
+    size_t written = 0;
+    while (nal < end){
+      nal += 3;
+      const char * next = findStartCode(nal, end - nal);
+      const char * nalEnd = next;
+      while (nalEnd > nal && !nalEnd[-1]){
+        --nalEnd;
+      }
+      size_t nalLen = nalEnd - nal;
+      if (nalLen){
+        dest[written] = (char)(nalLen >> 24);
+        dest[written + 1] = (char)(nalLen >> 16);
+        dest[written + 2] = (char)(nalLen >> 8);
+        dest[written + 3] = (char)nalLen;
+        memcpy(dest + written + 4, nal, nalLen);
+        written += 4 + nalLen;
+      }
+      nal = next;
+    }
+    return written;
+  }
+
   ///empty constructor of NAL
   NAL::NAL() {
 
@@ -57,7 +193,10 @@ namespace h264 {
     if (AnnexB) {
       MyData = "";
       InputData.erase(0, 3); //Intro Bytes
-      int Location = std::min(InputData.find(ShortAnnexB), InputData.find(FullAnnexB));
+      size_t Location = findStartCode(InputData.data(), InputData.size()) - InputData.data();
+      if (Location < InputData.size() && Location && !InputData[Location - 1]) {
+        Location--; //four byte start code
+      }
       MyData = InputData.substr(0, Location);
       InputData.erase(0, Location);
     } else {
@@ -140,15 +279,8 @@ namespace h264 {
     unsigned int heightInMapUnits = 0;
     unsigned int cropVertical = 0;
 
-    Utils::bitstream bs;
-    for (unsigned int i = 1; i < MyData.size(); i++) {
-      if (i + 2 < MyData.size() && MyData.substr(i, 3) == std::string("\000\000\003", 3)) {
-        bs <<  MyData.substr(i, 2);
-        i += 2;
-      } else {
-        bs << MyData.substr(i, 1);
-      }
-    }
+    //read the rbsp bytes, skipping emulation prevention bytes
+    Utils::bitReader bs(MyData.data() + 1, MyData.size() ? MyData.size() - 1 : 0, true);
 
     char profileIdc = bs.get(8);
     //Start skipping unused data
@@ -237,18 +369,8 @@ namespace h264 {
       DEBUG_MSG(DLVL_DEVEL, "This is not an SPS, but type %d", Type());
       return;
     }
-    Utils::bitstream bs;
-    //put rbsp bytes in mydata
-    for (unsigned int i = 1; i < MyData.size(); i++) {
-      //DEBUG_MSG(DLVL_DEVEL, "position %u out of %lu",i,MyData.size());
-      if (i + 2 < MyData.size() && MyData.substr(i, 3) == std::string("\000\000\003", 3)) {
-        bs <<  MyData.substr(i, 2);
-        //DEBUG_MSG(DLVL_DEVEL, "0x000003 encountered at i = %u",i);
-        i += 2;
-      } else {
-        bs << MyData.substr(i, 1);
-      }
-    }
+    //read the rbsp bytes, skipping emulation prevention bytes
+    Utils::bitReader bs(MyData.data() + 1, MyData.size() ? MyData.size() - 1 : 0, true);
     //bs contains all rbsp bytes, now we can analyze them
     std::cout << "seq_parameter_set_data()" << std::endl;
     std::cout << std::hex  << std::setfill('0') << std::setw(2);
@@ -427,16 +549,8 @@ namespace h264 {
       DEBUG_MSG(DLVL_DEVEL, "This is not a PPS, but type %d", Type());
       return;
     }
-    Utils::bitstream bs;
-    //put rbsp bytes in mydata
-    for (unsigned int i = 1; i < MyData.size(); i++) {
-      if (i + 2 < MyData.size() && MyData.substr(i, 3) == std::string("\000\000\003", 3)) {
-        bs <<  MyData.substr(i, 2);
-        i += 2;
-      } else {
-        bs << MyData.substr(i, 1);
-      }
-    }
+    //read the rbsp bytes, skipping emulation prevention bytes
+    Utils::bitReader bs(MyData.data() + 1, MyData.size() ? MyData.size() - 1 : 0, true);
     //bs contains all rbsp bytes, now we can analyze them
     std::cout << "pic_parameter_set_id: " << bs.getUExpGolomb() << std::endl;
     std::cout << "seq_parameter_set_id: " << bs.getUExpGolomb() << std::endl;
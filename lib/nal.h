@@ -1,8 +1,14 @@
+#pragma once
 #include <string>
 #include <cstdio>
+#include <stddef.h>
 
 namespace h264 {
 
+  const char * findStartCode(const char * data, size_t len);
+  size_t avccToAnnexB(const char * data, size_t len, char * dest);
+  size_t annexBToAVCC(const char * data, size_t len, char * dest);
+
   ///Struct containing pre-calculated metadata of an SPS nal unit. Width and height in pixels, fps in Hz
   struct SPSMeta {
     unsigned int width;
@@ -11,10 +11,11 @@
 
 namespace OGG {
 
+  /// A packet waiting to be sent by Page::sendTo. Its data is kept in the payload of the page.
   class oggSegment {
     public:
       oggSegment();
-      std::string dataString;
+      unsigned int dataLen;///< Amount of data of this packet that has not been sent yet.
       int isKeyframe;
       long long unsigned int lastKeyFrameSeen;
       long long unsigned int framesSinceKeyFrame;
@@ -33,9 +34,15 @@ namespace OGG {
 
   std::deque<unsigned int> decodeXiphSize(char * data, size_t len);
 
+  /// Position of a single segment of a page in the payload of that page.
+  struct segmentView {
+    unsigned int offset;
+    unsigned int len;
+  };
 
-
-
+  /// A single OGG page: the header with segment table, and one payload buffer.
+  /// Read pages keep their segments as views into the payload.
+  /// Pages that are written gather the data of the queued packets (oggSegments) in the payload, in order.
   class Page {
     public:
       Page();
@@ -62,7 +69,7 @@ namespace OGG {
       char getPageSegments();//get the amount of page segments
       inline void setPageSegments(char newVal);//set the amount of page segments
       int getPayloadSize();
-      const std::deque<std::string> & getAllSegments();
+      unsigned int getSegmentCount();
 
       bool possiblyContinued();
 
@@ -77,6 +84,7 @@ namespace OGG {
       bool setPayload(char * newData, unsigned int length); //probably obsolete
       unsigned int addSegment(const std::string & content); //add a segment to the page, returns added bytes
       unsigned int addSegment(const char * content, unsigned int length); //add a segment to the page, returns added bytes
+      void queuePacket(oggSegment & newSegment, const char * content, unsigned int length);
       void sendTo(Socket::Connection & destination, int calcGranule = -2); //combines all data and sends it to socket
       unsigned int setNextSegmentTableEntry(unsigned int entrySize);//returns the size that could not be added to the table
       unsigned int overFlow();//returns the amount of bytes that don't fit in this page from the segments;
@@ -99,8 +107,10 @@ namespace OGG {
       std::deque<vorbis::mode> vorbisModes;//modes for vorbis
       unsigned int split;             //KFGShift for theora
     private:
+      bool readSegmentTable();
       char data[282];//Fulldata
-      std::deque<std::string> segments;
+      std::string payload;///< Segment data of a read page, or data of the queued packets of a page that is written.
+      std::vector<segmentView> segments;
 
 
   };
@@ -11,6 +11,9 @@
 #define FILLER_DATA "Lorem ipsum dolor sit amet, consectetur adipiscing elit. Praesent commodo vulputate urna eu commodo. Cras tempor velit nec nulla placerat volutpat. Proin eleifend blandit quam sit amet suscipit. Pellentesque vitae tristique lorem. Maecenas facilisis consequat neque, vitae iaculis eros vulputate ut. Suspendisse ut arcu non eros vestibulum pulvinar id sed erat. Nam dictum tellus vel tellus rhoncus ut mollis tellus fermentum. Fusce volutpat consectetur ante, in mollis nisi euismod vulputate. Curabitur vitae facilisis ligula. Sed sed gravida dolor. Integer eu eros a dolor lobortis ullamcorper. Mauris interdum elit non neque interdum dictum. Suspendisse imperdiet eros sed sapien cursus pulvinar. Vestibulum ut dolor lectus, id commodo elit. Cras convallis varius leo eu porta. Duis luctus sapien nec dui adipiscing quis interdum nunc congue. Morbi pharetra aliquet mauris vitae tristique. Etiam feugiat sapien quis augue elementum id ultricies magna vulputate. Phasellus luctus, leo id egestas consequat, eros tortor commodo neque, vitae hendrerit nunc sem ut odio."
 #endif
 
+/// Most bytes reserved up front for an incoming message. The length comes from the peer, larger messages simply grow the buffer.
+#define RTMP_RESERVE_MAX 64 * 1024
+
 std::string RTMPStream::handshake_in; ///< Input for the handshake.
 std::string RTMPStream::handshake_out; ///< Output for the handshake.
 
@@ -325,176 +328,188 @@ std::string & RTMPStream::SendUSR(unsigned char type, unsigned int data, unsigne
 } //SendUSR
 
 /// Parses the argument Socket::Buffer into the current chunk.
-/// Tries to read a whole chunk, removing data from the Buffer as it reads.
-/// If a single packet contains a partial chunk, it will remove the packet and
-/// call itself again. This has the effect of only causing a "true" reponse in
-/// the case a *whole* chunk is read, not just part of a chunk.
+/// Reads whole chunks, removing data from the Buffer as it reads, until a
+/// complete message has been reassembled. Headers are parsed in place and the
+/// payload of each chunk is appended to the message buffer kept for its chunk
+/// stream in lastrecv, which is reserved for the message length up front, up to RTMP_RESERVE_MAX bytes.
+/// A completed message is swapped into this chunk, so it is never copied.
 /// \param buffer The input to parse and update.
 /// \warning This function will destroy the current data in this chunk!
-/// \returns True if a whole chunk could be read, false otherwise.
+/// \returns True if a whole message could be read, false otherwise.
 bool RTMPStream::Chunk::Parse(Socket::Buffer & buffer) {
   gettimeofday(&RTMPStream::lastrec, 0);
-  unsigned int i = 0;
-  if (!buffer.available(3)) {
-    return false;
-  } //we want at least 3 bytes
-  std::string indata = buffer.copy(3);
-
-  unsigned char chunktype = indata[i++ ];
-  //read the chunkstream ID properly
-  switch (chunktype & 0x3F) {
-    case 0:
-      cs_id = indata[i++ ] + 64;
-      break;
-    case 1:
-      cs_id = indata[i++ ] + 64;
-      cs_id += indata[i++ ] * 256;
-      break;
-    default:
-      cs_id = chunktype & 0x3F;
-      break;
-  }
+  //basic header, message header and extended timestamp are at most 18 bytes together
+  unsigned char indata[18];
+  while (true) {
+    unsigned int have = buffer.bytes(18);
+    if (have < 3) {
+      return false;
+    } //we want at least 3 bytes
+    buffer.copy((char *)indata, have);
+    unsigned int i = 0;
+
+    unsigned char chunktype = indata[i++ ];
+    unsigned int new_cs_id;
+    //read the chunkstream ID properly
+    switch (chunktype & 0x3F) {
+      case 0:
+        new_cs_id = indata[i++ ] + 64;
+        break;
+      case 1:
+        new_cs_id = indata[i++ ] + 64;
+        new_cs_id += indata[i++ ] * 256;
+        break;
+      default:
+        new_cs_id = chunktype & 0x3F;
+        break;
+    }
 
-  bool allow_short = lastrecv.count(cs_id);
-  RTMPStream::Chunk prev = lastrecv[cs_id];
-
-  //process the rest of the header, for each chunk type
-  headertype = chunktype & 0xC0;
-  
-  DEBUG_MSG(DLVL_DONTEVEN, "Parsing RTMP chunk header (%#.2hhX) at offset %#X", chunktype, RTMPStream::rec_cnt);
-  
-  switch (headertype) {
-    case 0x00:
-      if (!buffer.available(i + 11)) {
-        return false;
-      } //can't read whole header
-      indata = buffer.copy(i + 11);
-      timestamp = indata[i++ ] * 256 * 256;
-      timestamp += indata[i++ ] * 256;
-      timestamp += indata[i++ ];
-      ts_delta = timestamp;
-      ts_header = timestamp;
-      len = indata[i++ ] * 256 * 256;
-      len += indata[i++ ] * 256;
-      len += indata[i++ ];
-      len_left = 0;
-      msg_type_id = indata[i++ ];
-      msg_stream_id = indata[i++ ];
-      msg_stream_id += indata[i++ ] * 256;
-      msg_stream_id += indata[i++ ] * 256 * 256;
-      msg_stream_id += indata[i++ ] * 256 * 256 * 256;
-      break;
-    case 0x40:
-      if (!buffer.available(i + 7)) {
-        return false;
-      } //can't read whole header
-      indata = buffer.copy(i + 7);
-      if (!allow_short) {
-        DEBUG_MSG(DLVL_WARN, "Warning: Header type 0x40 with no valid previous chunk!");
-      }
-      timestamp = indata[i++ ] * 256 * 256;
-      timestamp += indata[i++ ] * 256;
-      timestamp += indata[i++ ];
-      ts_header = timestamp;
-      if (timestamp != 0x00ffffff) {
-        ts_delta = timestamp;
-        timestamp = prev.timestamp + ts_delta;
-      }
-      len = indata[i++ ] * 256 * 256;
-      len += indata[i++ ] * 256;
-      len += indata[i++ ];
-      len_left = 0;
-      msg_type_id = indata[i++ ];
-      msg_stream_id = prev.msg_stream_id;
-      break;
-    case 0x80:
-      if (!buffer.available(i + 3)) {
+    bool allow_short = lastrecv.count(new_cs_id);
+    RTMPStream::Chunk & prev = lastrecv[new_cs_id];
+    unsigned char new_headertype = chunktype & 0xC0;
+    unsigned int new_timestamp = prev.timestamp;
+    unsigned int new_ts_delta = prev.ts_delta;
+    unsigned int new_ts_header = prev.ts_header;
+    unsigned int new_len = prev.len;
+    unsigned int new_len_left = prev.len_left;
+    unsigned char new_msg_type_id = prev.msg_type_id;
+    unsigned int new_msg_stream_id = prev.msg_stream_id;
+
+    DEBUG_MSG(DLVL_DONTEVEN, "Parsing RTMP chunk header (%#.2hhX) at offset %#X", chunktype, RTMPStream::rec_cnt);
+
+    //process the rest of the header, for each chunk type
+    switch (new_headertype) {
+      case 0x00:
+        if (have < i + 11) {
+          return false;
+        } //can't read whole header
+        new_timestamp = indata[i++ ] * 256 * 256;
+        new_timestamp += indata[i++ ] * 256;
+        new_timestamp += indata[i++ ];
+        new_ts_delta = new_timestamp;
+        new_ts_header = new_timestamp;
+        new_len = indata[i++ ] * 256 * 256;
+        new_len += indata[i++ ] * 256;
+        new_len += indata[i++ ];
+        new_len_left = 0;
+        new_msg_type_id = indata[i++ ];
+        new_msg_stream_id = indata[i++ ];
+        new_msg_stream_id += indata[i++ ] * 256;
+        new_msg_stream_id += indata[i++ ] * 256 * 256;
+        new_msg_stream_id += indata[i++ ] * 256 * 256 * 256;
+        break;
+      case 0x40:
+        if (have < i + 7) {
+          return false;
+        } //can't read whole header
+        if (!allow_short) {
+          DEBUG_MSG(DLVL_WARN, "Warning: Header type 0x40 with no valid previous chunk!");
+        }
+        new_timestamp = indata[i++ ] * 256 * 256;
+        new_timestamp += indata[i++ ] * 256;
+        new_timestamp += indata[i++ ];
+        new_ts_header = new_timestamp;
+        if (new_timestamp != 0x00ffffff) {
+          new_ts_delta = new_timestamp;
+          new_timestamp = prev.timestamp + new_ts_delta;
+        }
+        new_len = indata[i++ ] * 256 * 256;
+        new_len += indata[i++ ] * 256;
+        new_len += indata[i++ ];
+        new_len_left = 0;
+        new_msg_type_id = indata[i++ ];
+        break;
+      case 0x80:
+        if (have < i + 3) {
+          return false;
+        } //can't read whole header
+        if (!allow_short) {
+          DEBUG_MSG(DLVL_WARN, "Warning: Header type 0x80 with no valid previous chunk!");
+        }
+        new_timestamp = indata[i++ ] * 256 * 256;
+        new_timestamp += indata[i++ ] * 256;
+        new_timestamp += indata[i++ ];
+        new_ts_header = new_timestamp;
+        if (new_timestamp != 0x00ffffff) {
+          new_ts_delta = new_timestamp;
+          new_timestamp = prev.timestamp + new_ts_delta;
+        }
+        break;
+      case 0xC0:
+        if (!allow_short) {
+          DEBUG_MSG(DLVL_WARN, "Warning: Header type 0xC0 with no valid previous chunk!");
+        }
+        if (!prev.len_left) {
+          new_timestamp = prev.timestamp + prev.ts_delta;
+        }
+        break;
+    }
+    //calculate chunk length, real length, and length left till complete
+    bool continued = (new_len_left > 0);
+    unsigned int new_real_len;
+    if (continued) {
+      new_real_len = new_len_left;
+      new_len_left = 0;
+    } else {
+      new_real_len = new_len;
+    }
+    if (new_real_len > RTMPStream::chunk_rec_max) {
+      new_len_left += new_real_len - RTMPStream::chunk_rec_max;
+      new_real_len = RTMPStream::chunk_rec_max;
+    }
+
+    DEBUG_MSG(DLVL_DONTEVEN, "Parsing RTMP chunk result: len_left=%d, real_len=%d", new_len_left, new_real_len);
+
+    //read extended timestamp, if neccesary
+    if (new_ts_header == 0x00ffffff) {
+      if (have < i + 4) {
         return false;
-      } //can't read whole header
-      indata = buffer.copy(i + 3);
-      if (!allow_short) {
-        DEBUG_MSG(DLVL_WARN, "Warning: Header type 0x80 with no valid previous chunk!");
-      }
-      timestamp = indata[i++ ] * 256 * 256;
-      timestamp += indata[i++ ] * 256;
-      timestamp += indata[i++ ];
-      ts_header = timestamp;
-      if (timestamp != 0x00ffffff) {
-        ts_delta = timestamp;
-        timestamp = prev.timestamp + ts_delta;
-      }
-      len = prev.len;
-      len_left = prev.len_left;
-      msg_type_id = prev.msg_type_id;
-      msg_stream_id = prev.msg_stream_id;
-      break;
-    case 0xC0:
-      if (!allow_short) {
-        DEBUG_MSG(DLVL_WARN, "Warning: Header type 0xC0 with no valid previous chunk!");
-      }
-      timestamp = prev.timestamp + prev.ts_delta;
-      ts_header = prev.ts_header;
-      ts_delta = prev.ts_delta;
-      len = prev.len;
-      len_left = prev.len_left;
-      if (len_left > 0){
-        timestamp = prev.timestamp;
-      }
-      msg_type_id = prev.msg_type_id;
-      msg_stream_id = prev.msg_stream_id;
-      break;
-  }
-  //calculate chunk length, real length, and length left till complete
-  if (len_left > 0) {
-    real_len = len_left;
-    len_left -= real_len;
-  } else {
-    real_len = len;
-  }
-  if (real_len > RTMPStream::chunk_rec_max) {
-    len_left += real_len - RTMPStream::chunk_rec_max;
-    real_len = RTMPStream::chunk_rec_max;
-  }
-  
-  DEBUG_MSG(DLVL_DONTEVEN, "Parsing RTMP chunk result: len_left=%d, real_len=%d", len_left, real_len);
-  
-  //read extended timestamp, if neccesary
-  if (ts_header == 0x00ffffff) {
-    if (!buffer.available(i + 4)) {
-      return false;
-    } //can't read timestamp
-    indata = buffer.copy(i + 4);
-    timestamp = indata[i++ ] * 256 * 256 * 256;
-    timestamp += indata[i++ ] * 256 * 256;
-    timestamp += indata[i++ ] * 256;
-    timestamp += indata[i++ ];
-    ts_delta = timestamp;
-  }
+      } //can't read timestamp
+      new_timestamp = indata[i++ ] * 256 * 256 * 256;
+      new_timestamp += indata[i++ ] * 256 * 256;
+      new_timestamp += indata[i++ ] * 256;
+      new_timestamp += indata[i++ ];
+      new_ts_delta = new_timestamp;
+    }
 
-  //read data if length > 0, and allocate it
-  if (real_len > 0) {
-    if (!buffer.available(i + real_len)) {
+    if (!buffer.available(i + new_real_len)) {
       return false;
     } //can't read all data (yet)
-    buffer.remove(i); //remove the header
-    if (prev.len_left > 0) {
-      data = prev.data + buffer.remove(real_len); //append the data and remove from buffer
-    } else {
-      data = buffer.remove(real_len); //append the data and remove from buffer
+
+    //the whole chunk is available, commit the header to the chunk stream state
+    prev.headertype = new_headertype;
+    prev.cs_id = new_cs_id;
+    prev.timestamp = new_timestamp;
+    prev.ts_delta = new_ts_delta;
+    prev.ts_header = new_ts_header;
+    prev.len = new_len;
+    prev.real_len = new_real_len;
+    prev.len_left = new_len_left;
+    prev.msg_type_id = new_msg_type_id;
+    prev.msg_stream_id = new_msg_stream_id;
+    buffer.skip(i); //remove the header
+    if (!continued) {
+      prev.data.clear();
+      prev.data.reserve(std::min(new_len, (unsigned int)(RTMP_RESERVE_MAX)));
     }
-    lastrecv[cs_id] = *this;
-    RTMPStream::rec_cnt += i + real_len;
-    if (len_left == 0) {
-      return true;
-    } else {
-      return Parse(buffer);
+    buffer.remove(prev.data, new_real_len);
+    RTMPStream::rec_cnt += i + new_real_len;
+    if (new_len_left) {
+      continue;
     }
-  } else {
-    buffer.remove(i); //remove the header
-    data = "";
-    indata = indata.substr(i + real_len);
-    lastrecv[cs_id] = *this;
-    RTMPStream::rec_cnt += i + real_len;
+    headertype = prev.headertype;
+    cs_id = prev.cs_id;
+    timestamp = prev.timestamp;
+    ts_delta = prev.ts_delta;
+    ts_header = prev.ts_header;
+    len = prev.len;
+    real_len = prev.real_len;
+    len_left = 0;
+    msg_type_id = prev.msg_type_id;
+    msg_stream_id = prev.msg_stream_id;
+    //hand over the message, the chunk stream keeps our old buffer to reuse its allocation
+    data.swap(prev.data);
+    prev.data.clear();
     return true;
   }
 } //Parse
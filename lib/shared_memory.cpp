@@ -7,12 +7,38 @@
 #include <cstdlib>
 #include <cstdio>
 #include <unistd.h>
+#include <signal.h>
 #include <iostream>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#endif
 #include "defines.h"
 #include "shared_memory.h"
 #include "stream.h"
 #include "procs.h"
 
+#if defined(__linux__) && defined(SYS_pidfd_open)
+#define SLOT_PIDFD 1
+#endif
+
+/// The size of the per-slot header when a counter is used: 4 byte generation, 4 byte pid, 1 byte state.
+#define SLOT_HEADER 9
+/// Offsets of the fields in the per-slot header.
+#define SLOT_GEN 0
+#define SLOT_PID 4
+#define SLOT_STATE 8
+
+/// The layout of a sharedSnapshot page: 8 byte current generation, 4 byte closed flag,
+/// an 8 byte generation per buffer, then the leases of 4 byte pid, 4 bytes padding and 8 byte generation each.
+#define SNAPSHOT_BUFFERS 4
+#define SNAPSHOT_CLOSED 8
+#define SNAPSHOT_BUFGEN 16
+#define SNAPSHOT_HEADER (SNAPSHOT_BUFGEN + 8 * SNAPSHOT_BUFFERS)
+#define SNAPSHOT_LEASES 1024
+#define SNAPSHOT_LEASE_SIZE 16
+#define SNAPSHOT_DATA (SNAPSHOT_HEADER + SNAPSHOT_LEASES * SNAPSHOT_LEASE_SIZE)
+
 namespace IPC {
 
 #if defined(__CYGWIN__) || defined(_WIN32)
@@ -54,22 +80,33 @@ namespace IPC {
 
   /// Reads a long value of p in host order to val.
   static void btohl(char * p, long & val) {
-    val = ((long)p[0] << 24) | ((long)p[1] << 16) | ((long)p[2] << 8) | p[3];
+    unsigned char * u = (unsigned char *)p;
+    val = ((long)u[0] << 24) | ((long)u[1] << 16) | ((long)u[2] << 8) | u[3];
   }
 
   /// Reads a short value of p in host order to val.
   static void btohs(char * p, unsigned short & val) {
-    val = ((short)p[0] << 8) | p[1];
+    unsigned char * u = (unsigned char *)p;
+    val = ((short)u[0] << 8) | u[1];
   }
 
   /// Reads a long value of p in host order to val.
   static void btohl(char * p, unsigned int & val) {
-    val = ((long)p[0] << 24) | ((long)p[1] << 16) | ((long)p[2] << 8) | p[3];
+    unsigned char * u = (unsigned char *)p;
+    val = ((long)u[0] << 24) | ((long)u[1] << 16) | ((long)u[2] << 8) | u[3];
   }
   
   /// Reads a long long value of p in host order to val.
   static void btohll(char * p, long long & val) {
-    val = ((long long)p[0] << 56) | ((long long)p[1] << 48) | ((long long)p[2] << 40) | ((long long)p[3] << 32) | ((long long)p[4] << 24) | ((long long)p[5] << 16) | ((long long)p[6] << 8) | p[7];
+    unsigned char * u = (unsigned char *)p;
+    val = ((long long)u[0] << 56) | ((long long)u[1] << 48) | ((long long)u[2] << 40) | ((long long)u[3] << 32) | ((long long)u[4] << 24) | ((long long)u[5] << 16) | ((long long)u[6] << 8) | u[7];
+  }
+
+  /// Reads an unsigned long long value of p in host order to val.
+  static void btohll(char * p, unsigned long long & val) {
+    long long tmp;
+    btohll(p, tmp);
+    val = tmp;
   }
 
   ///\brief Empty semaphore constructor, clears all values
@@ -602,13 +639,101 @@ namespace IPC {
 
   ///\brief Sets checksum field
   void statExchange::crc(unsigned int sum) {
-    htobl(data + 186, sum);
+    htobl(data + 168, sum);
   }
 
   ///\brief Gets checksum field
   unsigned int statExchange::crc() {
     unsigned int result;
-    btohl(data + 186, result);
+    btohl(data + 168, result);
+    return result;
+  }
+
+  ///\brief Sets the amount of playback stalls
+  void statExchange::rebuffers(unsigned int count) {
+    htobl(data + 172, count);
+  }
+
+  ///\brief Gets the amount of playback stalls
+  unsigned int statExchange::rebuffers() {
+    unsigned int result;
+    btohl(data + 172, result);
+    return result;
+  }
+
+  ///\brief Sets the distance to the live edge in milliseconds
+  void statExchange::liveLag(unsigned int ms) {
+    htobl(data + 176, ms);
+  }
+
+  ///\brief Gets the distance to the live edge in milliseconds
+  unsigned int statExchange::liveLag() {
+    unsigned int result;
+    btohl(data + 176, result);
+    return result;
+  }
+
+  ///\brief Sets the histogram of data page wait times
+  void statExchange::pageWait(const Util::durationHist & hist) {
+    setHist(180, hist);
+  }
+
+  ///\brief Gets the histogram of data page wait times
+  Util::durationHist statExchange::pageWait() {
+    return getHist(180);
+  }
+
+  ///\brief Sets the histogram of blocking send times
+  void statExchange::sendBlock(const Util::durationHist & hist) {
+    setHist(220, hist);
+  }
+
+  ///\brief Gets the histogram of blocking send times
+  Util::durationHist statExchange::sendBlock() {
+    return getHist(220);
+  }
+
+  ///\brief Sets the amount of idle pooled workers
+  void statExchange::poolIdle(unsigned int count) {
+    htobl(data + 260, count);
+  }
+
+  ///\brief Gets the amount of idle pooled workers
+  unsigned int statExchange::poolIdle() {
+    unsigned int result;
+    btohl(data + 260, result);
+    return result;
+  }
+
+  ///\brief Sets the amount of workers spawned by the pool
+  void statExchange::poolSpawned(unsigned int count) {
+    htobl(data + 264, count);
+  }
+
+  ///\brief Gets the amount of workers spawned by the pool
+  unsigned int statExchange::poolSpawned() {
+    unsigned int result;
+    btohl(data + 264, result);
+    return result;
+  }
+
+  ///\brief Writes a histogram at the given offset, truncating the bucket counters to 32 bits
+  void statExchange::setHist(unsigned int offset, const Util::durationHist & hist) {
+    for (unsigned int i = 0; i < DURATION_BUCKETS; ++i) {
+      htobl(data + offset + 4 * i, (unsigned int)hist.count[i]);
+    }
+    htobll(data + offset + 4 * DURATION_BUCKETS, hist.sum);
+  }
+
+  ///\brief Reads a histogram from the given offset
+  Util::durationHist statExchange::getHist(unsigned int offset) {
+    Util::durationHist result;
+    for (unsigned int i = 0; i < DURATION_BUCKETS; ++i) {
+      unsigned int tmp;
+      btohl(data + offset + 4 * i, tmp);
+      result.count[i] = tmp;
+    }
+    btohll(data + offset + 4 * DURATION_BUCKETS, result.sum);
     return result;
   }
 
@@ -622,11 +747,267 @@ namespace IPC {
     mySemaphore->post();
   }
 
+  ///\brief Creates an empty, unmapped snapshot page
+  sharedSnapshot::sharedSnapshot() {
+    bufSize = 0;
+  }
+
+  ///\brief Maps the snapshot page with the given name, creating it if master is set
+  sharedSnapshot::sharedSnapshot(std::string name, unsigned int len, bool master) {
+    bufSize = 0;
+    init(name, len, master);
+  }
+
+  ///\brief Marks the page as closed before the writer removes it, so readers know to map its successor
+  sharedSnapshot::~sharedSnapshot() {
+    if (page.mapped && page.master) {
+      *(volatile unsigned int *)(page.mapped + SNAPSHOT_CLOSED) = 1;
+    }
+  }
+
+  ///\brief Maps the snapshot page with the given name, creating it if master is set
+  ///\param name The name of the page
+  ///\param len The size of the whole page; each snapshot can use a little under a quarter of this
+  ///\param master Whether this is the writer, which creates the page and removes it when done
+  void sharedSnapshot::init(std::string name, unsigned int len, bool master) {
+    page.init(name, len, master, false);
+    bufSize = 0;
+    if (page.mapped && page.len > SNAPSHOT_DATA) {
+      bufSize = ((page.len - SNAPSHOT_DATA) / SNAPSHOT_BUFFERS) & ~7;
+    }
+  }
+
+  ///\brief Returns true if the page is mapped
+  sharedSnapshot::operator bool() const {
+    return page.mapped && bufSize;
+  }
+
+  ///\brief Returns true if the writer removed this page; a new writer publishes to a new page with the same name
+  bool sharedSnapshot::closed() {
+    return page.mapped && *(volatile unsigned int *)(page.mapped + SNAPSHOT_CLOSED);
+  }
+
+  volatile unsigned long long * sharedSnapshot::current() {
+    return (volatile unsigned long long *)page.mapped;
+  }
+
+  ///\brief Returns the generation held by buffer buf, zero while it is empty or being written
+  volatile unsigned long long * sharedSnapshot::bufGen(unsigned int buf) {
+    return (volatile unsigned long long *)(page.mapped + SNAPSHOT_BUFGEN) + buf;
+  }
+
+  char * sharedSnapshot::buffer(unsigned int buf) {
+    return page.mapped + SNAPSHOT_DATA + buf * bufSize;
+  }
+
+  ///\brief Returns the buffer holding generation gen, or -1 if it is no longer held by any
+  int sharedSnapshot::findBuffer(unsigned long long gen) {
+    for (unsigned int i = 0; i < SNAPSHOT_BUFFERS; ++i) {
+      if (*bufGen(i) == gen) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  ///\brief Returns true if a live process holds a lease on generation gen.
+  ///Leases of processes that no longer exist are reclaimed on the way.
+  bool sharedSnapshot::leased(unsigned long long gen) {
+    for (unsigned int i = 0; i < SNAPSHOT_LEASES; ++i) {
+      char * l = page.mapped + SNAPSHOT_HEADER + i * SNAPSHOT_LEASE_SIZE;
+      volatile unsigned int * pid = (volatile unsigned int *)l;
+      volatile unsigned long long * leaseGen = (volatile unsigned long long *)(l + 8);
+      if (!*pid || *leaseGen != gen) {
+        continue;
+      }
+      unsigned int owner = *pid;
+      if (kill(owner, 0) == -1 && errno == ESRCH) {
+        *leaseGen = 0;
+        __sync_bool_compare_and_swap(pid, owner, 0);
+        continue;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  ///\brief Publishes a new generation into a buffer that no reader holds. Only a single process may publish to a page.
+  ///Never waits for readers.
+  ///\returns False if the data does not fit or every other buffer is leased, in which case the current generation stays.
+  bool sharedSnapshot::publish(const char * data, unsigned int dataLen) {
+    if (!*this || dataLen + 4 > bufSize) {
+      return false;
+    }
+    unsigned long long cur = *current();
+    unsigned long long newest = cur;
+    for (unsigned int i = 0; i < SNAPSHOT_BUFFERS; ++i) {
+      newest = std::max(newest, (unsigned long long)*bufGen(i));
+    }
+    //try the oldest buffers first, they are the least likely to be leased
+    bool tried[SNAPSHOT_BUFFERS] = {false};
+    for (unsigned int attempt = 0; attempt < SNAPSHOT_BUFFERS; ++attempt) {
+      int buf = -1;
+      for (unsigned int i = 0; i < SNAPSHOT_BUFFERS; ++i) {
+        if (!tried[i] && (buf == -1 || *bufGen(i) < *bufGen(buf))) {
+          buf = i;
+        }
+      }
+      tried[buf] = true;
+      unsigned long long old = *bufGen(buf);
+      if (old && old == cur) {
+        continue;
+      }
+      //claim the buffer first: a reader that leases old after this sees it is gone, one that leased it before is seen here
+      *bufGen(buf) = 0;
+      __sync_synchronize();
+      if (old && leased(old)) {
+        *bufGen(buf) = old;
+        continue;
+      }
+      char * b = buffer(buf);
+      memcpy(b + 4, data, dataLen);
+      htobl(b, dataLen);
+      __sync_synchronize();
+      *bufGen(buf) = newest + 1;
+      __sync_synchronize();
+      *current() = newest + 1;
+      return true;
+    }
+    return false;
+  }
+
+  ///\brief Returns the newest complete generation, or zero if nothing was published yet
+  unsigned long long sharedSnapshot::generation() {
+    if (!*this) {
+      return 0;
+    }
+    unsigned long long gen = *current();
+    __sync_synchronize();
+    return gen;
+  }
+
+  ///\brief Returns a pointer to the data of generation gen and sets dataLen to its size, or 0 if gen is gone
+  ///Check stillValid after reading, the writer may reuse the buffer as soon as gen is no longer current.
+  const char * sharedSnapshot::snapshot(unsigned long long gen, unsigned int & dataLen) {
+    dataLen = 0;
+    if (!*this || !gen) {
+      return 0;
+    }
+    int buf = findBuffer(gen);
+    if (buf < 0) {
+      return 0;
+    }
+    __sync_synchronize();
+    char * b = buffer(buf);
+    unsigned int tmp;
+    btohl(b, tmp);
+    dataLen = std::min(tmp, bufSize - 4);
+    return b + 4;
+  }
+
+  ///\brief Returns true if everything read from generation gen so far was not changed by the writer
+  bool sharedSnapshot::stillValid(unsigned long long gen) {
+    if (!*this) {
+      return false;
+    }
+    __sync_synchronize();
+    return findBuffer(gen) >= 0;
+  }
+
+  ///\brief Leases the newest complete generation, which stays unchanged until it is unpinned
+  ///\param gen Set to the leased generation
+  ///\param dataLen Set to the size of its data
+  ///\param lease Set to the lease to pass to unpin
+  ///\returns A pointer to the data, or 0 if nothing was published yet or all leases are taken
+  const char * sharedSnapshot::pin(unsigned long long & gen, unsigned int & dataLen, unsigned int & lease) {
+    gen = 0;
+    dataLen = 0;
+    lease = SNAPSHOT_LEASES;
+    if (!*this || !generation()) {
+      return 0;
+    }
+    unsigned int me = getpid();
+    for (unsigned int i = 0; i < SNAPSHOT_LEASES; ++i) {
+      unsigned int slot = (me + i) % SNAPSHOT_LEASES;
+      if (__sync_bool_compare_and_swap((volatile unsigned int *)(page.mapped + SNAPSHOT_HEADER + slot * SNAPSHOT_LEASE_SIZE), 0, me)) {
+        lease = slot;
+        break;
+      }
+    }
+    if (lease == SNAPSHOT_LEASES) {
+      return 0;
+    }
+    volatile unsigned long long * leaseGen = (volatile unsigned long long *)(page.mapped + SNAPSHOT_HEADER + lease * SNAPSHOT_LEASE_SIZE + 8);
+    while (true) {
+      gen = generation();
+      *leaseGen = gen;
+      //the writer claims a buffer before checking leases, so after this barrier either it sees us or we see the claim
+      __sync_synchronize();
+      const char * ret = snapshot(gen, dataLen);
+      if (ret) {
+        return ret;
+      }
+    }
+  }
+
+  ///\brief Releases a lease returned by pin
+  void sharedSnapshot::unpin(unsigned int lease) {
+    if (!*this || lease >= SNAPSHOT_LEASES) {
+      return;
+    }
+    char * l = page.mapped + SNAPSHOT_HEADER + lease * SNAPSHOT_LEASE_SIZE;
+    if (*(volatile unsigned int *)l != (unsigned int)getpid()) {
+      return;
+    }
+    *(volatile unsigned long long *)(l + 8) = 0;
+    __sync_synchronize();
+    __sync_bool_compare_and_swap((volatile unsigned int *)l, (unsigned int)getpid(), 0);
+  }
+
+  /// Returns the size of a single slot, rounded up so the header of each slot is 8-byte aligned.
+  static unsigned int slotStride(unsigned int payLen, bool hasCounter) {
+    return ((hasCounter ? SLOT_HEADER : 0) + payLen + 7) & ~7;
+  }
+
+  /// Calculates how many slots fit on a page of the given length, storing the size of the occupancy bitmap in bitmapLen.
+  static unsigned int slotsOnPage(long long pageLen, unsigned int stride, unsigned int & bitmapLen) {
+    if (pageLen <= 8 || !stride) {
+      bitmapLen = 0;
+      return 0;
+    }
+    unsigned int slots = (pageLen * 8) / (stride * 8 + 1);
+    bitmapLen = ((slots + 63) / 64) * 8;
+    while (slots && bitmapLen + slots * stride > pageLen) {
+      --slots;
+      bitmapLen = ((slots + 63) / 64) * 8;
+    }
+    return slots;
+  }
+
+  /// Returns the value an unused bitmap word has: bits past the last slot on a page are always set.
+  static unsigned long long emptyWord(unsigned int word, unsigned int slots) {
+    if (word == slots / 64 && (slots % 64)) {
+      return ~0ull << (slots % 64);
+    }
+    return 0;
+  }
+
+  /// Opens a pidfd for the given pid, or returns -1 if this is not supported.
+  static int openPidFd(unsigned int pid) {
+#ifdef SLOT_PIDFD
+    return syscall(SYS_pidfd_open, (pid_t)pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
   ///\brief Default constructor, erases all the values
   sharedServer::sharedServer() {
     payLen = 0;
     hasCounter = false;
     amount = 0;
+    pollFd = -1;
   }
 
   ///\brief Desired constructor, initializes after cleaning.
@@ -634,7 +1015,10 @@ namespace IPC {
   ///\param len The lenght of the payload
   ///\param withCounter Whether the content should have a counter
   sharedServer::sharedServer(std::string name, int len, bool withCounter) {
-    sharedServer();
+    payLen = 0;
+    hasCounter = false;
+    amount = 0;
+    pollFd = -1;
     init(name, len, withCounter);
   }
 
@@ -644,32 +1028,34 @@ namespace IPC {
   ///\param withCounter Whether the content should have a counter
   void sharedServer::init(std::string name, int len, bool withCounter) {
     amount = 0;
-    if (mySemaphore) {
-      mySemaphore.close();
-    }
-    if (baseName != "") {
-      mySemaphore.unlink();
-    }
     myPages.clear();
+    for (unsigned int i = 0; i < trackers.size(); ++i) {
+      releaseSlot(i);
+    }
+    trackers.clear();
     baseName = "/" + name;
     payLen = len;
     hasCounter = withCounter;
-    mySemaphore.open(baseName.c_str(), O_CREAT | O_EXCL | O_RDWR, ACCESSPERMS, 1);
-    if (!mySemaphore) {
-      mySemaphore.open(baseName.c_str(), O_CREAT | O_RDWR, ACCESSPERMS, 1);
-    }
-    if (!mySemaphore) {
-      DEBUG_MSG(DLVL_FAIL, "Creating semaphore failed: %s", strerror(errno));
-      return;
+#ifdef SLOT_PIDFD
+    if (hasCounter && pollFd == -1) {
+      pollFd = epoll_create1(EPOLL_CLOEXEC);
+      if (pollFd == -1) {
+        DEBUG_MSG(DLVL_HIGH, "Could not create epoll handle, falling back to signal-based liveness checks: %s", strerror(errno));
+      }
     }
-    semGuard tmpGuard(&mySemaphore);
+#endif
     newPage();
   }
 
   ///\brief The deconstructor
   sharedServer::~sharedServer() {
-    mySemaphore.close();
-    mySemaphore.unlink();
+    for (unsigned int i = 0; i < trackers.size(); ++i) {
+      releaseSlot(i);
+    }
+    if (pollFd != -1) {
+      ::close(pollFd);
+      pollFd = -1;
+    }
   }
 
   ///\brief Determines whether a sharedServer is valid
@@ -680,173 +1066,255 @@ namespace IPC {
   ///\brief Creates the next page with the correct size
   void sharedServer::newPage() {
     sharedPage tmp(std::string(baseName.substr(1) + (char)(myPages.size() + (int)'A')), std::min(((8192 * 2)<< myPages.size()),  (32 * 1024 * 1024)), true);
+    if (tmp.mapped) {
+      //mark the bits past the last slot as permanently occupied
+      //clients may already have claimed slots in this word, so only ever add bits to it
+      unsigned int bitmapLen;
+      unsigned int slots = slotsOnPage(tmp.len, slotStride(payLen, hasCounter), bitmapLen);
+      if (slots % 64) {
+        __sync_fetch_and_or(((unsigned long long *)tmp.mapped) + slots / 64, emptyWord(slots / 64, slots));
+      }
+    }
     myPages.insert(tmp);
     tmp.master = false;
     DEBUG_MSG(DLVL_VERYHIGH, "Created a new page: %s", tmp.name.c_str());
   }
 
-  ///\brief Deletes the highest allocated page
-  void sharedServer::deletePage() {
+  ///\brief Deletes the highest allocated page, if none of its slots are claimed.
+  ///
+  ///The whole bitmap is claimed by the server first, so no client can join the page while it is being removed.
+  ///\return True if the page was deleted, false if it was in use.
+  bool sharedServer::deletePage() {
     if (myPages.size() == 1) {
       DEBUG_MSG(DLVL_WARN, "Can't remove last page for %s", baseName.c_str());
-      return;
+      return false;
+    }
+    const sharedPage & lastPage = *myPages.rbegin();
+    if (lastPage.mapped) {
+      unsigned int bitmapLen;
+      unsigned int slots = slotsOnPage(lastPage.len, slotStride(payLen, hasCounter), bitmapLen);
+      unsigned long long * bitmap = (unsigned long long *)lastPage.mapped;
+      for (unsigned int w = 0; w < bitmapLen / 8; ++w) {
+        if (!__sync_bool_compare_and_swap(bitmap + w, emptyWord(w, slots), ~0ull)) {
+          //a client joined in the meantime, give back what we claimed
+          while (w) {
+            --w;
+            bitmap[w] = emptyWord(w, slots);
+          }
+          __sync_synchronize();
+          return false;
+        }
+      }
     }
     myPages.erase((*myPages.rbegin()));
+    return true;
   }
 
   ///\brief Determines whether an id is currently in use or not
   bool sharedServer::isInUse(unsigned int id) {
+    unsigned int stride = slotStride(payLen, hasCounter);
     unsigned int i = 0;
     for (std::set<sharedPage>::iterator it = myPages.begin(); it != myPages.end(); it++) {
       //return if we reached the end
       if (!it->mapped || !it->len) {
         return false;
       }
+      unsigned int bitmapLen;
+      unsigned int slots = slotsOnPage(it->len, stride, bitmapLen);
       //not on this page? skip to next.
-      if (it->len < (id - i)*payLen) {
-        i += it->len / payLen;
+      if (id - i >= slots) {
+        i += slots;
         continue;
       }
-      if (hasCounter) {
-        //counter? return true if it is non-zero.
-        return (it->mapped[(id - i) * payLen] != 0);
-      } else {
-        //no counter - check the entire size for being all zeroes.
-        for (unsigned int j = 0; j < payLen; ++j) {
-          if (it->mapped[(id - i)*payLen + j]) {
-            return true;
-          }
-        }
-        return false;
-      }
+      return (((unsigned long long *)it->mapped)[(id - i) / 64] >> ((id - i) % 64)) & 1;
     }
     //only happens if we run out of pages
     return false;
   }
 
+  ///\brief Starts tracking a new occupant of the given slot, opening a pidfd for it if possible.
+  void sharedServer::trackSlot(unsigned int id, unsigned int pid) {
+    if (trackers.size() <= id) {
+      trackers.resize(id + 1);
+    }
+    releaseSlot(id);
+    slotTracker & trk = trackers[id];
+    trk.pid = pid;
+    if (pollFd == -1 || !pid) {
+      return;
+    }
+    trk.liveFd = openPidFd(pid);
+    if (trk.liveFd == -1) {
+      //no such process means it is gone already; anything else means we fall back to signals
+      trk.dead = (errno == ESRCH);
+      return;
+    }
+#ifdef SLOT_PIDFD
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(pollFd, EPOLL_CTL_ADD, trk.liveFd, &ev) == -1) {
+      ::close(trk.liveFd);
+      trk.liveFd = -1;
+    }
+#endif
+  }
+
+  ///\brief Stops tracking the occupant of the given slot.
+  void sharedServer::releaseSlot(unsigned int id) {
+    if (id >= trackers.size()) {
+      return;
+    }
+    slotTracker & trk = trackers[id];
+    if (trk.liveFd != -1) {
+      ::close(trk.liveFd);
+    }
+    trk = slotTracker();
+  }
+
+  ///\brief Marks all slots whose occupant has exited as dead, using a single epoll call on all pidfds.
+  void sharedServer::checkLiveness() {
+#ifdef SLOT_PIDFD
+    if (pollFd == -1) {
+      return;
+    }
+    struct epoll_event events[64];
+    int n = 64;
+    while (n == 64) {
+      n = epoll_wait(pollFd, events, 64, 0);
+      for (int i = 0; i < n; ++i) {
+        unsigned int id = events[i].data.u64;
+        if (id < trackers.size() && trackers[id].liveFd != -1) {
+          trackers[id].dead = true;
+          //exited processes stay readable, stop listening to prevent a busy loop
+          epoll_ctl(pollFd, EPOLL_CTL_DEL, trackers[id].liveFd, 0);
+        }
+      }
+    }
+#endif
+  }
+
   ///\brief Parse each of the possible payload pieces, and runs a callback on it if in use.
+  ///
+  ///Only claimed slots are visited, by walking the set bits in the occupancy bitmap of each page.
   void sharedServer::parseEach(void (*callback)(char * data, size_t len, unsigned int id)) {
-    char * empty = 0;
-    if (!hasCounter) {
-      empty = (char *)malloc(payLen * sizeof(char));
-      memset(empty, 0, payLen);
+    if (hasCounter) {
+      checkLiveness();
     }
-    semGuard tmpGuard(&mySemaphore);
+    unsigned int stride = slotStride(payLen, hasCounter);
     unsigned int id = 0;
-    unsigned int userCount=0;
+    unsigned int userCount = 0;
     unsigned int emptyCount = 0;
+    unsigned int newAmount = 0;
     for (std::set<sharedPage>::iterator it = myPages.begin(); it != myPages.end(); it++) {
       if (!it->mapped || !it->len) {
         DEBUG_MSG(DLVL_FAIL, "Something went terribly wrong?");
         break;
       }
       userCount = 0;
-      unsigned int offset = 0;
-      while (offset + payLen + (hasCounter ? 1 : 0) <= it->len) {
-        if (hasCounter) {
-          if (it->mapped[offset] != 0) {
-            char * counter = it->mapped+offset;
-            //increase the count if needed
-            ++userCount;
-            if (id >= amount) {
-              amount = id + 1;
-              DEBUG_MSG(DLVL_VERYHIGH, "Shared memory %s is now at count %u", baseName.c_str(), amount);
-            }            
-            unsigned short tmpPID = *((unsigned short *)(it->mapped+1+offset+payLen-2));            
-            if(!Util::Procs::isRunning(tmpPID) && !(*counter == 126 || *counter == 127 || *counter == 254 || *counter == 255)){
-              WARN_MSG("process disappeared, timing out. (pid %d)", tmpPID);    
-              *counter = 126; //if process is already dead, instant timeout.
-            }
-            callback(it->mapped + offset + 1, payLen, id);
-            switch (*counter) {
-              case 127:
-                DEBUG_MSG(DLVL_HIGH, "Client %u requested disconnect", id);
-                break;
-              case 126:
-                DEBUG_MSG(DLVL_WARN, "Client %u timed out", id);
-                break;
-              case 255:
-                DEBUG_MSG(DLVL_HIGH, "Client %u disconnected on request", id);
-                break;
-              case 254:
-                DEBUG_MSG(DLVL_WARN, "Client %u disconnect timed out", id);
-                break;
-              default:
-                if(*counter > 10 && *counter < 126 ){
-                  if(*counter < 30){
-                    if (*counter > 15){
-                      WARN_MSG("Process %d is unresponsive",tmpPID);
-                    }
-                    Util::Procs::Stop(tmpPID); //soft kill  
-                  } else {      
-                    ERROR_MSG("Killing unresponsive process %d", tmpPID);
-                    Util::Procs::Murder(tmpPID); //improved kill      
-                  }
-                }
-                break;
-            }
-            if (*counter == 127 || *counter == 126 || *counter == 255 || *counter == 254) {
-              memset(it->mapped + offset + 1, 0, payLen);
-              it->mapped[offset] = 0;
-            } else {
-              it->mapped[offset] ++;
+      unsigned int bitmapLen;
+      unsigned int slots = slotsOnPage(it->len, stride, bitmapLen);
+      unsigned long long * bitmap = (unsigned long long *)it->mapped;
+      for (unsigned int w = 0; w < bitmapLen / 8; ++w) {
+        unsigned long long bits = bitmap[w] & ~emptyWord(w, slots);
+        while (bits) {
+          unsigned int slotNo = w * 64 + __builtin_ctzll(bits);
+          bits &= bits - 1;
+          unsigned int slotId = id + slotNo;
+          char * slot = it->mapped + bitmapLen + slotNo * stride;
+          ++userCount;
+          if (slotId >= newAmount) {
+            newAmount = slotId + 1;
+          }
+          if (!hasCounter) {
+            //slots without a counter are released by the client itself, see sharedClient::finish
+            bool used = false;
+            for (unsigned int j = 0; j < payLen && !used; ++j) {
+              used = slot[j];
             }
-          } else {
-            //stop if we're past the amount counted and we're empty
-            if (id >= amount - 1) {
-              //bring the counter down if this was the last element
-              if (id == amount - 1) {
-                amount = id;
-                DEBUG_MSG(DLVL_VERYHIGH, "Shared memory %s is now at count %u", baseName.c_str(), amount);
-              }
-              //stop, we're guaranteed no more pages are full at this point
-              break;
+            if (used) {
+              callback(slot, payLen, slotId);
             }
+            continue;
           }
-        } else {
-          if (memcmp(empty, it->mapped + offset, payLen)) {
-            ++userCount;
-            //increase the count if needed
-            if (id >= amount) {
-              amount = id + 1;
-              DEBUG_MSG(DLVL_VERYHIGH, "Shared memory %s is now at count %u", baseName.c_str(), amount);
-            }
-            callback(it->mapped + offset, payLen, id);
+          char * counter = slot + SLOT_STATE;
+          //claimed, but not yet initialized by the client
+          if (*counter == 0) {
+            continue;
+          }
+          unsigned int tmpPID = *((volatile unsigned int *)(slot + SLOT_PID));
+          unsigned int gen = *((volatile unsigned int *)(slot + SLOT_GEN));
+          if (trackers.size() <= slotId || trackers[slotId].pid != tmpPID) {
+            trackSlot(slotId, tmpPID);
+            trackers[slotId].lastGen = gen;
+          } else if (trackers[slotId].lastGen != gen) {
+            trackers[slotId].lastGen = gen;
+            trackers[slotId].missed = 0;
           } else {
-            //stop if we're past the amount counted and we're empty
-            if (id >= amount - 1) {
-              //bring the counter down if this was the last element
-              if (id == amount - 1) {
-                amount = id;
-                DEBUG_MSG(DLVL_VERYHIGH, "Shared memory %s is now at count %u", baseName.c_str(), amount);
-              }
-              //stop, we're guaranteed no more pages are full at this point
-              if (empty) {
-                free(empty);
+            ++trackers[slotId].missed;
+          }
+          slotTracker & trk = trackers[slotId];
+          //without a pidfd, only signal processes that missed a keepalive
+          if (!trk.dead && trk.liveFd == -1 && trk.missed && !Util::Procs::isRunning(tmpPID)) {
+            trk.dead = true;
+          }
+          if (trk.dead && !(*counter == 126 || *counter == 127 || *counter == 254 || *counter == 255)) {
+            WARN_MSG("process disappeared, timing out. (pid %u)", tmpPID);
+            *counter = 126; //if process is already dead, instant timeout.
+          }
+          callback(slot + SLOT_HEADER, payLen, slotId);
+          switch (*counter) {
+            case 127:
+              DEBUG_MSG(DLVL_HIGH, "Client %u requested disconnect", slotId);
+              break;
+            case 126:
+              DEBUG_MSG(DLVL_WARN, "Client %u timed out", slotId);
+              break;
+            case 255:
+              DEBUG_MSG(DLVL_HIGH, "Client %u disconnected on request", slotId);
+              break;
+            case 254:
+              DEBUG_MSG(DLVL_WARN, "Client %u disconnect timed out", slotId);
+              break;
+            default:
+              if (trk.missed > 10) {
+                if (trk.missed < 30) {
+                  if (trk.missed > 15) {
+                    WARN_MSG("Process %u is unresponsive", tmpPID);
+                  }
+                  Util::Procs::Stop(tmpPID); //soft kill
+                } else {
+                  ERROR_MSG("Killing unresponsive process %u", tmpPID);
+                  Util::Procs::Murder(tmpPID); //improved kill
+                }
               }
               break;
-            }
+          }
+          if (*counter == 127 || *counter == 126 || *counter == 255 || *counter == 254) {
+            //clear the slot before giving it back, so a new client always starts out clean
+            memset(slot, 0, stride);
+            releaseSlot(slotId);
+            __sync_fetch_and_and(bitmap + w, ~(1ull << (slotNo % 64)));
+            --userCount;
           }
         }
-        offset += payLen + (hasCounter ? 1 : 0);
-        id ++;
-      }      
-      if(userCount==0) {
+      }
+      id += slots;
+      if (userCount == 0) {
         ++emptyCount;
       } else {
-        emptyCount=0;
+        emptyCount = 0;
       }
     }
-    
-    if( emptyCount > 1){
+    if (amount != newAmount) {
+      DEBUG_MSG(DLVL_VERYHIGH, "Shared memory %s is now at count %u", baseName.c_str(), newAmount);
+      amount = newAmount;
+    }
+    if (emptyCount > 1) {
       deletePage();
-    } else if( !emptyCount ){
+    } else if (!emptyCount) {
       newPage();
     }
-    
-    if (empty) {
-      free(empty);
-    }
   }
 
   ///\brief Creates an empty shared client
@@ -862,17 +1330,6 @@ namespace IPC {
     baseName = rhs.baseName;
     payLen = rhs.payLen;
     hasCounter = rhs.hasCounter;
-#ifdef __APPLE__
-    //note: O_CREAT is only needed for mac, probably
-    mySemaphore.open(baseName.c_str(), O_RDWR | O_CREAT, 0);
-#else
-    mySemaphore.open(baseName.c_str(), O_RDWR);
-#endif
-    if (!mySemaphore) {
-      DEBUG_MSG(DLVL_FAIL, "Creating semaphore failed: %s", strerror(errno));
-      return;
-    }
-    semGuard tmpGuard(&mySemaphore);
     myPage.init(rhs.myPage.name, rhs.myPage.len, rhs.myPage.master);
     offsetOnPage = rhs.offsetOnPage;
   }
@@ -882,113 +1339,114 @@ namespace IPC {
     baseName = rhs.baseName;
     payLen = rhs.payLen;
     hasCounter = rhs.hasCounter;
-#ifdef __APPLE__
-    //note: O_CREAT is only needed for mac, probably
-    mySemaphore.open(baseName.c_str(), O_RDWR | O_CREAT, 0);
-#else
-    mySemaphore.open(baseName.c_str(), O_RDWR);
-#endif
-    if (!mySemaphore) {
-      DEBUG_MSG(DLVL_FAIL, "Creating copy of semaphore %s failed: %s", baseName.c_str(), strerror(errno));
-      return;
-    }
-    semGuard tmpGuard(&mySemaphore);
     myPage.init(rhs.myPage.name, rhs.myPage.len, rhs.myPage.master);
     offsetOnPage = rhs.offsetOnPage;
   }
 
   ///\brief SharedClient Constructor, allocates space on the correct page.
+  ///
+  ///A slot is claimed by atomically setting its bit in the occupancy bitmap of a page, so no locking is needed.
   ///\param name The basename of the server to connect to
   ///\param len The size of the payload to allocate
   ///\param withCounter Whether or not this payload has a counter
   sharedClient::sharedClient(std::string name, int len, bool withCounter) : baseName("/"+name), payLen(len), offsetOnPage(-1), hasCounter(withCounter) {
-#ifdef __APPLE__
-    //note: O_CREAT is only needed for mac, probably
-    mySemaphore.open(baseName.c_str(), O_RDWR | O_CREAT, 0);
-#else
-    mySemaphore.open(baseName.c_str(), O_RDWR);
-#endif
-    if (!mySemaphore) {
-      DEBUG_MSG(DLVL_FAIL, "Creating semaphore %s failed: %s", baseName.c_str(), strerror(errno));
-      return;
-    }
-    char * empty = 0;
-    if (!hasCounter) {
-      empty = (char *)malloc(payLen * sizeof(char));
-      if (!empty) {
-        DEBUG_MSG(DLVL_FAIL, "Failed to allocate %u bytes for empty payload!", payLen);
-        return;
-      }
-      memset(empty, 0, payLen);
-    }
+    unsigned int stride = slotStride(payLen, hasCounter);
     while (offsetOnPage == -1){
-      {
-        semGuard tmpGuard(&mySemaphore);
-        for (char i = 'A'; i <= 'Z'; i++) {
-          myPage.init(baseName.substr(1) + i, (4096 << (i - 'A')), false, false);
-          if (!myPage.mapped){
-            break;
+      for (char i = 'A'; i <= 'Z'; i++) {
+        myPage.init(baseName.substr(1) + i, (4096 << (i - 'A')), false, false);
+        if (!myPage.mapped){
+          if (i == 'A'){
+            DEBUG_MSG(DLVL_FAIL, "Opening shared memory %s failed: %s", baseName.c_str(), strerror(errno));
+            return;
           }
-          int offset = 0;
-          while (offset + payLen + (hasCounter ? 1 : 0) <= myPage.len) {
-            if ((hasCounter && myPage.mapped[offset] == 0) || (!hasCounter && !memcmp(myPage.mapped + offset, empty, payLen))) {
-              offsetOnPage = offset;
-              if (hasCounter) {
-                myPage.mapped[offset] = 1;
-                *((unsigned short *)(myPage.mapped+1+offset+len-2))=getpid();           
-              }
-              break;
+          break;
+        }
+        unsigned int bitmapLen;
+        unsigned int slots = slotsOnPage(myPage.len, stride, bitmapLen);
+        unsigned long long * bitmap = (unsigned long long *)myPage.mapped;
+        for (unsigned int w = 0; w < bitmapLen / 8 && offsetOnPage == -1; ++w) {
+          unsigned long long bits = bitmap[w];
+          while (~bits) {
+            unsigned int bit = __builtin_ctzll(~bits);
+            if (!__sync_bool_compare_and_swap(bitmap + w, bits, bits | (1ull << bit))) {
+              bits = bitmap[w];
+              continue;
             }
-            offset += payLen + (hasCounter ? 1 : 0);
-          }
-          if (offsetOnPage != -1) {
+            //a page may be mapped before the server marked the bits past the last slot; skip those
+            if (w * 64 + bit >= slots) {
+              bits |= (1ull << bit);
+              continue;
+            }
+            offsetOnPage = bitmapLen + (w * 64 + bit) * stride;
             break;
           }
         }
+        if (offsetOnPage != -1) {
+          if (hasCounter) {
+            char * slot = myPage.mapped + offsetOnPage;
+            *((volatile unsigned int *)(slot + SLOT_GEN)) = 0;
+            *((volatile unsigned int *)(slot + SLOT_PID)) = getpid();
+            //make sure the header is complete before the server sees the slot as initialized
+            __sync_synchronize();
+            slot[SLOT_STATE] = 1;
+          }
+          break;
+        }
       }
       if (offsetOnPage == -1){
         Util::wait(500);
       }
     }
-    free(empty);
   }
 
   ///\brief The deconstructor
   sharedClient::~sharedClient() {
-    mySemaphore.close();
   }
 
   ///\brief Writes data to the shared data
   void sharedClient::write(char * data, int len) {
+    if (!myPage.mapped) {
+      return;
+    }
     if (hasCounter) {
       keepAlive();
     }
-    memcpy(myPage.mapped + offsetOnPage + (hasCounter ? 1 : 0), data, std::min(len, payLen));
+    memcpy(getData(), data, std::min(len, payLen));
   }
 
   ///\brief Indicate that the process is done using this piece of memory, set the counter to finished
+  ///
+  ///Slots without a counter have nobody to time them out, so they are cleared and given back to the page directly.
   void sharedClient::finish() {
     if (!myPage.mapped) {
       return;
     }
     if (!hasCounter) {
-      DEBUG_MSG(DLVL_WARN, "Trying to time-out an element without counters");
+      unsigned int stride = slotStride(payLen, hasCounter);
+      unsigned int bitmapLen;
+      slotsOnPage(myPage.len, stride, bitmapLen);
+      unsigned int slotNo = (offsetOnPage - bitmapLen) / stride;
+      memset(myPage.mapped + offsetOnPage, 0, stride);
+      __sync_synchronize();
+      __sync_fetch_and_and(((unsigned long long *)myPage.mapped) + slotNo / 64, ~(1ull << (slotNo % 64)));
+      myPage.close();
       return;
     }
-    if (myPage.mapped) {
-      semGuard tmpGuard(&mySemaphore);
-      myPage.mapped[offsetOnPage] = 127;
-    }
+    __sync_synchronize();
+    myPage.mapped[offsetOnPage + SLOT_STATE] = 127;
   }
 
-  ///\brief Re-initialize the counter
+  ///\brief Bumps the keepalive generation of this slot
   void sharedClient::keepAlive() {
     if (!hasCounter) {
       DEBUG_MSG(DLVL_WARN, "Trying to keep-alive an element without counters");
       return;
     }
-    if (myPage.mapped[offsetOnPage] < 128) {
-      myPage.mapped[offsetOnPage] = 1;
+    if (!myPage.mapped) {
+      return;
+    }
+    if (myPage.mapped[offsetOnPage + SLOT_STATE] < 126) {
+      ++*((volatile unsigned int *)(myPage.mapped + offsetOnPage + SLOT_GEN));
     } else {
       DEBUG_MSG(DLVL_WARN, "Trying to keep-alive an element that needs to timeout, ignoring");
     }
@@ -999,7 +1457,6 @@ namespace IPC {
     if (!myPage.mapped) {
       return 0;
     }
-    return (myPage.mapped + offsetOnPage + (hasCounter ? 1 : 0));
+    return (myPage.mapped + offsetOnPage + (hasCounter ? SLOT_HEADER : 0));
   }
 }
-
@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <set>
+#include <vector>
 
 #include "timing.h"
 #include "defines.h"
@@ -11,7 +12,7 @@
 #include <semaphore.h>
 #endif
 
-#define STAT_EX_SIZE 172
+#define STAT_EX_SIZE 268
 #define PLAY_EX_SIZE 2+6*SIMUL_TRACKS
 
 namespace IPC {
@@ -38,7 +39,21 @@ namespace IPC {
       std::string connector();
       void crc(unsigned int sum);
       unsigned int crc();
+      void rebuffers(unsigned int count);
+      unsigned int rebuffers();
+      void liveLag(unsigned int ms);
+      unsigned int liveLag();
+      void pageWait(const Util::durationHist & hist);
+      Util::durationHist pageWait();
+      void sendBlock(const Util::durationHist & hist);
+      Util::durationHist sendBlock();
+      void poolIdle(unsigned int count);
+      unsigned int poolIdle();
+      void poolSpawned(unsigned int count);
+      unsigned int poolSpawned();
   private:
+      void setHist(unsigned int offset, const Util::durationHist & hist);
+      Util::durationHist getHist(unsigned int offset);
       ///\brief The payload for the stat exchange
       /// - 8 byte - now (timestamp of last statistics)
       /// - 4 byte - time (duration of the current connection)
@@ -49,6 +64,14 @@ namespace IPC {
       /// - 100 byte - streamName (name of the stream peer is viewing)
       /// - 20 byte - connector (name of the connector the peer is using)
       /// - 4 byte - CRC32 of user agent (or zero if none)
+      /// - 4 byte - rebuffers (times playback stalled waiting for new live data)
+      /// - 4 byte - liveLag (ms behind the live edge, zero if not live)
+      /// - 40 byte - pageWait (histogram of time spent waiting for data pages)
+      /// - 40 byte - sendBlock (histogram of time spent blocked sending to the peer)
+      /// - 4 byte - poolIdle (idle pooled workers of the connector when this connection was handed over)
+      /// - 4 byte - poolSpawned (workers spawned by the connector's pool so far, zero if not pooled)
+      ///
+      /// Histograms are stored as DURATION_BUCKETS 4 byte counters followed by an 8 byte sum in ms.
       char * data;
   };
 
@@ -158,6 +181,56 @@ namespace IPC {
   };
 #endif
 
+  ///\brief A shared page holding several versions of an immutable snapshot, published by a single writer.
+  ///
+  ///The page starts with a header holding the current generation, a closed flag and the generation held by each buffer,
+  ///followed by a table of reader leases and SNAPSHOT_BUFFERS equally sized buffers that each start with a 4 byte length.
+  ///The writer always fills a buffer that is neither current nor leased, and never waits for readers:
+  ///if every other buffer is leased, publish fails and should be retried later.
+  ///Short reads can read a generation, read its buffer, and then use stillValid to check it was not reused in the meantime.
+  ///Longer reads lease a generation with pin instead; the writer leaves its buffer alone until it is unpinned,
+  ///unless the process holding the lease no longer exists.
+  class sharedSnapshot {
+    public:
+      sharedSnapshot();
+      sharedSnapshot(std::string name, unsigned int len, bool master = false);
+      ~sharedSnapshot();
+      void init(std::string name, unsigned int len, bool master = false);
+      operator bool() const;
+      bool closed();
+      bool publish(const char * data, unsigned int dataLen);
+      unsigned long long generation();
+      const char * snapshot(unsigned long long gen, unsigned int & dataLen);
+      bool stillValid(unsigned long long gen);
+      const char * pin(unsigned long long & gen, unsigned int & dataLen, unsigned int & lease);
+      void unpin(unsigned int lease);
+    private:
+      volatile unsigned long long * current();
+      volatile unsigned long long * bufGen(unsigned int buf);
+      int findBuffer(unsigned long long gen);
+      bool leased(unsigned long long gen);
+      char * buffer(unsigned int buf);
+      ///\brief The page holding the header, the leases and the buffers
+      sharedPage page;
+      ///\brief The size of a single buffer, including its length field
+      unsigned int bufSize;
+  };
+
+  ///\brief Server-side bookkeeping for a single slot, kept in local memory only.
+  struct slotTracker {
+    slotTracker() : pid(0), lastGen(0), missed(0), liveFd(-1), dead(false) {}
+    ///\brief The process id of the current occupant, zero if unknown
+    unsigned int pid;
+    ///\brief The keepalive generation seen during the previous parse
+    unsigned int lastGen;
+    ///\brief The amount of consecutive parses without a keepalive
+    unsigned int missed;
+    ///\brief A pidfd for the occupant, or -1 if liveness is checked using signals
+    int liveFd;
+    ///\brief Set when the occupant is known to have exited
+    bool dead;
+  };
+
   ///\brief The server part of a server/client model for shared memory.
   ///
   ///The server manages the shared memory pages, and allocates new pages when needed.
@@ -165,8 +238,10 @@ namespace IPC {
   ///Pages are created with a basename + index, where index is in the range of 'A' - 'Z'
   ///Each time a page is nearly full, the next page is created with a size double to the previous one.
   ///
-  ///Clients should allocate payLen bytes at a time, possibly with the addition of a counter.
-  ///If no such length can be allocated, the next page should be tried, and so on.
+  ///Each page starts with an occupancy bitmap, followed by fixed-size slots.
+  ///Clients claim a slot by atomically setting its bit, so no locking is needed to join or leave.
+  ///With a counter, each slot starts with a 4 byte keepalive generation, a 4 byte pid and a 1 byte state, followed by the payload.
+  ///If no slot can be claimed on a page, the next page should be tried, and so on.
   class sharedServer {
     public:
       sharedServer();
@@ -180,17 +255,22 @@ namespace IPC {
     private:
       bool isInUse(unsigned int id);
       void newPage();
-      void deletePage();
+      bool deletePage();
+      void checkLiveness();
+      void trackSlot(unsigned int id, unsigned int pid);
+      void releaseSlot(unsigned int id);
       ///\brief The basename of the shared pages.
       std::string baseName;
       ///\brief The length of each consecutive piece of payload
       unsigned int payLen;
       ///\brief The set of sharedPage structures to manage the actual memory
       std::set<sharedPage> myPages;
-      ///\brief A semaphore that is locked upon creation and deletion of the page, to ensure no new data is allocated during this step.
-      semaphore mySemaphore;
       ///\brief Whether the payload has a counter, if so, it is added in front of the payload
       bool hasCounter;
+      ///\brief Per-slot liveness bookkeeping, indexed by slot id
+      std::vector<slotTracker> trackers;
+      ///\brief The epoll handle all pidfds are registered on, or -1 if unavailable
+      int pollFd;
   };
 
   ///\brief The client part of a server/client model for shared memory.
@@ -200,8 +280,8 @@ namespace IPC {
   ///Pages are created with a basename + index, where index is in the range of 'A' - 'Z'
   ///Each time a page is nearly full, the next page is created with a size double to the previous one.
   ///
-  ///Clients should allocate payLen bytes at a time, possibly with the addition of a counter.
-  ///If no such length can be allocated, the next page should be tried, and so on.
+  ///Clients claim a slot by atomically setting a bit in the occupancy bitmap of a page.
+  ///If no slot can be claimed on a page, the next page should be tried, and so on.
   class sharedClient {
     public:
       sharedClient();
@@ -218,11 +298,9 @@ namespace IPC {
       std::string baseName;
       ///\brief The shared page this client has reserved a space on.
       sharedPage myPage;
-      ///\brief A semaphore that is locked upon trying to allocate space on a page
-      semaphore mySemaphore;
       ///\brief The size in bytes of the opened page
       int payLen;
-      ///\brief The offset of the payload reserved for this client within the opened page
+      ///\brief The offset of the slot reserved for this client within the opened page
       int offsetOnPage;
       ///\brief Whether the payload has a counter, if so, it is added in front of the payload
       bool hasCounter;
@@ -10,6 +10,10 @@
 #include <netdb.h>
 #include <sstream>
 #include <cstdlib>
+#include <algorithm>
+#include <climits>
+
+#include <netinet/tcp.h>
 
 #ifdef __FreeBSD__
 #include <netinet/in.h>
@@ -108,47 +112,85 @@ bool Socket::Buffer::available(unsigned int count) {
 /// Removes count bytes from the buffer, returning them by value.
 /// Returns an empty string if not all count bytes are available.
 std::string Socket::Buffer::remove(unsigned int count) {
+  std::string ret;
+  ret.reserve(count);
+  remove(ret, count);
+  return ret;
+}
+
+/// Removes count bytes from the buffer, appending them to dest.
+/// Nothing is removed and false returned if not all count bytes are available.
+bool Socket::Buffer::remove(std::string & dest, unsigned int count) {
+  if (!count) {
+    return true;
+  }
   if (!available(count)) {
-    return "";
+    return false;
   }
   unsigned int i = 0;
-  std::string ret;
-  ret.reserve(count);
   for (std::deque<std::string>::reverse_iterator it = data.rbegin(); it != data.rend(); ++it) {
     if (i + (*it).size() < count) {
-      ret.append(*it);
+      dest.append(*it);
       i += (*it).size();
       (*it).clear();
     } else {
-      ret.append(*it, 0, count - i);
+      dest.append(*it, 0, count - i);
       (*it).erase(0, count - i);
       break;
     }
   }
-  return ret;
+  return true;
 }
 
-/// Copies count bytes from the buffer, returning them by value.
-/// Returns an empty string if not all count bytes are available.
-std::string Socket::Buffer::copy(unsigned int count) {
+/// Removes count bytes from the buffer, discarding them.
+/// Nothing is removed and false returned if not all count bytes are available.
+bool Socket::Buffer::skip(unsigned int count) {
+  if (!count) {
+    return true;
+  }
   if (!available(count)) {
-    return "";
+    return false;
   }
   unsigned int i = 0;
-  std::string ret;
-  ret.reserve(count);
   for (std::deque<std::string>::reverse_iterator it = data.rbegin(); it != data.rend(); ++it) {
     if (i + (*it).size() < count) {
-      ret.append(*it);
       i += (*it).size();
+      (*it).clear();
     } else {
-      ret.append(*it, 0, count - i);
+      (*it).erase(0, count - i);
       break;
     }
   }
+  return true;
+}
+
+/// Copies count bytes from the buffer, returning them by value.
+/// Returns an empty string if not all count bytes are available.
+std::string Socket::Buffer::copy(unsigned int count) {
+  if (!available(count)) {
+    return "";
+  }
+  std::string ret;
+  ret.resize(count);
+  copy((char *)ret.data(), count);
   return ret;
 }
 
+/// Copies count bytes from the buffer into dest, which must be able to hold them.
+/// Nothing is copied and false returned if not all count bytes are available.
+bool Socket::Buffer::copy(char * dest, unsigned int count) {
+  if (!available(count)) {
+    return false;
+  }
+  unsigned int i = 0;
+  for (std::deque<std::string>::reverse_iterator it = data.rbegin(); it != data.rend() && i < count; ++it) {
+    unsigned int part = std::min((unsigned int)(*it).size(), count - i);
+    memcpy(dest + i, (*it).data(), part);
+    i += part;
+  }
+  return true;
+}
+
 /// Gets a reference to the back of the internal std::deque of std::string objects.
 std::string & Socket::Buffer::get() {
   static std::string empty;
@@ -427,6 +469,11 @@ unsigned int Socket::Connection::dataDown() {
   return down;
 }
 
+/// Returns a histogram of the time spent in SendNow calls, which is time spent blocked by the peer not reading fast enough.
+const Util::durationHist & Socket::Connection::sendBlocking() {
+  return sendBlocks;
+}
+
 /// Returns a std::string of stats, ended by a newline.
 /// Requires the current connector name as an argument.
 std::string Socket::Connection::getStats(std::string C) {
@@ -462,10 +509,44 @@ void Socket::Connection::SendNow(const char * data, size_t len) {
   if (!bing) {
     setBlocking(true);
   }
+  long long int start = Util::getMS();
   unsigned int i = iwrite(data, std::min((long unsigned int)len, SOCKETSIZE));
   while (i < len && connected()) {
     i += iwrite(data + i, std::min((long unsigned int)(len - i), SOCKETSIZE));
   }
+  sendBlocks.add(std::max(Util::getMS() - start, 0ll));
+  if (!bing) {
+    setBlocking(false);
+  }
+}
+
+/// Will not buffer anything but always send right away. Blocks.
+/// Sends all count buffers in vec in order, using gathered writes, so that several
+/// buffers (such as a header and a payload) cost a single system call.
+/// Any data that could not be send will block until it can be send or the connection is severed.
+/// \warning The contents of vec are changed to keep track of partial writes.
+void Socket::Connection::SendNow(struct iovec * vec, int count) {
+  bool bing = isBlocking();
+  if (!bing) {
+    setBlocking(true);
+  }
+  long long int start = Util::getMS();
+  unsigned int i = 0;
+  while (true) {
+    //skip the buffers that were written completely (or are empty), and the written part of the next one
+    while (count > 0 && i >= vec->iov_len) {
+      i -= vec->iov_len;
+      ++vec;
+      --count;
+    }
+    if (count < 1 || !connected()) {
+      break;
+    }
+    vec->iov_base = (char *)vec->iov_base + i;
+    vec->iov_len -= i;
+    i = iwrite(vec, std::min(count, IOV_MAX));
+  }
+  sendBlocks.add(std::max(Util::getMS() - start, 0ll));
   if (!bing) {
     setBlocking(false);
   }
@@ -522,6 +603,44 @@ unsigned int Socket::Connection::iwrite(const void * buffer, int len) {
   return r;
 } //Socket::Connection::iwrite
 
+/// Incremental gathered write call. This function tries to write all count buffers in vec to the socket,
+/// returning the amount of bytes it actually wrote.
+/// \param vec The buffers to write from, in order.
+/// \param count Amount of buffers in vec.
+/// \returns The amount of bytes actually written.
+unsigned int Socket::Connection::iwrite(struct iovec * vec, int count) {
+  if (!connected() || count < 1) {
+    return 0;
+  }
+  int r;
+  if (sock >= 0) {
+    r = writev(sock, vec, count);
+  } else {
+    r = writev(pipes[0], vec, count);
+  }
+  if (r < 0) {
+    switch (errno) {
+      case EWOULDBLOCK:
+        return 0;
+        break;
+      default:
+        if (errno != EPIPE && errno != ECONNRESET) {
+          Error = true;
+          remotehost = strerror(errno);
+          DEBUG_MSG(DLVL_WARN, "Could not iwrite data! Error: %s", remotehost.c_str());
+        }
+        close();
+        return 0;
+        break;
+    }
+  }
+  if (r == 0 && (sock >= 0)) {
+    close();
+  }
+  up += r;
+  return r;
+} //Socket::Connection::iwrite
+
 /// Incremental read call. This function tries to read len bytes to the buffer from the socket,
 /// returning the amount of bytes it actually read.
 /// \param buffer Location of the buffer to read to.
@@ -704,6 +823,13 @@ bool Socket::Connection::isAddress(std::string addr) {
   return false;
 }
 
+/// Sets the defaults: a backlog of 100 connections, no SO_REUSEPORT and no TCP_DEFER_ACCEPT.
+Socket::listenOptions::listenOptions() {
+  backlog = 100;
+  reusePort = false;
+  deferAccept = 0;
+}
+
 /// Create a new base Server. The socket is never connected, and a placeholder for later connections.
 Socket::Server::Server() {
   sock = -1;
@@ -716,18 +842,50 @@ Socket::Server::Server() {
 /// \param hostname (optional) The interface to bind to. The default is 0.0.0.0 (all interfaces).
 /// \param nonblock (optional) Whether accept() calls will be nonblocking. Default is false (blocking).
 Socket::Server::Server(int port, std::string hostname, bool nonblock) {
-  if (!IPv6bind(port, hostname, nonblock) && !IPv4bind(port, hostname, nonblock)) {
+  listenOptions opts;
+  if (!IPv6bind(port, hostname, nonblock, opts) && !IPv4bind(port, hostname, nonblock, opts)) {
     DEBUG_MSG(DLVL_FAIL, "Could not create socket %s:%i! Error: %s", hostname.c_str(), port, errors.c_str());
     sock = -1;
   }
 } //Socket::Server TCP Constructor
 
+/// Create a new TCP Server with the given listen options. The socket is immediately bound and set to listen.
+/// A maximum of opts.backlog connections will be accepted between accept() calls.
+/// \param port The TCP port to listen on
+/// \param hostname The interface to bind to, 0.0.0.0 for all interfaces.
+/// \param nonblock Whether accept() calls will be nonblocking.
+/// \param opts The backlog, SO_REUSEPORT and TCP_DEFER_ACCEPT settings for this socket.
+Socket::Server::Server(int port, std::string hostname, bool nonblock, const listenOptions & opts) {
+  if (!IPv6bind(port, hostname, nonblock, opts) && !IPv4bind(port, hostname, nonblock, opts)) {
+    DEBUG_MSG(DLVL_FAIL, "Could not create socket %s:%i! Error: %s", hostname.c_str(), port, errors.c_str());
+    sock = -1;
+  }
+} //Socket::Server TCP Constructor with options
+
+/// Sets TCP_DEFER_ACCEPT if requested and starts listening on the bound socket.
+/// SO_REUSEPORT must be set before binding, so IPv6bind and IPv4bind take care of that.
+/// \return True if successful, false otherwise.
+bool Socket::Server::listenOn(const listenOptions & opts) {
+  if (opts.deferAccept > 0) {
+#ifdef TCP_DEFER_ACCEPT
+    int secs = opts.deferAccept;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs)) != 0) {
+      DEBUG_MSG(DLVL_WARN, "Could not set TCP_DEFER_ACCEPT: %s", strerror(errno));
+    }
+#else
+    DEBUG_MSG(DLVL_WARN, "TCP_DEFER_ACCEPT is not supported on this platform");
+#endif
+  }
+  return listen(sock, opts.backlog) == 0;
+}
+
 /// Attempt to bind an IPv6 socket.
 /// \param port The TCP port to listen on
 /// \param hostname The interface to bind to. The default is 0.0.0.0 (all interfaces).
 /// \param nonblock Whether accept() calls will be nonblocking. Default is false (blocking).
+/// \param opts The backlog, SO_REUSEPORT and TCP_DEFER_ACCEPT settings for this socket.
 /// \return True if successful, false otherwise.
-bool Socket::Server::IPv6bind(int port, std::string hostname, bool nonblock) {
+bool Socket::Server::IPv6bind(int port, std::string hostname, bool nonblock, const listenOptions & opts) {
   sock = socket(AF_INET6, SOCK_STREAM, 0);
   if (sock < 0) {
     errors = strerror(errno);
@@ -736,6 +894,13 @@ bool Socket::Server::IPv6bind(int port, std::string hostname, bool nonblock) {
   }
   int on = 1;
   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (opts.reusePort) {
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#else
+    DEBUG_MSG(DLVL_WARN, "SO_REUSEPORT is not supported on this platform");
+#endif
+  }
 #ifdef __CYGWIN__
   on = 0;
   setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
@@ -756,8 +921,7 @@ bool Socket::Server::IPv6bind(int port, std::string hostname, bool nonblock) {
   }
   int ret = bind(sock, (sockaddr *) &addr, sizeof(addr)); //do the actual bind
   if (ret == 0) {
-    ret = listen(sock, 100); //start listening, backlog of 100 allowed
-    if (ret == 0) {
+    if (listenOn(opts)) {
       DEBUG_MSG(DLVL_DEVEL, "IPv6 socket success @ %s:%i", hostname.c_str(), port);
       return true;
     } else {
@@ -778,8 +942,9 @@ bool Socket::Server::IPv6bind(int port, std::string hostname, bool nonblock) {
 /// \param port The TCP port to listen on
 /// \param hostname The interface to bind to. The default is 0.0.0.0 (all interfaces).
 /// \param nonblock Whether accept() calls will be nonblocking. Default is false (blocking).
+/// \param opts The backlog, SO_REUSEPORT and TCP_DEFER_ACCEPT settings for this socket.
 /// \return True if successful, false otherwise.
-bool Socket::Server::IPv4bind(int port, std::string hostname, bool nonblock) {
+bool Socket::Server::IPv4bind(int port, std::string hostname, bool nonblock, const listenOptions & opts) {
   sock = socket(AF_INET, SOCK_STREAM, 0);
   if (sock < 0) {
     errors = strerror(errno);
@@ -788,6 +953,13 @@ bool Socket::Server::IPv4bind(int port, std::string hostname, bool nonblock) {
   }
   int on = 1;
   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (opts.reusePort) {
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#else
+    DEBUG_MSG(DLVL_WARN, "SO_REUSEPORT is not supported on this platform");
+#endif
+  }
   if (nonblock) {
     int flags = fcntl(sock, F_GETFL, 0);
     flags |= O_NONBLOCK;
@@ -804,8 +976,7 @@ bool Socket::Server::IPv4bind(int port, std::string hostname, bool nonblock) {
   }
   int ret = bind(sock, (sockaddr *) &addr4, sizeof(addr4)); //do the actual bind
   if (ret == 0) {
-    ret = listen(sock, 100); //start listening, backlog of 100 allowed
-    if (ret == 0) {
+    if (listenOn(opts)) {
       DEBUG_MSG(DLVL_DEVEL, "IPv4 socket success @ %s:%i", hostname.c_str(), port);
       return true;
     } else {
@@ -863,46 +1034,116 @@ Socket::Server::Server(std::string address, bool nonblock) {
   }
 } //Socket::Server Unix Constructor
 
-/// Accept any waiting connections. If the Socket::Server is blocking, this function will block until there is an incoming connection.
-/// If the Socket::Server is nonblocking, it might return a Socket::Connection that is not connected, so check for this.
-/// \param nonblock (optional) Whether the newly connected socket should be nonblocking. Default is false (blocking).
-/// \returns A Socket::Connection, which may or may not be connected, depending on settings and circumstances.
-Socket::Connection Socket::Server::accept(bool nonblock) {
-  if (sock < 0) {
-    return Socket::Connection(-1);
-  }
+/// Accepts a single connection on listening socket sock and fills host with the address of the peer.
+/// Uses accept4 where available, so the new socket is created close-on-exec and, if requested, nonblocking.
+/// \returns The new socket, or -1 with errno set.
+static int acceptSocket(int sock, bool nonblock, std::string & host) {
   struct sockaddr_in6 addrinfo;
   socklen_t len = sizeof(addrinfo);
-  static char addrconv[INET6_ADDRSTRLEN];
+  char addrconv[INET6_ADDRSTRLEN];
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+  int r = ::accept4(sock, (sockaddr *) &addrinfo, &len, SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0));
+#else
   int r = ::accept(sock, (sockaddr *) &addrinfo, &len);
   //set the socket to be nonblocking, if requested.
-  //we could do this through accept4 with a flag, but that call is non-standard...
   if ((r >= 0) && nonblock) {
     int flags = fcntl(r, F_GETFL, 0);
     flags |= O_NONBLOCK;
     fcntl(r, F_SETFL, flags);
   }
+#endif
+  if (r < 0) {
+    return r;
+  }
+  if (addrinfo.sin6_family == AF_INET6) {
+    host = inet_ntop(AF_INET6, &(addrinfo.sin6_addr), addrconv, INET6_ADDRSTRLEN);
+    DEBUG_MSG(DLVL_HIGH, "IPv6 addr [%s]", host.c_str());
+  }
+  if (addrinfo.sin6_family == AF_INET) {
+    host = inet_ntop(AF_INET, &(((sockaddr_in *) &addrinfo)->sin_addr), addrconv, INET6_ADDRSTRLEN);
+    DEBUG_MSG(DLVL_HIGH, "IPv4 addr [%s]", host.c_str());
+  }
+  if (addrinfo.sin6_family == AF_UNIX) {
+    DEBUG_MSG(DLVL_HIGH, "Unix connection");
+    host = "UNIX_SOCKET";
+  }
+  return r;
+}
+
+/// Returns true if errno, as set by a failed accept, means the server socket is still usable.
+static bool acceptRecoverable() {
+  return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR || errno == ECONNABORTED;
+}
+
+/// Accept any waiting connections. If the Socket::Server is blocking, this function will block until there is an incoming connection.
+/// If the Socket::Server is nonblocking, it might return a Socket::Connection that is not connected, so check for this.
+/// \param nonblock (optional) Whether the newly connected socket should be nonblocking. Default is false (blocking).
+/// \returns A Socket::Connection, which may or may not be connected, depending on settings and circumstances.
+Socket::Connection Socket::Server::accept(bool nonblock) {
+  if (sock < 0) {
+    return Socket::Connection(-1);
+  }
+  std::string host;
+  int r = acceptSocket(sock, nonblock, host);
   Socket::Connection tmp(r);
   if (r < 0) {
-    if ((errno != EWOULDBLOCK) && (errno != EAGAIN) && (errno != EINTR)) {
+    if (!acceptRecoverable()) {
       DEBUG_MSG(DLVL_FAIL, "Error during accept - closing server socket %d.", sock);
       close();
     }
   } else {
-    if (addrinfo.sin6_family == AF_INET6) {
-      tmp.remotehost = inet_ntop(AF_INET6, &(addrinfo.sin6_addr), addrconv, INET6_ADDRSTRLEN);
-      DEBUG_MSG(DLVL_HIGH, "IPv6 addr [%s]", tmp.remotehost.c_str());
+    tmp.remotehost = host;
+  }
+  return tmp;
+}
+
+/// Accepts up to max waiting connections and appends them to conns, draining the backlog in one go.
+/// If no connections are waiting, this waits up to timeout milliseconds for one (forever if negative), or until a signal arrives.
+/// The server socket is made nonblocking, so later accept() calls no longer block.
+/// \param conns Where the accepted connections are appended.
+/// \param max The maximum amount of connections to accept.
+/// \param timeout Milliseconds to wait if no connections are waiting, negative to wait until one arrives.
+/// \param nonblock Whether the newly connected sockets should be nonblocking.
+/// \returns The amount of connections appended to conns.
+unsigned int Socket::Server::acceptMany(std::deque<Connection> & conns, unsigned int max, int timeout, bool nonblock) {
+  if (sock < 0) {
+    return 0;
+  }
+  if (isFDBlocking(sock)) {
+    setFDBlocking(sock, false);
+  }
+  unsigned int count = 0;
+  while (count < max) {
+    std::string host;
+    int r = acceptSocket(sock, nonblock, host);
+    if (r >= 0) {
+      conns.push_back(Socket::Connection(r));
+      conns.back().remotehost = host;
+      ++count;
+      continue;
+    }
+    if (!acceptRecoverable()) {
+      DEBUG_MSG(DLVL_FAIL, "Error during accept - closing server socket %d.", sock);
+      close();
+      break;
     }
-    if (addrinfo.sin6_family == AF_INET) {
-      tmp.remotehost = inet_ntop(AF_INET, &(((sockaddr_in *) &addrinfo)->sin_addr), addrconv, INET6_ADDRSTRLEN);
-      DEBUG_MSG(DLVL_HIGH, "IPv4 addr [%s]", tmp.remotehost.c_str());
+    if (errno == ECONNABORTED) {
+      continue;
     }
-    if (addrinfo.sin6_family == AF_UNIX) {
-      DEBUG_MSG(DLVL_HIGH, "Unix connection");
-      tmp.remotehost = "UNIX_SOCKET";
+    //the backlog is empty: wait for a connection, but only if there is nothing to return yet
+    if (count || !timeout || errno == EINTR) {
+      break;
     }
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout) <= 0) {
+      break;
+    }
+    timeout = 0;
   }
-  return tmp;
+  return count;
 }
 
 /// Set this socket to be blocking (true) or nonblocking (false).
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -16,6 +17,8 @@
 #include <fcntl.h>
 #include <deque>
 
+#include "timing.h"
+
 //for being friendly with Socket::Connection down below
 namespace Buffer {
   class user;
@@ -38,7 +41,10 @@ namespace Socket {
       std::string & get();
       bool available(unsigned int count);
       std::string remove(unsigned int count);
+      bool remove(std::string & dest, unsigned int count);
+      bool skip(unsigned int count);
       std::string copy(unsigned int count);
+      bool copy(char * dest, unsigned int count);
       void clear();
   };
   //Buffer
@@ -53,10 +59,12 @@ namespace Socket {
       unsigned int down;
       long long int conntime;
       Buffer downbuffer; ///< Stores temporary data coming in.
+      Util::durationHist sendBlocks; ///< Time spent inside SendNow calls.
       int iread(void * buffer, int len, int flags = 0); ///< Incremental read call.
       unsigned int iwrite(const void * buffer, int len); ///< Incremental write call.
       bool iread(Buffer & buffer, int flags = 0); ///< Incremental write call that is compatible with Socket::Buffer.
       bool iwrite(std::string & buffer); ///< Write call that is compatible with std::string.
+      unsigned int iwrite(struct iovec * vec, int count); ///< Incremental gathered write call.
     public:
       //friends
       friend class ::Buffer::user;
@@ -86,10 +94,12 @@ namespace Socket {
       void SendNow(const std::string & data); ///< Will not buffer anything but always send right away. Blocks.
       void SendNow(const char * data); ///< Will not buffer anything but always send right away. Blocks.
       void SendNow(const char * data, size_t len); ///< Will not buffer anything but always send right away. Blocks.
+      void SendNow(struct iovec * vec, int count); ///< Sends all buffers in vec in order, in as few write calls as possible. Blocks.
       //stats related methods
       unsigned int connTime();///< Returns the time this socket has been connected.
       unsigned int dataUp(); ///< Returns total amount of bytes sent.
       unsigned int dataDown(); ///< Returns total amount of bytes received.
+      const Util::durationHist & sendBlocking(); ///< Returns a histogram of the time spent blocked in SendNow.
       std::string getStats(std::string C); ///< Returns a std::string of stats, ended by a newline.
       friend class Server;
       bool Error; ///< Set to true if a socket error happened.
@@ -100,18 +110,29 @@ namespace Socket {
       operator bool() const;
   };
 
+  /// Tuning options for listening TCP sockets.
+  struct listenOptions {
+    listenOptions();
+    int backlog; ///< Maximum amount of connections waiting to be accepted.
+    bool reusePort; ///< Set SO_REUSEPORT, so several sockets can listen on one port, each with its own queue.
+    int deferAccept; ///< Seconds connections are held back until their first data arrives (TCP_DEFER_ACCEPT), 0 to disable.
+  };
+
   /// This class is for easily setting up listening socket, either TCP or Unix.
   class Server {
     private:
       std::string errors; ///< Stores errors that may have occured.
       int sock; ///< Internally saved socket number.
-      bool IPv6bind(int port, std::string hostname, bool nonblock); ///< Attempt to bind an IPv6 socket
-      bool IPv4bind(int port, std::string hostname, bool nonblock); ///< Attempt to bind an IPv4 socket
+      bool IPv6bind(int port, std::string hostname, bool nonblock, const listenOptions & opts); ///< Attempt to bind an IPv6 socket
+      bool IPv4bind(int port, std::string hostname, bool nonblock, const listenOptions & opts); ///< Attempt to bind an IPv4 socket
+      bool listenOn(const listenOptions & opts); ///< Apply the listen options and start listening.
     public:
       Server(); ///< Create a new base Server.
       Server(int port, std::string hostname = "0.0.0.0", bool nonblock = false); ///< Create a new TCP Server.
+      Server(int port, std::string hostname, bool nonblock, const listenOptions & opts); ///< Create a new TCP Server with tuned listen options.
       Server(std::string adres, bool nonblock = false); ///< Create a new Unix Server.
       Connection accept(bool nonblock = false); ///< Accept any waiting connections.
+      unsigned int acceptMany(std::deque<Connection> & conns, unsigned int max, int timeout = -1, bool nonblock = false); ///< Accept a batch of waiting connections.
       void setBlocking(bool blocking); ///< Set this socket to be blocking (true) or nonblocking (false).
       bool connected() const; ///< Returns the connected-state for this socket.
       bool isBlocking(); ///< Check if this socket is blocking (true) or nonblocking (false).
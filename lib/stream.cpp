@@ -5,6 +5,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <deque>
+#include <vector>
 #include <semaphore.h>
 #include "json.h"
 #include "stream.h"
@@ -14,6 +16,7 @@
 #include "defines.h"
 #include "shared_memory.h"
 #include "dtsc.h"
+#include "bitfields.h"
 
 std::string Util::getTmpFolder() {
   std::string dir;
@@ -69,104 +72,669 @@ void Util::sanitizeName(std::string & streamname) {
   }
 }
 
-/// Starts a process for a VoD stream.
-bool Util::startInput(std::string streamname, std::string filename, bool forkFirst) {
-  if (streamname.size() > 100){
-    FAIL_MSG("Stream opening denied: %s is longer than 100 characters (%lu).", streamname.c_str(), streamname.size());
+/// Returns this process' mapping of the configuration page, or 0 if the controller has not created it.
+/// The page is mapped once per process, and mapped again when the controller that created it exited.
+/// Replaced mappings are never unmapped, as configSnapshots elsewhere in the process may still use them.
+static IPC::sharedSnapshot * configPage(){
+  static IPC::sharedSnapshot * page = 0;
+  if (page && !page->closed()){
+    return page;
+  }
+  IPC::sharedSnapshot * fresh = new IPC::sharedSnapshot(SHM_CONF_SNAPSHOT, DEFAULT_CONF_SNAPSHOT_SIZE);
+  if (!*fresh || fresh->closed()){
+    delete fresh;
+    return 0;
+  }
+  page = fresh;
+  return page;
+}
+
+/// Leases the newest configuration the controller published, if any.
+Util::configSnapshot::configSnapshot(){
+  page = 0;
+  lease = 0;
+  gen = 0;
+  data = 0;
+  dataLen = 0;
+  routes = 0;
+  routesLen = 0;
+  acquire();
+}
+
+Util::configSnapshot::~configSnapshot(){
+  release();
+}
+
+/// Releases the current configuration, if any, and leases the newest one.
+/// When all leases are taken, a private copy of the configuration is made instead.
+void Util::configSnapshot::acquire(){
+  release();
+  page = configPage();
+  if (!page){
+    return;
+  }
+  unsigned int len = 0;
+  const char * buf = page->pin(gen, len, lease);
+  if (!buf){
+    if (!page->generation()){
+      release();
+      return;
+    }
+    WARN_MSG("No configuration lease available, copying the configuration");
+    while (true){
+      gen = page->generation();
+      if (!gen){
+        release();
+        return;
+      }
+      buf = page->snapshot(gen, len);
+      if (buf){
+        copy.assign(buf, len);
+        if (page->stillValid(gen)){
+          break;
+        }
+      }
+    }
+    buf = copy.data();
+  }
+  if (len < 4){
+    release();
+    return;
+  }
+  unsigned int packedLen = Bit::btohl((char *)buf);
+  if (packedLen > len - 4){
+    release();
+    return;
+  }
+  data = (char *)buf + 4;
+  dataLen = packedLen;
+  //after the packed config follow the member index and the routing table, each 4-byte aligned and preceded by their length
+  unsigned int pos = (4 + packedLen + 3) & ~3;
+  if (pos + 4 > len){
+    return;
+  }
+  unsigned int indexLen = Bit::btohl((char *)buf + pos);
+  pos += 4;
+  if (indexLen > len - pos){
+    return;
+  }
+  index = DTSC::scanIndex(data, dataLen, buf + pos, indexLen);
+  pos = (pos + indexLen + 3) & ~3;
+  if (pos + 4 > len){
+    return;
+  }
+  unsigned int tableLen = Bit::btohl((char *)buf + pos);
+  pos += 4;
+  if (tableLen <= len - pos){
+    routes = buf + pos;
+    routesLen = tableLen;
+  }
+}
+
+/// Returns the root of the configuration: an object with config, streams and capabilities members.
+/// Returns an invalid object if the controller has not published a configuration, or after release.
+/// The returned object and everything taken from it are only valid until release.
+DTSC::Scan Util::configSnapshot::getScan(){
+  if (!gen){
+    return DTSC::Scan();
+  }
+  return DTSC::Scan(data, dataLen, &index);
+}
+
+/// Returns the version of the configuration, which increases with every change. Zero if none is held.
+unsigned long long Util::configSnapshot::version() const {
+  return gen;
+}
+
+/// Finds the HTTP connector that handles url, using the routing table published along with this configuration.
+/// \returns False if no connector handles url.
+bool Util::configSnapshot::route(const std::string & url, std::string & connector, std::string & streamname){
+  if (!gen || !routes){
     return false;
   }
-  IPC::sharedPage mistConfOut("!mistConfig", DEFAULT_CONF_PAGE_SIZE);
-  IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-  configLock.wait();
-  DTSC::Scan config = DTSC::Scan(mistConfOut.mapped, mistConfOut.len);
-  
-  sanitizeName(streamname);
-  std::string smp = streamname.substr(0, streamname.find_first_of("+ "));
-  //check if smp (everything before + or space) exists
-  DTSC::Scan stream_cfg = config.getMember("streams").getMember(smp);
-  if (!stream_cfg){
-    DEBUG_MSG(DLVL_MEDIUM, "Stream %s not configured", streamname.c_str());
-    configLock.post();//unlock the config semaphore
+  return routeURL(routes, routesLen, url, connector, streamname);
+}
+
+/// Releases the configuration early, for example before an exec call, after which the destructor cannot run.
+void Util::configSnapshot::release(){
+  if (page){
+    page->unpin(lease);
+  }
+  page = 0;
+  lease = 0;
+  gen = 0;
+  data = 0;
+  dataLen = 0;
+  copy.clear();
+  index = DTSC::scanIndex();
+  routes = 0;
+  routesLen = 0;
+}
+
+/// Appends data to snap, 4-byte aligned and preceded by its length.
+static void appendSection(std::string & snap, const std::string & data){
+  //sections are read in place as 32 bit words
+  snap.resize((snap.size() + 3) & ~3, (char)0);
+  char len[4];
+  Bit::htobl(len, data.size());
+  snap.append(len, 4);
+  snap.append(data);
+}
+
+/// Publishes the packed configuration as a new configSnapshot version, along with a member index and URL routing table for it.
+/// Only a single process may publish to a page; the controller does so in writeConfig.
+/// \returns False if the configuration does not fit the page, or all older versions are still leased.
+/// Readers then keep the previous version, and the caller should publish again later.
+bool Util::publishConfig(IPC::sharedSnapshot & page, const std::string & packed){
+  std::string table;
+  DTSC::buildScanIndex(packed.data(), packed.size(), table);
+  std::string routes;
+  buildRouteTable(DTSC::Scan((char *)packed.data(), packed.size()), routes);
+  std::string snap;
+  snap.reserve(20 + packed.size() + table.size() + routes.size());
+  snap.resize(4);
+  Bit::htobl((char *)snap.data(), packed.size());
+  snap.append(packed);
+  appendSection(snap, table);
+  appendSection(snap, routes);
+  if (!page.publish(snap.data(), snap.size())){
+    WARN_MSG("Could not publish configuration of %lu bytes: too large, or older versions still in use", (unsigned long)snap.size());
     return false;
   }
-  
-  //If starting without filename parameter, check if the stream is already active.
-  //If yes, don't activate again to prevent duplicate inputs.
-  //It's still possible a duplicate starts anyway, this is caught in the inputs initializer.
-  //Note: this uses the _whole_ stream name, including + (if any).
-  //This means "test+a" and "test+b" have separate locks and do not interact with each other.
-  if (!filename.size()){
-    IPC::semaphore playerLock(std::string("/lock_" + streamname).c_str(), O_CREAT | O_RDWR, ACCESSPERMS, 1);
-    if (!playerLock.tryWait()) {
-      playerLock.close();
-      DEBUG_MSG(DLVL_MEDIUM, "Stream %s already active - not activating again", streamname.c_str());
-      configLock.post();//unlock the config semaphore
-      return true;
+  return true;
+}
+
+/// The kinds of URL patterns in the routing table, see buildRouteTable.
+#define ROUTE_EXACT 0 ///< A url_match without $: the whole URL equals the pattern.
+#define ROUTE_MATCH 1 ///< A url_match with $: the URL starts with the part before $ and ends with the part after it.
+#define ROUTE_PREFIX 2 ///< A url_prefix with $: the URL starts with the part before $, the part after it follows somewhere.
+
+/// A URL pattern while the routing table is built.
+struct routePattern {
+  unsigned int connector;
+  unsigned int order;
+  unsigned int type;
+  std::string suffix;
+};
+
+/// A trie node while the routing table is built.
+struct routeNode {
+  std::map<unsigned char, unsigned int> children;
+  std::deque<unsigned int> patterns;
+};
+
+/// Adds pattern m of the given connector to the trie, keyed by its literal part.
+static void addRoute(std::deque<routeNode> & nodes, std::deque<routePattern> & patterns, unsigned int connector, bool prefix, const std::string & m){
+  size_t found = m.find('$');
+  if (prefix && found == std::string::npos){
+    return;//prefixes without $ never match
+  }
+  routePattern pat;
+  pat.connector = connector;
+  pat.order = patterns.size();
+  pat.type = (found == std::string::npos) ? ROUTE_EXACT : (prefix ? ROUTE_PREFIX : ROUTE_MATCH);
+  std::string literal = m.substr(0, found);
+  if (found != std::string::npos){
+    pat.suffix = m.substr(found + 1);
+  }
+  unsigned int node = 0;
+  for (size_t i = 0; i < literal.size(); ++i){
+    std::map<unsigned char, unsigned int>::iterator it = nodes[node].children.find(literal[i]);
+    if (it != nodes[node].children.end()){
+      node = it->second;
+      continue;
     }
-    playerLock.post();
-    playerLock.close();
-    filename = stream_cfg.getMember("source").asString();
+    nodes.push_back(routeNode());
+    nodes[node].children[literal[i]] = nodes.size() - 1;
+    node = nodes.size() - 1;
   }
-  
-  
-  std::string player_bin;
+  nodes[node].patterns.push_back(patterns.size());
+  patterns.push_back(pat);
+}
+
+/// Compiles the url_match and url_prefix patterns of all HTTP-based connectors in the capabilities of config
+/// into a trie, so routing a request takes a single walk over its URL, see routeURL.
+/// Connectors keep the priority of their order in the capabilities.
+/// The table consists of native 32 bit words: node, pattern, connector counts and the string area size,
+/// then the nodes (first child, child count << 8 | byte, first pattern, pattern count) with the children of a node
+/// stored together and sorted by byte, the patterns (connector, type << 24 | order, suffix offset, suffix length),
+/// the connectors (name offset, name length) and finally the strings.
+void Util::buildRouteTable(DTSC::Scan config, std::string & table){
+  std::deque<routeNode> nodes(1);
+  std::deque<routePattern> patterns;
+  std::deque<std::string> connectors;
+  DTSC::Scan capa = config.getMember("capabilities").getMember("connectors");
+  unsigned int capa_ctr = capa.getSize();
+  for (unsigned int i = 0; i < capa_ctr; ++i){
+    DTSC::Scan c = capa.getIndice(i);
+    if ((c.getMember("name").asString() != "HTTP" && c.getMember("deps").asString() != "HTTP") || (!c.getMember("url_match") && !c.getMember("url_prefix"))){
+      continue;
+    }
+    unsigned int connector = connectors.size();
+    connectors.push_back(capa.getIndiceName(i));
+    const char * kinds[] = {"url_match", "url_prefix"};
+    for (unsigned int k = 0; k < 2; ++k){
+      DTSC::Scan m = c.getMember(kinds[k]);
+      if (m.getType() == DTSC_ARR){
+        unsigned int m_ctr = m.getSize();
+        for (unsigned int j = 0; j < m_ctr; ++j){
+          addRoute(nodes, patterns, connector, k, m.getIndice(j).asString());
+        }
+      }else if (m){
+        addRoute(nodes, patterns, connector, k, m.asString());
+      }
+    }
+  }
+  //number the nodes breadth-first, so the children of each node are consecutive
+  std::deque<unsigned int> order(1, 0);
+  std::vector<unsigned int> number(nodes.size(), 0);
+  for (unsigned int i = 0; i < order.size(); ++i){
+    number[order[i]] = i;
+    for (std::map<unsigned char, unsigned int>::iterator it = nodes[order[i]].children.begin(); it != nodes[order[i]].children.end(); ++it){
+      order.push_back(it->second);
+    }
+  }
+  std::vector<uint32_t> words;
+  std::string strings;
+  words.push_back(nodes.size());
+  words.push_back(patterns.size());
+  words.push_back(connectors.size());
+  words.push_back(0);
+  std::vector<uint32_t> patWords;
+  unsigned int nextChild = 1;
+  for (unsigned int i = 0; i < order.size(); ++i){
+    routeNode & n = nodes[order[i]];
+    words.push_back(nextChild);
+    words.push_back(n.children.size() << 8);
+    words.push_back(patWords.size() / 4);
+    words.push_back(n.patterns.size());
+    nextChild += n.children.size();
+    for (std::deque<unsigned int>::iterator it = n.patterns.begin(); it != n.patterns.end(); ++it){
+      routePattern & p = patterns[*it];
+      patWords.push_back(p.connector);
+      patWords.push_back((p.type << 24) | p.order);
+      patWords.push_back(strings.size());
+      patWords.push_back(p.suffix.size());
+      strings.append(p.suffix);
+    }
+  }
+  //the low bits of each node hold the byte that leads to it
+  for (unsigned int i = 0; i < order.size(); ++i){
+    for (std::map<unsigned char, unsigned int>::iterator it = nodes[order[i]].children.begin(); it != nodes[order[i]].children.end(); ++it){
+      words[4 + number[it->second] * 4 + 1] |= it->first;
+    }
+  }
+  words.insert(words.end(), patWords.begin(), patWords.end());
+  for (std::deque<std::string>::iterator it = connectors.begin(); it != connectors.end(); ++it){
+    words.push_back(strings.size());
+    words.push_back(it->size());
+    strings.append(*it);
+  }
+  words[3] = strings.size();
+  table.assign((const char *)&words[0], words.size() * 4);
+  table.append(strings);
+}
+
+/// Routes url using a table made by buildRouteTable, the way HTTPOutput::getHandler used to try every pattern:
+/// the first connector with a matching pattern wins, and the last of its matching patterns with a $ sets the stream name.
+/// \returns False if no connector handles url.
+bool Util::routeURL(const char * table, size_t len, const std::string & url, std::string & connector, std::string & streamname){
+  if (len < 16){
+    return false;
+  }
+  const uint32_t * w = (const uint32_t *)table;
+  uint32_t nodeCount = w[0], patCount = w[1], connCount = w[2], strLen = w[3];
+  size_t wordCount = 4 + (size_t)nodeCount * 4 + (size_t)patCount * 4 + (size_t)connCount * 2;
+  if (!nodeCount || wordCount * 4 + strLen > len){
+    return false;
+  }
+  const uint32_t * nodes = w + 4;
+  const uint32_t * pats = nodes + nodeCount * 4;
+  const uint32_t * conns = pats + patCount * 4;
+  const char * strings = table + wordCount * 4;
+  uint32_t best = connCount;
+  uint32_t bestOrder = 0;
+  bool named = false;
+  std::string name;
+  uint32_t node = 0;
+  size_t depth = 0;
+  while (true){
+    const uint32_t * n = nodes + node * 4;
+    for (uint32_t i = n[2]; i < n[2] + n[3] && i < patCount; ++i){
+      const uint32_t * p = pats + i * 4;
+      if (p[0] > best || p[2] + p[3] > strLen){
+        continue;
+      }
+      uint32_t type = p[1] >> 24;
+      uint32_t order = p[1] & 0xFFFFFF;
+      const char * suffix = strings + p[2];
+      size_t sufLen = p[3];
+      bool match = false;
+      std::string found;
+      if (type == ROUTE_EXACT){
+        match = (depth == url.size());
+      }else if (type == ROUTE_MATCH){
+        if (url.size() >= depth + sufLen && !url.compare(url.size() - sufLen, sufLen, suffix, sufLen)){
+          match = true;
+          found = url.substr(depth, url.size() - depth - sufLen);
+        }
+      }else{
+        size_t pos = url.find(std::string(suffix, sufLen), depth);
+        if (pos != std::string::npos){
+          match = true;
+          found = url.substr(depth, pos - depth);
+        }
+      }
+      if (!match){
+        continue;
+      }
+      if (p[0] < best){
+        best = p[0];
+        named = false;
+        name.clear();
+      }
+      if (type != ROUTE_EXACT && (!named || order > bestOrder)){
+        named = true;
+        bestOrder = order;
+        name = found;
+      }
+    }
+    if (depth == url.size()){
+      break;
+    }
+    //binary search the children for the next byte
+    uint32_t lo = n[0], hi = n[0] + (n[1] >> 8);
+    unsigned char c = url[depth];
+    while (lo < hi){
+      uint32_t mid = (lo + hi) / 2;
+      if ((nodes[mid * 4 + 1] & 0xFF) < c){
+        lo = mid + 1;
+      }else{
+        hi = mid;
+      }
+    }
+    if (lo >= n[0] + (n[1] >> 8) || lo >= nodeCount || (nodes[lo * 4 + 1] & 0xFF) != c){
+      break;
+    }
+    node = lo;
+    ++depth;
+  }
+  if (best == connCount || conns[best * 2] + conns[best * 2 + 1] > strLen){
+    return false;
+  }
+  connector.assign(strings + conns[best * 2], conns[best * 2 + 1]);
+  streamname = name;
+  return true;
+}
+
+/// Picks the input with the highest priority whose source_match fits filename from config's capabilities,
+/// and collects the arguments for it from stream_cfg.
+/// \param config The server configuration, as found on the config page.
+/// \param stream_cfg The configuration of the stream.
+/// \param filename The source to start the input for.
+/// \param input Set to the name of the input, without the MistIn prefix.
+/// \param args Filled with the commandline options for the input and their values.
+/// \param error Set to a description of the problem, if there is one.
+/// \returns True if an input was found and all its required parameters are set.
+bool Util::resolveInput(DTSC::Scan & config, DTSC::Scan & stream_cfg, const std::string & filename, std::string & input, std::map<std::string, std::string> & args, std::string & error){
   bool selected = false;
   long long int curPrio = -1;
   //check in curConf for capabilities-inputs-<naam>-priority/source_match
   DTSC::Scan inputs = config.getMember("capabilities").getMember("inputs");
-  DTSC::Scan input;
+  DTSC::Scan best;
   unsigned int input_size = inputs.getSize();
   for (unsigned int i = 0; i < input_size; ++i){
-    input = inputs.getIndice(i);
+    DTSC::Scan candidate = inputs.getIndice(i);
     
     //if match voor current stream && priority is hoger dan wat we al hebben
-    if (curPrio < input.getMember("priority").asInt()){
-      std::string source = input.getMember("source_match").asString();
+    if (curPrio < candidate.getMember("priority").asInt()){
+      std::string source = candidate.getMember("source_match").asString();
       std::string front = source.substr(0,source.find('*'));
       std::string back = source.substr(source.find('*')+1);
-      DEBUG_MSG(DLVL_MEDIUM, "Checking input %s: %s (%s)", inputs.getIndiceName(i).c_str(), input.getMember("name").asString().c_str(), source.c_str());
+      DEBUG_MSG(DLVL_MEDIUM, "Checking input %s: %s (%s)", inputs.getIndiceName(i).c_str(), candidate.getMember("name").asString().c_str(), source.c_str());
       
-      if (filename.substr(0,front.size()) == front && filename.substr(filename.size()-back.size()) == back){
-        player_bin = Util::getMyPath() + "MistIn" + input.getMember("name").asString();
-        curPrio = input.getMember("priority").asInt();
+      if (filename.size() >= back.size() && filename.substr(0,front.size()) == front && filename.substr(filename.size()-back.size()) == back){
+        input = candidate.getMember("name").asString();
+        curPrio = candidate.getMember("priority").asInt();
+        best = candidate;
         selected = true;
       }
     }
   }
   
   if (!selected){
-    configLock.post();//unlock the config semaphore
-    FAIL_MSG("No compatible input found for stream %s: %s", streamname.c_str(), filename.c_str());
+    error = "No compatible input found";
     return false;
   }
 
-  //copy the neccessary arguments to separate storage so we can unlock the config semaphore safely
-  std::map<std::string, std::string> str_args;
   //check required parameters
-  DTSC::Scan required = input.getMember("required");
+  DTSC::Scan required = best.getMember("required");
   unsigned int req_size = required.getSize();
   for (unsigned int i = 0; i < req_size; ++i){
     std::string opt = required.getIndiceName(i);
     if (!stream_cfg.getMember(opt)){
-      configLock.post();//unlock the config semaphore
-      FAIL_MSG("Required parameter %s for stream %s missing", opt.c_str(), streamname.c_str());
+      error = "Required parameter " + opt + " missing";
       return false;
     }
-    str_args[required.getIndice(i).getMember("option").asString()] = stream_cfg.getMember(opt).asString();
+    args[required.getIndice(i).getMember("option").asString()] = stream_cfg.getMember(opt).asString();
   }
   //check optional parameters
-  DTSC::Scan optional = input.getMember("optional");
+  DTSC::Scan optional = best.getMember("optional");
   unsigned int opt_size = optional.getSize();
   for (unsigned int i = 0; i < opt_size; ++i){
     std::string opt = optional.getIndiceName(i);
     DEBUG_MSG(DLVL_VERYHIGH, "Checking optional %u: %s", i, opt.c_str());
     if (stream_cfg.getMember(opt)){
-      str_args[optional.getIndice(i).getMember("option").asString()] = stream_cfg.getMember(opt).asString();
+      args[optional.getIndice(i).getMember("option").asString()] = stream_cfg.getMember(opt).asString();
     }
   }
-  
-  //finally, unlock the config semaphore
-  configLock.post();
+  return true;
+}
+
+/// Appends a string with a 2 byte length to table.
+static void appendTableString(std::string & table, const std::string & str){
+  char len[2];
+  Bit::htobs(len, str.size());
+  table.append(len, 2);
+  table.append(str);
+}
+
+/// Resolves the input of every configured stream for its configured source, so startInput does not have to.
+/// The table starts with a 4 byte entry count, followed by a 4 byte offset per entry, sorted by stream name.
+/// Each entry is the stream name with a 1 byte length, a 2 byte string count, and that many strings with a 2 byte length:
+/// the input name, the source, and pairs of commandline options and their values.
+/// Streams without a usable input are left out, so startInput reports their problems the slow way.
+void Util::buildInputTable(DTSC::Scan config, std::string & table){
+  //std::map keeps the entries sorted by name
+  std::map<std::string, std::string> entries;
+  DTSC::Scan streams = config.getMember("streams");
+  unsigned int streamCount = streams.getSize();
+  for (unsigned int i = 0; i < streamCount; ++i){
+    std::string name = streams.getIndiceName(i);
+    DTSC::Scan stream_cfg = streams.getIndice(i);
+    std::string filename = stream_cfg.getMember("source").asString();
+    std::string input, error;
+    std::map<std::string, std::string> args;
+    if (!name.size() || name.size() > 100 || !resolveInput(config, stream_cfg, filename, input, args, error)){
+      continue;
+    }
+    std::string & entry = entries[name];
+    entry.append(1, (char)name.size());
+    entry.append(name);
+    char count[2];
+    Bit::htobs(count, 2 + 2 * args.size());
+    entry.append(count, 2);
+    appendTableString(entry, input);
+    appendTableString(entry, filename);
+    for (std::map<std::string, std::string>::iterator it = args.begin(); it != args.end(); ++it){
+      appendTableString(entry, it->first);
+      appendTableString(entry, it->second);
+    }
+  }
+  table.assign(4 + 4 * entries.size(), (char)0);
+  Bit::htobl((char *)table.data(), entries.size());
+  unsigned int idx = 0;
+  for (std::map<std::string, std::string>::iterator it = entries.begin(); it != entries.end(); ++it){
+    Bit::htobl((char *)table.data() + 4 + 4 * idx++, table.size());
+    table.append(it->second);
+  }
+}
+
+/// Reads a string with a 2 byte length at pos, advancing pos.
+/// \returns False if the string does not fit in the table.
+static bool readTableString(const char * table, unsigned int len, unsigned int & pos, std::string & str){
+  if (pos + 2 > len){
+    return false;
+  }
+  unsigned int strLen = Bit::btohs((char *)table + pos);
+  if (pos + 2 + strLen > len){
+    return false;
+  }
+  str.assign(table + pos + 2, strLen);
+  pos += 2 + strLen;
+  return true;
+}
+
+/// Looks smp up in a table made by buildInputTable, using binary search.
+/// \returns False if the stream is not in the table, or if the table is inconsistent.
+static bool findInTable(const char * table, unsigned int len, const std::string & smp, std::string & input, std::string & source, std::map<std::string, std::string> & args){
+  if (len < 4){
+    return false;
+  }
+  unsigned int count = Bit::btohl((char *)table);
+  if (4 + 4 * (unsigned long long)count > len){
+    return false;
+  }
+  unsigned int lo = 0, hi = count;
+  while (lo < hi){
+    unsigned int mid = lo + (hi - lo) / 2;
+    unsigned int pos = Bit::btohl((char *)table + 4 + 4 * mid);
+    if (pos >= len || pos + 1 + (unsigned char)table[pos] > len){
+      return false;
+    }
+    int cmp = smp.compare(0, std::string::npos, table + pos + 1, (unsigned char)table[pos]);
+    if (cmp < 0){
+      hi = mid;
+      continue;
+    }
+    if (cmp > 0){
+      lo = mid + 1;
+      continue;
+    }
+    pos += 1 + (unsigned char)table[pos];
+    if (pos + 2 > len){
+      return false;
+    }
+    unsigned int strings = Bit::btohs((char *)table + pos);
+    pos += 2;
+    if (strings < 2 || !readTableString(table, len, pos, input) || !readTableString(table, len, pos, source)){
+      return false;
+    }
+    for (unsigned int i = 2; i + 1 < strings; i += 2){
+      std::string opt, val;
+      if (!readTableString(table, len, pos, opt) || !readTableString(table, len, pos, val)){
+        return false;
+      }
+      args[opt] = val;
+    }
+    return true;
+  }
+  return false;
+}
+
+/// Looks smp up in the input table the controller publishes, without taking the config semaphore.
+/// \returns False if the table is not available or does not contain the stream.
+static bool cachedInput(const std::string & smp, std::string & input, std::string & source, std::map<std::string, std::string> & args){
+  static IPC::sharedSnapshot inputTable;
+  if (!inputTable || inputTable.closed()){
+    inputTable.init(SHM_INPUTS, DEFAULT_INPUTS_PAGE_SIZE);
+    if (!inputTable){
+      return false;
+    }
+  }
+  //retry a few times if the controller publishes a new table twice while we read
+  for (unsigned int attempt = 0; attempt < 3; ++attempt){
+    unsigned long long gen = inputTable.generation();
+    unsigned int len;
+    const char * table = inputTable.snapshot(gen, len);
+    if (!table){
+      return false;
+    }
+    input.clear();
+    source.clear();
+    args.clear();
+    bool found = findInTable(table, len, smp, input, source, args);
+    if (inputTable.stillValid(gen)){
+      return found;
+    }
+  }
+  return false;
+}
+
+/// Checks whether the input of a stream is already running, so startInput does not start a duplicate.
+/// It's still possible a duplicate starts anyway, this is caught in the inputs initializer.
+/// Note: this uses the _whole_ stream name, including + (if any).
+/// This means "test+a" and "test+b" have separate locks and do not interact with each other.
+bool Util::streamActive(const std::string & streamname){
+  IPC::semaphore playerLock(std::string("/lock_" + streamname).c_str(), O_CREAT | O_RDWR, ACCESSPERMS, 1);
+  if (!playerLock.tryWait()) {
+    playerLock.close();
+    return true;
+  }
+  playerLock.post();
+  playerLock.close();
+  return false;
+}
+
+/// Starts a process for a VoD stream.
+/// The input is taken from the table the controller publishes when possible, see buildInputTable.
+/// Otherwise, or if a different filename is given, it is resolved from a configSnapshot.
+bool Util::startInput(std::string streamname, std::string filename, bool forkFirst) {
+  if (streamname.size() > 100){
+    FAIL_MSG("Stream opening denied: %s is longer than 100 characters (%lu).", streamname.c_str(), streamname.size());
+    return false;
+  }
+  sanitizeName(streamname);
+  std::string smp = streamname.substr(0, streamname.find_first_of("+ "));
+
+  std::string input;
+  std::string source;
+  //copy the neccessary arguments to separate storage so we can release the configuration safely
+  std::map<std::string, std::string> str_args;
+  if (cachedInput(smp, input, source, str_args) && (!filename.size() || filename == source)){
+    if (!filename.size() && streamActive(streamname)){
+      DEBUG_MSG(DLVL_MEDIUM, "Stream %s already active - not activating again", streamname.c_str());
+      return true;
+    }
+    filename = source;
+  }else{
+    str_args.clear();
+    configSnapshot conf;
+    DTSC::Scan config = conf.getScan();
+    
+    //check if smp (everything before + or space) exists
+    DTSC::Scan stream_cfg = config.getMember("streams").getMember(smp);
+    if (!stream_cfg){
+      DEBUG_MSG(DLVL_MEDIUM, "Stream %s not configured", streamname.c_str());
+      return false;
+    }
+    if (!filename.size()){
+      if (streamActive(streamname)){
+        DEBUG_MSG(DLVL_MEDIUM, "Stream %s already active - not activating again", streamname.c_str());
+        return true;
+      }
+      filename = stream_cfg.getMember("source").asString();
+    }
+    std::string error;
+    bool resolved = resolveInput(config, stream_cfg, filename, input, str_args, error);
+    //everything needed was copied out, so the controller may replace the configuration now
+    conf.release();
+    if (!resolved){
+      FAIL_MSG("%s for stream %s: %s", error.c_str(), streamname.c_str(), filename.c_str());
+      return false;
+    }
+  }
+  std::string player_bin = Util::getMyPath() + "MistIn" + input;
 
   DEBUG_MSG(DLVL_MEDIUM, "Starting %s -s %s %s", player_bin.c_str(), streamname.c_str(), filename.c_str());
   char * argv[30] = {(char *)player_bin.c_str(), (char *)"-s", (char *)streamname.c_str(), (char *)filename.c_str()};
@@ -3,10 +3,55 @@
 
 #pragma once
 #include <string>
+#include <map>
 #include "socket.h"
+#include "dtsc.h"
+#include "shared_memory.h"
 
 namespace Util {
+  /// A leased, immutable view of the configuration the controller published last, see publishConfig.
+  /// Reading it never takes a lock, and the controller will not overwrite it until it is released;
+  /// newer versions are written next to it in the meantime.
+  /// Members of large objects (such as the list of streams) are found through a hash index instead of a walk.
+  /// Release it before doing anything slow, such as starting an input.
+  class configSnapshot {
+    public:
+      configSnapshot();
+      ~configSnapshot();
+      void acquire();
+      DTSC::Scan getScan();
+      unsigned long long version() const;
+      bool route(const std::string & url, std::string & connector, std::string & streamname);
+      void release();
+    private:
+      configSnapshot(const configSnapshot &);
+      configSnapshot & operator = (const configSnapshot &);
+      ///\brief The page the lease is held on
+      IPC::sharedSnapshot * page;
+      ///\brief The lease on page, if any
+      unsigned int lease;
+      ///\brief The version of the configuration, zero if none
+      unsigned long long gen;
+      ///\brief A private copy of the configuration, only used when no lease was available
+      std::string copy;
+      ///\brief The packed config
+      char * data;
+      size_t dataLen;
+      ///\brief The member index over data
+      DTSC::scanIndex index;
+      ///\brief The URL routing table, see buildRouteTable
+      const char * routes;
+      size_t routesLen;
+  };
+
+  bool publishConfig(IPC::sharedSnapshot & page, const std::string & packed);
+  void buildRouteTable(DTSC::Scan config, std::string & table);
+  bool routeURL(const char * table, size_t len, const std::string & url, std::string & connector, std::string & streamname);
+
   std::string getTmpFolder();
   void sanitizeName(std::string & streamname);
+  bool resolveInput(DTSC::Scan & config, DTSC::Scan & stream_cfg, const std::string & filename, std::string & input, std::map<std::string, std::string> & args, std::string & error);
+  void buildInputTable(DTSC::Scan config, std::string & table);
+  bool streamActive(const std::string & streamname);
   bool startInput(std::string streamname, std::string filename = "", bool forkFirst = true);
 }
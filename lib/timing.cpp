@@ -97,3 +97,51 @@ long long unsigned int Util::getMicros(long long unsigned int previous) {
 long long int Util::epoch() {
   return time(0);
 }
+
+/// Creates an empty histogram.
+Util::durationHist::durationHist(){
+  for (unsigned int i = 0; i < DURATION_BUCKETS; ++i){
+    count[i] = 0;
+  }
+  sum = 0;
+}
+
+/// Returns the inclusive upper limit in milliseconds of the given bucket: 1, 4, 16, ... 4096.
+/// The last bucket has no upper limit, for which 0 is returned.
+unsigned int Util::durationHist::bucketLimit(unsigned int bucket){
+  if (bucket >= DURATION_BUCKETS - 1){
+    return 0;
+  }
+  return 1u << (2 * bucket);
+}
+
+/// Adds a single sample of ms milliseconds.
+void Util::durationHist::add(unsigned int ms){
+  unsigned int bucket = 0;
+  while (bucket < DURATION_BUCKETS - 1 && ms > bucketLimit(bucket)){
+    ++bucket;
+  }
+  ++count[bucket];
+  sum += ms;
+}
+
+/// Adds the samples that newer holds on top of older.
+/// Both are expected to be snapshots of the same cumulative histogram, as exchanged through shared memory.
+/// The bucket counters there are 32 bits wide and allowed to wrap.
+void Util::durationHist::addDiff(const durationHist & newer, const durationHist & older){
+  for (unsigned int i = 0; i < DURATION_BUCKETS; ++i){
+    count[i] += (unsigned int)(newer.count[i] - older.count[i]);
+  }
+  if (newer.sum > older.sum){
+    sum += newer.sum - older.sum;
+  }
+}
+
+/// Returns the total amount of samples.
+unsigned long long Util::durationHist::total() const{
+  unsigned long long result = 0;
+  for (unsigned int i = 0; i < DURATION_BUCKETS; ++i){
+    result += count[i];
+  }
+  return result;
+}
@@ -3,6 +3,9 @@
 
 #pragma once
 
+/// Amount of buckets in a Util::durationHist.
+#define DURATION_BUCKETS 8
+
 namespace Util {
   void wait(int ms); ///< Sleeps for the indicated amount of milliseconds or longer.
   void sleep(int ms); ///< Sleeps for roughly the indicated amount of milliseconds.
@@ -12,4 +15,16 @@ namespace Util {
   long long unsigned int getMicros(long long unsigned int previous);///<Gets the time difference in microseconds.
   long long int getNTP();
   long long int epoch(); ///< Gets the amount of seconds since 01/01/1970.
+
+  /// Histogram of durations in milliseconds, in power-of-four buckets.
+  /// Bucket i holds samples of at most bucketLimit(i) ms, the last bucket holds everything above.
+  struct durationHist {
+    durationHist();
+    void add(unsigned int ms);
+    void addDiff(const durationHist & newer, const durationHist & older);
+    unsigned long long total() const;
+    static unsigned int bucketLimit(unsigned int bucket);
+    unsigned long long count[DURATION_BUCKETS];///< Samples per bucket, not cumulative.
+    unsigned long long sum;///< Sum of all samples in milliseconds.
+  };
 }
@@ -424,21 +424,55 @@ namespace TS {
 
 //BEGIN PES FUNCTIONS
 //pes functons do not use the internal strBuf character buffer
-  ///\brief Appends the PES-encoded timestamp to a string.
-  ///\param strBuf The string to append to
+  ///\brief Writes the PES-encoded timestamp to a buffer.
+  ///\param dest The buffer to write the 5 bytes to
   ///\param fixedLead The "fixed" 4-bit lead value to use
   ///\param time The timestamp to encode
-  void encodePESTimestamp(std::string & tmpBuf, char fixedLead, unsigned long long time){
+  static void encodePESTimestamp(char * dest, char fixedLead, unsigned long long time){
     //FixedLead of 4 bits, bits 32-30 time, 1 marker bit
-    tmpBuf += (char)(fixedLead | ((time & 0x1C0000000LL) >> 29) | 0x01);
+    dest[0] = (char)(fixedLead | ((time & 0x1C0000000LL) >> 29) | 0x01);
     //Bits 29-22 time
-    tmpBuf += (char)((time & 0x03FC00000LL) >> 22);
+    dest[1] = (char)((time & 0x03FC00000LL) >> 22);
     //Bits 21-15 time, 1 marker bit
-    tmpBuf += (char)(((time & 0x0003F8000LL) >> 14) | 0x01);
+    dest[2] = (char)(((time & 0x0003F8000LL) >> 14) | 0x01);
     //Bits 14-7 time
-    tmpBuf += (char)((time & 0x000007F80LL) >> 7);
+    dest[3] = (char)((time & 0x000007F80LL) >> 7);
     //Bits 7-0 time, 1 marker bit
-    tmpBuf += (char)(((time & 0x00000007FLL) << 1) | 0x01);
+    dest[4] = (char)(((time & 0x00000007FLL) << 1) | 0x01);
+  }
+
+/// Writes a PES Lead-in for a video frame to dest, which needs room for 19 bytes.
+/// \param len The length of this frame.
+/// \param PTS The timestamp of the frame.
+/// \returns The length of the lead-in, 14 bytes without offset and 19 bytes with.
+  unsigned int Packet::writePESVideoLeadIn(char * dest, unsigned int len, unsigned long long PTS, unsigned long long offset, bool isAligned) {
+    len += (offset ? 13 : 8);
+    memcpy(dest, "\000\000\001\340", 4);
+    dest[4] = (char)((len >> 8) & 0xFF);
+    dest[5] = (char)(len & 0xFF);
+    dest[6] = (isAligned ? '\204' : '\200');
+    dest[7] = (char)(offset ? 0xC0 : 0x80) ; //PTS/DTS + Flags
+    dest[8] = (char)(offset ? 0x0A : 0x05); //PESHeaderDataLength
+    encodePESTimestamp(dest + 9, (offset ? 0x30 : 0x20), PTS + offset);
+    if (offset){
+      encodePESTimestamp(dest + 14, 0x10, PTS);
+      return 19;
+    }
+    return 14;
+  }
+
+/// Writes a PES Lead-in for an audio frame to dest, which needs room for 14 bytes.
+/// \param len The length of this frame.
+/// \param PTS The timestamp of the frame.
+/// \returns The length of the lead-in, always 14 bytes.
+  unsigned int Packet::writePESAudioLeadIn(char * dest, unsigned int len, unsigned long long PTS) {
+    len += 8;
+    memcpy(dest, "\000\000\001\300", 4);
+    dest[4] = (char)((len & 0xFF00) >> 8); //PES PacketLength
+    dest[5] = (char)(len & 0x00FF); //PES PacketLength (Cont)
+    memcpy(dest + 6, "\204\200\005", 3);
+    encodePESTimestamp(dest + 9, 0x20, PTS);
+    return 14;
   }
 
 /// Generates a PES Lead-in for a video frame.
@@ -446,24 +480,9 @@ namespace TS {
 /// \param len The length of this frame.
 /// \param PTS The timestamp of the frame.
   std::string & Packet::getPESVideoLeadIn(unsigned int len, unsigned long long PTS, unsigned long long offset, bool isAligned) {
-    len += (offset ? 13 : 8);
     static std::string tmpStr;
-    tmpStr.clear();
-    tmpStr.reserve(25);
-    tmpStr.append("\000\000\001\340", 4);
-    tmpStr += (char)((len >> 8) & 0xFF);
-    tmpStr += (char)(len & 0xFF);
-    if (isAligned){
-      tmpStr.append("\204", 1);
-    }else{
-      tmpStr.append("\200", 1);
-    }
-    tmpStr += (char)(offset ? 0xC0 : 0x80) ; //PTS/DTS + Flags
-    tmpStr += (char)(offset ? 0x0A : 0x05); //PESHeaderDataLength
-    encodePESTimestamp(tmpStr, (offset ? 0x30 : 0x20), PTS + offset);
-    if (offset){
-      encodePESTimestamp(tmpStr, 0x10, PTS);
-    }
+    char leadIn[19];
+    tmpStr.assign(leadIn, writePESVideoLeadIn(leadIn, len, PTS, offset, isAligned));
     return tmpStr;
   }
 
@@ -473,14 +492,8 @@ namespace TS {
 /// \param PTS The timestamp of the frame.
   std::string & Packet::getPESAudioLeadIn(unsigned int len, unsigned long long PTS) {
     static std::string tmpStr;
-    tmpStr.clear();
-    tmpStr.reserve(14);
-    len += 8;
-    tmpStr.append("\000\000\001\300", 4);
-    tmpStr += (char)((len & 0xFF00) >> 8); //PES PacketLength
-    tmpStr += (char)(len & 0x00FF); //PES PacketLength (Cont)
-    tmpStr.append("\204\200\005", 3);
-    encodePESTimestamp(tmpStr, 0x20, PTS);
+    char leadIn[14];
+    tmpStr.assign(leadIn, writePESAudioLeadIn(leadIn, len, PTS));
     return tmpStr;
   }
 //END PES FUNCTIONS
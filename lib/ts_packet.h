@@ -69,6 +69,8 @@ namespace TS {
       //PES helpers      
       static std::string & getPESVideoLeadIn(unsigned int len, unsigned long long PTS, unsigned long long offset, bool isAligned);      
       static std::string & getPESAudioLeadIn(unsigned int len, unsigned long long PTS);
+      static unsigned int writePESVideoLeadIn(char * dest, unsigned int len, unsigned long long PTS, unsigned long long offset, bool isAligned);
+      static unsigned int writePESAudioLeadIn(char * dest, unsigned int len, unsigned long long PTS);
       
       //Printers and writers
       std::string toPrettyString(size_t indent = 0, int detailLevel = 3) const;
@@ -171,6 +173,17 @@ namespace TS {
     return std::string(StandardHeader, 7);
   }
 
+  /// Sets the frame length of an audio header made by getAudioHeader, so a header
+  /// made once per track can be reused for every frame.
+  /// \param header The 7 byte audio header to change.
+  /// \param FrameLen the length of the current audio frame.
+  static inline void setAudioHeaderLength(char * header, int FrameLen) {
+    FrameLen += 7;
+    header[3] = (header[3] & 0xFC) | ((FrameLen & 0x00001800) >> 11);
+    header[4] = ((FrameLen & 0x000007F8) >> 3);
+    header[5] = (header[5] & 0x1F) | ((FrameLen & 0x00000007) << 5);
+  }
+
 
   /// A standard Program Association Table, as generated by FFMPEG.
   /// Seems to be independent of the stream.
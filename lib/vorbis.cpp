@@ -190,8 +190,7 @@ namespace vorbis{
   }*/
   
   std::deque<mode> header::readModeDeque(char audioChannels){
-    Utils::bitstreamLSBF stream;
-    stream.append(data,datasize);
+    Utils::bitReaderLSBF stream(data, datasize);
     stream.skip(28); //skipping common header part
     stream.skip(28); //skipping common header part
     char codebook_count = stream.get(8) + 1;
@@ -154,8 +154,8 @@ namespace Analysers {
         std::cout << "  Theora data" << std::endl;
         static unsigned int numParts = 0;
         static unsigned int keyCount = 0;
-        for (unsigned int i = 0; i < oggPage.getAllSegments().size(); i++){
-          theora::header tmpHeader((char *)oggPage.getSegment(i), oggPage.getAllSegments()[i].size());
+        for (unsigned int i = 0; i < oggPage.getSegmentCount(); i++){
+          theora::header tmpHeader((char *)oggPage.getSegment(i), oggPage.getSegmentLen(i));
           if (tmpHeader.isHeader()){
             if (tmpHeader.getHeaderType() == 0){
               kfgshift = tmpHeader.getKFGShift();
@@ -176,8 +176,8 @@ namespace Analysers {
         }
       } else if (sn2Codec[oggPage.getBitstreamSerialNumber()] == "Vorbis"){
         std::cout << "  Vorbis data" << std::endl;
-        for (unsigned int i = 0; i < oggPage.getAllSegments().size(); i++){          
-          int len = oggPage.getAllSegments()[i].size();
+        for (unsigned int i = 0; i < oggPage.getSegmentCount(); i++){
+          int len = oggPage.getSegmentLen(i);
           vorbis::header tmpHeader((char*)oggPage.getSegment(i), len);
           if (tmpHeader.isHeader()){
             std::cout << tmpHeader.toPrettyString(4);
@@ -186,8 +186,8 @@ namespace Analysers {
       } else if (sn2Codec[oggPage.getBitstreamSerialNumber()] == "Opus"){
         std::cout << "  Opus data" << std::endl;
         int offset = 0;
-        for (unsigned int i = 0; i < oggPage.getAllSegments().size(); i++){
-          int len = oggPage.getAllSegments()[i].size();
+        for (unsigned int i = 0; i < oggPage.getSegmentCount(); i++){
+          int len = oggPage.getSegmentLen(i);
           const char * part = oggPage.getSegment(i);
           if (len >= 8 && memcmp(part, "Opus", 4) == 0){
             if (memcmp(part, "OpusHead", 8) == 0){
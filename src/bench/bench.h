@@ -0,0 +1,69 @@
+/// \file bench.h
+/// Shared declarations for the MistBench synthetic stream benchmark.
+
+#pragma once
+#include <string>
+#include <mist/dtsc.h>
+#include <mist/socket.h>
+
+///\brief Holds everything unique to MistBench.
+namespace Bench {
+  /// Describes the synthetic stream to generate.
+  struct streamSettings {
+    unsigned int duration;///< Length of the stream in seconds.
+    unsigned int videoTracks;///< Amount of 1280x720 H264 video tracks.
+    unsigned int videoBitrate;///< Bitrate per video track in kbit/s.
+    unsigned int fps;///< Frames per second of the video tracks.
+    unsigned int gop;///< Keyframe interval in milliseconds.
+    unsigned int audioTracks;///< Amount of audio tracks.
+    std::string audioCodec;///< Either AAC or MP3.
+    unsigned int audioBitrate;///< Bitrate per AAC track in kbit/s. MP3 tracks are always 128 kbit/s.
+  };
+
+  bool generateStream(const streamSettings & settings, const std::string & fileName, DTSC::Meta & meta);
+  bool writeFLV(const std::string & dtscFile, const std::string & fileName);
+  bool writeMP3(const std::string & dtscFile, const std::string & fileName);
+
+  /// Results of one benchmark run, summed over all requests or pages.
+  struct result {
+    result();
+    void add(const result & r);
+    unsigned long long runs;///< Requests sent to an output, or pages buffered by an input.
+    unsigned long long packets;///< Packets sent by the output or buffered by the input.
+    unsigned long long bytes;///< Bytes received from the output or buffered by the input.
+    unsigned long long micros;///< Wall clock time spent.
+    unsigned long long cpuMicros;///< User plus system CPU time spent.
+    unsigned long long sends;///< SendNow calls done by the output.
+    unsigned long long switches;///< Voluntary context switches, a measure of blocking system calls.
+    unsigned long long allocs;///< Calls to operator new.
+    unsigned long long headerMicros;///< Time spent reading or generating the header, inputs only.
+  };
+
+  unsigned long long allocations();
+  void resetGetopt();
+  bool selected(const std::string & list, const std::string & name);
+  void benchChecksums(const std::string & list, long long runs);
+
+  /// Entry points for the outputs. Each runs a single connection to completion.
+  bool outputFLV(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputMP4(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputOGG(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputMP3(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputJSON(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputHTTPTS(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputHLS(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputHDS(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputHSS(Socket::Connection & conn, const std::string & streamName, result & res);
+  bool outputRTMP(Socket::Connection & conn, const std::string & streamName, result & res);
+
+  /// Entry points for the inputs. The input functions buffer every page of the given file once,
+  /// the play functions serve the file as stream streamName until stopped.
+  bool inputDTSC(const std::string & fileName, const std::string & streamName, result & res);
+  bool inputFLV(const std::string & fileName, const std::string & streamName, result & res);
+  bool inputMP3(const std::string & fileName, const std::string & streamName, result & res);
+  bool inputOGG(const std::string & fileName, const std::string & streamName, result & res);
+  int playDTSC(const std::string & fileName, const std::string & streamName);
+  int playFLV(const std::string & fileName, const std::string & streamName);
+  int playMP3(const std::string & fileName, const std::string & streamName);
+  int playOGG(const std::string & fileName, const std::string & streamName);
+}
@@ -0,0 +1,61 @@
+/// \file bench_checksum.cpp
+/// Benchmarks the CRC implementations of lib/checksum.h for MistBench.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mist/checksum.h>
+#include <mist/timing.h>
+#include "bench.h"
+
+namespace Bench {
+  /// Benchmarks checksum::crc32c with every selected implementation the CPU supports,
+  /// on buffers the size of an OGG page header, a TS packet, an OGG page and a large chunk.
+  /// Every result is compared against the bytewise implementation.
+  void benchChecksums(const std::string & list, long long runs){
+    static const size_t sizes[] = {27, 188, 4096, 1024 * 1024};
+    //enough data per run to time the small sizes reliably
+    static const unsigned long long runBytes = 64 * 1024 * 1024;
+    std::string data;
+    data.resize(sizes[3]);
+    for (size_t i = 0; i < data.size(); ++i){
+      data[i] = (char)rand();
+    }
+    checksum::crcImplementation defaultImpl = checksum::getImplementation();
+    checksum::setImplementation(checksum::CRC_BYTEWISE);
+    unsigned int expected[4];
+    for (unsigned int s = 0; s < 4; ++s){
+      expected[s] = checksum::crc32c(0xFFFFFFFFU, data.data(), sizes[s]);
+    }
+
+    printf("%-9s %8s %10s\n", "Checksum", "Size", "MiB/s");
+    checksum::crcImplementation impls[] = {checksum::CRC_BYTEWISE, checksum::CRC_SLICE8, checksum::CRC_CLMUL};
+    for (unsigned int i = 0; i < 3; ++i){
+      const char * name = checksum::implementationName(impls[i]);
+      if (!selected(list, name)){
+        continue;
+      }
+      if (!checksum::setImplementation(impls[i])){
+        printf("%-9s not supported by this CPU\n", name);
+        continue;
+      }
+      for (unsigned int s = 0; s < 4; ++s){
+        unsigned long long count = runBytes / sizes[s];
+        unsigned long long micros = 0;
+        bool success = true;
+        for (long long r = 0; r < runs; ++r){
+          unsigned long long start = Util::getMicros();
+          unsigned int crc = 0;
+          for (unsigned long long c = 0; c < count; ++c){
+            crc = checksum::crc32c(0xFFFFFFFFU, data.data(), sizes[s]);
+          }
+          micros += Util::getMicros(start);
+          success &= (crc == expected[s]);
+        }
+        double mib = (double)count * sizes[s] * runs / (1024 * 1024);
+        printf("%-9s %8lu %10.1f%s\n", name, (unsigned long)sizes[s], micros ? mib * 1000000 / micros : 0, success ? "" : " (wrong result)");
+        fflush(stdout);
+      }
+    }
+    checksum::setImplementation(defaultImpl);
+  }
+}
@@ -0,0 +1,104 @@
+/// \file bench_input.cpp
+/// Buffers files through an input for MistBench.
+/// This file is compiled once per input, with INPUTTYPE set to the input header
+/// and BENCHNAME to the name used in the Bench::input* and Bench::play* entry points.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <mist/config.h>
+#include <mist/defines.h>
+#include <mist/shared_memory.h>
+#include <mist/timing.h>
+#include INPUTTYPE
+#include "bench.h"
+
+#define BENCH_CAT2(a, b) a ## b
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b)
+
+namespace {
+  /// Input that exposes the separate steps of Input::run, so they can be timed.
+  class benchIn : public mistIn {
+    public:
+      benchIn(Util::Config * cfg) : mistIn(cfg) {}
+      bool load(){
+        streamName = config->getString("streamname");
+        if (!setup() || !readHeader()){
+          return false;
+        }
+        parseHeader();
+        return true;
+      }
+      /// Buffers every page of every track once, removing each page again right after.
+      void bufferAll(Bench::result & res){
+        for (std::map<unsigned long, std::map<unsigned long, Mist::DTSCPageData> >::iterator it = pagesByTrack.begin(); it != pagesByTrack.end(); it++){
+          for (std::map<unsigned long, Mist::DTSCPageData>::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++){
+            unsigned long long allocStart = Bench::allocations();
+            unsigned long long start = Util::getMicros();
+            bufferFrame(it->first, it2->first);
+            res.micros += Util::getMicros(start);
+            res.allocs += Bench::allocations() - allocStart;
+            //bufferFrame also returns true for pages it skips, only buffered pages end up in pageCounter
+            if (pageCounter[it->first].count(it2->first)){
+              res.runs++;
+              res.packets += it2->second.partNum;
+              res.bytes += it2->second.dataSize;
+            }
+            bufferRemove(it->first, it2->first);
+            pageCounter[it->first].erase(it2->first);
+          }
+        }
+        finish();
+      }
+  };
+
+  /// Parses the arguments an input needs to serve fileName as streamName.
+  bool inputArgs(Util::Config & conf, const std::string & fileName, const std::string & streamName){
+    std::string fileArg = fileName;
+    std::string nameArg = streamName;
+    char * args[] = {(char*)"MistBench", (char*)"-s", (char*)nameArg.c_str(), (char*)fileArg.c_str(), 0};
+    int argc = 4;
+    char ** argv = args;
+    Bench::resetGetopt();
+    return conf.parseArgs(argc, argv);
+  }
+}
+
+/// Reads the header of fileName and buffers all of its pages once.
+/// Headers are timed in headerMicros, pages in micros. Any existing .dtsh header is used as-is.
+bool Bench::BENCH_CAT(input, BENCHNAME)(const std::string & fileName, const std::string & streamName, result & res){
+  Util::Config conf("MistBench", PACKAGE_VERSION);
+  benchIn in(&conf);
+  if (!inputArgs(conf, fileName, streamName)){
+    return false;
+  }
+  unsigned long long allocStart = allocations();
+  unsigned long long start = Util::getMicros();
+  if (!in.load()){
+    FAIL_MSG("Could not read %s", fileName.c_str());
+    return false;
+  }
+  res.headerMicros += Util::getMicros(start);
+  res.allocs += allocations() - allocStart;
+  in.bufferAll(res);
+  return true;
+}
+
+/// Serves fileName as streamName, the same way MistIn does, until no more viewers are connected or the process is signalled.
+int Bench::BENCH_CAT(play, BENCHNAME)(const std::string & fileName, const std::string & streamName){
+  Util::Config conf("MistBench", PACKAGE_VERSION);
+  mistIn in(&conf);
+  if (!inputArgs(conf, fileName, streamName)){
+    return 1;
+  }
+  IPC::semaphore playerLock(std::string("/lock_" + streamName).c_str(), O_CREAT | O_RDWR, ACCESSPERMS, 1);
+  if (!playerLock.tryWait()){
+    FAIL_MSG("A player for stream %s is already running", streamName.c_str());
+    return 1;
+  }
+  conf.activate();
+  int ret = in.run();
+  playerLock.post();
+  playerLock.close();
+  return ret;
+}
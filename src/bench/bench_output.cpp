@@ -0,0 +1,52 @@
+/// \file bench_output.cpp
+/// Runs a single output connection for MistBench.
+/// This file is compiled once per output, with OUTPUTTYPE set to the output header
+/// and BENCHNAME to the name used in the Bench::output* entry point.
+
+#include <unistd.h>
+#include <mist/config.h>
+#include <mist/socket.h>
+#include OUTPUTTYPE
+#include "bench.h"
+
+#define BENCH_CAT2(a, b) a ## b
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b)
+
+namespace {
+  /// Output that sends as fast as possible and counts the packets it sends.
+  class benchOut : public mistOut {
+    public:
+      benchOut(Socket::Connection & conn) : mistOut(conn), packets(0) {
+        realTime = 0;
+      }
+      void sendNext(){
+        ++packets;
+        mistOut::sendNext();
+      }
+      unsigned long long packets;
+  };
+}
+
+/// Serves conn with this output until the connection closes or the output finishes.
+/// Meant to be called in a freshly forked process, as outputs are not written to run twice in one process.
+bool Bench::BENCH_CAT(output, BENCHNAME)(Socket::Connection & conn, const std::string & streamName, result & res){
+  Util::Config conf("MistBench", PACKAGE_VERSION);
+  mistOut::init(&conf);
+  std::string nameArg = streamName;
+  char * args[] = {(char*)"MistBench", (char*)"-s", (char*)nameArg.c_str(), 0};
+  //outputs without a stream option (RTMP) get the stream name from the client
+  int argc = mistOut::capa["forward"].isMember("streamname") ? 3 : 1;
+  char ** argv = args;
+  resetGetopt();
+  if (!conf.parseArgs(argc, argv)){
+    return false;
+  }
+  conf.activate();
+  unsigned long long allocStart = allocations();
+  benchOut out(conn);
+  out.run();
+  res.packets = out.packets;
+  res.sends = conn.sendBlocking().total();
+  res.allocs = allocations() - allocStart;
+  return true;
+}
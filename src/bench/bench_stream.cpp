@@ -0,0 +1,234 @@
+/// \file bench_stream.cpp
+/// Generates the synthetic streams used by MistBench.
+
+#include <fstream>
+#include <deque>
+#include <mist/defines.h>
+#include <mist/flv_tag.h>
+#include <mist/json.h>
+#include "bench.h"
+
+namespace Bench {
+  /// avcC box of a 1280x720 High profile level 3.1 H264 stream.
+  static const char avcInit[] = "\001\144\000\037\377\341\000\032"
+                                "\147\144\000\037\254\331\100\120\005\273\001\020\000\000\003\000\020\000\000\003\003\300\361\203\031\140"
+                                "\001\000\006\150\353\343\313\042\300";
+  /// AudioSpecificConfig of an AAC-LC 44100Hz stereo stream.
+  static const char aacInit[] = "\022\020";
+  /// Header of an MPEG-1 layer 3 frame, 128 kbit/s, 44100Hz, joint stereo.
+  static const char mp3Header[] = "\377\373\220\104";
+  static const unsigned int mp3FrameSize = 417;
+
+  /// Generation state of a single synthetic track.
+  struct genTrack {
+    unsigned int tid;
+    unsigned int frame;///< Number of the next frame.
+    unsigned int rate;///< Frames per 1000 seconds.
+    unsigned int gopFrames;///< Video only, frames per keyframe interval.
+    unsigned int frameSize;///< Size of a non-keyframe, or of any audio frame.
+    bool video;
+    unsigned long long nextTime() const{
+      return (unsigned long long)frame * 1000000 / rate;
+    }
+  };
+
+  /// Fills data with a frame of size bytes.
+  /// Video frames are a single length-prefixed NAL unit. All payload bytes have the high bit set,
+  /// so the payload never contains an Annex B start code or an MP3 sync word.
+  static void fillFrame(std::string & data, const genTrack & trk, bool keyframe, bool mp3){
+    unsigned int size = trk.frameSize * (keyframe ? 4 : 1);
+    data.resize(size);
+    for (unsigned int i = 0; i < size; ++i){
+      data[i] = (char)(0x80 | ((i + trk.frame) & 0x7F));
+    }
+    if (trk.video){
+      unsigned int nalLen = size - 4;
+      data[0] = (char)(nalLen >> 24);
+      data[1] = (char)(nalLen >> 16);
+      data[2] = (char)(nalLen >> 8);
+      data[3] = (char)nalLen;
+      data[4] = keyframe ? 0x65 : 0x41;
+    }else if (mp3){
+      data.replace(0, 4, mp3Header, 4);
+    }
+  }
+
+  /// Writes an interleaved synthetic DTSC file to fileName, and its header to fileName.dtsh.
+  /// \param settings The stream to generate.
+  /// \param fileName The file to write, should end in .dtsc.
+  /// \param meta Is filled with the metadata of the generated stream.
+  bool generateStream(const streamSettings & settings, const std::string & fileName, DTSC::Meta & meta){
+    std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good()){
+      FAIL_MSG("Could not create %s", fileName.c_str());
+      return false;
+    }
+    bool mp3 = (settings.audioCodec == "MP3");
+    meta = DTSC::Meta();
+    std::deque<genTrack> tracks;
+    unsigned int tid = 1;
+    for (unsigned int i = 0; i < settings.videoTracks; ++i, ++tid){
+      DTSC::Track & trk = meta.tracks[tid];
+      trk.trackID = tid;
+      trk.type = "video";
+      trk.codec = "H264";
+      trk.init = std::string(avcInit, sizeof(avcInit) - 1);
+      trk.width = 1280;
+      trk.height = 720;
+      trk.fpks = settings.fps * 1000;
+      genTrack gen;
+      gen.tid = tid;
+      gen.frame = 0;
+      gen.rate = settings.fps * 1000;
+      gen.video = true;
+      gen.gopFrames = std::max(settings.gop * settings.fps / 1000, 1u);
+      //a keyframe is four times the size of the other frames in its group
+      gen.frameSize = std::max((unsigned long long)settings.videoBitrate * 125 * settings.gop / 1000 / (gen.gopFrames + 3), 16ull);
+      tracks.push_back(gen);
+    }
+    for (unsigned int i = 0; i < settings.audioTracks; ++i, ++tid){
+      DTSC::Track & trk = meta.tracks[tid];
+      trk.trackID = tid;
+      trk.type = "audio";
+      trk.codec = mp3 ? "MP3" : "AAC";
+      if (!mp3){
+        trk.init = std::string(aacInit, 2);
+      }
+      trk.rate = 44100;
+      trk.size = 16;
+      trk.channels = 2;
+      genTrack gen;
+      gen.tid = tid;
+      gen.frame = 0;
+      gen.video = false;
+      gen.gopFrames = 0;
+      //1152 samples per MP3 frame, 1024 per AAC frame
+      gen.rate = 44100000 / (mp3 ? 1152 : 1024);
+      gen.frameSize = mp3 ? mp3FrameSize : std::max(settings.audioBitrate * 125 * 1000 / gen.rate, 16u);
+      tracks.push_back(gen);
+    }
+    if (!tracks.size()){
+      FAIL_MSG("Refusing to generate a stream without tracks");
+      return false;
+    }
+
+    unsigned long long endTime = (unsigned long long)settings.duration * 1000;
+    unsigned long long bpos = 0;
+    std::string data;
+    JSON::Value pack;
+    while (true){
+      //write the track that is furthest behind, to keep the file interleaved
+      std::deque<genTrack>::iterator next = tracks.begin();
+      for (std::deque<genTrack>::iterator it = tracks.begin(); it != tracks.end(); ++it){
+        if (it->nextTime() < next->nextTime()){
+          next = it;
+        }
+      }
+      if (next->nextTime() >= endTime){
+        break;
+      }
+      bool keyframe = next->video && (next->frame % next->gopFrames == 0);
+      fillFrame(data, *next, keyframe, mp3);
+      pack.null();
+      pack["trackid"] = (long long)next->tid;
+      pack["time"] = (long long)next->nextTime();
+      pack["data"] = data;
+      if (keyframe){
+        pack["keyframe"] = 1ll;
+      }
+      std::string & packed = pack.toNetPacked();
+      DTSC::Packet dtscPack(packed.data(), packed.size());
+      meta.updatePosOverride(dtscPack, bpos);
+      file.write(packed.data(), packed.size());
+      bpos += packed.size();
+      ++next->frame;
+    }
+    file.close();
+
+    std::ofstream header((fileName + ".dtsh").c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    header << meta.toJSON().toNetPacked();
+    header.close();
+    return true;
+  }
+
+  /// Converts the first video and first audio track of a DTSC file to an FLV file.
+  /// The DTSC file needs a separate .dtsh header, as written by generateStream.
+  bool writeFLV(const std::string & dtscFile, const std::string & fileName){
+    DTSC::File in(dtscFile);
+    if (!in){
+      return false;
+    }
+    DTSC::Meta meta = in.getMeta();
+    std::set<unsigned long> selected;
+    unsigned int video = 0;
+    unsigned int audio = 0;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = meta.tracks.begin(); it != meta.tracks.end(); it++){
+      if (!video && it->second.type == "video"){
+        video = it->first;
+      }
+      if (!audio && it->second.type == "audio"){
+        audio = it->first;
+      }
+    }
+    if (video){
+      selected.insert(video);
+    }
+    if (audio){
+      selected.insert(audio);
+    }
+    std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    FLV::Tag tag;
+    file.write(FLV::Header, 13);
+    tag.DTSCMetaInit(meta, selected);
+    file.write(tag.data, tag.len);
+    if (video && tag.DTSCVideoInit(meta.tracks[video])){
+      file.write(tag.data, tag.len);
+    }
+    if (audio && tag.DTSCAudioInit(meta.tracks[audio])){
+      file.write(tag.data, tag.len);
+    }
+    in.selectTracks(selected);
+    in.seek_time(0);
+    in.seekNext();
+    while (in.getPacket()){
+      if (tag.DTSCLoader(in.getPacket(), meta.tracks[in.getPacket().getTrackId()])){
+        file.write(tag.data, tag.len);
+      }
+      in.seekNext();
+    }
+    file.close();
+    return true;
+  }
+
+  /// Writes the raw frames of the first MP3 track of a DTSC file to an MP3 file.
+  bool writeMP3(const std::string & dtscFile, const std::string & fileName){
+    DTSC::File in(dtscFile);
+    if (!in){
+      return false;
+    }
+    DTSC::Meta & meta = in.getMeta();
+    std::set<unsigned long> selected;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = meta.tracks.begin(); it != meta.tracks.end(); it++){
+      if (it->second.codec == "MP3"){
+        selected.insert(it->first);
+        break;
+      }
+    }
+    if (!selected.size()){
+      return false;
+    }
+    std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    in.selectTracks(selected);
+    in.seek_time(0);
+    in.seekNext();
+    while (in.getPacket()){
+      char * data;
+      unsigned int dataLen;
+      in.getPacket().getString("data", data, dataLen);
+      file.write(data, dataLen);
+      in.seekNext();
+    }
+    file.close();
+    return true;
+  }
+}
@@ -0,0 +1,601 @@
+/// \file mist_bench.cpp
+/// Benchmarks inputs and outputs against synthetic streams.
+///
+/// All inputs buffer every page of a generated file once, in this process.
+/// All outputs are driven by a fake client over a socketpair, each connection in its own forked process,
+/// while a forked DTSC input serves the generated stream the same way MistInDTSC would.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <sstream>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <mist/amf.h>
+#include <mist/config.h>
+#include <mist/defines.h>
+#include <mist/http_parser.h>
+#include <mist/rtmpchunks.h>
+#include <mist/shared_memory.h>
+#include <mist/stream.h>
+#include <mist/timing.h>
+#include "bench.h"
+
+#if __cplusplus >= 201103L
+#define BENCH_THROWS
+#define BENCH_NOTHROW noexcept
+#else
+#define BENCH_THROWS throw(std::bad_alloc)
+#define BENCH_NOTHROW throw()
+#endif
+
+static unsigned long long allocCount = 0;
+
+/// Counts all allocations done through operator new, including those of the array and nothrow versions.
+void * operator new(size_t size) BENCH_THROWS {
+  __sync_fetch_and_add(&allocCount, 1);
+  void * p = malloc(size ? size : 1);
+  if (!p){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void * p) BENCH_NOTHROW {
+  free(p);
+}
+
+namespace Bench {
+  /// Returns the amount of calls to operator new done by this process so far.
+  unsigned long long allocations(){
+    return allocCount;
+  }
+
+  /// Makes getopt start over, so Util::Config::parseArgs can be used more than once per process.
+  void resetGetopt(){
+#if defined(__GLIBC__)
+    //glibc only reinitializes its internal state when optind is zero
+    optind = 0;
+#else
+    optreset = 1;
+    optind = 1;
+#endif
+  }
+
+  /// Returns true if name is in the comma separated list, or the list is "all".
+  bool selected(const std::string & list, const std::string & name){
+    if (list == "all"){
+      return true;
+    }
+    return (std::string(",") + list + ",").find("," + name + ",") != std::string::npos;
+  }
+
+  result::result(){
+    runs = 0;
+    packets = 0;
+    bytes = 0;
+    micros = 0;
+    cpuMicros = 0;
+    sends = 0;
+    switches = 0;
+    allocs = 0;
+    headerMicros = 0;
+  }
+
+  void result::add(const result & r){
+    runs += r.runs;
+    packets += r.packets;
+    bytes += r.bytes;
+    micros += r.micros;
+    cpuMicros += r.cpuMicros;
+    sends += r.sends;
+    switches += r.switches;
+    allocs += r.allocs;
+    headerMicros += r.headerMicros;
+  }
+
+  /// Reads and discards everything on conn until the other end closes it.
+  /// \returns False if nothing was received for 10 seconds before that.
+  static bool readUntilClosed(Socket::Connection & conn, const std::string & what){
+    long long lastData = Util::getMS();
+    while (conn.connected()){
+      if (conn.spool()){
+        lastData = Util::getMS();
+      }else if (Util::getMS() - lastData > 10000){
+        FAIL_MSG("Reading %s stalled", what.c_str());
+        return false;
+      }
+      conn.Received().clear();
+    }
+    return true;
+  }
+
+  /// Sends a GET request for url and reads the complete response.
+  /// Responses without a length that are not chunked either are read until the connection closes.
+  /// \returns False if the connection closed or stalled before the response was complete.
+  static bool httpGet(Socket::Connection & conn, const std::string & url, std::string & body){
+    HTTP::Parser H;
+    H.url = url;
+    H.SetHeader("Host", "localhost");
+    H.SetHeader("User-Agent", "MistBench/" PACKAGE_VERSION);
+    H.SendRequest(conn);
+    H.Clean();
+    long long lastData = Util::getMS();
+    while (conn.connected()){
+      if (conn.spool()){
+        lastData = Util::getMS();
+      }else if (Util::getMS() - lastData > 10000){
+        FAIL_MSG("Response to %s stalled", url.c_str());
+        return false;
+      }
+      if (conn.Received().size() && H.Read(conn)){
+        body = H.body;
+        if (H.GetHeader("Content-Length") == "" && H.GetHeader("Transfer-Encoding") != "chunked"){
+          return readUntilClosed(conn, url);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Returns the directory part of url, including the trailing slash.
+  static std::string urlBase(const std::string & url){
+    return url.substr(0, url.rfind('/') + 1);
+  }
+
+  /// Requests a single progressive download.
+  static bool clientProgressive(Socket::Connection & conn, const std::string & url, DTSC::Meta & M){
+    std::string body;
+    if (httpGet(conn, url, body)){
+      return true;
+    }
+    //a chunked response that ends by closing the connection is complete as well
+    return !conn.connected() && conn.dataDown();
+  }
+
+  /// Requests the HLS master playlist, then the first media playlist and all of its segments.
+  static bool clientHLS(Socket::Connection & conn, const std::string & url, DTSC::Meta & M){
+    std::string playlist;
+    std::string playlistUrl = url;
+    bool isMaster = true;
+    while (true){
+      if (!httpGet(conn, playlistUrl, playlist)){
+        return false;
+      }
+      std::string base = urlBase(playlistUrl);
+      std::deque<std::string> lines;
+      size_t pos = 0;
+      while (pos < playlist.size()){
+        size_t end = playlist.find('\n', pos);
+        if (end == std::string::npos){
+          end = playlist.size();
+        }
+        std::string line = playlist.substr(pos, end - pos);
+        while (line.size() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' ')){
+          line.erase(line.size() - 1);
+        }
+        if (line.size() && line[0] != '#'){
+          lines.push_back(line[0] == '/' ? line : base + line);
+        }
+        pos = end + 1;
+      }
+      if (!lines.size()){
+        return false;
+      }
+      if (isMaster && lines[0].find(".m3u8") != std::string::npos){
+        playlistUrl = lines[0];
+        isMaster = false;
+        continue;
+      }
+      std::string segment;
+      for (std::deque<std::string>::iterator it = lines.begin(); it != lines.end(); it++){
+        if (!httpGet(conn, *it, segment)){
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  /// Requests the HDS manifest, then all fragments of the first video track.
+  /// The last fragment is skipped, the HDS output only serves fragments that have a successor.
+  static bool clientHDS(Socket::Connection & conn, const std::string & url, DTSC::Meta & M){
+    std::string body;
+    if (!httpGet(conn, url, body)){
+      return false;
+    }
+    unsigned int tid = 0;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = M.tracks.begin(); it != M.tracks.end(); it++){
+      if (it->second.type == "video"){
+        tid = it->first;
+        break;
+      }
+    }
+    if (!tid){
+      return true;
+    }
+    for (unsigned int i = 1; i < M.tracks[tid].fragments.size(); ++i){
+      std::stringstream fragUrl;
+      fragUrl << urlBase(url) << tid << "-Seg1-Frag" << i;
+      if (!httpGet(conn, fragUrl.str(), body)){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Requests the smooth streaming manifest, then every fragment of every track.
+  static bool clientHSS(Socket::Connection & conn, const std::string & url, DTSC::Meta & M){
+    std::string body;
+    if (!httpGet(conn, url, body)){
+      return false;
+    }
+    for (std::map<unsigned int, DTSC::Track>::iterator it = M.tracks.begin(); it != M.tracks.end(); it++){
+      for (std::deque<DTSC::Key>::iterator key = it->second.keys.begin(); key != it->second.keys.end(); key++){
+        std::stringstream fragUrl;
+        fragUrl << urlBase(url) << "Q(" << it->second.bps * 8 << ",TrackID=" << it->first << ")/" << (it->second.type == "video" ? "V" : "A") << "(" << (unsigned long long)key->getTime() * 10000 << ")";
+        if (!httpGet(conn, fragUrl.str(), body)){
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// Does a plain RTMP handshake, plays the stream named url and reads until the output closes the connection.
+  static bool clientRTMP(Socket::Connection & conn, const std::string & url, DTSC::Meta & M){
+    //every run is a new connection, header compression may not refer to chunks sent during earlier runs
+    RTMPStream::lastsend.clear();
+    RTMPStream::chunk_snd_max = 128;
+    RTMPStream::snd_cnt = 0;
+    //C0 and C1, then wait for S0, S1 and S2 before sending C2
+    std::string handshake(1537, '\000');
+    handshake[0] = 3;
+    conn.SendNow(handshake);
+    long long start = Util::getMS();
+    while (conn.connected() && !conn.Received().available(3073)){
+      conn.spool();
+      if (Util::getMS() - start > 10000){
+        FAIL_MSG("RTMP handshake stalled");
+        return false;
+      }
+    }
+    if (!conn){
+      return false;
+    }
+    conn.Received().remove(3073);
+    conn.SendNow(handshake.data() + 1, 1536);
+
+    AMF::Object amfCmd("container", AMF::AMF0_DDV_CONTAINER);
+    amfCmd.addContent(AMF::Object("", "connect"));
+    amfCmd.addContent(AMF::Object("", 1.0));
+    amfCmd.addContent(AMF::Object(""));
+    amfCmd.getContentP(2)->addContent(AMF::Object("app", "play"));
+    amfCmd.getContentP(2)->addContent(AMF::Object("tcUrl", "rtmp://localhost/play"));
+    conn.SendNow(RTMPStream::SendChunk(3, 20, 0, amfCmd.Pack()));
+    amfCmd = AMF::Object("container", AMF::AMF0_DDV_CONTAINER);
+    amfCmd.addContent(AMF::Object("", "createStream"));
+    amfCmd.addContent(AMF::Object("", 2.0));
+    amfCmd.addContent(AMF::Object("", 0.0, AMF::AMF0_NULL));
+    conn.SendNow(RTMPStream::SendChunk(3, 20, 0, amfCmd.Pack()));
+    amfCmd = AMF::Object("container", AMF::AMF0_DDV_CONTAINER);
+    amfCmd.addContent(AMF::Object("", "play"));
+    amfCmd.addContent(AMF::Object("", 3.0));
+    amfCmd.addContent(AMF::Object("", 0.0, AMF::AMF0_NULL));
+    amfCmd.addContent(AMF::Object("", url));
+    conn.SendNow(RTMPStream::SendChunk(8, 20, 1, amfCmd.Pack()));
+
+    return readUntilClosed(conn, url);
+  }
+
+  typedef bool (*outputFunc)(Socket::Connection & conn, const std::string & streamName, result & res);
+  typedef bool (*clientFunc)(Socket::Connection & conn, const std::string & url, DTSC::Meta & M);
+  typedef bool (*inputFunc)(const std::string & fileName, const std::string & streamName, result & res);
+
+  /// A benchmarked output, with the client that drives it.
+  struct outputBench {
+    const char * name;
+    outputFunc output;
+    clientFunc client;
+    const char * url;///< The URL to request, $ is replaced by the stream name.
+  };
+
+  static outputBench outputs[] = {
+    {"FLV", outputFLV, clientProgressive, "/$.flv"},
+    {"MP4", outputMP4, clientProgressive, "/$.mp4"},
+    {"OGG", outputOGG, clientProgressive, "/$.ogg"},
+    {"MP3", outputMP3, clientProgressive, "/$.mp3"},
+    {"JSON", outputJSON, clientProgressive, "/$.json"},
+    {"HTTPTS", outputHTTPTS, clientProgressive, "/$.ts"},
+    {"HLS", outputHLS, clientHLS, "/hls/$/index.m3u8"},
+    {"HDS", outputHDS, clientHDS, "/dynamic/$/manifest.f4m"},
+    {"HSS", outputHSS, clientHSS, "/smooth/$.ism/Manifest"},
+    {"RTMP", outputRTMP, clientRTMP, "$"},
+    {0, 0, 0, 0}
+  };
+
+  static void ignoreStats(char * data, size_t len, unsigned int id){}
+
+  /// Runs a single output connection.
+  /// The output runs in a forked process on one end of a socketpair, the client in this process on the other end.
+  /// Wall clock time is measured from the fork until the output process is reaped.
+  static bool runOutput(const outputBench & bench, const std::string & streamName, DTSC::Meta & M, result & res){
+    int sock[2];
+    int report[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock)){
+      FAIL_MSG("Could not create socketpair: %s", strerror(errno));
+      return false;
+    }
+    if (pipe(report)){
+      FAIL_MSG("Could not create pipe: %s", strerror(errno));
+      ::close(sock[0]);
+      ::close(sock[1]);
+      return false;
+    }
+    unsigned long long start = Util::getMicros();
+    pid_t pid = fork();
+    if (pid == -1){
+      FAIL_MSG("Could not fork: %s", strerror(errno));
+      return false;
+    }
+    if (!pid){
+      ::close(sock[0]);
+      ::close(report[0]);
+      Socket::Connection conn(sock[1]);
+      result r;
+      if (bench.output(conn, streamName, r)){
+        if (write(report[1], &r, sizeof(r)) != sizeof(r)){
+          _exit(1);
+        }
+      }
+      _exit(0);
+    }
+    ::close(sock[1]);
+    ::close(report[1]);
+    Socket::Connection conn(sock[0]);
+    conn.setBlocking(true);
+    //wake up now and then, so the clients can detect stalled outputs
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(sock[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string url = bench.url;
+    url.replace(url.find('$'), 1, streamName);
+    bool success = bench.client(conn, url, M);
+    //stop the clock here, keep-alive outputs only notice the close after their idle wait
+    unsigned long long micros = Util::getMicros(start);
+    conn.close();
+
+    result r;
+    bool reported = (read(report[0], &r, sizeof(r)) == sizeof(r));
+    ::close(report[0]);
+    struct rusage usage;
+    int status;
+    while (wait4(pid, &status, 0, &usage) == -1 && errno == EINTR){}
+    r.runs = 1;
+    r.micros = micros;
+    r.cpuMicros = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    r.switches = usage.ru_nvcsw;
+    r.bytes = conn.dataDown();
+    res.add(r);
+    if (!reported){
+      FAIL_MSG("%s output did not report its results", bench.name);
+    }
+    return success && reported;
+  }
+
+  /// Publishes a configuration containing only streamName, so outputs and Util::startInput accept the stream.
+  static bool writeConfig(IPC::sharedSnapshot & page, const std::string & streamName, const std::string & source){
+    IPC::sharedSnapshot existing(SHM_CONF_SNAPSHOT, DEFAULT_CONF_SNAPSHOT_SIZE);
+    if (existing){
+      FAIL_MSG("A server configuration already exists. Stop the controller before benchmarking outputs.");
+      return false;
+    }
+    page.init(SHM_CONF_SNAPSHOT, DEFAULT_CONF_SNAPSHOT_SIZE, true);
+    if (!page){
+      return false;
+    }
+    JSON::Value conf;
+    conf["streams"][streamName]["name"] = streamName;
+    conf["streams"][streamName]["source"] = source;
+    return Util::publishConfig(page, conf.toPacked());
+  }
+
+  static double perSecond(unsigned long long amount, unsigned long long micros){
+    return micros ? amount * 1000000.0 / micros : 0;
+  }
+
+  /// Benchmarks all selected outputs against source, served as streamName by a forked DTSC input.
+  static void benchOutputs(Util::Config & conf, const std::string & source, const std::string & streamName, DTSC::Meta & M){
+    IPC::sharedSnapshot confPage;
+    if (!writeConfig(confPage, streamName, source)){
+      return;
+    }
+    IPC::sharedServer statServer(SHM_STATISTICS, STAT_EX_SIZE, true);
+    pid_t player = fork();
+    if (!player){
+      _exit(playDTSC(source, streamName));
+    }
+    if (player == -1){
+      FAIL_MSG("Could not fork input: %s", strerror(errno));
+      return;
+    }
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_STREAM_INDEX, streamName.c_str());
+    IPC::sharedPage streamIndex;
+    for (int i = 0; i < 100 && !streamIndex.mapped; ++i){
+      Util::sleep(100);
+      streamIndex.init(pageName, DEFAULT_META_PAGE_SIZE, false, false);
+    }
+    if (!streamIndex.mapped){
+      FAIL_MSG("Input for %s did not start", source.c_str());
+      kill(player, SIGTERM);
+      waitpid(player, 0, 0);
+      return;
+    }
+    //give the input time to write the metadata and the first pages
+    Util::sleep(500);
+
+    printf("%-8s %5s %10s %12s %10s %10s %10s %10s %10s\n", "Output", "Runs", "Packets", "Packets/s", "MiB/s", "Sends", "Allocs", "CPU ms", "Ctx sw");
+    long long runs = conf.getInteger("runs");
+    for (outputBench * it = outputs; it->name; ++it){
+      if (!selected(conf.getString("outputs"), it->name)){
+        continue;
+      }
+      result res;
+      bool success = true;
+      for (long long i = 0; i < runs; ++i){
+        success &= runOutput(*it, streamName, M, res);
+        statServer.parseEach(ignoreStats);
+      }
+      printf("%-8s %5llu %10llu %12.0f %10.2f %10llu %10llu %10llu %10llu%s\n", it->name, res.runs, res.packets, perSecond(res.packets, res.micros), perSecond(res.bytes, res.micros) / (1024 * 1024), res.sends, res.allocs, res.cpuMicros / 1000, res.switches, success ? "" : " (failed)");
+      fflush(stdout);
+    }
+    kill(player, SIGTERM);
+    waitpid(player, 0, 0);
+  }
+
+  /// A benchmarked input, with the file it reads.
+  struct inputBench {
+    const char * name;
+    inputFunc input;
+    std::string file;
+    bool generatedHeader;///< If true, the .dtsh header is removed before each run, so it is generated again.
+  };
+
+  /// Benchmarks all selected inputs.
+  static void benchInputs(Util::Config & conf, std::deque<inputBench> & inputs){
+    printf("%-8s %5s %10s %12s %10s %10s %10s\n", "Input", "Pages", "Packets", "Packets/s", "MiB/s", "Header ms", "Allocs");
+    long long runs = conf.getInteger("runs");
+    for (std::deque<inputBench>::iterator it = inputs.begin(); it != inputs.end(); it++){
+      if (!selected(conf.getString("inputs"), it->name)){
+        continue;
+      }
+      result res;
+      bool success = true;
+      for (long long i = 0; i < runs; ++i){
+        if (it->generatedHeader){
+          unlink((it->file + ".dtsh").c_str());
+        }
+        success &= it->input(it->file, "mistbench_in", res);
+      }
+      printf("%-8s %5llu %10llu %12.0f %10.2f %10llu %10llu%s\n", it->name, res.runs, res.packets, perSecond(res.packets, res.micros), perSecond(res.bytes, res.micros) / (1024 * 1024), res.headerMicros / 1000, res.allocs, success ? "" : " (failed)");
+      fflush(stdout);
+    }
+  }
+}
+
+int main(int argc, char ** argv){
+  Util::Config conf(argv[0], PACKAGE_VERSION);
+  conf.addOption("duration", JSON::fromString("{\"arg\":\"integer\", \"short\":\"d\", \"long\":\"duration\", \"value\":[60], \"help\":\"Length of the generated stream in seconds.\"}"));
+  conf.addOption("video", JSON::fromString("{\"arg\":\"integer\", \"short\":\"V\", \"long\":\"video\", \"value\":[1], \"help\":\"Amount of H264 video tracks to generate.\"}"));
+  conf.addOption("vbitrate", JSON::fromString("{\"arg\":\"integer\", \"short\":\"b\", \"long\":\"vbitrate\", \"value\":[2000], \"help\":\"Bitrate of each video track in kbit/s.\"}"));
+  conf.addOption("fps", JSON::fromString("{\"arg\":\"integer\", \"short\":\"f\", \"long\":\"fps\", \"value\":[25], \"help\":\"Frames per second of the video tracks.\"}"));
+  conf.addOption("gop", JSON::fromString("{\"arg\":\"integer\", \"short\":\"k\", \"long\":\"gop\", \"value\":[2000], \"help\":\"Keyframe interval of the video tracks in milliseconds.\"}"));
+  conf.addOption("audio", JSON::fromString("{\"arg\":\"integer\", \"short\":\"A\", \"long\":\"audio\", \"value\":[1], \"help\":\"Amount of audio tracks to generate.\"}"));
+  conf.addOption("acodec", JSON::fromString("{\"arg\":\"string\", \"short\":\"c\", \"long\":\"acodec\", \"value\":[\"AAC\"], \"help\":\"Codec of the audio tracks, AAC or MP3. The MP3 output only has data to send for MP3.\"}"));
+  conf.addOption("abitrate", JSON::fromString("{\"arg\":\"integer\", \"short\":\"a\", \"long\":\"abitrate\", \"value\":[128], \"help\":\"Bitrate of each AAC track in kbit/s. MP3 tracks are always 128 kbit/s.\"}"));
+  conf.addOption("runs", JSON::fromString("{\"arg\":\"integer\", \"short\":\"r\", \"long\":\"runs\", \"value\":[3], \"help\":\"Amount of times to run each benchmark.\"}"));
+  conf.addOption("outputs", JSON::fromString("{\"arg\":\"string\", \"short\":\"o\", \"long\":\"outputs\", \"value\":[\"all\"], \"help\":\"Comma separated list of outputs to benchmark: FLV, MP4, OGG, MP3, JSON, HTTPTS, HLS, HDS, HSS, RTMP, all or none.\"}"));
+  conf.addOption("inputs", JSON::fromString("{\"arg\":\"string\", \"short\":\"i\", \"long\":\"inputs\", \"value\":[\"all\"], \"help\":\"Comma separated list of inputs to benchmark: DTSC, FLV, MP3, OGG, all or none.\"}"));
+  conf.addOption("source", JSON::fromString("{\"arg\":\"string\", \"short\":\"S\", \"long\":\"source\", \"value\":[\"\"], \"help\":\"Existing DTSC file with separate .dtsh header to use instead of a generated stream.\"}"));
+  conf.addOption("ogg", JSON::fromString("{\"arg\":\"string\", \"short\":\"O\", \"long\":\"ogg\", \"value\":[\"\"], \"help\":\"OGG file for the OGG input benchmark, which is skipped if not given.\"}"));
+  conf.addOption("dir", JSON::fromString("{\"arg\":\"string\", \"short\":\"D\", \"long\":\"dir\", \"value\":[\"/tmp\"], \"help\":\"Directory to write the generated files to.\"}"));
+  conf.addOption("stream", JSON::fromString("{\"arg\":\"string\", \"short\":\"s\", \"long\":\"stream\", \"value\":[\"mistbench\"], \"help\":\"Name of the stream the outputs are benchmarked on.\"}"));
+  conf.addOption("checksums", JSON::fromString("{\"arg\":\"string\", \"short\":\"C\", \"long\":\"checksums\", \"value\":[\"all\"], \"help\":\"Comma separated list of CRC implementations to benchmark: bytewise, slice8, clmul, all or none.\"}"));
+  if (!conf.parseArgs(argc, argv)){
+    return 1;
+  }
+  //outputs may close the connection on us before we are done writing
+  signal(SIGPIPE, SIG_IGN);
+
+  if (conf.getString("checksums") != "none"){
+    Bench::benchChecksums(conf.getString("checksums"), conf.getInteger("runs"));
+  }
+
+  std::string dir = conf.getString("dir");
+  std::string source = conf.getString("source");
+  DTSC::Meta M;
+  if (source.size()){
+    DTSC::File F(source);
+    if (!F || !F.getMeta().tracks.size()){
+      FAIL_MSG("%s is not a DTSC file with a separate header", source.c_str());
+      return 1;
+    }
+    M = F.getMeta();
+  }else{
+    Bench::streamSettings settings;
+    settings.duration = conf.getInteger("duration");
+    settings.videoTracks = conf.getInteger("video");
+    settings.videoBitrate = conf.getInteger("vbitrate");
+    settings.fps = std::max(conf.getInteger("fps"), 1ll);
+    settings.gop = conf.getInteger("gop");
+    settings.audioTracks = conf.getInteger("audio");
+    settings.audioCodec = conf.getString("acodec");
+    settings.audioBitrate = conf.getInteger("abitrate");
+    source = dir + "/mistbench.dtsc";
+    unsigned long long start = Util::getMicros();
+    if (!Bench::generateStream(settings, source, M)){
+      return 1;
+    }
+    INFO_MSG("Generated %s in %llu ms", source.c_str(), Util::getMicros(start) / 1000);
+  }
+
+  if (conf.getString("inputs") != "none"){
+    std::deque<Bench::inputBench> inputs;
+    Bench::inputBench in;
+    in.name = "DTSC";
+    in.input = Bench::inputDTSC;
+    in.file = source;
+    in.generatedHeader = false;
+    inputs.push_back(in);
+    in.name = "FLV";
+    in.input = Bench::inputFLV;
+    in.file = dir + "/mistbench.flv";
+    in.generatedHeader = true;
+    if (Bench::writeFLV(source, in.file)){
+      inputs.push_back(in);
+    }
+    //the MP3 input only reads MP3 files, generate an audio-only stream for it
+    Bench::streamSettings mp3Settings;
+    mp3Settings.duration = (M.tracks.size() ? M.tracks.begin()->second.lastms / 1000 : 0) + 1;
+    mp3Settings.videoTracks = 0;
+    mp3Settings.videoBitrate = 0;
+    mp3Settings.fps = 1;
+    mp3Settings.gop = 0;
+    mp3Settings.audioTracks = 1;
+    mp3Settings.audioCodec = "MP3";
+    mp3Settings.audioBitrate = 128;
+    DTSC::Meta mp3Meta;
+    in.name = "MP3";
+    in.input = Bench::inputMP3;
+    in.file = dir + "/mistbench.mp3";
+    if (Bench::generateStream(mp3Settings, dir + "/mistbench_mp3.dtsc", mp3Meta) && Bench::writeMP3(dir + "/mistbench_mp3.dtsc", in.file)){
+      inputs.push_back(in);
+    }
+    if (conf.getString("ogg").size()){
+      in.name = "OGG";
+      in.input = Bench::inputOGG;
+      in.file = conf.getString("ogg");
+      in.generatedHeader = false;
+      inputs.push_back(in);
+    }
+    Bench::benchInputs(conf, inputs);
+  }
+
+  if (conf.getString("outputs") != "none"){
+    Bench::benchOutputs(conf, source, conf.getString("stream"), M);
+  }
+  return 0;
+}
@@ -1,7 +1,9 @@
 #include <dirent.h> //for browse API call
 #include <sys/stat.h> //for browse API call
+#include <strings.h> //for metrics authorization
 #include <mist/http_parser.h>
 #include <mist/auth.h>
+#include <mist/base64.h>
 #include <mist/config.h>
 #include <mist/defines.h>
 #include <mist/timing.h>
@@ -149,6 +151,30 @@ bool Controller::authorize(JSON::Value & Request, JSON::Value & Response, Socket
   return false;
 }//Authorize
 
+/// Checks whether a /metrics request may be answered.
+/// Scrapers cannot do the challenge/response login, so HTTP basic authentication against the API accounts is accepted instead.
+/// Setting `"metrics_public": true` in the config object allows unauthenticated access.
+/// Assumes the config mutex is held.
+static bool metricsAuthorized(HTTP::Parser & H){
+  if (Controller::Storage["config"]["metrics_public"].asBool()){
+    return true;
+  }
+  std::string auth = H.GetHeader("Authorization");
+  if (auth.size() < 6 || strncasecmp(auth.data(), "Basic ", 6)){
+    return false;
+  }
+  std::string creds = Base64::decode(auth.substr(6));
+  size_t colon = creds.find(':');
+  if (colon == std::string::npos || !colon){
+    return false;
+  }
+  std::string UserID = creds.substr(0, colon);
+  if (!Controller::Storage["account"].isMember(UserID)){
+    return false;
+  }
+  return Secure::md5(creds.substr(colon + 1)) == Controller::Storage["account"][UserID]["password"].asStringRef();
+}
+
 /// Handles a single incoming API connection.
 /// Assumes the connection is unauthorized and will allow for 4 requests without authorization before disconnecting.
 int Controller::handleAPIConnection(Socket::Connection & conn){
@@ -159,6 +185,34 @@ int Controller::handleAPIConnection(Socket::Connection & conn){
   //while connected and not past login attempt limit
   while (conn && logins < 4){
     if ((conn.spool() || conn.Received().size()) && H.Read(conn)){
+      //read-only metrics in Prometheus text format
+      if (H.url == "/metrics"){
+        std::string metrics;
+        bool allowed = false;
+        {
+          tthread::lock_guard<tthread::mutex> guard(configMutex);
+          allowed = authorized || metricsAuthorized(H);
+          if (allowed){
+            Controller::fillMetrics(metrics, Controller::Storage["streams"], Controller::Storage["config"]["protocols"]);
+          }
+        }
+        if (!allowed){
+          Util::sleep(1000);//sleep a second to prevent bruteforcing
+          logins++;
+          H.Clean();
+          H.SetHeader("WWW-Authenticate", "Basic realm=\"MistServer\"");
+          H.SetBody("Unauthorized\n");
+          H.SendResponse("401", "Unauthorized", conn);
+          H.Clean();
+          continue;
+        }
+        H.Clean();
+        H.SetHeader("Content-Type", "text/plain; version=0.0.4");
+        H.SetBody(metrics);
+        H.SendResponse("200", "OK", conn);
+        H.Clean();
+        continue;
+      }
       JSON::Value Response;
       JSON::Value Request = JSON::fromString(H.GetVar("command"));
       //invalid request? send the web interface, unless requested as "/api"
@@ -1,5 +1,7 @@
 #include <cstdio>
+#include <cstring>
 #include <mist/config.h>
+#include <mist/stream.h>
 #include "controller_statistics.h"
 
 // These are used to store "clients" field requests in a bitfield for speedup.
@@ -23,17 +25,115 @@
 
 std::map<Controller::sessIndex, Controller::statSession> Controller::sessions; ///< list of sessions that have statistics data available
 std::map<unsigned long, Controller::sessIndex> Controller::connToSession; ///< Map of socket IDs to session info.
+std::map<unsigned long long, Controller::statTotals> Controller::totals; ///< Per-second totals, indexed by sessIndex::totalsKey.
 tthread::mutex Controller::statsMutex;
 
+static std::vector<std::string> internNames; ///< Interned names, indexed by ID.
+static std::map<std::string, unsigned int> internIds; ///< Reverse lookup of interned names.
+static std::vector<unsigned int> internFree; ///< IDs of pruned names, reused before the table grows.
+
+/// Worker pool state of a connector, as reported by the pooled output that was handed its connection last.
+struct statPool {
+  unsigned int idle;
+  unsigned int spawned;
+  unsigned long long lastTime;///< When this pool last reported.
+};
+static std::map<unsigned int, statPool> pools; ///< Worker pool states, indexed by interned connector name.
+
+/// Returns the ID of the given stream or connector name, adding it to the table of interned names if needed.
+unsigned int Controller::internName(const std::string & name){
+  std::map<std::string, unsigned int>::iterator it = internIds.find(name);
+  if (it != internIds.end()){
+    return it->second;
+  }
+  if (internFree.size()){
+    unsigned int id = internFree.back();
+    internFree.pop_back();
+    internNames[id] = name;
+    internIds[name] = id;
+    return id;
+  }
+  internNames.push_back(name);
+  internIds[name] = internNames.size() - 1;
+  return internNames.size() - 1;
+}
+
+/// Looks up the ID of an already interned name, without adding it.
+/// Returns false if the name was never seen.
+bool Controller::findInterned(const std::string & name, unsigned int & id){
+  std::map<std::string, unsigned int>::iterator it = internIds.find(name);
+  if (it == internIds.end()){
+    return false;
+  }
+  id = it->second;
+  return true;
+}
+
+/// Drops all totals and worker pools without data since cutOff, and frees the interned names that nothing refers to anymore.
+/// Must be called with statsMutex held.
+static void pruneStats(unsigned long long cutOff){
+  std::map<unsigned int, statPool>::iterator pIt = pools.begin();
+  while (pIt != pools.end()){
+    if (pIt->second.lastTime <= cutOff){
+      pools.erase(pIt++);
+    }else{
+      ++pIt;
+    }
+  }
+  std::map<unsigned long long, Controller::statTotals>::iterator tIt = Controller::totals.begin();
+  while (tIt != Controller::totals.end()){
+    if (tIt->second.lastTime() <= cutOff){
+      Controller::totals.erase(tIt++);
+    }else{
+      ++tIt;
+    }
+  }
+  std::vector<char> used(internNames.size(), 0);
+  for (tIt = Controller::totals.begin(); tIt != Controller::totals.end(); ++tIt){
+    used[tIt->first >> 32] = 1;
+    used[tIt->first & 0xFFFFFFFFull] = 1;
+  }
+  for (std::map<Controller::sessIndex, Controller::statSession>::iterator it = Controller::sessions.begin(); it != Controller::sessions.end(); ++it){
+    used[it->first.streamId] = 1;
+    used[it->first.connectorId] = 1;
+  }
+  for (std::map<unsigned long, Controller::sessIndex>::iterator it = Controller::connToSession.begin(); it != Controller::connToSession.end(); ++it){
+    used[it->second.streamId] = 1;
+    used[it->second.connectorId] = 1;
+  }
+  for (std::map<unsigned int, statPool>::iterator it = pools.begin(); it != pools.end(); ++it){
+    used[it->first] = 1;
+  }
+  for (unsigned int id = 0; id < internNames.size(); ++id){
+    if (used[id]){continue;}
+    std::map<std::string, unsigned int>::iterator it = internIds.find(internNames[id]);
+    if (it == internIds.end() || it->second != id){continue;}//already free
+    internIds.erase(it);
+    internNames[id].clear();
+    internFree.push_back(id);
+  }
+}
+
+/// Returns the name belonging to an interned ID.
+const std::string & Controller::internedName(unsigned int id){
+  static std::string empty;
+  if (id >= internNames.size()){
+    return empty;
+  }
+  return internNames[id];
+}
+
 Controller::sessIndex::sessIndex(std::string dhost, unsigned int dcrc, std::string dstreamName, std::string dconnector){
   host = dhost;
   crc = dcrc;
-  streamName = dstreamName;
-  connector = dconnector;
+  streamId = internName(dstreamName);
+  connectorId = internName(dconnector);
 }
 
 Controller::sessIndex::sessIndex(){
   crc = 0;
+  streamId = internName("");
+  connectorId = streamId;
 }
 
 /// Initializes a sessIndex from a statExchange object, converting binary format IP addresses into strings.
@@ -49,14 +149,28 @@ Controller::sessIndex::sessIndex(IPC::statExchange & data){
     snprintf(tmpstr, 40, "%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x:%0.2x%0.2x", tHost[0], tHost[1], tHost[2], tHost[3], tHost[4], tHost[5], tHost[6], tHost[7], tHost[8], tHost[9], tHost[10], tHost[11], tHost[12], tHost[13], tHost[14], tHost[15]);
     host = tmpstr;
   }
-  streamName = data.streamName();
-  connector = data.connector();
+  streamId = internName(data.streamName());
+  connectorId = internName(data.connector());
   crc = data.crc();
 }
 
+/// Returns the name of the stream of this session.
+const std::string & Controller::sessIndex::streamName() const{
+  return internedName(streamId);
+}
+
+/// Returns the name of the connector of this session.
+const std::string & Controller::sessIndex::connector() const{
+  return internedName(connectorId);
+}
+
+/// Returns the key of the totals this session is counted in: the stream and connector combined.
+unsigned long long Controller::sessIndex::totalsKey() const{
+  return ((unsigned long long)streamId << 32) | connectorId;
+}
 
 bool Controller::sessIndex::operator== (const Controller::sessIndex &b) const{
-  return (host == b.host && crc == b.crc && streamName == b.streamName && connector == b.connector);
+  return (crc == b.crc && streamId == b.streamId && connectorId == b.connectorId && host == b.host);
 }
 
 bool Controller::sessIndex::operator!= (const Controller::sessIndex &b) const{
@@ -64,11 +178,14 @@ bool Controller::sessIndex::operator!= (const Controller::sessIndex &b) const{
 }
 
 bool Controller::sessIndex::operator> (const Controller::sessIndex &b) const{
-  return host > b.host || (host == b.host && (crc > b.crc || (crc == b.crc && (streamName > b.streamName || (streamName == b.streamName && connector > b.connector)))));
+  return b < *this;
 }
 
 bool Controller::sessIndex::operator< (const Controller::sessIndex &b) const{
-  return host < b.host || (host == b.host && (crc < b.crc || (crc == b.crc && (streamName < b.streamName || (streamName == b.streamName && connector < b.connector)))));
+  if (streamId != b.streamId){return streamId < b.streamId;}
+  if (connectorId != b.connectorId){return connectorId < b.connectorId;}
+  if (crc != b.crc){return crc < b.crc;}
+  return host < b.host;
 }
 
 bool Controller::sessIndex::operator<= (const Controller::sessIndex &b) const{
@@ -91,13 +208,20 @@ void Controller::SharedMemStats(void * config){
       tthread::lock_guard<tthread::mutex> guard(statsMutex);
       //parse current users
       statServer.parseEach(parseStatistics);
-      //wipe old statistics
+      //wipe old statistics, and sessions that have nothing left
       if (sessions.size()){
         unsigned long long cutOffPoint = Util::epoch() - STAT_CUTOFF;
-        for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); it++){
+        std::map<sessIndex, statSession>::iterator it = sessions.begin();
+        while (it != sessions.end()){
           it->second.wipeOld(cutOffPoint);
+          if (!it->second.isActive() && !it->second.hasData()){
+            sessions.erase(it++);
+          }else{
+            ++it;
+          }
         }
       }
+      pruneStats(Util::epoch() - STAT_CUTOFF);
     }
     Util::sleep(1000);
   }
@@ -105,11 +229,37 @@ void Controller::SharedMemStats(void * config){
 }
 
 /// Updates the given active connection with new stats data.
-void Controller::statSession::update(unsigned long index, IPC::statExchange & data){
-  curConns[index].update(data);
+/// The session is counted as a client in the given totals once per second, and the bytes transferred
+/// and pipeline counters since the previous update of this connection are added to them.
+void Controller::statSession::update(unsigned long index, IPC::statExchange & data, statTotals & tot){
+  statStorage & conn = curConns[index];
+  long long prevDown = 0;
+  long long prevUp = 0;
+  if (!conn.empty()){
+    prevDown = conn.newest().down;
+    prevUp = conn.newest().up;
+  }
+  unsigned long long now = data.now();
+  bool newSample = conn.empty() || now > conn.lastTime();
+  conn.update(data);
+  if (conn.newest().down > prevDown || conn.newest().up > prevUp){
+    tot.addBytes(now, std::max(conn.newest().down - prevDown, 0ll), std::max(conn.newest().up - prevUp, 0ll));
+  }
+  tot.addPipeline(data, conn.pipeline);
+  if (newSample && data.liveLag()){
+    tot.addLiveLag(now, data.liveLag());
+  }
   //store timestamp of last received data, if newer
-  if (data.now() > lastSec){
-    lastSec = data.now();
+  //the session counts as a client in every second since its previous data, like hasDataFor reports it
+  if (now > lastSec){
+    unsigned long long sec = now;
+    if (lastSec && lastSec + STAT_CUTOFF > now){
+      sec = lastSec + 1;
+    }
+    for (; sec <= now; ++sec){
+      tot.addClient(sec);
+    }
+    lastSec = now;
   }
   //store timestamp of first received data, if older
   if (firstSec > data.now()){
@@ -125,19 +275,24 @@ void Controller::statSession::wipeOld(unsigned long long cutOff){
   firstSec = 0xFFFFFFFFFFFFFFFFull;
   if (oldConns.size()){
     for (std::deque<statStorage>::iterator it = oldConns.begin(); it != oldConns.end(); ++it){
-      while (it->log.size() && it->log.begin()->first < cutOff){
-        it->log.erase(it->log.begin());
-      }
-      if (it->log.size()){
-        if (firstSec > it->log.begin()->first){
-          firstSec = it->log.begin()->first;
+      it->wipeOld(cutOff);
+      if (!it->empty()){
+        if (firstSec > it->firstTime()){
+          firstSec = it->firstTime();
         }
       }
     }
-    while (oldConns.size() && !oldConns.begin()->log.size()){
+    while (oldConns.size() && oldConns.begin()->empty()){
       oldConns.pop_front();
     }
   }
+  if (curConns.size()){
+    for (std::map<unsigned long, statStorage>::iterator it = curConns.begin(); it != curConns.end(); ++it){
+      if (!it->second.empty() && firstSec > it->second.firstTime()){
+        firstSec = it->second.firstTime();
+      }
+    }
+  }
 }
 
 /// Archives the given connection.
@@ -157,40 +312,40 @@ void Controller::statSession::switchOverTo(statSession & newSess, unsigned long
   //add to the given session first
   newSess.curConns[index] = curConns[index];
   //if this connection has data, update firstSec/lastSec if needed
-  if (curConns[index].log.size()){
-    if (newSess.firstSec > curConns[index].log.begin()->first){
-      newSess.firstSec = curConns[index].log.begin()->first;
+  if (!curConns[index].empty()){
+    if (newSess.firstSec > curConns[index].firstTime()){
+      newSess.firstSec = curConns[index].firstTime();
     }
-    if (newSess.lastSec < curConns[index].log.rbegin()->first){
-      newSess.lastSec = curConns[index].log.rbegin()->first;
+    if (newSess.lastSec < curConns[index].lastTime()){
+      newSess.lastSec = curConns[index].lastTime();
     }
   }
   //remove from current session
   curConns.erase(index);
   //if there was any data, recalculate this session's firstSec and lastSec.
-  if (newSess.curConns[index].log.size()){
+  if (!newSess.curConns[index].empty()){
     firstSec = 0xFFFFFFFFFFFFFFFFull;
     lastSec = 0;
     if (oldConns.size()){
       for (std::deque<statStorage>::iterator it = oldConns.begin(); it != oldConns.end(); ++it){
-        if (it->log.size()){
-          if (firstSec > it->log.begin()->first){
-            firstSec = it->log.begin()->first;
+        if (!it->empty()){
+          if (firstSec > it->firstTime()){
+            firstSec = it->firstTime();
           }
-          if (lastSec < it->log.rbegin()->first){
-            lastSec = it->log.rbegin()->first;
+          if (lastSec < it->lastTime()){
+            lastSec = it->lastTime();
           }
         }
       }
     }
     if (curConns.size()){
       for (std::map<unsigned long, statStorage>::iterator it = curConns.begin(); it != curConns.end(); ++it){
-        if (it->second.log.size()){
-          if (firstSec > it->second.log.begin()->first){
-            firstSec = it->second.log.begin()->first;
+        if (!it->second.empty()){
+          if (firstSec > it->second.firstTime()){
+            firstSec = it->second.firstTime();
           }
-          if (lastSec < it->second.log.rbegin()->first){
-            lastSec = it->second.log.rbegin()->first;
+          if (lastSec < it->second.lastTime()){
+            lastSec = it->second.lastTime();
           }
         }
       }
@@ -230,17 +385,22 @@ bool Controller::statSession::hasData(){
   if (!firstSec && !lastSec){return false;}
   if (oldConns.size()){
     for (std::deque<statStorage>::iterator it = oldConns.begin(); it != oldConns.end(); ++it){
-      if (it->log.size()){return true;}
+      if (!it->empty()){return true;}
     }
   }
   if (curConns.size()){
     for (std::map<unsigned long, statStorage>::iterator it = curConns.begin(); it != curConns.end(); ++it){
-      if (it->second.log.size()){return true;}
+      if (!it->second.empty()){return true;}
     }
   }
   return false;
 }
 
+/// Returns true if this session has any connections that are still open.
+bool Controller::statSession::isActive(){
+  return curConns.size();
+}
+
 /// Returns the cumulative connected time for this session at timestamp t.
 long long Controller::statSession::getConnTime(unsigned long long t){
   long long retVal = 0;
@@ -352,45 +512,266 @@ long long Controller::statSession::getBpsUp(unsigned long long t){
   }
 }
 
+/// Constructs an empty ring buffer. Memory is only allocated as samples come in.
+Controller::statStorage::statStorage(){
+  first = 0;
+  count = 0;
+}
+
+/// Returns the i-th oldest sample.
+Controller::statLog & Controller::statStorage::at(unsigned int i){
+  return log[(first + i) % log.size()];
+}
+
+/// Returns the i-th oldest sample.
+const Controller::statLog & Controller::statStorage::at(unsigned int i) const{
+  return log[(first + i) % log.size()];
+}
+
+/// Returns true if no samples are stored.
+bool Controller::statStorage::empty() const{
+  return !count;
+}
+
+/// Returns the timestamp of the oldest sample. Only valid if not empty.
+unsigned long long Controller::statStorage::firstTime() const{
+  return at(0).now;
+}
+
+/// Returns the timestamp of the newest sample. Only valid if not empty.
+unsigned long long Controller::statStorage::lastTime() const{
+  return at(count - 1).now;
+}
+
+/// Returns the newest sample. Only valid if not empty.
+const Controller::statLog & Controller::statStorage::newest() const{
+  return at(count - 1);
+}
+
+/// Drops all samples older than cutOff.
+void Controller::statStorage::wipeOld(unsigned long long cutOff){
+  while (count && at(0).now < cutOff){
+    first = (first + 1) % log.size();
+    --count;
+  }
+  if (!count){
+    std::vector<statLog>().swap(log);
+    first = 0;
+  }
+}
+
 /// Returns true if there is data available for timestamp t.
 bool Controller::statStorage::hasDataFor(unsigned long long t) {
-  if (!log.size()){return false;}
-  return (t >= log.begin()->first);
+  if (!count){return false;}
+  return (t >= firstTime());
 }
 
 /// Returns a reference to the most current data available at timestamp t.
+/// Samples are kept in time order, so this is a binary search.
 Controller::statLog & Controller::statStorage::getDataFor(unsigned long long t) {
   static statLog empty;
-  if (!log.size()){
+  if (!count){
+    empty.now = 0;
     empty.time = 0;
     empty.lastSecond = 0;
     empty.down = 0;
     empty.up = 0;
     return empty;
   }
-  std::map<unsigned long long, statLog>::iterator it = log.upper_bound(t);
-  if (it != log.begin()){
-    it--;
+  //find the first sample newer than t, return the one before it
+  unsigned int lo = 0;
+  unsigned int hi = count;
+  while (lo < hi){
+    unsigned int mid = (lo + hi) / 2;
+    if (at(mid).now <= t){
+      lo = mid + 1;
+    }else{
+      hi = mid;
+    }
   }
-  return it->second;
+  return at(lo ? lo - 1 : 0);
 }
 
 /// This function is called by parseStatistics.
 /// It updates the internally saved statistics data.
+/// A sample for a second that is already stored replaces it, and once STAT_CUTOFF samples are stored the oldest one is overwritten.
 void Controller::statStorage::update(IPC::statExchange & data) {
   statLog tmp;
+  tmp.now = data.now();
   tmp.time = data.time();
   tmp.lastSecond = data.lastSecond();
   tmp.down = data.down();
   tmp.up = data.up();
-  log[data.now()] = tmp;
-  //wipe data older than approx. STAT_CUTOFF seconds
-  /// \todo Remove least interesting data first.
-  if (log.size() > STAT_CUTOFF){
-    log.erase(log.begin());
+  if (count && lastTime() >= tmp.now){
+    if (lastTime() == tmp.now){
+      at(count - 1) = tmp;
+    }
+    return;
+  }
+  if (count < log.size()){
+    at(count) = tmp;
+    ++count;
+    return;
   }
+  if (log.size() < STAT_CUTOFF){
+    //not full yet: grow, keeping the samples in order
+    std::vector<statLog> tmpLog;
+    tmpLog.reserve(std::min(log.size() * 2 + 8, (size_t)STAT_CUTOFF));
+    for (unsigned int i = 0; i < count; ++i){
+      tmpLog.push_back(at(i));
+    }
+    tmpLog.push_back(tmp);
+    tmpLog.resize(std::min(log.size() * 2 + 8, (size_t)STAT_CUTOFF));
+    log.swap(tmpLog);
+    first = 0;
+    ++count;
+    return;
+  }
+  //full: overwrite the oldest sample
+  log[first] = tmp;
+  first = (first + 1) % log.size();
 }
-  
+
+/// Constructs empty totals.
+Controller::statPipeline::statPipeline(){
+  rebuffers = 0;
+}
+
+Controller::statTotals::statTotals(){
+  totalDown = 0;
+  totalUp = 0;
+  rebuffers = 0;
+  newest = 0;
+  memset(log, 0, sizeof(log));
+}
+
+/// Returns the most recent timestamp anything was counted at, or zero if nothing was.
+unsigned long long Controller::statTotals::lastTime() const{
+  return newest;
+}
+
+/// Returns the entry for timestamp t, clearing it first if it still holds data from STAT_CUTOFF seconds ago or more.
+Controller::statTotals::entry & Controller::statTotals::at(unsigned long long t){
+  entry & e = log[t % STAT_CUTOFF];
+  if (t > newest){
+    newest = t;
+  }
+  if (e.now != t){
+    e.now = t;
+    e.clients = 0;
+    e.down = 0;
+    e.up = 0;
+    e.lagSum = 0;
+    e.lagCount = 0;
+    e.lagMax = 0;
+  }
+  return e;
+}
+
+/// Counts one more client at timestamp t.
+void Controller::statTotals::addClient(unsigned long long t){
+  ++at(t).clients;
+}
+
+/// Adds transferred bytes at timestamp t.
+void Controller::statTotals::addBytes(unsigned long long t, long long down, long long up){
+  entry & e = at(t);
+  e.down += down;
+  e.up += up;
+  totalDown += down;
+  totalUp += up;
+}
+
+/// Returns the amount of bytes downloaded since the controller started.
+long long Controller::statTotals::getTotalDown(){
+  return totalDown;
+}
+
+/// Returns the amount of bytes uploaded since the controller started.
+long long Controller::statTotals::getTotalUp(){
+  return totalUp;
+}
+
+/// Adds the pipeline counters that changed since last, and stores the new counters in last.
+void Controller::statTotals::addPipeline(IPC::statExchange & data, statPipeline & last){
+  unsigned int newRebuffers = data.rebuffers();
+  rebuffers += (unsigned int)(newRebuffers - last.rebuffers);
+  last.rebuffers = newRebuffers;
+  Util::durationHist newHist = data.pageWait();
+  pageWait.addDiff(newHist, last.pageWait);
+  last.pageWait = newHist;
+  newHist = data.sendBlock();
+  sendBlock.addDiff(newHist, last.sendBlock);
+  last.sendBlock = newHist;
+}
+
+/// Adds the live edge distance of one connection at timestamp t.
+void Controller::statTotals::addLiveLag(unsigned long long t, unsigned int ms){
+  entry & e = at(t);
+  e.lagSum += ms;
+  ++e.lagCount;
+  if (e.lagMax < ms){
+    e.lagMax = ms;
+  }
+}
+
+/// Returns the average live edge distance in ms at timestamp t, over connections that reported one.
+long long Controller::statTotals::getLiveLag(unsigned long long t){
+  entry & e = log[t % STAT_CUTOFF];
+  return (e.now == t && e.lagCount) ? e.lagSum / e.lagCount : 0;
+}
+
+/// Returns the largest live edge distance in ms at timestamp t.
+long long Controller::statTotals::getLiveLagMax(unsigned long long t){
+  entry & e = log[t % STAT_CUTOFF];
+  return (e.now == t) ? e.lagMax : 0;
+}
+
+/// Returns the amount of playback stalls since the controller started.
+long long Controller::statTotals::getRebuffers(){
+  return rebuffers;
+}
+
+/// Returns the data page wait times since the controller started.
+const Util::durationHist & Controller::statTotals::getPageWait(){
+  return pageWait;
+}
+
+/// Returns the blocking send times since the controller started.
+const Util::durationHist & Controller::statTotals::getSendBlock(){
+  return sendBlock;
+}
+
+/// Returns the amount of clients at timestamp t.
+long long Controller::statTotals::getClients(unsigned long long t){
+  entry & e = log[t % STAT_CUTOFF];
+  return (e.now == t) ? e.clients : 0;
+}
+
+/// Returns the downloaded bytes per second, averaged over the 5 seconds up to timestamp t.
+long long Controller::statTotals::getBpsDown(unsigned long long t){
+  long long sum = 0;
+  for (unsigned long long i = t - 4; i <= t; ++i){
+    entry & e = log[i % STAT_CUTOFF];
+    if (e.now == i){
+      sum += e.down;
+    }
+  }
+  return sum / 5;
+}
+
+/// Returns the uploaded bytes per second, averaged over the 5 seconds up to timestamp t.
+long long Controller::statTotals::getBpsUp(unsigned long long t){
+  long long sum = 0;
+  for (unsigned long long i = t - 4; i <= t; ++i){
+    entry & e = log[i % STAT_CUTOFF];
+    if (e.now == i){
+      sum += e.up;
+    }
+  }
+  return sum / 5;
+}
+
 /// This function is called by the shared memory page that holds statistics.
 /// It updates the internally saved statistics data, moving across sessions or archiving when neccessary.
 void Controller::parseStatistics(char * data, size_t len, unsigned int id){
@@ -399,38 +780,72 @@ void Controller::parseStatistics(char * data, size_t len, unsigned int id){
   //calculate the current session index, store as idx.
   sessIndex idx(tmpEx);
   //if the connection was already indexed and it has changed, move it
-  if (connToSession.count(id) && connToSession[id] != idx){
-    sessions[connToSession[id]].switchOverTo(sessions[idx], id);
-    if (!sessions[connToSession[id]].hasData()){
-      sessions.erase(connToSession[id]);
+  std::map<unsigned long, sessIndex>::iterator connIt = connToSession.find(id);
+  if (connIt != connToSession.end() && connIt->second != idx){
+    std::map<sessIndex, statSession>::iterator oldSess = sessions.find(connIt->second);
+    if (oldSess != sessions.end()){
+      oldSess->second.switchOverTo(sessions[idx], id);
+      if (!oldSess->second.hasData()){
+        sessions.erase(oldSess);
+      }
     }
   }
   //store the index for later comparison
   connToSession[id] = idx;
+  //the highest spawn count is the most recent hand-over
+  if (tmpEx.poolSpawned()){
+    statPool & pool = pools[idx.connectorId];
+    if (tmpEx.poolSpawned() >= pool.spawned){
+      pool.idle = tmpEx.poolIdle();
+      pool.spawned = tmpEx.poolSpawned();
+    }
+    pool.lastTime = tmpEx.now();
+  }
   //update the session with the latest data
-  sessions[idx].update(id, tmpEx);
+  statSession & sess = sessions[idx];
+  sess.update(id, tmpEx, totals[idx.totalsKey()]);
   //check validity of stats data
   char counter = (*(data - 1));
   if (counter == 126 || counter == 127 || counter == 254 || counter == 255){
     //the data is no longer valid - connection has gone away, store for later
-    sessions[idx].finish(id);
+    sess.finish(id);
     connToSession.erase(id);
   }
 }
 
 /// Returns true if this stream has at least one connected client.
+/// Looks at the per-stream totals of the current and previous second, so this does not depend on the amount of sessions.
 bool Controller::hasViewers(std::string streamName){
-  if (sessions.size()){
-    long long currTime = Util::epoch();
-    for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); it++){
-      if (it->first.streamName == streamName && it->second.hasDataFor(currTime)){
-        return true;
-      }
+  tthread::lock_guard<tthread::mutex> guard(statsMutex);
+  unsigned int streamId;
+  if (!findInterned(streamName, streamId)){
+    return false;
+  }
+  long long currTime = Util::epoch();
+  std::map<unsigned long long, statTotals>::iterator it = totals.lower_bound((unsigned long long)streamId << 32);
+  for (; it != totals.end() && (it->first >> 32) == streamId; ++it){
+    if (it->second.getClients(currTime) || it->second.getClients(currTime - 1)){
+      return true;
     }
   }
   return false;
 }
 
+/// Reads an array of names from req[field] and stores the interned IDs of those names in ids.
+/// Returns true if the request filters on this field; names that were never seen can't match anything.
+static bool getInternedFilter(JSON::Value & req, const char * field, std::set<unsigned int> & ids){
+  if (!req.isMember(field) || !req[field].size()){
+    return false;
+  }
+  for (JSON::ArrIter it = req[field].ArrBegin(); it != req[field].ArrEnd(); it++){
+    unsigned int id;
+    if (Controller::findInterned((*it).asStringRef(), id)){
+      ids.insert(id);
+    }
+  }
+  return true;
+}
+
 /// This takes a "clients" request, and fills in the response data.
 /// 
 /// \api
@@ -499,20 +914,11 @@ void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
   }
   //select all, if none selected
   if (!fields){fields = STAT_CLI_ALL;}
-  //figure out what streams are wanted
-  std::set<std::string> streams;
-  if (req.isMember("streams") && req["streams"].size()){
-    for (JSON::ArrIter it = req["streams"].ArrBegin(); it != req["streams"].ArrEnd(); it++){
-      streams.insert((*it).asStringRef());
-    }
-  }
-  //figure out what protocols are wanted
-  std::set<std::string> protos;
-  if (req.isMember("protocols") && req["protocols"].size()){
-    for (JSON::ArrIter it = req["protocols"].ArrBegin(); it != req["protocols"].ArrEnd(); it++){
-      protos.insert((*it).asStringRef());
-    }
-  }
+  //figure out what streams and protocols are wanted
+  std::set<unsigned int> streams;
+  std::set<unsigned int> protos;
+  bool filterStreams = getInternedFilter(req, "streams", streams);
+  bool filterProtos = getInternedFilter(req, "protocols", protos);
   //output the selected fields
   rep["fields"].null();
   if (fields & STAT_CLI_HOST){rep["fields"].append("host");}
@@ -533,12 +939,12 @@ void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
       unsigned long long time = reqTime;
       if (now && reqTime - it->second.getEnd() < 5){time = it->second.getEnd();}
       //data present and wanted? insert it!
-      if ((it->second.getEnd() >= time && it->second.getStart() <= time) && (!streams.size() || streams.count(it->first.streamName)) && (!protos.size() || protos.count(it->first.connector))){
+      if ((it->second.getEnd() >= time && it->second.getStart() <= time) && (!filterStreams || streams.count(it->first.streamId)) && (!filterProtos || protos.count(it->first.connectorId))){
         if (it->second.hasDataFor(time)){
           JSON::Value d;
           if (fields & STAT_CLI_HOST){d.append(it->first.host);}
-          if (fields & STAT_CLI_STREAM){d.append(it->first.streamName);}
-          if (fields & STAT_CLI_PROTO){d.append(it->first.connector);}
+          if (fields & STAT_CLI_STREAM){d.append(it->first.streamName());}
+          if (fields & STAT_CLI_PROTO){d.append(it->first.connector());}
           if (fields & STAT_CLI_CONNTIME){d.append(it->second.getConnTime(time));}
           if (fields & STAT_CLI_POSITION){d.append(it->second.getLastSecond(time));}
           if (fields & STAT_CLI_DOWN){d.append(it->second.getDown(time));}
@@ -561,8 +967,8 @@ class totalsData {
       downbps = 0;
       upbps = 0;
     }
-    void add(unsigned int down, unsigned int up){
-      clients++;
+    void add(long long count, long long down, long long up){
+      clients += count;
       downbps += down;
       upbps += up;
     }
@@ -646,19 +1052,14 @@ void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
   }
   //select all, if none selected
   if (!fields){fields = STAT_TOT_ALL;}
-  //figure out what streams are wanted
-  std::set<std::string> streams;
-  if (req.isMember("streams") && req["streams"].size()){
-    for (JSON::ArrIter it = req["streams"].ArrBegin(); it != req["streams"].ArrEnd(); it++){
-      streams.insert((*it).asStringRef());
-    }
-  }
-  //figure out what protocols are wanted
-  std::set<std::string> protos;
-  if (req.isMember("protocols") && req["protocols"].size()){
-    for (JSON::ArrIter it = req["protocols"].ArrBegin(); it != req["protocols"].ArrEnd(); it++){
-      protos.insert((*it).asStringRef());
-    }
+  //figure out what streams and protocols are wanted
+  std::set<unsigned int> streams;
+  std::set<unsigned int> protos;
+  bool filterStreams = getInternedFilter(req, "streams", streams);
+  bool filterProtos = getInternedFilter(req, "protocols", protos);
+  //there is no data from before the cutoff
+  if (reqStart < Util::epoch() - STAT_CUTOFF){
+    reqStart = Util::epoch() - STAT_CUTOFF;
   }
   //output the selected fields
   rep["fields"].null();
@@ -667,17 +1068,16 @@ void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
   if (fields & STAT_TOT_BPS_UP){rep["fields"].append("upbps");}
   //start data collection
   std::map<long long unsigned int, totalsData> totalsCount;
-  //loop over all sessions
+  //loop over the pre-aggregated totals of all wanted stream/protocol combinations
   /// \todo Make the interval configurable instead of 1 second
-  if (sessions.size()){
-    for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); it++){
-      //data present and wanted? insert it!
-      if ((it->second.getEnd() >= (unsigned long long)reqStart || it->second.getStart() <= (unsigned long long)reqEnd) && (!streams.size() || streams.count(it->first.streamName)) && (!protos.size() || protos.count(it->first.connector))){
-        for (unsigned long long i = reqStart; i <= reqEnd; ++i){
-          if (it->second.hasDataFor(i)){
-            totalsCount[i].add(it->second.getBpsDown(i), it->second.getBpsUp(i));
-          }
-        }
+  for (std::map<unsigned long long, statTotals>::iterator it = totals.begin(); it != totals.end(); it++){
+    if ((filterStreams && !streams.count(it->first >> 32)) || (filterProtos && !protos.count(it->first & 0xFFFFFFFFull))){
+      continue;
+    }
+    for (long long i = reqStart; i <= reqEnd; ++i){
+      long long clients = it->second.getClients(i);
+      if (clients){
+        totalsCount[i].add(clients, it->second.getBpsDown(i), it->second.getBpsUp(i));
       }
     }
   }
@@ -725,3 +1125,237 @@ void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
   }
   //all done! return is by reference, so no need to return anything here.
 }
+
+/// Appends a label value to out, escaped as required by the Prometheus text format.
+static void addLabel(std::string & out, const char * name, const std::string & value){
+  if (out.size() && out[out.size() - 1] != '{'){
+    out += ',';
+  }
+  out += name;
+  out += "=\"";
+  for (unsigned int i = 0; i < value.size(); ++i){
+    switch (value[i]){
+      case '\\': out += "\\\\"; break;
+      case '"': out += "\\\""; break;
+      case '\n': out += "\\n"; break;
+      default: out += value[i]; break;
+    }
+  }
+  out += '"';
+}
+
+/// Appends a single sample line to out. Labels, if any, must already be formatted by addLabel.
+static void addSample(std::string & out, const char * name, const std::string & labels, long long value){
+  char val[32];
+  snprintf(val, 32, " %lld\n", value);
+  out += name;
+  if (labels.size()){
+    out += '{';
+    out += labels;
+    out += '}';
+  }
+  out += val;
+}
+
+/// Appends the HELP and TYPE lines of a metric to out.
+static void addHeader(std::string & out, const char * name, const char * type, const char * help){
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+/// Appends the bucket, sum and count samples of a histogram to out, with cumulative buckets as Prometheus expects.
+static void addHistogram(std::string & out, const char * name, const std::string & labels, const Util::durationHist & hist){
+  std::string metric = std::string(name) + "_bucket";
+  unsigned long long cumulative = 0;
+  char le[16];
+  for (unsigned int i = 0; i < DURATION_BUCKETS; ++i){
+    cumulative += hist.count[i];
+    std::string bucketLabels = labels;
+    if (Util::durationHist::bucketLimit(i)){
+      snprintf(le, 16, "%u", Util::durationHist::bucketLimit(i));
+      addLabel(bucketLabels, "le", le);
+    }else{
+      addLabel(bucketLabels, "le", "+Inf");
+    }
+    addSample(out, metric.c_str(), bucketLabels, cumulative);
+  }
+  metric = std::string(name) + "_sum";
+  addSample(out, metric.c_str(), labels, hist.sum);
+  metric = std::string(name) + "_count";
+  addSample(out, metric.c_str(), labels, cumulative);
+}
+
+/// Renders current statistics in the Prometheus text exposition format into out.
+/// Per-stream and per-protocol values are read directly from the pre-aggregated totals,
+/// stream and connector state from the given streams and protocols configuration.
+/// The caller is expected to hold the config mutex; this function locks the stats mutex itself.
+void Controller::fillMetrics(std::string & out, JSON::Value & streams, JSON::Value & protocols){
+  long long now = Util::epoch();
+  std::string labels;
+  {
+    tthread::lock_guard<tthread::mutex> guard(statsMutex);
+    long long activeSessions = 0;
+    for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); ++it){
+      if (it->second.isActive()){
+        ++activeSessions;
+      }
+    }
+    addHeader(out, "mist_sessions", "gauge", "Sessions with at least one open connection.");
+    addSample(out, "mist_sessions", "", activeSessions);
+    addHeader(out, "mist_connections", "gauge", "Open connections to output processes.");
+    addSample(out, "mist_connections", "", connToSession.size());
+    //every open connection is served by its own output process
+    std::map<unsigned long long, long long> outputs;
+    for (std::map<unsigned long, sessIndex>::iterator it = connToSession.begin(); it != connToSession.end(); ++it){
+      ++outputs[it->second.totalsKey()];
+    }
+    addHeader(out, "mist_outputs", "gauge", "Output processes serving a connection, per stream and protocol.");
+    for (std::map<unsigned long long, long long>::iterator it = outputs.begin(); it != outputs.end(); ++it){
+      labels.clear();
+      addLabel(labels, "stream", internedName(it->first >> 32));
+      addLabel(labels, "protocol", internedName(it->first & 0xFFFFFFFFull));
+      addSample(out, "mist_outputs", labels, it->second);
+    }
+
+    //streams and protocols that had no data within STAT_CUTOFF are expired, and are not reported anymore
+    std::vector<std::map<unsigned long long, statTotals>::iterator> live;
+    for (std::map<unsigned long long, statTotals>::iterator it = totals.begin(); it != totals.end(); ++it){
+      if (it->second.lastTime() + STAT_CUTOFF > (unsigned long long)now){
+        live.push_back(it);
+      }
+    }
+
+    static const char * names[] = {"mist_viewers", "mist_bps_down", "mist_bps_up", "mist_bytes_down_total", "mist_bytes_up_total", "mist_live_lag_ms", "mist_live_lag_max_ms", "mist_rebuffers_total"};
+    static const char * types[] = {"gauge", "gauge", "gauge", "counter", "counter", "gauge", "gauge", "counter"};
+    static const char * helps[] = {"Viewers per stream and protocol.", "Bytes per second received from viewers, averaged over 5 seconds.", "Bytes per second sent to viewers, averaged over 5 seconds.", "Bytes received from viewers.", "Bytes sent to viewers.", "Average distance of live viewers to the live edge.", "Largest distance of a live viewer to the live edge.", "Times playback stalled waiting for new live data."};
+    for (unsigned int m = 0; m < 8; ++m){
+      addHeader(out, names[m], types[m], helps[m]);
+      for (unsigned int l = 0; l < live.size(); ++l){
+        std::map<unsigned long long, statTotals>::iterator it = live[l];
+        labels.clear();
+        addLabel(labels, "stream", internedName(it->first >> 32));
+        addLabel(labels, "protocol", internedName(it->first & 0xFFFFFFFFull));
+        long long value = 0;
+        switch (m){
+          //the current second may not have been parsed yet
+          case 0: value = std::max(it->second.getClients(now), it->second.getClients(now - 1)); break;
+          case 1: value = it->second.getBpsDown(now - 1); break;
+          case 2: value = it->second.getBpsUp(now - 1); break;
+          case 3: value = it->second.getTotalDown(); break;
+          case 4: value = it->second.getTotalUp(); break;
+          case 5: value = it->second.getLiveLag(now - 1); break;
+          case 6: value = it->second.getLiveLagMax(now - 1); break;
+          case 7: value = it->second.getRebuffers(); break;
+        }
+        addSample(out, names[m], labels, value);
+      }
+    }
+    addHeader(out, "mist_page_wait_ms", "histogram", "Time outputs spent waiting for data pages to become available.");
+    for (unsigned int l = 0; l < live.size(); ++l){
+      std::map<unsigned long long, statTotals>::iterator it = live[l];
+      labels.clear();
+      addLabel(labels, "stream", internedName(it->first >> 32));
+      addLabel(labels, "protocol", internedName(it->first & 0xFFFFFFFFull));
+      addHistogram(out, "mist_page_wait_ms", labels, it->second.getPageWait());
+    }
+    addHeader(out, "mist_send_block_ms", "histogram", "Time outputs spent blocked sending data to viewers.");
+    for (unsigned int l = 0; l < live.size(); ++l){
+      std::map<unsigned long long, statTotals>::iterator it = live[l];
+      labels.clear();
+      addLabel(labels, "stream", internedName(it->first >> 32));
+      addLabel(labels, "protocol", internedName(it->first & 0xFFFFFFFFull));
+      addHistogram(out, "mist_send_block_ms", labels, it->second.getSendBlock());
+    }
+    addHeader(out, "mist_output_pool_idle", "gauge", "Pre-forked output processes waiting for a connection.");
+    for (std::map<unsigned int, statPool>::iterator it = pools.begin(); it != pools.end(); ++it){
+      if (it->second.lastTime + STAT_CUTOFF <= (unsigned long long)now){
+        continue;
+      }
+      labels.clear();
+      addLabel(labels, "protocol", internedName(it->first));
+      addSample(out, "mist_output_pool_idle", labels, it->second.idle);
+    }
+    addHeader(out, "mist_output_pool_spawns_total", "counter", "Output processes pre-forked by worker pools.");
+    for (std::map<unsigned int, statPool>::iterator it = pools.begin(); it != pools.end(); ++it){
+      if (it->second.lastTime + STAT_CUTOFF <= (unsigned long long)now){
+        continue;
+      }
+      labels.clear();
+      addLabel(labels, "protocol", internedName(it->first));
+      addSample(out, "mist_output_pool_spawns_total", labels, it->second.spawned);
+    }
+  }
+
+  addHeader(out, "mist_stream_online", "gauge", "Stream state: 0 offline, 1 active, 2 available.");
+  for (JSON::ObjIter it = streams.ObjBegin(); it != streams.ObjEnd(); ++it){
+    labels.clear();
+    addLabel(labels, "stream", it->first);
+    addSample(out, "mist_stream_online", labels, it->second["online"].asInt());
+  }
+  addHeader(out, "mist_stream_inputs", "gauge", "Input processes running for a stream, at most one.");
+  for (JSON::ObjIter it = streams.ObjBegin(); it != streams.ObjEnd(); ++it){
+    labels.clear();
+    addLabel(labels, "stream", it->first);
+    addSample(out, "mist_stream_inputs", labels, Util::streamActive(it->first) ? 1 : 0);
+  }
+  addHeader(out, "mist_stream_buffer_window_ms", "gauge", "Length of the available media window of a stream.");
+  for (JSON::ObjIter it = streams.ObjBegin(); it != streams.ObjEnd(); ++it){
+    if (!it->second.isMember("meta") || !it->second["meta"].isMember("tracks")){
+      continue;
+    }
+    long long firstms = -1;
+    long long lastms = 0;
+    for (JSON::ObjIter trit = it->second["meta"]["tracks"].ObjBegin(); trit != it->second["meta"]["tracks"].ObjEnd(); ++trit){
+      if (firstms < 0 || trit->second["firstms"].asInt() < firstms){
+        firstms = trit->second["firstms"].asInt();
+      }
+      if (trit->second["lastms"].asInt() > lastms){
+        lastms = trit->second["lastms"].asInt();
+      }
+    }
+    labels.clear();
+    addLabel(labels, "stream", it->first);
+    addSample(out, "mist_stream_buffer_window_ms", labels, firstms < 0 ? 0 : lastms - firstms);
+  }
+  addHeader(out, "mist_stream_pages", "gauge", "Data pages currently buffered for a stream, over all tracks.");
+  for (JSON::ObjIter it = streams.ObjBegin(); it != streams.ObjEnd(); ++it){
+    if (it->second["online"].asInt() != 1 || !it->second.isMember("meta") || !it->second["meta"].isMember("tracks")){
+      continue;
+    }
+    long long pages = 0;
+    for (JSON::ObjIter trit = it->second["meta"]["tracks"].ObjBegin(); trit != it->second["meta"]["tracks"].ObjEnd(); ++trit){
+      char pageName[NAME_BUFFER_SIZE];
+      snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_INDEX, it->first.c_str(), (unsigned long)trit->second["trackid"].asInt());
+      IPC::sharedPage index(pageName, 8 * 1024, false, false);
+      if (!index.mapped){
+        continue;
+      }
+      //each entry is the first key and amount of keys of one page, unused entries have no keys
+      for (int i = 0; i < index.len / 8; ++i){
+        if (((int *)index.mapped)[i * 2 + 1]){
+          ++pages;
+        }
+      }
+    }
+    labels.clear();
+    addLabel(labels, "stream", it->first);
+    addSample(out, "mist_stream_pages", labels, pages);
+  }
+  long long online = 0;
+  for (JSON::ArrIter it = protocols.ArrBegin(); it != protocols.ArrEnd(); ++it){
+    if ((*it)["online"].asInt() == 1){
+      ++online;
+    }
+  }
+  addHeader(out, "mist_connectors", "gauge", "Configured protocol listeners.");
+  addSample(out, "mist_connectors", "", protocols.size());
+  addHeader(out, "mist_connectors_online", "gauge", "Protocol listeners that are running.");
+  addSample(out, "mist_connectors_online", "", online);
+}
@@ -4,6 +4,7 @@
 #include <mist/json.h>
 #include <mist/tinythread.h>
 #include <string>
+#include <vector>
 #include <map>
 
 /// The STAT_CUTOFF define sets how many seconds of statistics history is kept.
@@ -12,14 +13,20 @@
 
 namespace Controller {
   struct statLog {
+    unsigned long long now;
     long time;
     long lastSecond;
     long long down;
     long long up;
   };
 
+  unsigned int internName(const std::string & name);
+  bool findInterned(const std::string & name, unsigned int & id);
+  const std::string & internedName(unsigned int id);
+
   /// This is a comparison and storage class that keeps sessions apart from each other.
   /// Whenever two of these objects are not equal, it will create a new session.
+  /// Stream and connector names are interned, so comparing them is an integer compare.
   class sessIndex {
     public:
       sessIndex(std::string host, unsigned int crc, std::string streamName, std::string connector);
@@ -27,9 +34,12 @@ namespace Controller {
       sessIndex();
       std::string host;
       unsigned int crc;
-      std::string streamName;
-      std::string connector;
-      
+      unsigned int streamId;///< Interned stream name, see internedName.
+      unsigned int connectorId;///< Interned connector name, see internedName.
+      const std::string & streamName() const;
+      const std::string & connector() const;
+      unsigned long long totalsKey() const;
+
       bool operator== (const sessIndex &o) const;
       bool operator!= (const sessIndex &o) const;
       bool operator> (const sessIndex &o) const;
@@ -37,16 +47,76 @@ namespace Controller {
       bool operator< (const sessIndex &o) const;
       bool operator>= (const sessIndex &o) const;
   };
-  
-  
+
+  /// Cumulative output pipeline counters of a single connection, as last reported.
+  struct statPipeline {
+    statPipeline();
+    unsigned int rebuffers;
+    Util::durationHist pageWait;
+    Util::durationHist sendBlock;
+  };
+
+  /// Holds the statistics of a single connection as a ring buffer of at most STAT_CUTOFF samples, oldest first.
   class statStorage {
     public:
+      statStorage();
       void update(IPC::statExchange & data);
+      void wipeOld(unsigned long long cutOff);
+      bool empty() const;
+      unsigned long long firstTime() const;
+      unsigned long long lastTime() const;
+      const statLog & newest() const;
       bool hasDataFor(unsigned long long);
       statLog & getDataFor(unsigned long long);
-      std::map<unsigned long long, statLog> log;
+      statPipeline pipeline;///< Latest pipeline counters, only differences are added to the totals.
+    private:
+      statLog & at(unsigned int i);
+      const statLog & at(unsigned int i) const;
+      std::vector<statLog> log;
+      unsigned int first;///< Index in log of the oldest sample.
+      unsigned int count;///< Amount of samples stored.
   };
-  
+
+  /// Per-second totals of all sessions for a single stream/protocol combination.
+  /// Kept up to date while parsing statistics, so querying them is O(1) per second.
+  class statTotals {
+    public:
+      statTotals();
+      void addClient(unsigned long long t);
+      void addBytes(unsigned long long t, long long down, long long up);
+      long long getClients(unsigned long long t);
+      long long getBpsDown(unsigned long long t);
+      long long getBpsUp(unsigned long long t);
+      long long getTotalDown();
+      long long getTotalUp();
+      void addPipeline(IPC::statExchange & data, statPipeline & last);
+      void addLiveLag(unsigned long long t, unsigned int ms);
+      long long getLiveLag(unsigned long long t);
+      long long getLiveLagMax(unsigned long long t);
+      long long getRebuffers();
+      const Util::durationHist & getPageWait();
+      const Util::durationHist & getSendBlock();
+      unsigned long long lastTime() const;
+    private:
+      long long totalDown;///< Bytes downloaded since the controller started.
+      long long totalUp;///< Bytes uploaded since the controller started.
+      long long rebuffers;///< Playback stalls since the controller started.
+      Util::durationHist pageWait;///< Data page wait times since the controller started.
+      Util::durationHist sendBlock;///< Blocking send times since the controller started.
+      unsigned long long newest;///< Most recent timestamp anything was counted at.
+      struct entry {
+        unsigned long long now;
+        long long clients;
+        long long down;
+        long long up;
+        long long lagSum;
+        long long lagCount;
+        long long lagMax;
+      };
+      entry & at(unsigned long long t);
+      entry log[STAT_CUTOFF];
+  };
+
   /// A session class that keeps track of both current and archived connections.
   /// Allows for moving of connections to another session.
   class statSession {
@@ -60,11 +130,12 @@ namespace Controller {
       void wipeOld(unsigned long long);
       void finish(unsigned long index);
       void switchOverTo(statSession & newSess, unsigned long index);
-      void update(unsigned long index, IPC::statExchange & data);
+      void update(unsigned long index, IPC::statExchange & data, statTotals & tot);
       unsigned long long getStart();
       unsigned long long getEnd();
       bool hasDataFor(unsigned long long time);
       bool hasData();
+      bool isActive();
       long long getConnTime(unsigned long long time);
       long long getLastSecond(unsigned long long time);
       long long getDown(unsigned long long time);
@@ -75,13 +146,15 @@ namespace Controller {
       long long getBpsUp(unsigned long long start, unsigned long long end);
   };
 
-  
+
   extern std::map<sessIndex, statSession> sessions;
   extern std::map<unsigned long, sessIndex> connToSession;
+  extern std::map<unsigned long long, statTotals> totals;
   extern tthread::mutex statsMutex;
   void parseStatistics(char * data, size_t len, unsigned int id);
   void fillClients(JSON::Value & req, JSON::Value & rep);
   void fillTotals(JSON::Value & req, JSON::Value & rep);
+  void fillMetrics(std::string & out, JSON::Value & streams, JSON::Value & protocols);
   void SharedMemStats(void * config);
   bool hasViewers(std::string streamName);
 }
@@ -5,6 +5,8 @@
 #include <mist/timing.h>
 #include <mist/shared_memory.h>
 #include <mist/defines.h>
+#include <mist/dtsc.h>
+#include <mist/stream.h>
 #include "controller_storage.h"
 #include "controller_capabilities.h"
 
@@ -74,22 +76,67 @@ namespace Controller {
     close((long long int)err);
   }
   
-  /// Writes the current config to shared memory to be used in other processes
-  void writeConfig(){
+  /// Sets "metaversion" on every stream in conf: a number that changes whenever the metadata of the stream,
+  /// the protocols or the capabilities change, so outputs can cache what they generate from those.
+  /// Numbering starts at the current time in milliseconds, so it does not repeat when the controller restarts.
+  static void stampMetaVersions(JSON::Value & conf){
+    static long long nextVersion = Util::epoch() * 1000;
+    static JSON::Value seen;
+    static std::map<std::string, long long> versions;
+    bool common = (seen["protocols"] != conf["config"]["protocols"] || seen["capabilities"] != conf["capabilities"]);
+    if (common){
+      seen["protocols"] = conf["config"]["protocols"];
+      seen["capabilities"] = conf["capabilities"];
+    }
+    std::map<std::string, long long> current;
+    for (JSON::ObjIter it = conf["streams"].ObjBegin(); it != conf["streams"].ObjEnd(); ++it){
+      if (common || !versions.count(it->first) || seen["streams"][it->first] != it->second["meta"]){
+        seen["streams"][it->first] = it->second["meta"];
+        current[it->first] = ++nextVersion;
+      }else{
+        current[it->first] = versions[it->first];
+      }
+      it->second["metaversion"] = current[it->first];
+    }
+    //forget removed streams
+    for (std::map<std::string, long long>::iterator it = versions.begin(); it != versions.end(); ++it){
+      if (!current.count(it->first)){
+        seen["streams"].removeMember(it->first);
+      }
+    }
+    versions.swap(current);
+  }
+
+  /// Publishes the current config as a new Util::configSnapshot version to be used in other processes,
+  /// along with the table of inputs for all streams that Util::startInput reads without locking.
+  /// Readers never take the semaphore; it only keeps the controller threads from publishing at the same time.
+  /// \returns False if the config could not be published yet, see Util::publishConfig.
+  bool writeConfig(){
     JSON::Value writeConf;
     writeConf["config"] = Storage["config"];
     writeConf["streams"] = Storage["streams"];
     writeConf["capabilities"] = capabilities;
+    stampMetaVersions(writeConf);
 
-    static IPC::sharedPage mistConfOut("!mistConfig", DEFAULT_CONF_PAGE_SIZE, true);
+    static IPC::sharedSnapshot mistConfOut(SHM_CONF_SNAPSHOT, DEFAULT_CONF_SNAPSHOT_SIZE, true);
     IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
     //lock semaphore
     configLock.wait();
     //write config
     std::string temp = writeConf.toPacked();
-    memcpy(mistConfOut.mapped, temp.data(), std::min(temp.size(), (size_t)mistConfOut.len));
+    bool published = Util::publishConfig(mistConfOut, temp);
+    //publish the input table
+    static IPC::sharedSnapshot inputTable(SHM_INPUTS, DEFAULT_INPUTS_PAGE_SIZE, true);
+    std::string table;
+    Util::buildInputTable(DTSC::Scan((char *)temp.data(), temp.size()), table);
+    if (!inputTable.publish(table.data(), table.size())){
+      DEBUG_MSG(DLVL_WARN, "Input table of %lu bytes does not fit, streams are started the slow way", (unsigned long)table.size());
+    }
+    //the info response cache is filled by the HTTP outputs, it only has to exist for as long as the controller runs
+    static IPC::sharedPage infoCache(SHM_INFO_CACHE, INFO_CACHE_SLOTS * INFO_CACHE_SLOT_SIZE, true);
     //unlock semaphore
     configLock.post();
+    return published;
   }
   
 }
@@ -17,6 +17,6 @@ namespace Controller {
   
   void handleMsg(void * err);
 
-  void writeConfig();
+  bool writeConfig();
 
 }
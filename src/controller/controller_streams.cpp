@@ -239,9 +239,16 @@ namespace Controller {
           }
         }
       }
+      //keep the input of keepwarm VoD streams running, so their headers stay loaded
+      if (jit->second.isMember("keepwarm") && jit->second["keepwarm"].asInt() && jit->second["online"].asInt()
+          && jit->second["source"].asString().substr(0, 1) == "/"){
+        Util::startInput(jit->first);
+      }
     }
     static JSON::Value strlist;
-    bool changed = false;
+    //set when a config could not be published, so it is tried again
+    static bool unpublished = false;
+    bool changed = unpublished;
     if (strlist["config"] != Storage["config"]){
       strlist["config"] = Storage["config"];
       changed = true;
@@ -251,7 +258,7 @@ namespace Controller {
       changed = true;
     }
     if (changed){
-      writeConfig();
+      unpublished = !writeConfig();
     }
   }
   
@@ -273,6 +280,12 @@ namespace Controller {
         if (jit->second.isMember("cut")){
           out[jit->first]["cut"] = jit->second["cut"].asInt();
         }
+        if (jit->second.isMember("spill")){
+          out[jit->first]["spill"] = jit->second["spill"].asString();
+        }
+        if (jit->second.isMember("memory")){
+          out[jit->first]["memory"] = jit->second["memory"].asInt();
+        }
         Log("STRM", std::string("New stream ") + jit->first);
       }
     }
@@ -289,6 +302,8 @@ namespace Controller {
   ///   "streamname_here": { //name of the stream
   ///     "source": "/mnt/media/a.dtsc" //full path to a VoD file, or "push://" followed by the IP or hostname of the machine allowed to push live data. Empty means everyone is allowed to push live data.
   ///     "DVR": 30000 //optional. For live streams, indicates the requested minimum size of the available DVR buffer in milliseconds.
+  ///     "spill": "/mnt/dvr" //optional. For live streams, directory to move the part of the DVR buffer that is older than "memory" to.
+  ///     "memory": 30000 //optional. For live streams with "spill" set, the most recent part of the DVR buffer that stays in memory, in milliseconds.
   ///   },
   ///   //the above structure repeated for all configured streams
   /// }
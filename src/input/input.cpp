@@ -1,8 +1,10 @@
 #include <semaphore.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <mist/defines.h>
+#include <mist/tinythread.h>
 #include "input.h"
 #include <sstream>
 #include <fstream>
@@ -53,7 +55,25 @@ namespace Mist {
     option["long"] = "stream";
     option["help"] = "The name of the stream that this connector will provide in player mode";
     config->addOption("streamname", option);
+    option.null();
+    option["arg"] = "integer";
+    option["short"] = "T";
+    option["long"] = "threads";
+    option["help"] = "Amount of threads used to generate a missing header, or 0 for one per CPU core. Only used by inputs that can generate headers in parallel.";
+    option["value"].append(0ll);
+    config->addOption("threads", option);
+    option.null();
+    option["arg"] = "integer";
+    option["short"] = "K";
+    option["long"] = "keepwarm";
+    option["help"] = "If set to 1, a VoD input keeps running and keeps the first page of every track loaded while nobody is watching.";
+    option["value"].append(0ll);
+    config->addOption("keepwarm", option);
     
+    capa["optional"]["keepwarm"]["name"] = "Keep warm";
+    capa["optional"]["keepwarm"]["help"] = "Keep the input running with the start of the stream loaded while nobody is watching, for a faster first play - 1 to enable";
+    capa["optional"]["keepwarm"]["option"] = "--keepwarm";
+    capa["optional"]["keepwarm"]["type"] = "uint";
     capa["optional"]["debug"]["name"] = "debug";
     capa["optional"]["debug"]["help"] = "The debug level at which messages need to be printed.";
     capa["optional"]["debug"]["option"] = "--debug";
@@ -66,6 +86,8 @@ namespace Mist {
     
     singleton = this;
     isBuffer = false;
+    scanData = 0;
+    scanSize = 0;
   }
 
   void Input::checkHeaderTimes(std::string streamFile){
@@ -98,6 +120,113 @@ namespace Mist {
     }
   }
 
+  /// Ranges smaller than this are not worth a thread of their own.
+  #define MIN_SCAN_RANGE (4 * 1024 * 1024)
+
+  /// Arguments for scanRangeThread.
+  struct scanArgs {
+    Input * input;
+    headerRange * range;
+  };
+
+  void Input::scanRangeThread(void * arg){
+    scanArgs * args = (scanArgs *)arg;
+    args->input->scanRange(*(args->range));
+  }
+
+  /// Adds a packet found by scanRange to myMeta. Called in file order.
+  void Input::addHeaderPacket(headerPacket & pack){
+    myMeta.update(pack.time, pack.offset, pack.track, pack.dataSize, pack.bpos, pack.keyframe, pack.sendSize);
+  }
+
+  /// Generates the header of a file by splitting it in byte ranges, which are scanned for packets in parallel by scanRange.
+  /// Every range but the first starts at the first packet scanRange can find in it. If that is not where the packets
+  /// of the preceding range continue, the range is scanned again from the right position, so the result is always
+  /// the same as that of a sequential scan. The packets are then added through addHeaderPacket, in file order.
+  /// \param file The input file, which is mapped while scanning.
+  /// \param begin Position of the first packet in the file.
+  /// \param relativeTimes If true, scanRange times packets from the start of each range, and the times are made absolute here.
+  /// \returns False if scanRange could not scan the file, in which case myMeta is left untouched.
+  bool Input::scanHeader(FILE * file, long long unsigned int begin, bool relativeTimes){
+    struct stat st;
+    if (fstat(fileno(file), &st) || (long long unsigned int)st.st_size <= begin){
+      return false;
+    }
+    scanSize = st.st_size;
+    void * mapped = mmap(0, scanSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (mapped == MAP_FAILED){
+      FAIL_MSG("Could not map %s: %s", config->getString("input").c_str(), strerror(errno));
+      scanSize = 0;
+      return false;
+    }
+    scanData = (const char *)mapped;
+
+    unsigned int threads = config->getInteger("threads");
+    if (!threads){
+      threads = tthread::thread::hardware_concurrency();
+    }
+    long long unsigned int rangeCount = std::max(std::min((long long unsigned int)threads, (scanSize - begin) / MIN_SCAN_RANGE), 1ull);
+    std::deque<headerRange> ranges(rangeCount);
+    for (unsigned int i = 0; i < rangeCount; ++i){
+      ranges[i].start = begin + (scanSize - begin) * i / rangeCount;
+      ranges[i].end = begin + (scanSize - begin) * (i + 1) / rangeCount;
+    }
+    ranges[0].exact = true;
+    unsigned long long start = Util::getMS();
+    std::deque<scanArgs> args(rangeCount);
+    std::deque<tthread::thread *> workers;
+    for (unsigned int i = 1; i < rangeCount; ++i){
+      args[i].input = this;
+      args[i].range = &ranges[i];
+      workers.push_back(new tthread::thread(scanRangeThread, &args[i]));
+    }
+    scanRange(ranges[0]);
+    for (std::deque<tthread::thread *>::iterator it = workers.begin(); it != workers.end(); it++){
+      (*it)->join();
+      delete *it;
+    }
+
+    //check that every range continues where the previous one left off
+    bool success = true;
+    unsigned int rescans = 0;
+    unsigned int usedRanges = 0;
+    long long unsigned int expected = begin;
+    for (unsigned int i = 0; i < rangeCount && success; ++i){
+      if (!ranges[i].error && ranges[i].first != expected){
+        headerRange retry;
+        retry.start = expected;
+        retry.end = ranges[i].end;
+        retry.exact = true;
+        ranges[i] = retry;
+        scanRange(ranges[i]);
+        ++rescans;
+      }
+      success = !ranges[i].error;
+      expected = ranges[i].next;
+      usedRanges = i + 1;
+      if (ranges[i].last){
+        break;
+      }
+    }
+    if (success){
+      long long unsigned int timeOffset = 0;
+      for (unsigned int i = 0; i < usedRanges; ++i){
+        for (std::deque<headerPacket>::iterator it = ranges[i].packets.begin(); it != ranges[i].packets.end(); it++){
+          if (relativeTimes){
+            it->time += timeOffset;
+          }
+          addHeaderPacket(*it);
+        }
+        timeOffset += ranges[i].duration;
+      }
+      INFO_MSG("Scanned %s in %llu ranges (%u scanned again) in %llu ms", config->getString("input").c_str(), rangeCount, rescans, Util::getMS() - start);
+    }
+    munmap(mapped, scanSize);
+    scanData = 0;
+    scanSize = 0;
+    return success;
+  }
+
   int Input::run() {
     streamName = config->getString("streamname");
     if (config->getBool("json")) {
@@ -156,9 +285,16 @@ namespace Mist {
       
       DEBUG_MSG(DLVL_DONTEVEN,"Pre-While");
       
+      bool keepWarm = !isBuffer && config->getInteger("keepwarm");
       long long int activityCounter = Util::bootSecs();
-      while ((Util::bootSecs() - activityCounter) < 10){//10 second timeout
+      while (config->is_active && (keepWarm || (Util::bootSecs() - activityCounter) < 10)){//10 second timeout
         Util::wait(1000);
+        if (keepWarm){
+          //keep the first pages from timing out, so a new viewer can start right away
+          for (std::map<unsigned int,DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++){
+            bufferFrame(it->first, 1);
+          }
+        }
         removeUnused();
         userPage.parseEach(callbackWrapper);
         if (userPage.amount){
@@ -1,5 +1,7 @@
 #include <set>
 #include <map>
+#include <deque>
+#include <cstdio>
 #include <cstdlib>
 #include <mist/config.h>
 #include <mist/json.h>
@@ -16,6 +18,33 @@ namespace Mist {
     int curPart;
   };
 
+  /// A packet found while generating a header: everything Meta::update needs, without the packet data.
+  struct headerPacket {
+    headerPacket() : time(0), bpos(0), offset(0), track(0), dataSize(0), sendSize(0), keyframe(false), special(false) {}
+    long long unsigned int time;
+    long long unsigned int bpos;
+    long long int offset;
+    unsigned int track;
+    unsigned int dataSize;
+    unsigned int sendSize;///< Size of the packet in DTSC form, or 0 to let Meta::update calculate it.
+    bool keyframe;
+    bool special;///< Has to be parsed in full, because it changes the metadata.
+  };
+
+  /// A byte range of the input file, scanned for packets by its own thread while generating a header.
+  struct headerRange {
+    headerRange() : start(0), end(0), first(0), next(0), duration(0), exact(false), last(false), error(false) {}
+    long long unsigned int start;///< Scanning starts at the first packet found at or after this position, or right here if exact is set.
+    long long unsigned int end;///< Scanning stops at the first packet that starts at or after this position.
+    long long unsigned int first;///< Position of the first packet found.
+    long long unsigned int next;///< Position where the packet after the last one found starts.
+    long long unsigned int duration;///< Summed duration of the packets, for inputs that time packets from the start of the range.
+    bool exact;///< If true, start is known to be the position of a packet.
+    bool last;///< If true, the packets end in this range, and the rest of the file is ignored.
+    bool error;///< If true, the range could not be scanned, and the header has to be generated sequentially.
+    std::deque<headerPacket> packets;
+  };
+
   class Input : public InOutBase {
     public:
       Input(Util::Config * cfg);
@@ -40,6 +69,16 @@ namespace Mist {
       void parseHeader();
       bool bufferFrame(unsigned int track, unsigned int keyNum);
 
+      bool scanHeader(FILE * file, long long unsigned int begin, bool relativeTimes);
+      static void scanRangeThread(void * arg);
+      /// Finds the packets in range, reading from scanData. Called from multiple threads at once.
+      virtual void scanRange(headerRange & range){
+        range.error = true;
+      }
+      virtual void addHeaderPacket(headerPacket & pack);
+      const char * scanData;///< The input file, mapped while scanHeader runs.
+      long long unsigned int scanSize;
+
       unsigned int packTime;///Media-timestamp of the last packet.
       int lastActive;///Timestamp of the last time we received or sent something.
       int initialTime;
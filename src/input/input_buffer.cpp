@@ -7,6 +7,8 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <sstream>
+#include <unistd.h>
 #include <mist/stream.h>
 #include <mist/defines.h>
 
@@ -31,6 +33,29 @@ namespace Mist {
     capa["optional"]["DVR"]["option"] = "--buffer";
     capa["optional"]["DVR"]["type"] = "uint";
     capa["optional"]["DVR"]["default"] = 50000LL;
+    option.null();
+    option["arg"] = "string";
+    option["long"] = "spill";
+    option["short"] = "S";
+    option["help"] = "Directory to move buffered pages that are older than the memory time to";
+    option["value"].append("");
+    config->addOption("spill", option);
+    capa["optional"]["spill"]["name"] = "Spill directory";
+    capa["optional"]["spill"]["help"] = "If set, pages of the buffer that are older than the memory time are moved to this directory, and loaded back when a viewer asks for them. Allows long DVR buffers without keeping them in memory.";
+    capa["optional"]["spill"]["option"] = "--spill";
+    capa["optional"]["spill"]["type"] = "str";
+    option.null();
+    option["arg"] = "integer";
+    option["long"] = "memory";
+    option["short"] = "m";
+    option["help"] = "Part of the buffer kept in memory in ms, when spilling to disk";
+    option["value"].append(30000LL);
+    config->addOption("memory", option);
+    capa["optional"]["memory"]["name"] = "Memory time (ms)";
+    capa["optional"]["memory"]["help"] = "When a spill directory is set, the most recent part of the buffer that is always kept in memory, in milliseconds.";
+    capa["optional"]["memory"]["option"] = "--memory";
+    capa["optional"]["memory"]["type"] = "uint";
+    capa["optional"]["memory"]["default"] = 30000LL;
     capa["source_match"] = "push://*";
     capa["priority"] = 9ll;
     capa["desc"] = "Provides buffered live input";
@@ -41,6 +66,7 @@ namespace Mist {
     singleton = this;
     bufferTime = 0;
     cutTime = 0;
+    memoryTime = 0;
   }
 
   inputBuffer::~inputBuffer() {
@@ -127,11 +153,15 @@ namespace Mist {
         }
 
         curPageNum.erase(tid);
-        char thisPageName[NAME_BUFFER_SIZE];
-        snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
-        curPage[tid].init(thisPageName, 20971520);
-        curPage[tid].master = true;
+        //evicted pages only exist on disk
+        if (!evictedPages[tid].count(bufferLocations[tid].begin()->first)) {
+          char thisPageName[NAME_BUFFER_SIZE];
+          snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
+          curPage[tid].init(thisPageName, 20971520);
+          curPage[tid].master = true;
+        }
         curPage.erase(tid);
+        removeSpilledPage(tid, bufferLocations[tid].begin()->first);
 
         bufferLocations[tid].erase(bufferLocations[tid].begin());
       } else {
@@ -151,6 +181,7 @@ namespace Mist {
       curPage[tid].init(thisPageName, 20971520, false, false);
       curPage[tid].master = true;
       curPage.erase(tid);
+      removeSpilledPage(tid, it->first);
     }
     bufferLocations.erase(tid);
     metaPages[tid].master = true;
@@ -199,11 +230,14 @@ namespace Mist {
           INFO_MSG("Erasing track %d because of timeout", it->first);
           lastUpdated.erase(tid);
           while (bufferLocations[tid].size()){
-            char thisPageName[NAME_BUFFER_SIZE];
-            snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
-            curPage[tid].init(thisPageName, 20971520);
-            curPage[tid].master = true;
+            if (!evictedPages[tid].count(bufferLocations[tid].begin()->first)){
+              char thisPageName[NAME_BUFFER_SIZE];
+              snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
+              curPage[tid].init(thisPageName, 20971520);
+              curPage[tid].master = true;
+            }
             curPage.erase(tid);
+            removeSpilledPage(tid, bufferLocations[tid].begin()->first);
             bufferLocations[tid].erase(bufferLocations[tid].begin());
           }
           curPageNum.erase(it->first);
@@ -246,9 +280,174 @@ namespace Mist {
         }
       }
     }
+    if (spillDir.size()) {
+      for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
+        spillPages(it->first);
+      }
+    }
     updateMeta();
   }
 
+  ///Returns the name of the file a page is spilled to.
+  std::string inputBuffer::spillFile(unsigned long tid, unsigned long pageNum) {
+    std::stringstream fileName;
+    fileName << spillDir << "/" << config->getString("streamname") << "_" << tid << "_" << pageNum << ".dtsc";
+    return fileName.str();
+  }
+
+  ///Spills all complete pages of a track that are entirely older than memoryTime.
+  ///Pages that were loaded back for a viewer are kept until nobody asked for them for 10 seconds.
+  void inputBuffer::spillPages(unsigned long tid) {
+    std::map<unsigned long, DTSCPageData> & locations = bufferLocations[tid];
+    DTSC::Track & trk = myMeta.tracks[tid];
+    if (locations.size() < 2 || !trk.keys.size()) {
+      return;
+    }
+    unsigned long long now = Util::bootSecs();
+    unsigned long firstKey = trk.keys[0].getNumber();
+    //The last page is still being written to
+    std::map<unsigned long, DTSCPageData>::iterator lastPage = --locations.end();
+    for (std::map<unsigned long, DTSCPageData>::iterator it = locations.begin(); it != lastPage; it++) {
+      if (evictedPages[tid].count(it->first)) {
+        continue;
+      }
+      if (pageRequested[tid].count(it->first) && now - pageRequested[tid][it->first] < 10) {
+        continue;
+      }
+      //The first key of the next page tells us when this page ends
+      unsigned long nextKey = it->first + it->second.keyNum;
+      if (nextKey < firstKey || nextKey - firstKey >= trk.keys.size()) {
+        continue;
+      }
+      if (trk.lastms - (long long)trk.keys[nextKey - firstKey].getTime() < memoryTime) {
+        //Later pages are even more recent
+        break;
+      }
+      spillPage(tid, it->first);
+    }
+  }
+
+  ///Moves a complete page to disk and removes it from shared memory and from the track index page.
+  ///Outputs that need the page again ask for it through the user page, see requestKey.
+  ///The copy on disk is kept until the page leaves the buffer, so spilling a page a second time does not write it again.
+  bool inputBuffer::spillPage(unsigned long tid, unsigned long pageNum) {
+    DTSCPageData & pageData = bufferLocations[tid][pageNum];
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), tid, pageNum);
+    IPC::sharedPage page;
+    page.init(pageName, DEFAULT_DATA_PAGE_SIZE, false, false);
+    if (!page.mapped) {
+      WARN_MSG("Could not open page %s to spill it", pageName);
+      return false;
+    }
+    //Only spill pages of which we parsed all packets
+    if (!pageData.curOffset || pageData.curOffset + 4 > (unsigned long long)page.len || page.mapped[pageData.curOffset]) {
+      return false;
+    }
+    if (!spilledPages[tid].count(pageNum)) {
+      std::string fileName = spillFile(tid, pageNum);
+      FILE * spill = fopen(fileName.c_str(), "wb");
+      if (!spill) {
+        FAIL_MSG("Could not create %s: %s", fileName.c_str(), strerror(errno));
+        return false;
+      }
+      if (fwrite(page.mapped, pageData.curOffset, 1, spill) != 1 || fclose(spill)) {
+        FAIL_MSG("Could not write %s: %s", fileName.c_str(), strerror(errno));
+        unlink(fileName.c_str());
+        return false;
+      }
+      spilledPages[tid].insert(pageNum);
+    }
+    for (int i = 0; i < 1024; i++) {
+      int * tmpOffset = (int *)(metaPages[tid].mapped + (i * 8));
+      if (ntohl(tmpOffset[0]) == pageNum) {
+        tmpOffset[0] = 0;
+        tmpOffset[1] = 0;
+      }
+    }
+    if (curPageNum.count(tid) && curPageNum[tid] == pageNum) {
+      curPageNum.erase(tid);
+      curPage.erase(tid);
+    }
+    evictedPages[tid].insert(pageNum);
+    pageRequested[tid].erase(pageNum);
+    //Outputs that still have the page mapped keep their copy until they let go of it
+    page.master = true;
+    HIGH_MSG("Spilled page %lu of track %lu (%llu bytes) to disk", pageNum, tid, pageData.curOffset);
+    return true;
+  }
+
+  ///Copies a spilled page back into shared memory and registers it on the track index page again.
+  bool inputBuffer::loadSpilledPage(unsigned long tid, unsigned long pageNum) {
+    DTSCPageData & pageData = bufferLocations[tid][pageNum];
+    std::string fileName = spillFile(tid, pageNum);
+    FILE * spill = fopen(fileName.c_str(), "rb");
+    if (!spill) {
+      FAIL_MSG("Could not open %s: %s", fileName.c_str(), strerror(errno));
+      return false;
+    }
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), tid, pageNum);
+    IPC::sharedPage page;
+    page.init(pageName, DEFAULT_DATA_PAGE_SIZE, true);
+    //Until the page is fully loaded and registered, it is destroyed when leaving scope
+    page.master = true;
+    if (!page.mapped || fread(page.mapped, pageData.curOffset, 1, spill) != 1) {
+      FAIL_MSG("Could not load page %lu of track %lu from %s", pageNum, tid, fileName.c_str());
+      fclose(spill);
+      return false;
+    }
+    fclose(spill);
+    bool inserted = false;
+    for (int i = 0; i < 1024; i++) {
+      int * tmpOffset = (int *)(metaPages[tid].mapped + (i * 8));
+      if (tmpOffset[0] == 0 && tmpOffset[1] == 0) {
+        tmpOffset[0] = htonl(pageNum);
+        tmpOffset[1] = htonl(pageData.keyNum);
+        inserted = true;
+        break;
+      }
+    }
+    if (!inserted) {
+      WARN_MSG("Could not register page %lu of track %lu, no empty spots left on the index page", pageNum, tid);
+      return false;
+    }
+    page.master = false;
+    evictedPages[tid].erase(pageNum);
+    HIGH_MSG("Loaded page %lu of track %lu back from disk", pageNum, tid);
+    return true;
+  }
+
+  ///Removes the copy on disk of a page that leaves the buffer, if there is one.
+  void inputBuffer::removeSpilledPage(unsigned long tid, unsigned long pageNum) {
+    if (!spilledPages.count(tid) || !spilledPages[tid].count(pageNum)) {
+      return;
+    }
+    unlink(spillFile(tid, pageNum).c_str());
+    spilledPages[tid].erase(pageNum);
+    evictedPages[tid].erase(pageNum);
+    pageRequested[tid].erase(pageNum);
+  }
+
+  ///Marks the spilled page holding a key as in use, and loads it back from disk if it was evicted.
+  void inputBuffer::requestKey(unsigned long tid, unsigned long keyNum) {
+    if (!spilledPages.count(tid) || !spilledPages[tid].size()) {
+      return;
+    }
+    std::set<unsigned long>::iterator it = spilledPages[tid].upper_bound(keyNum);
+    if (it == spilledPages[tid].begin()) {
+      return;
+    }
+    --it;
+    if (keyNum >= *it + bufferLocations[tid][*it].keyNum) {
+      return;
+    }
+    pageRequested[tid][*it] = Util::bootSecs();
+    if (evictedPages[tid].count(*it)) {
+      loadSpilledPage(tid, *it);
+    }
+  }
+
   void inputBuffer::userCallback(char * data, size_t len, unsigned int id) {
     //Static variable keeping track of the next temporary mapping to use for a track.
     static int nextTempId = 1001;
@@ -409,6 +608,19 @@ namespace Mist {
         //Update the metadata to reflect all changes
         updateMeta();
       }
+      //Viewers ask for the key after the one in the userpage element, make sure the pages for both are in memory
+      if (spillDir.size() && activeTracks.count(value) && pushLocation[value] != data) {
+        //the userpage element only holds the lower 16 bits of the key number,
+        //so rebuild the full number as the first one at or after the oldest buffered key that matches them
+        unsigned long keyNum = ((unsigned long)(unsigned char)thisData[4] << 8) | (unsigned char)thisData[5];
+        std::map<unsigned int, DTSC::Track>::iterator trIt = myMeta.tracks.find(value);
+        if (trIt != myMeta.tracks.end() && trIt->second.keys.size()) {
+          unsigned long firstKey = trIt->second.keys.begin()->getNumber();
+          keyNum = firstKey + ((keyNum - firstKey) & 0xFFFF);
+        }
+        requestKey(value, keyNum);
+        requestKey(value, keyNum + 1);
+      }
       //If the track is active, and this is the element responsible for pushing it
       if (activeTracks.count(value) && pushLocation[value] == data) {
         //Open the track index page if we dont have it open yet
@@ -447,6 +659,10 @@ namespace Mist {
 
     //Since the map is ordered by keynumber, this loop updates the metadata for each page from oldest to newest
     for (std::map<unsigned long, DTSCPageData>::iterator pageIt = locations.begin(); pageIt != locations.end(); pageIt++) {
+      //Spilled pages are complete, and evicted ones are not in memory to read from
+      if (spilledPages.count(tNum) && spilledPages[tNum].count(pageIt->first)) {
+        continue;
+      }
       updateMetaFromPage(tNum, pageIt->first);
     }
     updateMeta();
@@ -511,10 +727,8 @@ namespace Mist {
     std::string strName = config->getString("streamname");
     Util::sanitizeName(strName);
     strName = strName.substr(0, (strName.find_first_of("+ ")));
-    IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE, false, false); ///< Contains server configuration and capabilities
-    IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-    configLock.wait();
-    DTSC::Scan streamCfg = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("streams").getMember(strName);
+    Util::configSnapshot serverCfg; ///< Contains server configuration and capabilities
+    DTSC::Scan streamCfg = serverCfg.getScan().getMember("streams").getMember(strName);
     long long tmpNum;
 
     //if stream is configured and setting is present, use it, always
@@ -534,9 +748,13 @@ namespace Mist {
       DEBUG_MSG(DLVL_DEVEL, "Setting bufferTime from %u to new value of %lli", bufferTime, tmpNum);
       bufferTime = tmpNum;
     }
+    serverCfg.release();
 
-    configLock.post();
-    configLock.close();
+    spillDir = config->getString("spill");
+    memoryTime = config->getInteger("memory");
+    if (spillDir.size()) {
+      DEBUG_MSG(DLVL_DEVEL, "Keeping %u ms of the buffer in memory, spilling the rest to %s", memoryTime, spillDir.c_str());
+    }
     return true;
   }
 
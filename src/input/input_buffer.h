@@ -10,6 +10,8 @@ namespace Mist {
     private:
       unsigned int bufferTime;
       unsigned int cutTime;
+      std::string spillDir;
+      unsigned int memoryTime;
     protected:
       //Private Functions
       bool setup();
@@ -23,6 +25,12 @@ namespace Mist {
       bool removeKey(unsigned int tid);
       void removeUnused();
       void eraseTrackDataPages(unsigned long tid);
+      std::string spillFile(unsigned long tid, unsigned long pageNum);
+      void spillPages(unsigned long tid);
+      bool spillPage(unsigned long tid, unsigned long pageNum);
+      bool loadSpilledPage(unsigned long tid, unsigned long pageNum);
+      void removeSpilledPage(unsigned long tid, unsigned long pageNum);
+      void requestKey(unsigned long tid, unsigned long keyNum);
       void finish();
       void userCallback(char * data, size_t len, unsigned int id);
       std::set<unsigned long> negotiatingTracks;
@@ -32,6 +40,12 @@ namespace Mist {
       ///Maps trackid to a pagenum->pageData map
       std::map<unsigned long, std::map<unsigned long, DTSCPageData> > bufferLocations;
       std::map<unsigned long, char *> pushLocation;
+      ///Maps trackid to the pages that have a copy in spillDir
+      std::map<unsigned long, std::set<unsigned long> > spilledPages;
+      ///Maps trackid to the spilled pages that are currently not in shared memory
+      std::map<unsigned long, std::set<unsigned long> > evictedPages;
+      ///Maps trackid to a pagenum->time map, holding the last time a viewer asked for a spilled page
+      std::map<unsigned long, std::map<unsigned long, unsigned long long> > pageRequested;
       inputBuffer * singleton;
   };
 }
@@ -65,6 +65,16 @@ namespace Mist {
       }
     }
     //Create header file from FLV data
+    //the first tag of each track is parsed in full, as are all tags after an onMetaData tag
+    fullParse.insert(1);
+    fullParse.insert(2);
+    if (scanHeader(inFile, 13, false)){
+      std::ofstream oFile(std::string(config->getString("input") + ".dtsh").c_str());
+      oFile << myMeta.toJSON().toNetPacked();
+      oFile.close();
+      return true;
+    }
+    myMeta = DTSC::Meta();
     fseek(inFile, 13, SEEK_SET);
     FLV::Tag tmpTag;
     AMF::Object amf_storage;
@@ -114,6 +124,111 @@ namespace Mist {
     thisPacket.reInit(tmpStr.data(), tmpStr.size());
   }
 
+  /// Finds the tags in a range of the mapped file, without parsing them.
+  /// Tags that change the metadata are marked as special, so addHeaderPacket parses them in full.
+  void inputFLV::scanRange(headerRange & range){
+    long long unsigned int pos = range.start;
+    if (!range.exact){
+      //a tag is only trusted if its type is known, its stream ID is zero and its trailing size field matches
+      while (pos < range.end){
+        const char * tag = scanData + pos;
+        if (pos + 11 <= scanSize && (tag[0] == 0x08 || tag[0] == 0x09 || tag[0] == 0x12) && !tag[8] && !tag[9] && !tag[10]){
+          unsigned int size = (tag[1] << 16) + (tag[2] << 8) + tag[3];
+          if (pos + size + 15 <= scanSize){
+            const char * trailer = tag + 11 + size;
+            if ((unsigned int)((trailer[0] << 24) + (trailer[1] << 16) + (trailer[2] << 8) + trailer[3]) == size + 11){
+              break;
+            }
+          }
+        }
+        ++pos;
+      }
+    }
+    range.first = pos;
+    while (pos < range.end){
+      if (pos + 11 > scanSize){
+        range.last = true;
+        break;
+      }
+      const char * data = scanData + pos;
+      if (data[0] > 0x12){
+        //either a broken file or a second FLV header, both are left to the sequential parser
+        range.error = true;
+        return;
+      }
+      unsigned int len = (data[1] << 16) + (data[2] << 8) + data[3] + 15;
+      if (pos + len > scanSize){
+        range.last = true;
+        break;
+      }
+      headerPacket pack;
+      pack.bpos = pos;
+      pack.time = (unsigned int)((data[4] << 16) + (data[5] << 8) + data[6] + (data[7] << 24));
+      //trackid, bpos, time and data members, plus the object itself
+      pack.sendSize = 63;
+      if (data[0] == 0x09){
+        pack.track = 1;
+        bool h264 = ((data[11] & 0x0F) == 7);
+        if ((data[11] & 0xF0) == 0x50 || len < (h264 ? 21u : 17u) || (h264 && data[12] == 0)){
+          pack.special = true;
+        }else{
+          pack.keyframe = ((data[11] & 0xF0) == 0x10 || (data[11] & 0xF0) == 0x40);
+          if (h264){
+            pack.offset = (((data[13] << 16) + (data[14] << 8) + data[15]) << 8) >> 8;
+            pack.dataSize = len - 20;
+            pack.sendSize += 17 + (data[12] == 1 ? 15 : 0) + (data[12] == 2 ? 19 : 0);
+          }else{
+            pack.dataSize = len - 16;
+          }
+          pack.sendSize += pack.dataSize + (pack.keyframe ? 19 : 0);
+        }
+      }else if (data[0] == 0x08){
+        pack.track = 2;
+        bool aac = ((data[11] & 0xF0) == 0xA0);
+        if (len < (aac ? 18u : 17u) || (aac && data[12] == 0)){
+          pack.special = true;
+        }else{
+          pack.dataSize = len - (aac ? 17 : 16);
+          pack.sendSize += pack.dataSize;
+        }
+      }else{
+        pack.special = true;
+      }
+      range.packets.push_back(pack);
+      pos += len;
+    }
+    if (pos >= scanSize){
+      range.last = true;
+    }
+    range.next = pos;
+  }
+
+  /// Adds a tag found by scanRange to the header.
+  /// Tags that may change the metadata are parsed in full, all others only update the track timing.
+  void inputFLV::addHeaderPacket(headerPacket & pack){
+    if (!pack.special && !fullParse.count(pack.track)){
+      Input::addHeaderPacket(pack);
+      return;
+    }
+    FLV::Tag tmpTag;
+    unsigned int tagPos = 0;
+    unsigned int tagSize = std::min(scanSize - pack.bpos, 0xFFFFFFFFull);
+    while (!tmpTag.MemLoader((char *)scanData + pack.bpos, tagSize, tagPos)){
+      if (tagPos >= tagSize){
+        return;
+      }
+    }
+    JSON::Value lastPack = tmpTag.toJSON(myMeta, amfStorage);
+    lastPack["bpos"] = (long long)pack.bpos;
+    myMeta.update(lastPack);
+    if (tmpTag.data[0] == 0x12){
+      fullParse.insert(1);
+      fullParse.insert(2);
+    }else{
+      fullParse.erase(pack.track);
+    }
+  }
+
   void inputFLV::seek(int seekTime) {
     //We will seek to the corresponding keyframe of the video track if selected, otherwise audio keyframe.
     //Flv files are never multi-track, so track 1 is video, track 2 is audio.
@@ -1,5 +1,7 @@
 #include "input.h"
 #include <mist/dtsc.h>
+#include <mist/amf.h>
+#include <set>
 
 namespace Mist {
   class inputFLV : public Input {
@@ -12,8 +14,12 @@ namespace Mist {
       void getNext(bool smart = true);
       void seek(int seekTime);
       void trackSelect(std::string trackSpec);
+      void scanRange(headerRange & range);
+      void addHeaderPacket(headerPacket & pack);
 
       FILE * inFile;
+      AMF::Object amfStorage;///< Last onMetaData object found while generating the header.
+      std::set<unsigned int> fullParse;///< Tracks whose next tag is parsed in full while generating the header.
   };
 }
 
@@ -12,6 +12,42 @@
 #include "input_mp3.h"
 
 namespace Mist {
+  /// Decodes the MPEG audio frame header at header.
+  /// \param sampleCount Is set to the amount of samples in the frame.
+  /// \param sampleRate Is set to the sample rate of the frame in Hz.
+  /// \returns The size of the frame in bytes, or 0 if the header is invalid.
+  static size_t frameSize(const char * header, int & sampleCount, int & sampleRate){
+    //mpeg version is on the bits 0x18 of header[1], but only 0x08 is important --> 0 is version 2, 1 is version 1
+    //leads to 2 - value == version, -1 to get the right index for the array
+    int mpegVersion = 1 - ((header[1] >> 3) & 0x01);
+    //mpeg layer is on the bits 0x06 of header[1] --> 1 is layer 3, 2 is layer 2, 3 is layer 1
+    //leads to 4 - value == layer, -1 to get the right index for the array
+    int mpegLayer = 3 - ((header[1] >> 1) & 0x03);
+    int rateIndex = (header[2] >> 2) & 0x03;
+    if (mpegLayer > 2 || rateIndex > 2){
+      return 0;
+    }
+    sampleCount = sampleCounts[mpegVersion][mpegLayer];
+    //samplerate is encoded in bits 0x0C of header[2];
+    sampleRate = sampleRates[mpegVersion][rateIndex] * 1000;
+    int bitRate = bitRates[mpegVersion][mpegLayer][((header[2] >> 4) & 0x0F)] * 1000;
+    if (bitRate <= 0){
+      return 0;
+    }
+    if (mpegLayer == 0){ //layer 1
+      //Layer 1: dataSize = (12 * BitRate / SampleRate + Padding) * 4
+      return (12 * ((double)bitRate / sampleRate) + ((header[2] >> 1) & 0x01)) * 4;
+    }
+    //Layer 2, 3: dataSize = 144 * BitRate / SampleRate + Padding
+    return 144 * ((double)bitRate / sampleRate) + ((header[2] >> 1) & 0x01);
+  }
+
+  /// Returns true if a valid frame header starts at pos.
+  static bool isFrame(const char * data, size_t size, size_t pos){
+    int sampleCount, sampleRate;
+    return pos + 4 <= size && data[pos] == 0xFF && (data[pos + 1] & 0xE0) == 0xE0 && frameSize(data + pos, sampleCount, sampleRate);
+  }
+
   inputMP3::inputMP3(Util::Config * cfg) : Input(cfg) {
     capa["name"] = "MP3";
     capa["desc"] = "Enables MP3 Input";
@@ -85,10 +121,13 @@ namespace Mist {
     myMeta.tracks[1].channels = 2 - ( header[3] >> 7);
 
 
-    getNext();
-    while (thisPacket){
-      myMeta.update(thisPacket);
+    if (!scanHeader(inFile, filePos, true)){
+      fseek(inFile, filePos, SEEK_SET);
       getNext();
+      while (thisPacket){
+        myMeta.update(thisPacket);
+        getNext();
+      }
     }
 
     fseek(inFile, 0, SEEK_SET);
@@ -130,31 +169,9 @@ namespace Mist {
       read = fread(packHeader, 1, 3000, inFile);
     }
     //We now have a sync byte for sure
-
-    //mpeg version is on the bits 0x18 of packHeader[1], but only 0x08 is important --> 0 is version 2, 1 is version 1
-    //leads to 2 - value == version, -1 to get the right index for the array
-    int mpegVersion = 1 - ((packHeader[1] >> 3) & 0x01);
-    //mpeg layer is on the bits 0x06 of packHeader[1] --> 1 is layer 3, 2 is layer 2, 3 is layer 1
-    //leads to 4 - value == layer, -1 to get the right index for the array
-    int mpegLayer = 3 - ((packHeader[1] >> 1) & 0x03);
-    int sampleCount = sampleCounts[mpegVersion][mpegLayer]; 
-    //samplerate is encoded in bits 0x0C of packHeader[2];
-    int sampleRate = sampleRates[mpegVersion][((packHeader[2] >> 2) & 0x03)] * 1000;
-
-    int bitRate = bitRates[mpegVersion][mpegLayer][((packHeader[2] >> 4) & 0x0F)] * 1000;
-
-
-
-    size_t dataSize = 0;
-    if (mpegLayer == 0){ //layer 1
-      //Layer 1: dataSize = (12 * BitRate / SampleRate + Padding) * 4
-      dataSize = (12 * ((double)bitRate / sampleRate) + ((packHeader[2] >> 1) & 0x01)) * 4;
-    }else{//Layer 2 or 3
-      //Layer 2, 3: dataSize = 144 * BitRate / SampleRate + Padding
-      dataSize = 144 * ((double)bitRate / sampleRate) + ((packHeader[2] >> 1) & 0x01);
-    }
-
-
+    int sampleCount = 0;
+    int sampleRate = 0;
+    size_t dataSize = frameSize(packHeader, sampleCount, sampleRate);
     if (!dataSize){
       return;
     }
@@ -176,6 +193,66 @@ namespace Mist {
     timestamp += (sampleCount / (sampleRate / 1000));
   }
 
+  /// Finds the frames in a range of the mapped file, the same way getNext would.
+  /// Frame times are relative to the start of the range.
+  void inputMP3::scanRange(headerRange & range){
+    size_t pos = range.start;
+    if (!range.exact){
+      //a frame is only trusted if another one follows right after it
+      int sampleCount, sampleRate;
+      while (pos < range.end && !(isFrame(scanData, scanSize, pos) && (pos + frameSize(scanData + pos, sampleCount, sampleRate) >= scanSize || isFrame(scanData, scanSize, pos + frameSize(scanData + pos, sampleCount, sampleRate))))){
+        ++pos;
+      }
+    }
+    range.first = pos;
+    long long unsigned int time = 0;
+    while (pos < range.end){
+      size_t framePos = pos;
+      size_t window = std::min((size_t)3000, (size_t)(scanSize - pos));
+      if (scanData[pos] != 0xFF || window < 2 || (scanData[pos + 1] & 0xE0) != 0xE0){
+        //getNext resyncs to the first 0xFF byte, if a valid sync word follows anywhere after it
+        const char * ff = (const char *)memchr(scanData + pos, 0xFF, window);
+        if (!ff || ff == scanData + pos){
+          range.last = true;
+          break;
+        }
+        const char * sync = ff;
+        while (sync && (sync + 1 >= scanData + pos + window || (sync[1] & 0xE0) != 0xE0)){
+          sync = (const char *)memchr(sync + 1, 0xFF, scanData + pos + window - (sync + 1));
+        }
+        if (!sync){
+          range.last = true;
+          break;
+        }
+        framePos = ff - scanData;
+      }
+      if (framePos + 4 > scanSize){
+        range.last = true;
+        break;
+      }
+      int sampleCount = 0;
+      int sampleRate = 0;
+      size_t dataSize = frameSize(scanData + framePos, sampleCount, sampleRate);
+      if (!dataSize){
+        range.last = true;
+        break;
+      }
+      headerPacket pack;
+      pack.time = time;
+      pack.bpos = framePos;
+      pack.track = 1;
+      pack.dataSize = dataSize;
+      range.packets.push_back(pack);
+      time += sampleCount / (sampleRate / 1000);
+      pos = framePos + dataSize;
+    }
+    if (pos >= scanSize){
+      range.last = true;
+    }
+    range.next = pos;
+    range.duration = time;
+  }
+
   void inputMP3::seek(int seekTime) {
     std::deque<DTSC::Key> & keys = myMeta.tracks[1].keys;
     size_t seekPos = keys[0].getBpos();
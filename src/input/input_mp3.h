@@ -21,6 +21,7 @@ namespace Mist {
       void getNext(bool smart = true);
       void seek(int seekTime);
       void trackSelect(std::string trackSpec);
+      void scanRange(headerRange & range);
       double timestamp;
 
       FILE * inFile;
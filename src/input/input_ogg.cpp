@@ -5,6 +5,9 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <mist/stream.h>
 #include <mist/ogg.h>
 #include <mist/defines.h>
@@ -15,28 +18,6 @@
 
 namespace Mist {
 
-  JSON::Value segment::toJSON(OGG::oggCodec myCodec){
-    JSON::Value retval;
-    retval["time"] = (long long int)time;
-    retval["trackid"] = (long long int)tid;
-    std::string tmpString = "";
-    for (unsigned int i = 0; i < parts.size(); i++){
-      tmpString += parts[i];
-    }
-    retval["data"] = tmpString;
-//    INFO_MSG("Setting bpos for packet on track %llu, time %llu, to %llu", tid, time, bytepos);
-    retval["bpos"] = (long long int)bytepos;
-    if (myCodec == OGG::THEORA){
-      if (!theora::isHeader(tmpString.data(), tmpString.size())){
-        theora::header tmpHeader((char*)tmpString.data(), tmpString.size());
-        if (tmpHeader.getFTYPE() == 0){
-          retval["keyframe"] = 1LL;
-        }
-      }
-    }
-    return retval;
-  }
-
 /*
   unsigned long oggTrack::getBlockSize(unsigned int vModeIndex){ //WTF!!?
     return blockSize[vModes[vModeIndex].blockFlag];
@@ -44,6 +25,9 @@ namespace Mist {
   }
 */
   inputOGG::inputOGG(Util::Config * cfg) : Input(cfg){
+    inFile = 0;
+    mapped = 0;
+    mapSize = 0;
     capa["name"] = "OGG";
     capa["desc"] = "Enables OGG input";
     capa["source_match"] = "/*.ogg";
@@ -62,9 +46,74 @@ namespace Mist {
     if (!inFile){
       return false;
     }
+    struct stat st;
+    if (fstat(fileno(inFile), &st) || !st.st_size){
+      return false;
+    }
+    mapSize = st.st_size;
+    mapped = (char *)mmap(0, mapSize, PROT_READ, MAP_PRIVATE, fileno(inFile), 0);
+    if (mapped == MAP_FAILED){
+      FAIL_MSG("Could not map %s: %s", config->getString("input").c_str(), strerror(errno));
+      mapped = 0;
+      return false;
+    }
     return true;
   }
 
+  /// Walks over all pages in the file once, storing the position, granule and segment table of every page per bitstream.
+  /// Indexing stops at the first invalid or truncated page, just like reading the pages one by one would.
+  bool inputOGG::buildIndex(){
+    pageIndex.clear();
+    long long unsigned int pos = 0;
+    while (pos + 27 <= mapSize){
+      const char * header = mapped + pos;
+      if (memcmp(header, "OggS", 4)){
+        WARN_MSG("Invalid OGG page at byte %llu, ignoring the rest of the file", pos);
+        break;
+      }
+      unsigned int segCount = header[26];
+      long long unsigned int dataPos = pos + 27 + segCount;
+      if (dataPos > mapSize){
+        break;
+      }
+      oggPagePos page;
+      page.bytepos = pos;
+      page.headerType = header[5];
+      page.granule = 0;
+      for (int i = 7; i >= 0; --i){
+        page.granule = (page.granule << 8) | header[6 + i];
+      }
+      long unsigned int serial = header[14] | (header[15] << 8) | (header[16] << 16) | ((long unsigned int)header[17] << 24);
+      oggPageIndex & idx = pageIndex[serial];
+      page.firstSegment = idx.segments.size();
+      oggSegmentPos seg;
+      seg.offset = dataPos;
+      seg.len = 0;
+      for (unsigned int i = 0; i < segCount; ++i){
+        seg.len += header[27 + i];
+        if (header[27 + i] != 0xFF){
+          idx.segments.push_back(seg);
+          seg.offset += seg.len;
+          seg.len = 0;
+        }
+      }
+      if (seg.len){
+        idx.segments.push_back(seg);
+        seg.offset += seg.len;
+      }
+      if (seg.offset > mapSize){
+        idx.segments.resize(page.firstSegment);
+        break;
+      }
+      page.segmentCount = idx.segments.size() - page.firstSegment;
+      if (page.segmentCount){
+        idx.pages.push_back(page);
+      }
+      pos = seg.offset;
+    }
+    return pageIndex.size();
+  }
+
   ///\todo check if all trackID (tid) instances are replaced with bitstream serial numbers
   void inputOGG::parseBeginOfStream(OGG::Page & bosPage){
     //long long int tid = snum2tid.size() + 1;
@@ -138,7 +187,7 @@ namespace Mist {
       ///\todo make sure the header is ffmpeg compatible
       if (myMeta.tracks[tid].codec == "theora"){
         //    INFO_MSG("theora");
-        for (unsigned int i = 0; i < myPage.getAllSegments().size(); i++){
+        for (unsigned int i = 0; i < myPage.getSegmentCount(); i++){
           unsigned long len = myPage.getSegmentLen(i);
           INFO_MSG("Length for segment %d: %lu", i, len);
           theora::header tmpHead((char*)myPage.getSegment(i),len);
@@ -168,7 +217,7 @@ namespace Mist {
       }
 
       if (myMeta.tracks[tid].codec == "vorbis"){                
-        for (unsigned int i = 0; i < myPage.getAllSegments().size(); i++){
+        for (unsigned int i = 0; i < myPage.getSegmentCount(); i++){
           unsigned long len = myPage.getSegmentLen(i);
           vorbis::header tmpHead((char*)myPage.getSegment(i), len);
           if (!tmpHead.isHeader()){
@@ -207,8 +256,11 @@ namespace Mist {
       }
     }
 
+    if (!buildIndex()){
+      FAIL_MSG("No OGG pages found");
+      return false;
+    }
     for (std::map<long unsigned int, OGG::oggTrack>::iterator it = oggTracks.begin(); it != oggTracks.end(); it++){
-      fseek(inFile, 0, SEEK_SET);
       position tmp = seekFirstData(it->first);
       if (tmp.trackID){
         currentPositions.insert(tmp);
@@ -231,46 +283,33 @@ namespace Mist {
   }
 
   position inputOGG::seekFirstData(long long unsigned int tid){
-    fseek(inFile, 0, SEEK_SET);
     position res;
     res.time = 0;
     res.trackID = tid;
     res.segmentNo = 0;
-    bool readSuccesfull = true;
-    bool quitloop = false;
-    while (!quitloop){
-      quitloop = true;
-      res.bytepos = ftell(inFile);
-      readSuccesfull = oggTracks[tid].myPage.read(inFile);
-      if (!readSuccesfull){
-        quitloop = true; //break :(
-        break;
-      }
-      if (oggTracks[tid].myPage.getBitstreamSerialNumber() != tid){
-        quitloop = false;
-        continue;
-      }
-      if (oggTracks[tid].myPage.getHeaderType() != OGG::Plain){
-        quitloop = false;
+    oggPageIndex & idx = pageIndex[tid];
+    for (res.pageNo = 0; res.pageNo < idx.pages.size(); ++res.pageNo){
+      const oggPagePos & page = idx.pages[res.pageNo];
+      if (page.headerType != OGG::Plain){
         continue;
       }
+      const oggSegmentPos & seg = idx.segments[page.firstSegment];
       if (oggTracks[tid].codec == OGG::VORBIS){
-        vorbis::header tmpHead((char*)oggTracks[tid].myPage.getSegment(0), oggTracks[tid].myPage.getSegmentLen(0));
+        vorbis::header tmpHead(mapped + seg.offset, seg.len);
         if (tmpHead.isHeader()){
-          quitloop = false;
+          continue;
         }
       }
       if (oggTracks[tid].codec == OGG::THEORA){
-        theora::header tmpHead((char*)oggTracks[tid].myPage.getSegment(0), oggTracks[tid].myPage.getSegmentLen(0));
+        theora::header tmpHead(mapped + seg.offset, seg.len);
         if (tmpHead.isHeader()){
-          quitloop = false;
+          continue;
         }
       }
-    }// while ( oggTracks[tid].myPage.getHeaderType() != OGG::Plain && readSuccesfull && oggTracks[tid].myPage.getBitstreamSerialNumber() != tid);
-    INFO_MSG("seek first bytepos: %llu tid: %llu oggTracks[tid].myPage.getHeaderType(): %d ", res.bytepos, tid, oggTracks[tid].myPage.getHeaderType());
-    if (!readSuccesfull){
-      res.trackID = 0;
+      INFO_MSG("seek first bytepos: %llu tid: %llu", page.bytepos, tid);
+      return res;
     }
+    res.trackID = 0;
     return res;
   }
 
@@ -282,33 +321,40 @@ namespace Mist {
     bool lastCompleteSegment = false;
     position curPos = *currentPositions.begin();
     currentPositions.erase(currentPositions.begin());
-    segment thisSegment;
-    thisSegment.tid = curPos.trackID;
-    thisSegment.time = curPos.time;
-    thisSegment.bytepos = curPos.bytepos + curPos.segmentNo;
-    unsigned int oldSegNo = curPos.segmentNo;
-    fseek(inFile, curPos.bytepos, SEEK_SET);
-    OGG::Page curPage;
-    curPage.read(inFile);
-    thisSegment.parts.push_back(std::string(curPage.getSegment(curPos.segmentNo), curPage.getSegmentLen(curPos.segmentNo)));
+    unsigned long tid = curPos.trackID;
+    OGG::oggTrack & trk = oggTracks[tid];
+    oggPageIndex & idx = pageIndex[tid];
+    const oggPagePos & curPage = idx.pages[curPos.pageNo];
+    if (curPos.segmentNo >= curPage.segmentCount){
+      WARN_MSG("Segment %llu does not exist on page %llu of track %lu, dropping track", curPos.segmentNo, curPage.bytepos, tid);
+      getNext(smart);
+      return;
+    }
+    long long unsigned int time = curPos.time;
+    long long unsigned int bytepos = curPage.bytepos + curPos.segmentNo;
+    const oggSegmentPos & firstPart = idx.segments[curPage.firstSegment + curPos.segmentNo];
+    //packets that fit in a single segment are sent straight from the mapped file
+    const char * data = mapped + firstPart.offset;
+    unsigned int dataLen = firstPart.len;
+    bool multiPart = false;
     bool readFullPacket = false;
-    if (curPos.segmentNo == curPage.getAllSegments().size() - 1){
-      OGG::Page tmpPage;
-      unsigned int bPos;
+    if (curPos.segmentNo == curPage.segmentCount - 1){
+      //the packet may continue on the next page of this bitstream
       while (!readFullPacket){
-        bPos = ftell(inFile);//<-- :(
-        if (!tmpPage.read(inFile)){
+        if (curPos.pageNo + 1 >= idx.pages.size()){
           break;
         }
-        if (tmpPage.getBitstreamSerialNumber() != thisSegment.tid){
-          continue;
-        }
-        curPos.bytepos = bPos;
+        const oggPagePos & tmpPage = idx.pages[++curPos.pageNo];
         curPos.segmentNo = 0;
-        if (tmpPage.getHeaderType() == OGG::Continued){
-          thisSegment.parts.push_back(std::string(tmpPage.getSegment(0), tmpPage.getSegmentLen(0)));
+        if (tmpPage.headerType == OGG::Continued){
+          if (!multiPart){
+            packetParts.clear();
+            packetParts.push_back(firstPart);
+            multiPart = true;
+          }
+          packetParts.push_back(idx.segments[tmpPage.firstSegment]);
           curPos.segmentNo = 1;
-          if (tmpPage.getAllSegments().size() == 1){
+          if (tmpPage.segmentCount == 1){
             continue;
           }
         } else {
@@ -318,44 +364,56 @@ namespace Mist {
       }
     } else {
       curPos.segmentNo++;
-     
-     // if (oggTracks[thisSegment.tid].codec == OGG::THEORA && curPage.getGranulePosition() != (0xFFFFFFFFFFFFFFFFull) && curPos.segmentNo == curPage.getAllSegments().size() - 1){ //if the next segment is the last one on the page, the (theora) granule should be used to sync the time for the current segment
-      if ((oggTracks[thisSegment.tid].codec == OGG::THEORA ||oggTracks[thisSegment.tid].codec == OGG::VORBIS)&& curPage.getGranulePosition() != (0xFFFFFFFFFFFFFFFFull) && curPos.segmentNo == curPage.getAllSegments().size() - 1){ //if the next segment is the last one on the page, the (theora) granule should be used to sync the time for the current segment
-        OGG::Page tmpPage;
-        while (tmpPage.read(inFile) && tmpPage.getBitstreamSerialNumber() != thisSegment.tid){}
-        if ((tmpPage.getBitstreamSerialNumber() == thisSegment.tid) && tmpPage.getHeaderType() == OGG::Continued){
+      //if the next segment is the last one on the page, the granule should be used to sync the time for the current segment
+      if ((trk.codec == OGG::THEORA || trk.codec == OGG::VORBIS) && curPage.granule != (0xFFFFFFFFFFFFFFFFull) && curPos.segmentNo == curPage.segmentCount - 1){
+        if (curPos.pageNo + 1 < idx.pages.size() && idx.pages[curPos.pageNo + 1].headerType == OGG::Continued){
           lastCompleteSegment = true; //this segment should be used to sync time using granule
         }
       }
       readFullPacket = true;
     }
-    std::string tmpStr = thisSegment.toJSON(oggTracks[thisSegment.tid].codec).toNetPacked();
-    thisPacket.reInit(tmpStr.data(), tmpStr.size());
+    if (multiPart){
+      //the packet is complete, copy all of its parts at once
+      dataLen = 0;
+      for (std::vector<oggSegmentPos>::iterator it = packetParts.begin(); it != packetParts.end(); it++){
+        dataLen += it->len;
+      }
+      packetBuf.resize(dataLen);
+      char * dest = (char *)packetBuf.data();
+      for (std::vector<oggSegmentPos>::iterator it = packetParts.begin(); it != packetParts.end(); it++){
+        memcpy(dest, mapped + it->offset, it->len);
+        dest += it->len;
+      }
+      data = packetBuf.data();
+    }
 
-    if (oggTracks[thisSegment.tid].codec == OGG::VORBIS){
+    bool keyframe = false;
+    if (trk.codec == OGG::VORBIS){
       unsigned long blockSize = 0;
-      Utils::bitstreamLSBF packet;
-      packet.append((char*)curPage.getSegment(oldSegNo), curPage.getSegmentLen(oldSegNo));
+      //only the packet type and mode index are needed
+      Utils::bitReaderLSBF packet(mapped + firstPart.offset, std::min(firstPart.len, 4u));
       if (!packet.get(1)){
         //Read index first
-        unsigned long vModeIndex = packet.get(vorbis::ilog(oggTracks[thisSegment.tid].vModes.size() - 1));
-        blockSize= oggTracks[thisSegment.tid].blockSize[oggTracks[thisSegment.tid].vModes[vModeIndex].blockFlag]; //almost readable.        
+        unsigned long vModeIndex = packet.get(vorbis::ilog(trk.vModes.size() - 1));
+        blockSize= trk.blockSize[trk.vModes[vModeIndex].blockFlag]; //almost readable.
       } else {
         DEBUG_MSG(DLVL_WARN, "Packet type != 0");
       }
-      curPos.time += oggTracks[thisSegment.tid].msPerFrame * (blockSize / oggTracks[thisSegment.tid].channels);    
-    } else if (oggTracks[thisSegment.tid].codec == OGG::THEORA){
-      if (lastCompleteSegment == true && curPage.getGranulePosition() != (0xFFFFFFFFFFFFFFFFull)){ //this segment should be used to sync time using granule
-        long long unsigned int parseGranuleUpper = curPage.getGranulePosition() >> oggTracks[thisSegment.tid].KFGShift ;
-        long long unsigned int parseGranuleLower(curPage.getGranulePosition() & ((1 << oggTracks[thisSegment.tid].KFGShift) - 1));
-        thisSegment.time = oggTracks[thisSegment.tid].msPerFrame * (parseGranuleUpper + parseGranuleLower - 1);
-        curPos.time = thisSegment.time;
-        std::string tmpStr = thisSegment.toJSON(oggTracks[thisSegment.tid].codec).toNetPacked();
-        thisPacket.reInit(tmpStr.data(), tmpStr.size());
-        //  INFO_MSG("thisTime: %d", thisPacket.getTime());
+      curPos.time += trk.msPerFrame * (blockSize / trk.channels);
+    } else if (trk.codec == OGG::THEORA){
+      if (lastCompleteSegment == true && curPage.granule != (0xFFFFFFFFFFFFFFFFull)){ //this segment should be used to sync time using granule
+        long long unsigned int parseGranuleUpper = curPage.granule >> trk.KFGShift ;
+        long long unsigned int parseGranuleLower(curPage.granule & ((1 << trk.KFGShift) - 1));
+        time = trk.msPerFrame * (parseGranuleUpper + parseGranuleLower - 1);
+        curPos.time = time;
+      }
+      curPos.time += trk.msPerFrame;
+      if (!theora::isHeader(data, dataLen)){
+        theora::header tmpHeader((char*)data, dataLen);
+        keyframe = (tmpHeader.getFTYPE() == 0);
       }
-      curPos.time += oggTracks[thisSegment.tid].msPerFrame;
     }
+    thisPacket.genericFill(time, 0, tid, (char*)data, dataLen, bytepos, keyframe);
     if (readFullPacket){
       currentPositions.insert(curPos);
     }
@@ -379,19 +437,10 @@ namespace Mist {
     return 0;
   }
 
-  #ifndef _GNU_SOURCE  
-    void * memrchr(const void *s, int c, size_t n){      
-      const unsigned char *cp;
-      if (n != 0) {
-        cp = (unsigned char *)s + n;
-        do {
-          if (*(--cp) == (unsigned char)c)
-            return((void *)cp);
-        } while (--n != 0);
-      }
-      return((void *)0);
-    }  
-  #endif 
+  /// Orders a byte position before the pages that start after it.
+  static bool bytePosBefore(long long unsigned int bytepos, const oggPagePos & page){
+    return bytepos < page.bytepos;
+  }
 
   void inputOGG::seek(int seekTime){
     currentPositions.clear();
@@ -403,31 +452,27 @@ namespace Mist {
       position tmpPos;
       tmpPos.trackID = *it;
       tmpPos.time = myMeta.tracks[*it].keys.begin()->getTime();
-      tmpPos.bytepos = myMeta.tracks[*it].keys.begin()->getBpos();
+      long long unsigned int bytepos = myMeta.tracks[*it].keys.begin()->getBpos();
       for (std::deque<DTSC::Key>::iterator ot = myMeta.tracks[*it].keys.begin(); ot != myMeta.tracks[*it].keys.end(); ot++){
         if (ot->getTime() > seekTime){
           break;
         } else {
           tmpPos.time = ot->getTime();
-          tmpPos.bytepos = ot->getBpos();
+          bytepos = ot->getBpos();
         }
       }
-      INFO_MSG("Found %dms for track %lu at %llu bytepos %llu", seekTime, *it, tmpPos.time, tmpPos.bytepos);
-      int backChrs=std::min(280ull, tmpPos.bytepos - 1);
-      fseek(inFile, tmpPos.bytepos - backChrs, SEEK_SET);
-      char buffer[300];
-      fread(buffer, 300, 1, inFile);
-      char * loc = buffer + backChrs + 2; //start at tmpPos.bytepos+2
-      while (loc && !(loc[0] == 'O' && loc[1] == 'g' && loc[2] == 'g' && loc[3] == 'S')){
-        loc = (char *)memrchr(buffer, 'O',  (loc-buffer) -1 );//seek reverse
-      }
-      if (!loc){
-        INFO_MSG("Unable to find a page boundary starting @ %llu, track %lu", tmpPos.bytepos, *it);        
+      INFO_MSG("Found %dms for track %lu at %llu bytepos %llu", seekTime, *it, tmpPos.time, bytepos);
+      //the byte position of a packet is the position of its first page plus its segment number on that page
+      std::vector<oggPagePos> & pages = pageIndex[*it].pages;
+      std::vector<oggPagePos>::iterator page = std::upper_bound(pages.begin(), pages.end(), bytepos, bytePosBefore);
+      if (page == pages.begin() || bytepos - (page - 1)->bytepos >= (page - 1)->segmentCount){
+        INFO_MSG("Unable to find a page boundary starting @ %llu, track %lu", bytepos, *it);
         continue;
       }
-      tmpPos.segmentNo = backChrs - (loc - buffer);
-      tmpPos.bytepos -= tmpPos.segmentNo;
-      INFO_MSG("Track %lu, segment %llu found at bytepos %llu", *it, tmpPos.segmentNo, tmpPos.bytepos);
+      --page;
+      tmpPos.pageNo = page - pages.begin();
+      tmpPos.segmentNo = bytepos - page->bytepos;
+      INFO_MSG("Track %lu, segment %llu found at bytepos %llu", *it, tmpPos.segmentNo, page->bytepos);
 
       currentPositions.insert(tmpPos);
     }
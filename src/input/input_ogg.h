@@ -4,25 +4,6 @@
 
 namespace Mist {
 
-  struct segPart {
-    char * segData;
-    unsigned int len;
-  };
-
-  class segment {
-    public:
-      segment() : time(0), tid(0), bytepos(0), keyframe(0){}
-      bool operator < (const segment & rhs) const {
-        return time < rhs.time || (time == rhs.time && tid < rhs.tid);
-      }
-      std::vector<std::string> parts;
-      unsigned long long int time;
-      unsigned long long int tid;
-      long long unsigned int bytepos;
-      bool keyframe;
-      JSON::Value toJSON(OGG::oggCodec myCodec);
-  };
-
   struct position {
     bool operator < (const position & rhs) const {
       if (time < rhs.time){
@@ -38,9 +19,31 @@ namespace Mist {
     }
     long unsigned int trackID;
     long long unsigned int time;
-    long long unsigned int bytepos;
+    unsigned int pageNo;///< Index of the page in the page index of the track.
     long long unsigned int segmentNo;
   };
+
+  /// A single segment of a page, as found in the segment table of the page.
+  /// Segments are runs of lacing values, as decoded by OGG::decodeXiphSize.
+  struct oggSegmentPos {
+    long long unsigned int offset;///< Byte offset of the segment data in the file.
+    unsigned int len;
+  };
+
+  /// A single page of a bitstream, as found while indexing the file.
+  struct oggPagePos {
+    long long unsigned int bytepos;///< Byte offset of the page header in the file.
+    long long unsigned int granule;
+    char headerType;
+    unsigned int firstSegment;///< Index of the first segment of this page in oggPageIndex::segments.
+    unsigned int segmentCount;
+  };
+
+  /// All pages and segments of a single bitstream, in file order.
+  struct oggPageIndex {
+    std::vector<oggPagePos> pages;
+    std::vector<oggSegmentPos> segments;
+  };
 /*
   class oggTrack {
     public:
@@ -78,12 +81,16 @@ namespace Mist {
       void trackSelect(std::string trackSpec);
 
       void parseBeginOfStream(OGG::Page & bosPage);
+      bool buildIndex();
       std::set<position> currentPositions;
       FILE * inFile;
+      char * mapped;///< The input file, mapped read-only.
+      long long unsigned int mapSize;
+      std::map<long unsigned int, oggPageIndex> pageIndex;///< Pages and segments of every bitstream, built once by readHeader.
+      std::vector<oggSegmentPos> packetParts;///< Parts of a packet that continues over multiple pages.
+      std::string packetBuf;///< Packets that continue over multiple pages are copied here once all parts are known.
       std::map<long unsigned int, OGG::oggTrack> oggTracks;//this remembers all metadata for every track
-      std::set<segment> sortedSegments;//probably not needing this
       long long unsigned int calcGranuleTime(unsigned long tid, long long unsigned int granule);
-      long long unsigned int calcSegmentDuration(unsigned long tid , std::string & segment);
 
   };
 }
@@ -40,6 +40,8 @@ namespace Mist {
     isInitialized = false;
     isBlocking = false;
     lastStats = 0;
+    rebuffers = 0;
+    thisSlot = 0;
     maxSkipAhead = 7500;
     minSkipAhead = 5000;
     realTime = 1000;
@@ -71,12 +73,49 @@ namespace Mist {
       DTSC::Packet tmpMeta(metaPages[0].mapped, metaPages[0].len, true);
       if (tmpMeta.getVersion()){
         myMeta.reinit(tmpMeta);
+        //reinit rebuilds all tracks, point the descriptors at the new ones
+        //slots of tracks that are gone are cleared, so their remaining packets get dropped
+        for (std::vector<trackDesc>::iterator it = trackSlots.begin(); it != trackSlots.end(); it++){
+          linkSlot(*it);
+        }
       }
     }
     if (lock){
       liveMeta.post();
     }
   }
+
+  /// Points a descriptor at its track in myMeta, or clears it if the track does not exist (anymore).
+  void Output::linkSlot(trackDesc & desc){
+    std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.find(desc.tid);
+    if (it == myMeta.tracks.end()){
+      desc.track = 0;
+      desc.type = DTSC::TRACK_UNKNOWN;
+      desc.codec = DTSC::CODEC_UNKNOWN;
+      return;
+    }
+    desc.track = &it->second;
+    desc.type = desc.track->typeId;
+    desc.codec = desc.track->codecId;
+  }
+
+  /// Returns the slot of the descriptor for track tid, creating it if needed.
+  /// Type and codec are looked up here once, instead of for every packet.
+  unsigned int Output::trackSlot(unsigned int tid){
+    for (unsigned int i = 0; i < trackSlots.size(); ++i){
+      if (trackSlots[i].tid == tid){
+        if (!trackSlots[i].track){
+          linkSlot(trackSlots[i]);
+        }
+        return i;
+      }
+    }
+    trackDesc desc;
+    desc.tid = tid;
+    linkSlot(desc);
+    trackSlots.push_back(desc);
+    return trackSlots.size() - 1;
+  }
   
   /// Called when stream initialization has failed.
   /// The standard implementation will set isInitialized to false and close the client connection,
@@ -276,6 +315,7 @@ namespace Mist {
       return;
     }
     DEBUG_MSG(DLVL_HIGH, "Loading track %lu, containing key %lld", trackId, keyNum);
+    long long int waitStart = Util::getMS();
     unsigned int timeout = 0;
     unsigned long pageNum = pageNumForKey(trackId, keyNum);
     while (pageNum == -1){
@@ -284,6 +324,7 @@ namespace Mist {
       }
       if (timeout++ > 100){
         DEBUG_MSG(DLVL_FAIL, "Timeout while waiting for requested page. Aborting.");
+        pageWait.add(Util::getMS() - waitStart);
         curPage.erase(trackId);
         currKeyOpen.erase(trackId);
         return;
@@ -297,6 +338,7 @@ namespace Mist {
       Util::sleep(100);
       pageNum = pageNumForKey(trackId, keyNum);
     }
+    pageWait.add(Util::getMS() - waitStart);
     
     if (keyNum){
       nxtKeyNum[trackId] = keyNum-1;
@@ -345,6 +387,7 @@ namespace Mist {
     }
     sortedPageInfo tmp;
     tmp.tid = tid;
+    tmp.slot = trackSlot(tid);
     tmp.offset = 0;
     DTSC::Packet tmpPack;
     tmpPack.reInit(curPage[tid].mapped + tmp.offset, 0, true);
@@ -431,7 +474,7 @@ namespace Mist {
       return 0;
     }
     for (std::set<long unsigned int>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++){
-      if (myMeta.tracks[*it].type == "video"){
+      if (myMeta.tracks[*it].typeId == DTSC::TRACK_VIDEO){
         return *it;
       }
     }
@@ -472,6 +515,12 @@ namespace Mist {
     sortedPageInfo nxt = *(buffer.begin());
     buffer.erase(buffer.begin());
 
+    if (!trackSlots[nxt.slot].track){
+      DEBUG_MSG(DLVL_DEVEL, "Track %u no longer exists - dropping track.", nxt.tid);
+      prepareNext();
+      return;
+    }
+
     DEBUG_MSG(DLVL_DONTEVEN, "Loading track %u (next=%lu), %llu ms", nxt.tid, nxtKeyNum[nxt.tid], nxt.time);
     
     if (nxt.offset >= curPage[nxt.tid].len){
@@ -513,6 +562,9 @@ namespace Mist {
       if (myMeta.live && currKeyOpen.count(nxt.tid) && (currKeyOpen[nxt.tid] == (unsigned int)nextPage || nextPage == -1)){
         if (myMeta && ++emptyCount < 42){
           //we're waiting for new data. Simply retry.
+          if (emptyCount == 1){
+            ++rebuffers;
+          }
           buffer.insert(nxt);
         }else{
           //after ~10 seconds, give up and drop the track.
@@ -546,12 +598,18 @@ namespace Mist {
     }
     thisPacket.reInit(curPage[nxt.tid].mapped + nxt.offset, 0, true);
     if (thisPacket){
+      thisSlot = nxt.slot;
       if (thisPacket.getTime() != nxt.time && nxt.time){
         DEBUG_MSG(DLVL_MEDIUM, "ACTUALLY Loaded track %ld (next=%lu), %llu ms", thisPacket.getTrackId(), nxtKeyNum[nxt.tid], thisPacket.getTime());
       }
-      if ((myMeta.tracks[nxt.tid].type == "video" && thisPacket.getFlag("keyframe")) || (++nonVideoCount % 30 == 0)){
+      if ((trackSlots[nxt.slot].type == DTSC::TRACK_VIDEO && thisPacket.getFlag("keyframe")) || (++nonVideoCount % 30 == 0)){
         if (myMeta.live){
           updateMeta();
+          if (!trackSlots[nxt.slot].track){
+            DEBUG_MSG(DLVL_DEVEL, "Track %u no longer exists - dropping track.", nxt.tid);
+            prepareNext();
+            return;
+          }
         }
         nxtKeyNum[nxt.tid] = getKeyForTime(nxt.tid, thisPacket.getTime());
         DEBUG_MSG(DLVL_VERYHIGH, "Track %u @ %llums = key %lu", nxt.tid, thisPacket.getTime(), nxtKeyNum[nxt.tid]);
@@ -604,6 +662,20 @@ namespace Mist {
         }else{
           tmpEx.lastSecond(0);
         }
+        //distance to the live edge, measured against the newest data of the main track
+        unsigned int lag = 0;
+        if (myMeta.live && thisPacket){
+          long long lastms = myMeta.tracks[getMainSelectedTrack()].lastms;
+          if (lastms > (long long)thisPacket.getTime()){
+            lag = lastms - thisPacket.getTime();
+          }
+        }
+        tmpEx.liveLag(lag);
+        tmpEx.rebuffers(rebuffers);
+        tmpEx.pageWait(pageWait);
+        tmpEx.sendBlock(myConn.sendBlocking());
+        tmpEx.poolIdle(Util::Config::poolIdle);
+        tmpEx.poolSpawned(Util::Config::poolSpawned);
         statsPage.keepAlive();
       }
     }
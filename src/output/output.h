@@ -1,5 +1,6 @@
 #pragma once
 #include <set>
+#include <vector>
 #include <cstdlib>
 #include <map>
 #include <mist/config.h>
@@ -25,6 +26,15 @@ namespace Mist {
     unsigned int tid;
     long long unsigned int time;
     unsigned int offset;
+    unsigned int slot;///< Index of the track in Output::trackSlots.
+  };
+
+  /// Describes a track that is being sent, so sending a packet needs no string compares or map lookups.
+  struct trackDesc{
+    unsigned int tid;
+    DTSC::trackType type;
+    DTSC::trackCodec codec;
+    DTSC::Track * track;///< Points into myMeta, updated whenever the metadata is reloaded.
   };
 
   /// The output class is intended to be inherited by MistOut process classes.
@@ -71,12 +81,22 @@ namespace Mist {
       long long unsigned int firstTime;///< Time of first packet after last seek. Used for real-time sending.
       std::map<unsigned long, unsigned long> nxtKeyNum;///< Contains the number of the next key, for page seeking purposes.
       std::set<sortedPageInfo> buffer;///< A sorted list of next-to-be-loaded packets.
+      std::vector<trackDesc> trackSlots;///< Descriptors of all tracks that were sought to, indexed by sortedPageInfo::slot.
+      unsigned int thisSlot;///< Slot of the track thisPacket belongs to.
+      unsigned int trackSlot(unsigned int tid);
+      void linkSlot(trackDesc & desc);
       bool sought;///<If a seek has been done, this is set to true. Used for seeking on prepareNext().
+      unsigned int rebuffers;///< Amount of times playback stalled waiting for new live data.
+      Util::durationHist pageWait;///< Time spent waiting for data pages to become available.
     protected://these are to be messed with by child classes
       IPC::sharedClient statsPage;///< Shared memory used for statistics reporting.
       bool isBlocking;///< If true, indicates that myConn is blocking.
       unsigned int crc;///< Checksum, if any, for usage in the stats.
       unsigned int getKeyForTime(long unsigned int trackId, long long timeStamp);
+      /// Returns the descriptor of the track thisPacket belongs to. Only valid while thisPacket is.
+      trackDesc & thisTrack(){
+        return trackSlots[thisSlot];
+      }
       
       //stream delaying variables
       unsigned int maxSkipAhead;///< Maximum ms that we will go ahead of the intended timestamps.
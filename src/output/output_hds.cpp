@@ -170,7 +170,7 @@ namespace Mist {
       H.Chunkify("", 0, myConn);
       return;
     }
-    tag.DTSCLoader(thisPacket, myMeta.tracks[thisPacket.getTrackId()]);
+    tag.DTSCLoader(thisPacket, *thisTrack().track);
     if (tag.len){
       H.Chunkify(tag.data, tag.len, myConn);
     }
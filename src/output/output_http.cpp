@@ -99,51 +99,16 @@ namespace Mist {
       }
     }
     
-    //loop over the connectors
-    IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-    configLock.wait();
-    IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE);
-    DTSC::Scan capa = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("capabilities").getMember("connectors");
-    unsigned int capa_ctr = capa.getSize();
-    for (unsigned int i = 0; i < capa_ctr; ++i){
-      DTSC::Scan c = capa.getIndice(i);
-      //if it depends on HTTP and has a match or prefix...
-      if ((c.getMember("name").asString() == "HTTP" || c.getMember("deps").asString() == "HTTP") && (c.getMember("url_match") || c.getMember("url_prefix"))){
-        bool match = false;
-        std::string streamname;
-        //if there is a matcher, try to match
-        if (c.getMember("url_match")){
-          if (c.getMember("url_match").getSize()){
-            for (unsigned int j = 0; j < c.getMember("url_match").getSize(); ++j){
-              match |= isMatch(url, c.getMember("url_match").getIndice(j).asString(), streamname);
-            }
-          }else{
-            match |= isMatch(url, c.getMember("url_match").asString(), streamname);
-          }
-        }
-        //if there is a prefix, try to match
-        if (c.getMember("url_prefix")){
-          if (c.getMember("url_prefix").getSize()){
-            for (unsigned int j = 0; j < c.getMember("url_prefix").getSize(); ++j){
-              match |= isPrefix(url, c.getMember("url_prefix").getIndice(j).asString(), streamname);
-            }
-          }else{
-            match |= isPrefix(url, c.getMember("url_prefix").asString(), streamname);
-          }
-        }
-        if (match){
-          if (streamname.size()){
-            Util::sanitizeName(streamname);
-            H.SetVar("stream", streamname);
-          }
-          configLock.post();
-          configLock.close();
-          return capa.getIndiceName(i);
-        }
+    //route through the table the controller compiled from all connectors' patterns
+    Util::configSnapshot serverCfg;
+    std::string connector, streamname;
+    if (serverCfg.route(url, connector, streamname)){
+      if (streamname.size()){
+        Util::sanitizeName(streamname);
+        H.SetVar("stream", streamname);
       }
+      return connector;
     }
-    configLock.post();
-    configLock.close();
     return "";
   }
   
@@ -252,10 +217,8 @@ namespace Mist {
     for (int i=0; i<20; i++){argarr[i] = 0;}
     int id = -1;
     
-    IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-    configLock.wait();
-    IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE);
-    DTSC::Scan prots = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("config").getMember("protocols");
+    Util::configSnapshot serverCfg;
+    DTSC::Scan prots = serverCfg.getScan().getMember("config").getMember("protocols");
     unsigned int prots_ctr = prots.getSize();
     
     for (unsigned int i=0; i < prots_ctr; ++i){
@@ -275,8 +238,6 @@ namespace Mist {
       if (id == -1) {
         connector = connector.substr(0, connector.size() - 4);
         DEBUG_MSG(DLVL_ERROR, "No connector found for: %s", connector.c_str());
-        configLock.post();
-        configLock.close();
         return;
       }
     }
@@ -291,9 +252,9 @@ namespace Mist {
     int argnum = 0;
     argarr[argnum++] = (char*)tmparg.c_str();
     JSON::Value p = prots.getIndice(id).asJSON();
-    JSON::Value pipedCapa = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("capabilities").getMember("connectors").getMember(connector).asJSON();
-    configLock.post();
-    configLock.close();
+    JSON::Value pipedCapa = serverCfg.getScan().getMember("capabilities").getMember("connectors").getMember(connector).asJSON();
+    //released by hand: the exec below means the destructor never runs
+    serverCfg.release();
     argarr[argnum++] = (char*)"--ip";
     argarr[argnum++] = (char*)(temphost.c_str());
     argarr[argnum++] = (char*)"--stream";
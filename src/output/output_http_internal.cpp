@@ -1,6 +1,15 @@
 #include <sys/stat.h>
 #include "output_http_internal.h"
 #include <mist/stream.h>
+#include <mist/checksum.h>
+
+/// Layout of a slot on the SHM_INFO_CACHE page: a sequence number that is odd while the slot is being written,
+/// the version of the metadata the response was made for, the lengths of the key and the response, and then both.
+#define INFO_SLOT_SEQ 0
+#define INFO_SLOT_VERSION 8
+#define INFO_SLOT_KEYLEN 16
+#define INFO_SLOT_DATALEN 20
+#define INFO_SLOT_HEADER 24
 
 namespace Mist {
   OutHTTP::OutHTTP(Socket::Connection & conn) : HTTPOutput(conn){
@@ -52,6 +61,75 @@ namespace Mist {
     cfg->addConnectorOptions(8080, capa);
   }
   
+  /// Returns the slot of the shared info response cache the given key belongs in, or null if there is no cache.
+  /// The page is created by the controller, so all output processes share the responses.
+  static char * infoCacheSlot(const std::string & key){
+    static IPC::sharedPage page;
+    if (!page.mapped){
+      page.init(SHM_INFO_CACHE, INFO_CACHE_SLOTS * INFO_CACHE_SLOT_SIZE, false, false);
+      if (!page.mapped || page.len < INFO_CACHE_SLOTS * INFO_CACHE_SLOT_SIZE){
+        page.close();
+        return 0;
+      }
+    }
+    return page.mapped + (checksum::crc32c(0, key.data(), key.size()) % INFO_CACHE_SLOTS) * INFO_CACHE_SLOT_SIZE;
+  }
+
+  /// Looks up a generated info_, json_ or embed_ response in the shared cache.
+  /// \returns True and sets response if a response for key was stored for exactly this version.
+  static bool getCachedInfo(const std::string & key, unsigned long long version, std::string & response){
+    char * slot = infoCacheSlot(key);
+    if (!slot){
+      return false;
+    }
+    volatile unsigned int * seq = (volatile unsigned int *)(slot + INFO_SLOT_SEQ);
+    unsigned int before = *seq;
+    if (!before || (before & 1)){
+      return false;
+    }
+    __sync_synchronize();
+    unsigned int keyLen = *(unsigned int *)(slot + INFO_SLOT_KEYLEN);
+    unsigned int dataLen = *(unsigned int *)(slot + INFO_SLOT_DATALEN);
+    if (*(unsigned long long *)(slot + INFO_SLOT_VERSION) != version || keyLen != key.size() || dataLen > INFO_CACHE_SLOT_SIZE - INFO_SLOT_HEADER - keyLen){
+      return false;
+    }
+    if (memcmp(slot + INFO_SLOT_HEADER, key.data(), keyLen)){
+      return false;
+    }
+    std::string data(slot + INFO_SLOT_HEADER + keyLen, dataLen);
+    //a writer may have replaced the slot while we were copying
+    __sync_synchronize();
+    if (*seq != before){
+      return false;
+    }
+    response.swap(data);
+    return true;
+  }
+
+  /// Stores a generated info_, json_ or embed_ response in the shared cache, replacing whatever was in its slot.
+  /// Responses that do not fit a slot, or slots another process is writing, are skipped.
+  static void putCachedInfo(const std::string & key, unsigned long long version, const std::string & response){
+    if (INFO_SLOT_HEADER + key.size() + response.size() > INFO_CACHE_SLOT_SIZE){
+      return;
+    }
+    char * slot = infoCacheSlot(key);
+    if (!slot){
+      return;
+    }
+    volatile unsigned int * seq = (volatile unsigned int *)(slot + INFO_SLOT_SEQ);
+    unsigned int before = *seq;
+    if ((before & 1) || !__sync_bool_compare_and_swap(seq, before, before + 1)){
+      return;
+    }
+    *(unsigned long long *)(slot + INFO_SLOT_VERSION) = version;
+    *(unsigned int *)(slot + INFO_SLOT_KEYLEN) = key.size();
+    *(unsigned int *)(slot + INFO_SLOT_DATALEN) = response.size();
+    memcpy(slot + INFO_SLOT_HEADER, key.data(), key.size());
+    memcpy(slot + INFO_SLOT_HEADER + key.size(), response.data(), response.size());
+    __sync_synchronize();
+    *seq = before + 2;
+  }
+
   /// Sorts the JSON::Value objects that hold source information by preference.
   struct sourceCompare {
     bool operator() (const JSON::Value& lhs, const JSON::Value& rhs) const {
@@ -196,11 +274,10 @@ namespace Mist {
       
       std::string port, url_rel;
       
-      IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-      configLock.wait();
-      IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE);
-      DTSC::Scan prtcls = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("config").getMember("protocols");
-      DTSC::Scan capa = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("capabilities").getMember("connectors").getMember("RTMP");
+      Util::configSnapshot serverCfg;
+      DTSC::Scan cfg = serverCfg.getScan();
+      DTSC::Scan prtcls = cfg.getMember("config").getMember("protocols");
+      DTSC::Scan capa = cfg.getMember("capabilities").getMember("connectors").getMember("RTMP");
       unsigned int pro_cnt = prtcls.getSize();
       for (unsigned int i = 0; i < pro_cnt; ++i){
         if (prtcls.getIndice(i).getMember("connector").asString() != "RTMP"){
@@ -219,7 +296,7 @@ namespace Mist {
       }
       
       std::string trackSources;//this string contains all track sources for MBR smil
-      DTSC::Scan tracks = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("streams").getMember(streamName).getMember("meta").getMember("tracks");
+      DTSC::Scan tracks = cfg.getMember("streams").getMember(streamName).getMember("meta").getMember("tracks");
       unsigned int track_ctr = tracks.getSize();
       for (unsigned int i = 0; i < track_ctr; ++i){//for all video tracks
         DTSC::Scan trk = tracks.getIndice(i);
@@ -227,8 +304,7 @@ namespace Mist {
           trackSources += "      <video src='"+ streamName + "?track=" + trk.getMember("trackid").asString() + "' height='" + trk.getMember("height").asString() + "' system-bitrate='" + trk.getMember("bps").asString() + "' width='" + trk.getMember("width").asString() + "' />\n";
         }
       }
-      configLock.post();
-      configLock.close();
+      serverCfg.release();
       
       H.Clean();
       H.SetHeader("Content-Type", "application/smil");
@@ -256,31 +332,56 @@ namespace Mist {
       }
       response = "// Generating info code for stream " + streamName + "\n\nif (!mistvideo){var mistvideo = {};}\n";
       JSON::Value json_resp;
-      IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
       IPC::semaphore metaLocker(std::string("liveMeta@" + streamName).c_str(), O_CREAT | O_RDWR, ACCESSPERMS, 1);
       bool metaLock = false;
-      configLock.wait();
-      IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE);
-      DTSC::Scan strm = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("streams").getMember(streamName).getMember("meta");
+      Util::configSnapshot serverCfg;
+      DTSC::Scan cfg = serverCfg.getScan();
+      DTSC::Scan strm = cfg.getMember("streams").getMember(streamName).getMember("meta");
+      //the response only depends on the request and what metaversion covers, so reuse it while that stays the same
+      unsigned long long metaVersion = strm ? cfg.getMember("streams").getMember(streamName).getMember("metaversion").asInt() : 0;
+      std::string cacheKey = rURL + " " + host;
+      std::string cached;
+      if (metaVersion && getCachedInfo(cacheKey, metaVersion, cached)){
+        H.SetBody(cached);
+        H.SendResponse("200", "OK", myConn);
+        return;
+      }
       IPC::sharedPage streamIndex;
       if (!strm){
-        configLock.post();
-        //Stream metadata not found - attempt to start it
+        //Stream metadata not found - attempt to start it, without holding on to the configuration meanwhile
+        serverCfg.release();
         if (Util::startInput(streamName)){
           streamIndex.init(streamName, DEFAULT_META_PAGE_SIZE);
           if (streamIndex.mapped){
             metaLock = true;
             metaLocker.wait();
-            strm = DTSC::Packet(streamIndex.mapped, streamIndex.len, true).getScan();
+            DTSC::Packet metaPack(streamIndex.mapped, streamIndex.len, true);
+            strm = metaPack.getScan();
+            //metadata from the stream itself has no metaversion, its checksum stands in for it
+            if (strm){
+              metaVersion = checksum::crc32c(0, metaPack.getData(), metaPack.getDataLen()) & 0x7FFFFFFFull;
+            }
           }
         }
         if (!strm){
           //stream failed to start or isn't configured
           response += "// Stream isn't configured and/or couldn't be started. Sorry.\n";
         }
-        configLock.wait();
+        serverCfg.acquire();
+        cfg = serverCfg.getScan();
+        if (metaVersion){
+          //the top bit keeps these apart from real metaversions, the configuration version covers the protocols
+          metaVersion = (1ull << 63) | (metaVersion << 32) | (serverCfg.version() & 0xFFFFFFFFull);
+          if (getCachedInfo(cacheKey, metaVersion, cached)){
+            metaLocker.post();
+            serverCfg.release();
+            H.SetBody(cached);
+            H.SendResponse("200", "OK", myConn);
+            return;
+          }
+        }
       }
-      DTSC::Scan prots = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("config").getMember("protocols");
+      DTSC::Scan prots = cfg.getMember("config").getMember("protocols");
       if (strm && prots){
         DTSC::Scan trcks = strm.getMember("tracks");
         unsigned int trcks_ctr = trcks.getSize();
@@ -323,7 +424,7 @@ namespace Mist {
         //loop over the connectors.
         for (unsigned int i = 0; i < prots_ctr; ++i){
           std::string cName = prots.getIndice(i).getMember("connector").asString();
-          DTSC::Scan capa = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("capabilities").getMember("connectors").getMember(cName);
+          DTSC::Scan capa = cfg.getMember("capabilities").getMember("connectors").getMember(cName);
           //if the connector has a port,
           if (capa.getMember("optional").getMember("port")){
             //get the default port if none is set
@@ -337,7 +438,7 @@ namespace Mist {
               addSources(streamName, capa.getMember("url_rel").asString(), sources, host, port, capa_json, json_resp["meta"]);
             }
             //check each enabled protocol separately to see if it depends on this connector
-            DTSC::Scan capa_lst = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("capabilities").getMember("connectors");
+            DTSC::Scan capa_lst = cfg.getMember("capabilities").getMember("connectors");
             unsigned int capa_lst_ctr = capa_lst.getSize();
             for (unsigned int j = 0; j < capa_lst_ctr; ++j){
               //if it depends on this connector and has a URL, list it
@@ -361,9 +462,7 @@ namespace Mist {
       if (metaLock){
         metaLocker.post();
       }
-      
-      configLock.post();
-      configLock.close();
+      serverCfg.release();
       if (rURL.substr(0, 6) != "/json_"){
         response += "mistvideo['" + streamName + "'] = " + json_resp.toString() + ";\n";
       }else{
@@ -379,6 +478,9 @@ namespace Mist {
         }
         response.append("(\"" + streamName + "\"));\n");
       }
+      if (metaVersion){
+        putCachedInfo(cacheKey, metaVersion, response);
+      }
       H.SetBody(response);
       H.SendResponse("200", "OK", myConn);
       return;
@@ -31,7 +31,7 @@ namespace Mist {
   }
   
   void OutProgressiveFLV::sendNext(){
-    tag.DTSCLoader(thisPacket, myMeta.tracks[thisPacket.getTrackId()]);
+    tag.DTSCLoader(thisPacket, *thisTrack().track);
     myConn.SendNow(tag.data, tag.len); 
   }
 
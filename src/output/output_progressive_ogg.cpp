@@ -31,7 +31,9 @@ namespace Mist {
 
 
     OGG::oggSegment newSegment;
-    thisPacket.getString("data", newSegment.dataString);
+    char * dataPointer = 0;
+    unsigned int len = 0;
+    thisPacket.getString("data", dataPointer, len);
     pageBuffer[track].totalFrames = ((double)thisPacket.getTime() / (1000000.0f / myMeta.tracks[track].fpks)) + 1.5; //should start at 1. added .5 for rounding.
 
     if (pageBuffer[track].codec == OGG::THEORA){
@@ -47,7 +49,7 @@ namespace Mist {
     newSegment.frameNumber = pageBuffer[track].totalFrames;
     newSegment.timeStamp = thisPacket.getTime();
 
-    pageBuffer[track].oggSegments.push_back(newSegment);
+    pageBuffer[track].queuePacket(newSegment, dataPointer, len);
 
     if (pageBuffer[track].codec == OGG::VORBIS){
       pageBuffer[track].vorbisStuff();//this updates lastKeyFrame
@@ -156,15 +158,12 @@ namespace Mist {
         pageBuffer[*it].codec = OGG::OPUS;
       }
       pageBuffer[*it].clear(OGG::BeginOfStream, 0, *it, 0);   //CREATES a (map)pageBuffer object, *it = id, pagetype=BOS
-      newSegment.dataString = initData[*it][0];
-      pageBuffer[*it].oggSegments.push_back(newSegment);
+      pageBuffer[*it].queuePacket(newSegment, initData[*it][0].data(), initData[*it][0].size());
       pageBuffer[*it].sendTo(myConn, 0); //granule position of 0
     }
     for (std::set<long unsigned int>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++){
-      newSegment.dataString = initData[*it][1];
-      pageBuffer[*it].oggSegments.push_back(newSegment);
-      newSegment.dataString = initData[*it][2];
-      pageBuffer[*it].oggSegments.push_back(newSegment);
+      pageBuffer[*it].queuePacket(newSegment, initData[*it][1].data(), initData[*it][1].size());
+      pageBuffer[*it].queuePacket(newSegment, initData[*it][2].data(), initData[*it][2].size());
       while (pageBuffer[*it].oggSegments.size()){
         pageBuffer[*it].sendTo(myConn, 0); //granule position of 0
       }
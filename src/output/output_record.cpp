@@ -0,0 +1,273 @@
+#include "output_record.h"
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mist/defines.h>
+#include <mist/timing.h>
+
+namespace Mist {
+  /// Writes all of data to fd, retrying on partial writes and interrupts.
+  static bool writeAll(int fd, const char * data, unsigned int len){
+    while (len){
+      int r = write(fd, data, len);
+      if (r < 0){
+        if (errno == EINTR){
+          continue;
+        }
+        return false;
+      }
+      data += r;
+      len -= r;
+    }
+    return true;
+  }
+
+  OutRecord::OutRecord(Socket::Connection & conn) : Output(conn){
+    streamName = config->getString("streamname");
+    target = config->getString("file");
+    segmentTime = config->getInteger("duration") * 1000;
+    segmentSize = config->getInteger("size") * 1024 * 1024;
+    syncWrites = config->getBool("sync");
+    writeSize = config->getInteger("buffer") * 1024;
+    if (writeSize < 4096){
+      writeSize = 4096;
+    }
+    writeSize -= writeSize % 4096;
+    writeLen = 0;
+    writeBuf = 0;
+    if (posix_memalign((void**)&writeBuf, 4096, writeSize)){
+      writeBuf = 0;
+    }
+    segmentFile = -1;
+    segmentStart = 0;
+    segmentBytes = 0;
+    lagging = false;
+    parseData = true;
+    wantRequest = false;
+    //recording happens as fast as the data comes in
+    realTime = 0;
+    config->activate();
+    if (!writeBuf){
+      FAIL_MSG("Could not allocate a %u byte write buffer", writeSize);
+      parseData = false;
+      return;
+    }
+    initialize();
+    std::string tracks = config->getString("tracks");
+    unsigned int currTrack = 0;
+    //loop over tracks, add any found track IDs to selectedTracks
+    if (tracks != ""){
+      selectedTracks.clear();
+      for (unsigned int i = 0; i < tracks.size(); ++i){
+        if (tracks[i] >= '0' && tracks[i] <= '9'){
+          currTrack = currTrack*10 + (tracks[i] - '0');
+        }else{
+          if (currTrack > 0){
+            selectedTracks.insert(currTrack);
+          }
+          currTrack = 0;
+        }
+      }
+      if (currTrack > 0){
+        selectedTracks.insert(currTrack);
+      }
+    }else{
+      //unlike a viewer, a recording keeps every track
+      selectedTracks.clear();
+      for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++){
+        selectedTracks.insert(it->first);
+      }
+    }
+  }
+
+  OutRecord::~OutRecord(){
+    finishSegment();
+    free(writeBuf);
+  }
+
+  void OutRecord::init(Util::Config * cfg){
+    Output::init(cfg);
+    capa["name"] = "Record";
+    capa["desc"] = "Records a stream to disk as DTSC files, starting a new file every time the duration or size limit is reached.";
+    capa["deps"] = "";
+    capa["required"]["streamname"]["name"] = "Stream";
+    capa["required"]["streamname"]["help"] = "What streamname to record.";
+    capa["required"]["streamname"]["type"] = "str";
+    capa["required"]["streamname"]["option"] = "--stream";
+    capa["required"]["file"]["name"] = "File";
+    capa["required"]["file"]["help"] = "Path and file name prefix of the recording. Each segment is written as <file>_<unix time>.dtsc.";
+    capa["required"]["file"]["type"] = "str";
+    capa["required"]["file"]["option"] = "--file";
+    capa["optional"]["tracks"]["name"] = "Tracks";
+    capa["optional"]["tracks"]["help"] = "The track IDs of the stream that will be recorded separated by spaces. Defaults to all tracks.";
+    capa["optional"]["tracks"]["type"] = "str";
+    capa["optional"]["tracks"]["option"] = "--tracks";
+    capa["optional"]["duration"]["name"] = "Segment duration";
+    capa["optional"]["duration"]["help"] = "Maximum duration of a single file in seconds, zero for no limit.";
+    capa["optional"]["duration"]["type"] = "uint";
+    capa["optional"]["duration"]["option"] = "--duration";
+    capa["optional"]["size"]["name"] = "Segment size";
+    capa["optional"]["size"]["help"] = "Maximum size of a single file in MiB, zero for no limit.";
+    capa["optional"]["size"]["type"] = "uint";
+    capa["optional"]["size"]["option"] = "--size";
+    capa["optional"]["buffer"]["name"] = "Write buffer";
+    capa["optional"]["buffer"]["help"] = "Amount of data in KiB that is gathered before it is written to disk.";
+    capa["optional"]["buffer"]["type"] = "uint";
+    capa["optional"]["buffer"]["option"] = "--buffer";
+    capa["optional"]["sync"]["name"] = "Sync writes";
+    capa["optional"]["sync"]["help"] = "Set to 1 to sync every write to disk, instead of only finished files.";
+    capa["optional"]["sync"]["type"] = "uint";
+    capa["optional"]["sync"]["option"] = "--sync";
+    cfg->addOption("streamname",
+                   JSON::fromString("{\"arg\":\"string\",\"short\":\"s\",\"long\":\"stream\",\"help\":\"The name of the stream to record.\"}"));
+    cfg->addOption("file",
+                   JSON::fromString("{\"arg\":\"string\",\"short\":\"f\",\"long\":\"file\",\"help\":\"Path and file name prefix of the recorded files.\"}"));
+    cfg->addOption("tracks",
+                   JSON::fromString("{\"arg\":\"string\",\"value\":[\"\"],\"short\": \"t\",\"long\":\"tracks\",\"help\":\"The track IDs of the stream that will be recorded separated by spaces.\"}"));
+    cfg->addOption("duration",
+                   JSON::fromString("{\"arg\":\"integer\",\"value\":[3600],\"short\":\"D\",\"long\":\"duration\",\"help\":\"Maximum duration of a single file in seconds, zero for no limit.\"}"));
+    cfg->addOption("size",
+                   JSON::fromString("{\"arg\":\"integer\",\"value\":[0],\"short\":\"z\",\"long\":\"size\",\"help\":\"Maximum size of a single file in MiB, zero for no limit.\"}"));
+    cfg->addOption("buffer",
+                   JSON::fromString("{\"arg\":\"integer\",\"value\":[4096],\"short\":\"b\",\"long\":\"buffer\",\"help\":\"Amount of data in KiB that is gathered before it is written to disk.\"}"));
+    cfg->addOption("sync",
+                   JSON::fromString("{\"arg\":\"integer\",\"short\":\"y\",\"long\":\"sync\",\"value\":[0],\"help\":\"Sync every write to disk, instead of only finished files.\"}"));
+    cfg->addBasicConnectorOptions(capa);
+    config = cfg;
+  }
+
+  void OutRecord::sendNext(){
+    unsigned long long now = thisPacket.getTime();
+    //files are only ever split on a keyframe of the main track, so every file starts playable
+    if (thisPacket.getTrackId() == (long)getMainSelectedTrack() && (thisTrack().track->typeId != DTSC::TRACK_VIDEO || thisPacket.getFlag("keyframe"))){
+      if (segmentFile != -1){
+        if ((segmentTime && now - segmentStart >= segmentTime) || (segmentSize && segmentBytes >= segmentSize)){
+          finishSegment();
+        }
+      }
+      if (segmentFile == -1 && !startSegment()){
+        myConn.close();
+        return;
+      }
+    }
+    if (segmentFile == -1){
+      //still waiting for the first keyframe
+      return;
+    }
+    //falling behind is reported through the stats, but is worth a warning as well: the buffer will not wait for us
+    if (myMeta.live){
+      long long behind = thisTrack().track->lastms - (long long)now;
+      if (!lagging && behind > myMeta.bufferWindow / 2){
+        WARN_MSG("Recording of %s is %lld ms behind the live point, data may be lost", streamName.c_str(), behind);
+        lagging = true;
+      }
+      if (lagging && behind < myMeta.bufferWindow / 4){
+        INFO_MSG("Recording of %s caught up with the live point", streamName.c_str());
+        lagging = false;
+      }
+    }
+    segmentMeta.updatePosOverride(thisPacket, segmentBytes);
+    if (!writeData(thisPacket.getData(), thisPacket.getDataLen())){
+      myConn.close();
+    }
+  }
+
+  bool OutRecord::onFinish(){
+    finishSegment();
+    return false;
+  }
+
+  /// Opens a new file, starting at the current packet.
+  bool OutRecord::startSegment(){
+    unsigned long long now = Util::epoch();
+    for (unsigned int i = 0; segmentFile == -1; ++i){
+      std::stringstream name;
+      name << target << "_" << now;
+      if (i){
+        name << "_" << i;
+      }
+      name << ".dtsc";
+      segmentName = name.str();
+      segmentFile = open(segmentName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+      if (segmentFile == -1 && (errno != EEXIST || i >= 100)){
+        FAIL_MSG("Could not create %s: %s", segmentName.c_str(), strerror(errno));
+        return false;
+      }
+    }
+    segmentMeta = DTSC::Meta();
+    for (std::set<unsigned long>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++){
+      segmentMeta.tracks[*it] = myMeta.tracks[*it];
+    }
+    segmentMeta.reset();
+    segmentStart = thisPacket.getTime();
+    segmentBytes = 0;
+    INFO_MSG("Recording %s to %s", streamName.c_str(), segmentName.c_str());
+    return true;
+  }
+
+  /// Writes out and closes the current file, if any, and writes its header next to it.
+  void OutRecord::finishSegment(){
+    if (segmentFile == -1){
+      return;
+    }
+    flush();
+    fdatasync(segmentFile);
+    close(segmentFile);
+    segmentFile = -1;
+    //the header is written after the data, so MistInDTSC never considers it outdated
+    segmentMeta.live = false;
+    segmentMeta.vod = true;
+    std::string header = segmentMeta.toJSON().toNetPacked();
+    std::string headerName = segmentName + ".dtsh";
+    int headerFile = open(headerName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (headerFile == -1 || !writeAll(headerFile, header.data(), header.size())){
+      FAIL_MSG("Could not write %s: %s", headerName.c_str(), strerror(errno));
+    }
+    if (headerFile != -1){
+      fdatasync(headerFile);
+      close(headerFile);
+    }
+    INFO_MSG("Finished %s: %llu bytes, %lld ms", segmentName.c_str(), segmentBytes, segmentMeta.tracks[getMainSelectedTrack()].lastms - segmentStart);
+  }
+
+  /// Adds data to the current file, gathering it in writeBuf so the disk sees few large writes.
+  bool OutRecord::writeData(const char * data, unsigned int len){
+    segmentBytes += len;
+    if (writeLen + len > writeSize && !flush()){
+      return false;
+    }
+    if (len >= writeSize){
+      if (!writeAll(segmentFile, data, len)){
+        FAIL_MSG("Could not write to %s: %s", segmentName.c_str(), strerror(errno));
+        return false;
+      }
+      if (syncWrites){
+        fdatasync(segmentFile);
+      }
+      return true;
+    }
+    memcpy(writeBuf + writeLen, data, len);
+    writeLen += len;
+    return true;
+  }
+
+  /// Writes the contents of writeBuf to the current file.
+  bool OutRecord::flush(){
+    if (!writeLen){
+      return true;
+    }
+    bool ret = writeAll(segmentFile, writeBuf, writeLen);
+    writeLen = 0;
+    if (!ret){
+      FAIL_MSG("Could not write to %s: %s", segmentName.c_str(), strerror(errno));
+      return false;
+    }
+    if (syncWrites){
+      fdatasync(segmentFile);
+    }
+    return true;
+  }
+}
@@ -0,0 +1,35 @@
+#include "output.h"
+
+
+namespace Mist {
+  /// Records a stream to disk as a series of DTSC files, each with its own .dtsh header.
+  class OutRecord : public Output {
+    public:
+      OutRecord(Socket::Connection & conn);
+      ~OutRecord();
+      static void init(Util::Config * cfg);
+      static bool listenMode(){return false;}
+      void sendNext();
+      bool onFinish();
+    private:
+      bool startSegment();
+      void finishSegment();
+      bool writeData(const char * data, unsigned int len);
+      bool flush();
+      std::string target;///< Path and file name prefix of the segments.
+      unsigned long long segmentTime;///< Maximum duration of a segment in ms, or 0 for no limit.
+      unsigned long long segmentSize;///< Maximum size of a segment in bytes, or 0 for no limit.
+      bool syncWrites;///< If true, every write is synced to disk, not just finished segments.
+      int segmentFile;///< File descriptor of the current segment, or -1 if no segment is open.
+      std::string segmentName;///< File name of the current segment.
+      unsigned long long segmentStart;///< Time of the first packet in the current segment.
+      unsigned long long segmentBytes;///< Size of the current segment, including what is still in writeBuf.
+      DTSC::Meta segmentMeta;///< Header of the current segment.
+      char * writeBuf;///< Page aligned buffer that packets are gathered in before writing.
+      unsigned int writeSize;///< Capacity of writeBuf.
+      unsigned int writeLen;///< Amount of data in writeBuf.
+      bool lagging;///< True while the recording is more than half the buffer window behind the live point.
+  };
+}
+
+typedef Mist::OutRecord mistOut;
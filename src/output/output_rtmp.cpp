@@ -32,6 +32,9 @@ namespace Mist {
     setBlocking(false);
     maxSkipAhead = 1500;
     minSkipAhead = 500;
+    aggregateTime = 0;
+    aggregateCount = 0;
+    aggregateMax = config->getInteger("aggregate");
   }
 
   OutRTMP::~OutRTMP() {}
@@ -86,6 +89,7 @@ namespace Mist {
       pos = nextpos + 1;
     }
     if (trackSwitch){
+      dropAggregate();
       seek(thisPacket.getTime());
     }
   }
@@ -115,28 +119,31 @@ namespace Mist {
     capa["methods"][0u]["handler"] = "rtmp";
     capa["methods"][0u]["type"] = "flash/10";
     capa["methods"][0u]["priority"] = 6ll;
+    capa["optional"]["aggregate"]["name"] = "Audio aggregation";
+    capa["optional"]["aggregate"]["help"] = "Maximum amount of audio frames to bundle into a single RTMP aggregate message, 0 or 1 to disable. 8 by default.";
+    capa["optional"]["aggregate"]["type"] = "uint";
+    capa["optional"]["aggregate"]["option"] = "--aggregate";
+    capa["optional"]["aggregate"]["default"] = 8ll;
+    cfg->addOption("aggregate",
+                   JSON::fromString("{\"arg\":\"integer\",\"value\":[8],\"short\":\"A\",\"long\":\"aggregate\",\"help\":\"Maximum amount of audio frames to bundle into a single RTMP aggregate message, 0 or 1 to disable.\"}"));
     cfg->addConnectorOptions(1935, capa);
     config = cfg;
   }
   
   void OutRTMP::sendNext() {
-    char rtmpheader[] = {0, //byte 0 = cs_id | ch_type
-                         0, 0, 0, //bytes 1-3 = timestamp
-                         0, 0, 0, //bytes 4-6 = length
-                         0x12, //byte 7 = msg_type_id
-                         1, 0, 0, 0, //bytes 8-11 = msg_stream_id = 1
-                         0, 0, 0, 0}; //bytes 12-15 = extended timestamp
+    char msgType = 0x12;
     char dataheader[] = {0, 0, 0, 0, 0};
     unsigned int dheader_len = 1;
     char * tmpData = 0;//pointer to raw media data
-    unsigned int data_len = 0;//length of processed media data
+    unsigned int data_len = 0;//length of raw media data
     thisPacket.getString("data", tmpData, data_len);
-    DTSC::Track & track = myMeta.tracks[thisPacket.getTrackId()];
+    trackDesc & trk = thisTrack();
+    DTSC::Track & track = *trk.track;
     
     //set msg_type_id
-    if (track.type == "video"){
-      rtmpheader[7] = 0x09;
-      if (track.codec == "H264"){
+    if (trk.type == DTSC::TRACK_VIDEO){
+      msgType = 0x09;
+      if (trk.codec == DTSC::CODEC_H264){
         dheader_len += 4;
         dataheader[0] = 7;
         dataheader[1] = 1;
@@ -147,7 +154,7 @@ namespace Mist {
           dataheader[4] = offset & 0xFF;
         }
       }
-      if (track.codec == "H263"){
+      if (trk.codec == DTSC::CODEC_H263){
         dataheader[0] = 2;
       }
       if (thisPacket.getFlag("keyframe")){
@@ -160,14 +167,14 @@ namespace Mist {
       }
     }
     
-    if (track.type == "audio"){
-      rtmpheader[7] = 0x08;
-      if (track.codec == "AAC"){
+    if (trk.type == DTSC::TRACK_AUDIO){
+      msgType = 0x08;
+      if (trk.codec == DTSC::CODEC_AAC){
         dataheader[0] += 0xA0;
         dheader_len += 1;
         dataheader[1] = 1; //raw AAC data, not sequence header
       }
-      if (track.codec == "MP3"){
+      if (trk.codec == DTSC::CODEC_MP3){
         dataheader[0] += 0x20;
       }
       if (track.rate >= 44100){
@@ -184,10 +191,62 @@ namespace Mist {
         dataheader[0] |= 0x01;
       }
     }
-    data_len += dheader_len;
     
     unsigned int timestamp = thisPacket.getTime();
     
+    //bundle audio frames into aggregate messages, as long as they fit in a single chunk
+    if (msgType == 0x08 && aggregateMax > 1){
+      unsigned int tagLen = 11 + dheader_len + data_len + 4;
+      if (aggregateCount && aggregate.size() + tagLen > RTMPStream::chunk_snd_max){
+        sendAggregate();
+      }
+      if (tagLen <= RTMPStream::chunk_snd_max){
+        if (!aggregateCount){
+          aggregateTime = timestamp;
+        }
+        unsigned int bodyLen = dheader_len + data_len;
+        //FLV tag header: type, size, timestamp, extended timestamp, stream ID (always 0)
+        char tagHeader[] = {msgType, (char)(bodyLen >> 16), (char)(bodyLen >> 8), (char)bodyLen,
+                            (char)(timestamp >> 16), (char)(timestamp >> 8), (char)timestamp, (char)(timestamp >> 24),
+                            0, 0, 0};
+        //back pointer: size of the whole tag
+        unsigned int tagSize = bodyLen + 11;
+        char tagFooter[] = {(char)(tagSize >> 24), (char)(tagSize >> 16), (char)(tagSize >> 8), (char)tagSize};
+        aggregate.append(tagHeader, 11);
+        aggregate.append(dataheader, dheader_len);
+        aggregate.append(tmpData, data_len);
+        aggregate.append(tagFooter, 4);
+        if (++aggregateCount >= aggregateMax){
+          sendAggregate();
+        }
+        return;
+      }
+    }
+    //anything else goes out on its own, after any audio that came before it
+    if (aggregateCount){
+      sendAggregate();
+    }
+    sendMessage(msgType, timestamp, dataheader, dheader_len, tmpData, data_len);
+  }
+
+  /// Sends a single media message on chunk stream 4, compressing the chunk header against the previous one.
+  /// The chunk header, the head and data buffers and the continuation bytes between chunks are written with one
+  /// gathered write, so that data is sent straight from the page it is stored in.
+  /// \param msgType The RTMP message type ID.
+  /// \param timestamp The message timestamp, in milliseconds.
+  /// \param head Bytes to send before data, such as the FLV audio or video data header. Must be shorter than the chunk size.
+  /// \param data The message payload.
+  void OutRTMP::sendMessage(char msgType, unsigned int timestamp, char * head, unsigned int headLen, char * data, unsigned int dataLen){
+    char rtmpheader[] = {0, //byte 0 = cs_id | ch_type
+                         0, 0, 0, //bytes 1-3 = timestamp
+                         0, 0, 0, //bytes 4-6 = length
+                         0x12, //byte 7 = msg_type_id
+                         1, 0, 0, 0, //bytes 8-11 = msg_stream_id = 1
+                         0, 0, 0, 0}; //bytes 12-15 = extended timestamp
+    static char continueHeader = 0xC4;//type 3 chunk header on chunk stream 4
+    unsigned int data_len = headLen + dataLen;
+    rtmpheader[7] = msgType;
+    
     bool allow_short = RTMPStream::lastsend.count(4);
     RTMPStream::Chunk & prev = RTMPStream::lastsend[4];
     unsigned char chtype = 0x00;
@@ -251,35 +310,59 @@ namespace Mist {
       rtmpheader[3] = timestamp & 0xff;
     }
     
-    //send the header
-    myConn.setBlocking(true);
-    myConn.SendNow(rtmpheader, header_len);
-    //set the header's first byte to the "continue" type chunk, for later use
-    rtmpheader[0] = 0xC4;
-
-    //sent actual data - never send more than chunk_snd_max at a time
-    //interleave blocks of max chunk_snd_max bytes with 0xC4 bytes to indicate continue
-    unsigned int len_sent = 0;
+    //build the whole message: the header, then blocks of max chunk_snd_max bytes,
+    //interleaved with 0xC4 bytes to indicate continue
+    sendVec.clear();
+    struct iovec part;
+    part.iov_base = rtmpheader;
+    part.iov_len = header_len;
+    sendVec.push_back(part);
+    part.iov_base = head;
+    part.iov_len = headLen;
+    sendVec.push_back(part);
     unsigned int steps = 0;
-    while (len_sent < data_len){
-      unsigned int to_send = std::min(data_len - len_sent, RTMPStream::chunk_snd_max);
-      if (!len_sent){
-        myConn.SendNow(dataheader, dheader_len);
-        to_send -= dheader_len;
-        len_sent += dheader_len;
-      }
-      myConn.SendNow(tmpData+len_sent-dheader_len, to_send);
+    unsigned int chunkLeft = RTMPStream::chunk_snd_max - headLen;
+    unsigned int len_sent = 0;
+    while (len_sent < dataLen){
+      unsigned int to_send = std::min(dataLen - len_sent, chunkLeft);
+      part.iov_base = data + len_sent;
+      part.iov_len = to_send;
+      sendVec.push_back(part);
       len_sent += to_send;
-      if (len_sent < data_len){
-        myConn.SendNow(rtmpheader, 1);
+      if (len_sent < dataLen){
+        part.iov_base = &continueHeader;
+        part.iov_len = 1;
+        sendVec.push_back(part);
         ++steps;
       }
+      chunkLeft = RTMPStream::chunk_snd_max;
     }
-    myConn.setBlocking(false);
+    myConn.SendNow(&sendVec[0], sendVec.size());
     //update the sent data counter
     RTMPStream::snd_cnt += header_len + data_len + steps;
   }
 
+  /// Sends the bundled audio frames, if any, as a single aggregate message (type 22).
+  /// The sub-messages carry their own absolute timestamps, the aggregate carries the timestamp of the first one.
+  void OutRTMP::sendAggregate(){
+    if (!aggregateCount){
+      return;
+    }
+    sendMessage(0x16, aggregateTime, 0, 0, (char*)aggregate.data(), aggregate.size());
+    dropAggregate();
+  }
+
+  /// Throws away any bundled audio frames, for when playback jumps elsewhere.
+  void OutRTMP::dropAggregate(){
+    aggregate.clear();
+    aggregateCount = 0;
+  }
+
+  bool OutRTMP::onFinish(){
+    sendAggregate();
+    return false;
+  }
+
   void OutRTMP::sendHeader() {
     FLV::Tag tag;
     tag.DTSCMetaInit(myMeta, selectedTracks);
@@ -461,11 +544,9 @@ namespace Mist {
         
         Util::sanitizeName(streamName);
         //pull the server configuration
-        IPC::sharedPage serverCfg("!mistConfig", DEFAULT_CONF_PAGE_SIZE); ///< Contains server configuration and capabilities
-        IPC::semaphore configLock("!mistConfLock", O_CREAT | O_RDWR, ACCESSPERMS, 1);
-        configLock.wait();
+        Util::configSnapshot serverCfg; ///< Contains server configuration and capabilities
         
-        DTSC::Scan streamCfg = DTSC::Scan(serverCfg.mapped, serverCfg.len).getMember("streams").getMember(streamName);
+        DTSC::Scan streamCfg = serverCfg.getScan().getMember("streams").getMember(streamName);
         if (streamCfg){
           if (streamCfg.getMember("source").asString().substr(0, 7) != "push://"){
             DEBUG_MSG(DLVL_FAIL, "Push rejected - stream %s not a push-able stream. (%s != push://*)", streamName.c_str(), streamCfg.getMember("source").asString().c_str());
@@ -484,8 +565,7 @@ namespace Mist {
           DEBUG_MSG(DLVL_FAIL, "Push from %s rejected - stream '%s' not configured.", myConn.getHost().c_str(), streamName.c_str());
           myConn.close();
         }
-        configLock.post();
-        configLock.close();
+        serverCfg.release();
         if (!myConn){return;}//do not initialize if rejected
         initialize();
       }
@@ -601,6 +681,7 @@ namespace Mist {
       amfReply.getContentP(3)->addContent(AMF::Object("details", "DDV"));
       amfReply.getContentP(3)->addContent(AMF::Object("clientid", (double)1337));
       sendCommand(amfReply, playMessageType, playStreamId);
+      dropAggregate();
       seek((long long int)amfData.getContentP(3)->NumValue());
 
       //send a status reply
@@ -810,7 +891,7 @@ namespace Mist {
             if (!userClient.getData()){
               char userPageName[NAME_BUFFER_SIZE];
               snprintf(userPageName, NAME_BUFFER_SIZE, SHM_USERS, streamName.c_str());
-              userClient = IPC::sharedClient(userPageName, 30, true);
+              userClient = IPC::sharedClient(userPageName, PLAY_EX_SIZE, true);
             }
             continueNegotiate(pack_out["trackid"].asInt());
             bufferLivePacket(pack_out);
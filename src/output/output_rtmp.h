@@ -2,6 +2,7 @@
 #include <mist/flv_tag.h>
 #include <mist/amf.h>
 #include <mist/rtmpchunks.h>
+#include <vector>
 
 
 namespace Mist {
@@ -14,12 +15,21 @@ namespace Mist {
       void onRequest();
       void sendNext();
       void sendHeader();
+      bool onFinish();
     protected:
       void parseVars(std::string data);
       std::string app_name;
       void parseChunk(Socket::Buffer & inputBuffer);
       void parseAMFCommand(AMF::Object & amfData, int messageType, int streamId);
       void sendCommand(AMF::Object & amfReply, int messageType, int streamId);
+      void sendMessage(char msgType, unsigned int timestamp, char * head, unsigned int headLen, char * data, unsigned int dataLen);
+      void sendAggregate();
+      void dropAggregate();
+      std::vector<struct iovec> sendVec;///< Scratch space for the chunk framing of a single message.
+      std::string aggregate;///< FLV tags of the audio frames waiting to be sent as a single aggregate message.
+      unsigned int aggregateTime;///< Timestamp of the first frame in aggregate.
+      unsigned int aggregateCount;///< Amount of frames in aggregate.
+      unsigned int aggregateMax;///< Maximum amount of frames per aggregate message, less than 2 disables aggregation.
   };
 }
 
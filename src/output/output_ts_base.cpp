@@ -3,53 +3,74 @@
 namespace Mist {
   TSOutput::TSOutput(Socket::Connection & conn) : TS_BASECLASS(conn){
     packCounter=0;
-    haveAvcc = false;
+    patPacket.FromPointer(TS::PAT);
     until=0xFFFFFFFFFFFFFFFFull;
     setBlocking(true);
     sendRepeatingHeaders = false;
     appleCompat=false;
   }
 
+  /// Returns the headers of the track thisPacket belongs to, making them if this is its first frame.
+  tsTrackHeaders & TSOutput::thisTrackHeaders(){
+    trackDesc & trk = thisTrack();
+    std::map<unsigned int, tsTrackHeaders>::iterator it = trackHeaders.find(trk.tid);
+    if (it != trackHeaders.end()){
+      return it->second;
+    }
+    tsTrackHeaders & hdr = trackHeaders[trk.tid];
+    if (trk.codec == DTSC::CODEC_H264){
+      MP4::AVCC avccbox;
+      avccbox.setPayload(trk.track->init);
+      hdr.annexBInit = avccbox.asAnnexB();
+    }
+    if (trk.codec == DTSC::CODEC_AAC){
+      memcpy(hdr.adts, TS::getAudioHeader(0, trk.track->init).data(), 7);
+    }
+    return hdr;
+  }
+
   void TSOutput::fillPacket(const char * data, const size_t dataLen){
-    
-    if (!packData.getBytesFree()){
-      ///\todo only resend the PAT/PMT for HLS
-      if ( (sendRepeatingHeaders && packCounter % 42 == 0) || !packCounter){
-        TS::Packet tmpPack;
-        tmpPack.FromPointer(TS::PAT);
-        tmpPack.setContinuityCounter(++contCounters[0]);
-        sendTS(tmpPack.checkAndGetBuffer());
-        sendTS(TS::createPMT(selectedTracks, myMeta, ++contCounters[4096]));
-        packCounter += 2;
+    size_t filled = 0;
+    do{
+      if (!packData.getBytesFree()){
+        ///\todo only resend the PAT/PMT for HLS
+        if ( (sendRepeatingHeaders && packCounter % 42 == 0) || !packCounter){
+          patPacket.setContinuityCounter(++contCounters[0]);
+          sendTS(patPacket.checkAndGetBuffer());
+          if (pmtTracks != selectedTracks){
+            pmtPacket.FromPointer(TS::createPMT(selectedTracks, myMeta));
+            pmtTracks = selectedTracks;
+          }
+          pmtPacket.setContinuityCounter(++contCounters[4096]);
+          sendTS(pmtPacket.checkAndGetBuffer());
+          packCounter += 2;
+        }
+        sendTS(packData.checkAndGetBuffer());
+        packCounter ++;
+        packData.clear();
       }
-      sendTS(packData.checkAndGetBuffer());
-      packCounter ++;
-      packData.clear();
-    }
-    
-    if (!dataLen){return;}
-    
-    if (packData.getBytesFree() == 184){
-      packData.clear();      
-      packData.setPID(0x100 - 1 + thisPacket.getTrackId());      
-      packData.setContinuityCounter(++contCounters[packData.getPID()]);
-      if (first[thisPacket.getTrackId()]){
-        packData.setUnitStart(1);
-        packData.setDiscontinuity(true);
-        if (myMeta.tracks[thisPacket.getTrackId()].type == "video"){
-          if (thisPacket.getInt("keyframe")){
-            packData.setRandomAccess(1);
-          }      
-          packData.setPCR(thisPacket.getTime() * 27000);      
+      
+      if (!dataLen){return;}
+      
+      if (packData.getBytesFree() == 184){
+        packData.clear();      
+        packData.setPID(0x100 - 1 + thisPacket.getTrackId());      
+        packData.setContinuityCounter(++contCounters[packData.getPID()]);
+        if (first[thisPacket.getTrackId()]){
+          packData.setUnitStart(1);
+          packData.setDiscontinuity(true);
+          if (thisTrack().type == DTSC::TRACK_VIDEO){
+            if (thisPacket.getInt("keyframe")){
+              packData.setRandomAccess(1);
+            }      
+            packData.setPCR(thisPacket.getTime() * 27000);      
+          }
+          first[thisPacket.getTrackId()] = false;
         }
-        first[thisPacket.getTrackId()] = false;
       }
-    }
-    
-    int tmp = packData.fillFree(data, dataLen);     
-    if (tmp != dataLen){
-      return fillPacket(data+tmp, dataLen-tmp);
-    }
+      
+      filled += packData.fillFree(data + filled, dataLen - filled);
+    }while (filled < dataLen);
   }
 
   void TSOutput::sendNext(){
@@ -64,97 +85,47 @@ namespace Mist {
       sendTS("",0);      
       return;
     }
-    std::string bs;
-    //prepare bufferstring    
-    if (myMeta.tracks[thisPacket.getTrackId()].type == "video"){      
-      unsigned int extraSize = 0;      
-      //dataPointer[4] & 0x1f is used to check if this should be done later: fillPacket("\000\000\000\001\011\360", 6);
-      if (myMeta.tracks[thisPacket.getTrackId()].codec == "H264" && (dataPointer[4] & 0x1f) != 0x09){
-        extraSize += 6;
+    trackDesc & trk = thisTrack();
+    tsTrackHeaders & hdr = thisTrackHeaders();
+    char leadIn[21];
+    if (trk.type == DTSC::TRACK_VIDEO){
+      //build the whole frame as Annex B first, then split it over as many PES packets as needed
+      bool addAud = (trk.codec == DTSC::CODEC_H264 && dataLen > 4 && (dataPointer[4] & 0x1f) != 0x09);
+      bool addInit = (thisPacket.getInt("keyframe") && trk.codec == DTSC::CODEC_H264);
+      unsigned int extraSize = (addAud ? 6 : 0) + (addInit ? hdr.annexBInit.size() : 0);
+      annexB.resize(extraSize + dataLen);
+      char * frame = (char *)annexB.data();
+      if (addAud){
+        //End of previous nal unit, if not already present
+        memcpy(frame, "\000\000\000\001\011\360", 6);
       }
-      if (thisPacket.getInt("keyframe")){
-        if (myMeta.tracks[thisPacket.getTrackId()].codec == "H264"){
-          if (!haveAvcc){
-            avccbox.setPayload(myMeta.tracks[thisPacket.getTrackId()].init);
-            haveAvcc = true;
-          }
-          bs = avccbox.asAnnexB();
-          extraSize += bs.size();
-        }
+      if (addInit){
+        memcpy(frame + (addAud ? 6 : 0), hdr.annexBInit.data(), hdr.annexBInit.size());
       }
+      unsigned int converted = h264::avccToAnnexB(dataPointer, dataLen, frame + extraSize);
+      if (converted < dataLen){
+        DEBUG_MSG(DLVL_WARN, "Too big NALU detected at byte %u of %u - skipping the rest of the frame!", converted, dataLen);
+      }
+      unsigned int frameLen = extraSize + converted;
       
+      unsigned long long pts = thisPacket.getTime() * 90;
+      unsigned long long offset = thisPacket.getInt("offset") * 90;
       unsigned int watKunnenWeIn1Ding = 65490-13;
-      unsigned int splitCount = (dataLen+extraSize) / watKunnenWeIn1Ding;
-      unsigned int currPack = 0;
-      unsigned int ThisNaluSize = 0;
-      unsigned int i = 0;
-      unsigned int nalLead = 0;
-      
-      while (currPack <= splitCount){
-        unsigned int alreadySent = 0;
-        bs = TS::Packet::getPESVideoLeadIn((currPack != splitCount ? watKunnenWeIn1Ding : dataLen+extraSize - currPack*watKunnenWeIn1Ding), thisPacket.getTime() * 90, thisPacket.getInt("offset") * 90, !currPack);
-        fillPacket(bs.data(), bs.size());
-        if (!currPack){
-          if (myMeta.tracks[thisPacket.getTrackId()].codec == "H264" && (dataPointer[4] & 0x1f) != 0x09){
-            //End of previous nal unit, if not already present
-            fillPacket("\000\000\000\001\011\360", 6);
-            alreadySent += 6;
-          }
-          if (thisPacket.getInt("keyframe")){
-            if (myMeta.tracks[thisPacket.getTrackId()].codec == "H264"){
-              bs = avccbox.asAnnexB();
-              fillPacket(bs.data(), bs.size());
-              alreadySent += bs.size();
-            }
-          }
-        }
-        while (i + 4 < (unsigned int)dataLen){
-          if (nalLead){
-            fillPacket("\000\000\000\001"+4-nalLead,nalLead);
-            i += nalLead;
-            alreadySent += nalLead;
-            nalLead = 0;
-          }
-          if (!ThisNaluSize){
-            ThisNaluSize = (dataPointer[i] << 24) + (dataPointer[i+1] << 16) + (dataPointer[i+2] << 8) + dataPointer[i+3];
-            if (ThisNaluSize + i + 4 > (unsigned int)dataLen){
-              DEBUG_MSG(DLVL_WARN, "Too big NALU detected (%u > %d) - skipping!", ThisNaluSize + i + 4, dataLen);
-              break;
-            }
-            if (alreadySent + 4 > watKunnenWeIn1Ding){
-              nalLead = 4 - watKunnenWeIn1Ding-alreadySent;
-              fillPacket("\000\000\000\001",watKunnenWeIn1Ding-alreadySent);
-              i += watKunnenWeIn1Ding-alreadySent;
-              alreadySent += watKunnenWeIn1Ding-alreadySent;
-            }else{
-              fillPacket("\000\000\000\001",4);
-              alreadySent += 4;
-              i += 4;
-            }
-          }
-          if (alreadySent + ThisNaluSize > watKunnenWeIn1Ding){
-            fillPacket(dataPointer+i,watKunnenWeIn1Ding-alreadySent);
-            i += watKunnenWeIn1Ding-alreadySent;
-            ThisNaluSize -= watKunnenWeIn1Ding-alreadySent;
-            alreadySent += watKunnenWeIn1Ding-alreadySent;
-          }else{
-            fillPacket(dataPointer+i,ThisNaluSize);
-            alreadySent += ThisNaluSize;
-            i += ThisNaluSize;
-            ThisNaluSize = 0;
-          }          
-          if (alreadySent == watKunnenWeIn1Ding){
-            packData.addStuffing();
-            fillPacket(0, 0);
-            first[thisPacket.getTrackId()] = true;
-            break;
-          }
+      unsigned int sent = 0;
+      do{
+        unsigned int pesLen = std::min(frameLen - sent, watKunnenWeIn1Ding);
+        fillPacket(leadIn, TS::Packet::writePESVideoLeadIn(leadIn, pesLen, pts, offset, !sent));
+        fillPacket(frame + sent, pesLen);
+        sent += pesLen;
+        if (sent < frameLen){
+          packData.addStuffing();
+          fillPacket(0, 0);
+          first[thisPacket.getTrackId()] = true;
         }
-        currPack++;
-      }
-    }else if (myMeta.tracks[thisPacket.getTrackId()].type == "audio"){
+      }while (sent < frameLen);
+    }else if (trk.type == DTSC::TRACK_AUDIO){
       long unsigned int tempLen = dataLen;
-      if ( myMeta.tracks[thisPacket.getTrackId()].codec == "AAC"){
+      if ( trk.codec == DTSC::CODEC_AAC){
         tempLen += 7;
       }
       long long unsigned int tempTime;
@@ -168,12 +139,13 @@ namespace Mist {
       //if( (thisPacket.getTime() * 90)-lastSent >= 70*90 ){
       //   lastSent=(thisPacket.getTime() * 90);
       //}      
-      bs = TS::Packet::getPESAudioLeadIn(tempLen, tempTime);// myMeta.tracks[thisPacket.getTrackId()].rate / 1000 );
-      fillPacket(bs.data(), bs.size());
-      if (myMeta.tracks[thisPacket.getTrackId()].codec == "AAC"){        
-        bs = TS::getAudioHeader(dataLen, myMeta.tracks[thisPacket.getTrackId()].init);      
-        fillPacket(bs.data(), bs.size());
+      unsigned int leadInLen = TS::Packet::writePESAudioLeadIn(leadIn, tempLen, tempTime);// myMeta.tracks[thisPacket.getTrackId()].rate / 1000 );
+      if (trk.codec == DTSC::CODEC_AAC){        
+        memcpy(leadIn + leadInLen, hdr.adts, 7);
+        TS::setAudioHeaderLength(leadIn + leadInLen, dataLen);
+        leadInLen += 7;
       }
+      fillPacket(leadIn, leadInLen);
       fillPacket(dataPointer,dataLen);
     }
     if (packData.getBytesFree() < 184){
@@ -2,6 +2,7 @@
 #include "output.h"
 #include "output_http.h"
 #include <mist/mp4_generic.h>
+#include <mist/nal.h>
 #include <mist/ts_packet.h>
 
 #ifndef TS_BASECLASS
@@ -10,6 +11,12 @@
 
 namespace Mist {
 
+  /// Headers of a track that are the same for every frame, made once per track.
+  struct tsTrackHeaders {
+    char adts[7];///< ADTS header of AAC tracks, the frame length is filled in for every frame.
+    std::string annexBInit;///< SPS and PPS of H264 tracks as Annex B, sent before every keyframe.
+  };
+
   class TSOutput : public TS_BASECLASS {
     public:
       TSOutput(Socket::Connection & conn);
@@ -22,8 +29,12 @@ namespace Mist {
       std::map<unsigned int, int> contCounters;
       unsigned int packCounter; ///\todo update constructors?
       TS::Packet packData;
-      bool haveAvcc;
-      MP4::AVCC avccbox;
+      TS::Packet patPacket;///< The PAT, only the continuity counter changes.
+      TS::Packet pmtPacket;///< The PMT for pmtTracks, only the continuity counter changes.
+      std::set<unsigned long> pmtTracks;///< The selected tracks pmtPacket was made for.
+      std::map<unsigned int, tsTrackHeaders> trackHeaders;
+      tsTrackHeaders & thisTrackHeaders();
+      std::string annexB;///< The current video frame, converted to Annex B.
       bool appleCompat;
       bool sendRepeatingHeaders;
       long long unsigned int until;